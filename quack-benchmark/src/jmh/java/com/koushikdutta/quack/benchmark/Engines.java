@@ -0,0 +1,33 @@
+package com.koushikdutta.quack.benchmark;
+
+import com.koushikdutta.quack.QuackContext;
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+
+final class Engines {
+    static final String DUKTAPE = "duktape";
+    static final String QUICKJS = "quickjs";
+
+    private Engines() {
+    }
+
+    static QuackContext create(String engine) {
+        if (QUICKJS.equals(engine))
+            return QuackContext.create(true);
+        if (DUKTAPE.equals(engine))
+            return QuackContext.create(false);
+        throw new IllegalArgumentException("unknown engine: " + engine);
+    }
+
+    static File octaneFile(String name) {
+        String directory = System.getProperty("quack.octane.dir", "quack-java/src/test/assets/octane");
+        return new File(directory, name);
+    }
+
+    static String read(File file) throws IOException {
+        return new String(Files.readAllBytes(file.toPath()), StandardCharsets.UTF_8);
+    }
+}
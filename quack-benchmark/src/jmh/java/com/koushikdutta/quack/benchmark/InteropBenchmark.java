@@ -0,0 +1,143 @@
+package com.koushikdutta.quack.benchmark;
+
+import com.koushikdutta.quack.JavaScriptObject;
+import com.koushikdutta.quack.QuackContext;
+import com.koushikdutta.quack.QuackJsonObject;
+import com.koushikdutta.quack.QuackMethodObject;
+import com.koushikdutta.quack.QuackObject;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OperationsPerInvocation;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+
+import java.nio.ByteBuffer;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Costs of crossing between Java and JavaScript, per crossing.
+ */
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class InteropBenchmark {
+    private static final int CROSSINGS = 100;
+
+    @State(Scope.Benchmark)
+    public static class Context {
+        @Param({ Engines.DUKTAPE, Engines.QUICKJS })
+        public String engine;
+
+        QuackContext quack;
+        JavaScriptObject add;
+        JavaScriptObject getLoop;
+        JavaScriptObject applyLoop;
+        JavaScriptObject identity;
+        JavaScriptObject data;
+        final ByteBuffer jsonBuffer = ByteBuffer.allocateDirect(64 * 1024);
+
+        final QuackObject javaObject = new QuackObject() {
+            @Override
+            public Object get(Object key) {
+                return 1;
+            }
+        };
+
+        final QuackMethodObject javaFunction = new QuackMethodObject() {
+            @Override
+            public Object callMethod(Object thiz, Object... args) {
+                return args[0];
+            }
+        };
+
+        @Setup(Level.Trial)
+        public void setup() {
+            quack = Engines.create(engine);
+            add = quack.compileFunction("function(a, b) { return a + b; }", "add.js");
+            getLoop = quack.compileFunction("function(o) { var s = 0; for (var i = 0; i < " + CROSSINGS + "; i++) s += o.value; return s; }", "get.js");
+            applyLoop = quack.compileFunction("function(f) { var s = 0; for (var i = 0; i < " + CROSSINGS + "; i++) s += f(i); return s; }", "apply.js");
+            identity = quack.compileFunction("function(o) { return o; }", "identity.js");
+            data = quack.evaluateForJavaScriptObject("(function() {\n" +
+                "  var items = [];\n" +
+                "  for (var i = 0; i < 100; i++) items.push({ id: i, name: 'item ' + i, tags: ['a', 'b', 'c'], price: i * 1.5 });\n" +
+                "  return { items: items };\n" +
+                "})()");
+        }
+
+        @TearDown(Level.Trial)
+        public void tearDown() {
+            quack.close();
+        }
+    }
+
+    @State(Scope.Benchmark)
+    public static class Buffers {
+        @Param({ "false", "true" })
+        public boolean zeroCopy;
+
+        @Param({ "4096", "1048576" })
+        public int size;
+
+        ByteBuffer javaBuffer;
+        JavaScriptObject byteLength;
+        JavaScriptObject getBuffer;
+
+        @Setup(Level.Trial)
+        public void setup(Context context) {
+            context.quack.setZeroCopyBuffers(zeroCopy);
+            javaBuffer = ByteBuffer.allocateDirect(size);
+            byteLength = context.quack.compileFunction("function(b) { return b.byteLength; }", "byteLength.js");
+            context.quack.evaluate("var benchmarkBuffer = new Uint8Array(" + size + ");");
+            getBuffer = context.quack.compileFunction("function() { return benchmarkBuffer; }", "getBuffer.js");
+        }
+    }
+
+    @Benchmark
+    public Object callJavaScript(Context context) {
+        return context.add.call(1, 2);
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(CROSSINGS)
+    public Object proxyGet(Context context) {
+        return context.getLoop.call(context.javaObject);
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(CROSSINGS)
+    public Object proxyApply(Context context) {
+        return context.applyLoop.call(context.javaFunction);
+    }
+
+    @Benchmark
+    public Object bufferToJavaScript(Context context, Buffers buffers) {
+        return buffers.byteLength.call(buffers.javaBuffer);
+    }
+
+    @Benchmark
+    public Object bufferFromJavaScript(Context context, Buffers buffers) {
+        return buffers.getBuffer.call();
+    }
+
+    @Benchmark
+    public Object jsonRoundtrip(Context context) {
+        return context.identity.call(new QuackJsonObject(context.data.stringify()));
+    }
+
+    @Benchmark
+    public Object jsonBufferRoundtrip(Context context) {
+        return context.identity.call(new QuackJsonObject(context.data.stringify(context.jsonBuffer)));
+    }
+}
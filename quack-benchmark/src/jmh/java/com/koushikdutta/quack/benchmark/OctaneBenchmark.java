@@ -0,0 +1,111 @@
+package com.koushikdutta.quack.benchmark;
+
+import com.koushikdutta.quack.JavaScriptObject;
+import com.koushikdutta.quack.QuackContext;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+
+import java.io.File;
+import java.io.IOException;
+import java.util.HashMap;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Runs each Octane suite from quack-java/src/test/assets/octane. Octane's own timing loop
+ * (BenchmarkSuite.RunSuites) is bypassed: one benchmark invocation runs every benchmark
+ * of the suite once, and JMH handles warmup and measurement.
+ */
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.MILLISECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class OctaneBenchmark {
+    private static final HashMap<String, String[]> SUITE_FILES = new HashMap<>();
+    static {
+        SUITE_FILES.put("Richards", new String[] { "richards.js" });
+        SUITE_FILES.put("DeltaBlue", new String[] { "deltablue.js" });
+        SUITE_FILES.put("Crypto", new String[] { "crypto.js" });
+        SUITE_FILES.put("RayTrace", new String[] { "raytrace.js" });
+        SUITE_FILES.put("EarleyBoyer", new String[] { "earley-boyer.js" });
+        SUITE_FILES.put("RegExp", new String[] { "regexp.js" });
+        SUITE_FILES.put("Splay", new String[] { "splay.js" });
+        SUITE_FILES.put("NavierStokes", new String[] { "navier-stokes.js" });
+        SUITE_FILES.put("PdfJS", new String[] { "pdfjs.js" });
+        SUITE_FILES.put("Mandreel", new String[] { "mandreel.js" });
+        SUITE_FILES.put("Gameboy", new String[] { "gbemu-part1.js", "gbemu-part2.js" });
+        SUITE_FILES.put("CodeLoad", new String[] { "code-load.js" });
+        SUITE_FILES.put("Box2D", new String[] { "box2d.js" });
+        SUITE_FILES.put("zlib", new String[] { "zlib-data.js", "zlib.js" });
+    }
+
+    private static final String RUNNER =
+        "function(name) {\n" +
+        "  var suite = BenchmarkSuite.suites.filter(function(s) { return s.name == name; })[0];\n" +
+        "  if (!suite) throw new Error('suite not found: ' + name);\n" +
+        "  var benchmarks = suite.benchmarks;\n" +
+        "  return {\n" +
+        "    setup: function() { for (var i = 0; i < benchmarks.length; i++) benchmarks[i].Setup(); },\n" +
+        "    run: function() { for (var i = 0; i < benchmarks.length; i++) benchmarks[i].run(); },\n" +
+        "    tearDown: function() { for (var i = 0; i < benchmarks.length; i++) benchmarks[i].TearDown(); }\n" +
+        "  };\n" +
+        "}";
+
+    @Param({ Engines.DUKTAPE, Engines.QUICKJS })
+    public String engine;
+
+    @Param({ "Richards", "DeltaBlue", "Crypto", "RayTrace", "EarleyBoyer", "RegExp", "Splay",
+        "NavierStokes", "PdfJS", "Mandreel", "Gameboy", "CodeLoad", "Box2D", "zlib" })
+    public String suite;
+
+    private QuackContext quack;
+    private JavaScriptObject runner;
+
+    @Setup(Level.Trial)
+    public void createContext() throws IOException {
+        quack = Engines.create(engine);
+        load("base.js");
+        for (String file: SUITE_FILES.get(suite)) {
+            load(file);
+        }
+        runner = (JavaScriptObject)quack.compileFunction(RUNNER, "octane-runner.js").call(suite);
+    }
+
+    private void load(String name) throws IOException {
+        File file = Engines.octaneFile(name);
+        quack.evaluate(Engines.read(file), file.getName());
+    }
+
+    @Setup(Level.Iteration)
+    public void setupSuite() {
+        runner.callProperty("setup");
+    }
+
+    @Benchmark
+    public void run() {
+        runner.callProperty("run");
+    }
+
+    @TearDown(Level.Iteration)
+    public void tearDownSuite() {
+        runner.callProperty("tearDown");
+    }
+
+    @TearDown(Level.Trial)
+    public void closeContext() {
+        quack.close();
+    }
+}
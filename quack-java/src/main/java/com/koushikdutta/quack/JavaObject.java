@@ -83,6 +83,58 @@ public final class JavaObject implements QuackJavaObject {
         return false;
     }
 
+    /**
+     * Resolve a property to a public instance field that the native field cache can read and
+     * write directly, returning one of the QuackContext.FIELD_* kinds. Properties that get
+     * or set would handle any other way, such as Map entries or coerced values, are not
+     * resolved.
+     */
+    int resolveField(String key) {
+        Class clazz = target.getClass();
+        if (target instanceof Map || target instanceof Class || clazz.isArray() || Proxy.isProxyClass(clazz))
+            return QuackContext.FIELD_NONE;
+
+        // set uses the first field with a matching name, static or not.
+        Field found = null;
+        for (Field field : clazz.getFields()) {
+            if (field.getName().equals(key)) {
+                found = field;
+                break;
+            }
+        }
+        if (found == null || Modifier.isStatic(found.getModifiers()))
+            return QuackContext.FIELD_NONE;
+
+        Class type = found.getType();
+        int kind;
+        Class boxedType;
+        if (type == int.class) {
+            kind = QuackContext.FIELD_INT;
+            boxedType = Integer.class;
+        }
+        else if (type == boolean.class) {
+            kind = QuackContext.FIELD_BOOLEAN;
+            boxedType = Boolean.class;
+        }
+        else if (type == double.class) {
+            kind = QuackContext.FIELD_DOUBLE;
+            boxedType = Double.class;
+        }
+        else if (type == String.class) {
+            kind = QuackContext.FIELD_STRING;
+            boxedType = String.class;
+        }
+        else {
+            return QuackContext.FIELD_NONE;
+        }
+
+        if (!quackContext.isUncoercedType(type, boxedType))
+            return QuackContext.FIELD_NONE;
+        if (Modifier.isFinal(found.getModifiers()))
+            kind |= QuackContext.FIELD_FINAL;
+        return kind;
+    }
+
     @Override
     public Object get(String key) {
         Object ret = getMap(key);
@@ -3,24 +3,42 @@ package com.koushikdutta.quack;
 import java.lang.reflect.InvocationHandler;
 import java.lang.reflect.Method;
 import java.lang.reflect.Proxy;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 import java.util.Collections;
+import java.util.concurrent.CompletableFuture;
 
 @SuppressWarnings({"unchecked", "rawtypes"})
 public class JavaScriptObject implements QuackObject {
     final public QuackContext quackContext;
     public final long context;
     final public long pointer;
-    public JavaScriptObject(QuackContext quackContext, long context, long pointer) {
+    // slot in the native table that keeps the object alive while this is reachable.
+    final long handle;
+    public JavaScriptObject(QuackContext quackContext, long context, long pointer, long handle) {
         this.quackContext = quackContext;
         this.context = context;
         this.pointer = pointer;
+        this.handle = handle;
     }
 
     public String stringify() {
         return quackContext.stringify(pointer);
     }
 
+    /**
+     * Serialize this object to UTF-8 JSON without creating a Java String.
+     *
+     * @param buffer a direct buffer to write the JSON into, starting at its position. Its
+     *               position and limit are not changed. If it is null or does not have room,
+     *               a new direct buffer is allocated.
+     * @return a buffer holding exactly the JSON, which shares its content with {@code buffer}
+     * when the JSON fit. null if this object has no JSON representation, such as a function.
+     */
+    public ByteBuffer stringify(ByteBuffer buffer) {
+        return quackContext.stringify(pointer, buffer);
+    }
+
     @Override
     public Object get(String key) {
         return quackContext.getKeyString(pointer, key);
@@ -37,6 +55,71 @@ public class JavaScriptObject implements QuackObject {
         return quackContext.coerceJavaScriptToJava(null, quackContext.call(pointer, args));
     }
 
+    /**
+     * Call this function, and get a future for its result. If the function returns a Promise,
+     * or any other thenable, the future completes once it settles, as promise jobs run; see
+     * {@link QuackContext#setJobExecutor}. A rejection completes the future exceptionally, with
+     * the exception throwing the rejection reason would have raised in Java.
+     * Dependent stages of the future run on the thread that runs the jobs by default.
+     * On Android, this requires API level 24.
+     */
+    public CompletableFuture<Object> callAsync(Object... args) {
+        CompletableFuture<Object> future = new CompletableFuture<>();
+        Object result;
+        try {
+            result = call(args);
+        }
+        catch (RuntimeException e) {
+            future.completeExceptionally(QuackException.withJSStack(e));
+            return future;
+        }
+        if (!(result instanceof JavaScriptObject) || !(((JavaScriptObject)result).get("then") instanceof JavaScriptObject)) {
+            future.complete(result);
+            return future;
+        }
+
+        QuackMethodObject onFulfilled = new QuackMethodObject() {
+            @Override
+            public Object callMethod(Object thiz, Object... args) {
+                future.complete(args.length > 0 ? args[0] : null);
+                return null;
+            }
+        };
+        QuackMethodObject onRejected = new QuackMethodObject() {
+            @Override
+            public Object callMethod(Object thiz, Object... args) {
+                future.completeExceptionally(QuackException.withJSStack(quackContext.toJavaException(args.length > 0 ? args[0] : null)));
+                return null;
+            }
+        };
+        try {
+            ((JavaScriptObject)result).callProperty("then", onFulfilled, onRejected);
+        }
+        catch (RuntimeException e) {
+            future.completeExceptionally(QuackException.withJSStack(e));
+        }
+        return future;
+    }
+
+    /**
+     * Call this function once per entry of {@code argsList}, in a single transition into
+     * the engine. Returns the result of each call. An entry that threw holds its Throwable,
+     * and does not stop the rest of the batch.
+     */
+    public Object[] callBatch(Object[]... argsList) {
+        for (Object[] args: argsList) {
+            quackContext.coerceJavaArgsToJavaScript(args);
+        }
+        Object[] results = quackContext.callBatch(pointer, argsList);
+        if (results != null) {
+            for (int i = 0; i < results.length; i++) {
+                if (!(results[i] instanceof Throwable))
+                    results[i] = quackContext.coerceJavaScriptToJava(null, results[i]);
+            }
+        }
+        return results;
+    }
+
     @Override
     public Object callMethod(Object thiz, Object... args) {
         quackContext.coerceJavaArgsToJavaScript(args);
@@ -49,11 +132,34 @@ public class JavaScriptObject implements QuackObject {
         return quackContext.coerceJavaScriptToJava(null, quackContext.callProperty(pointer, property, args));
     }
 
+    public Object get(QuackPropertyKey key) {
+        // keys are only valid in the context that interned them.
+        if (key.quackContext != quackContext)
+            return get(key.name);
+        return quackContext.getKeyHandle(pointer, key.handle);
+    }
+
+    public boolean set(QuackPropertyKey key, Object value) {
+        if (key.quackContext != quackContext)
+            return set(key.name, value);
+        return quackContext.setKeyHandle(pointer, key.handle, value);
+    }
+
+    public Object callProperty(QuackPropertyKey key, Object... args) {
+        if (key.quackContext != quackContext)
+            return callProperty(key.name, args);
+        quackContext.coerceJavaArgsToJavaScript(args);
+        return quackContext.coerceJavaScriptToJava(null, quackContext.callPropertyHandle(pointer, key.handle, args));
+    }
+
     @Override
     public Object get(Object key) {
         if (key instanceof String)
             return get((String)key);
 
+        if (key instanceof QuackPropertyKey)
+            return get((QuackPropertyKey)key);
+
         if (key instanceof Number) {
             Number number = (Number)key;
             if (((Integer)number.intValue()).equals(number))
@@ -79,6 +185,10 @@ public class JavaScriptObject implements QuackObject {
             return set((String)key, value);
         }
 
+        if (key instanceof QuackPropertyKey) {
+            return set((QuackPropertyKey)key, value);
+        }
+
         if (key instanceof Number) {
             Number number = (Number)key;
             if (number.doubleValue() == number.intValue()) {
@@ -89,6 +199,99 @@ public class JavaScriptObject implements QuackObject {
         return quackContext.setKeyObject(pointer, key, value);
     }
 
+    /**
+     * Copy {@code length} elements of this array, starting at {@code index}, into
+     * {@code destination} at {@code offset}, in one call into the engine. This may be an Array
+     * or any array-like object; an Int32Array is copied directly. Other elements are converted
+     * as an Int32Array would convert them, so missing elements are 0.
+     */
+    public void getArrayRange(int index, int[] destination, int offset, int length) {
+        checkArrayRange(index, destination.length, offset, length);
+        quackContext.getArrayRange(pointer, index, destination, QuackContext.ARRAY_INT, offset, length);
+    }
+
+    /**
+     * Copy elements of this array into {@code destination}. A Float32Array is copied directly;
+     * see {@link #getArrayRange(int, int[], int, int)}.
+     */
+    public void getArrayRange(int index, float[] destination, int offset, int length) {
+        checkArrayRange(index, destination.length, offset, length);
+        quackContext.getArrayRange(pointer, index, destination, QuackContext.ARRAY_FLOAT, offset, length);
+    }
+
+    /**
+     * Copy elements of this array into {@code destination}. A Float64Array is copied directly;
+     * see {@link #getArrayRange(int, int[], int, int)}.
+     */
+    public void getArrayRange(int index, double[] destination, int offset, int length) {
+        checkArrayRange(index, destination.length, offset, length);
+        quackContext.getArrayRange(pointer, index, destination, QuackContext.ARRAY_DOUBLE, offset, length);
+    }
+
+    /**
+     * Copy {@code length} elements of {@code source}, starting at {@code offset}, into this array
+     * at {@code index}, in one call into the engine. An Int32Array is written directly,
+     * any other array has its elements set, and grows as needed.
+     */
+    public void setArrayRange(int index, int[] source, int offset, int length) {
+        checkArrayRange(index, source.length, offset, length);
+        quackContext.setArrayRange(pointer, index, source, QuackContext.ARRAY_INT, offset, length);
+    }
+
+    /**
+     * Copy elements of {@code source} into this array. A Float32Array is written directly;
+     * see {@link #setArrayRange(int, int[], int, int)}.
+     */
+    public void setArrayRange(int index, float[] source, int offset, int length) {
+        checkArrayRange(index, source.length, offset, length);
+        quackContext.setArrayRange(pointer, index, source, QuackContext.ARRAY_FLOAT, offset, length);
+    }
+
+    /**
+     * Copy elements of {@code source} into this array. A Float64Array is written directly;
+     * see {@link #setArrayRange(int, int[], int, int)}.
+     */
+    public void setArrayRange(int index, double[] source, int offset, int length) {
+        checkArrayRange(index, source.length, offset, length);
+        quackContext.setArrayRange(pointer, index, source, QuackContext.ARRAY_DOUBLE, offset, length);
+    }
+
+    /**
+     * Copy this array into a new int[], with the elements converted as an Int32Array would
+     * convert them.
+     */
+    public int[] toIntArray() {
+        int[] ret = new int[arrayLength()];
+        getArrayRange(0, ret, 0, ret.length);
+        return ret;
+    }
+
+    public float[] toFloatArray() {
+        float[] ret = new float[arrayLength()];
+        getArrayRange(0, ret, 0, ret.length);
+        return ret;
+    }
+
+    public double[] toDoubleArray() {
+        double[] ret = new double[arrayLength()];
+        getArrayRange(0, ret, 0, ret.length);
+        return ret;
+    }
+
+    private int arrayLength() {
+        Object length = get("length");
+        if (!(length instanceof Number))
+            return 0;
+        return Math.max(0, ((Number)length).intValue());
+    }
+
+    private static void checkArrayRange(int index, int arrayLength, int offset, int length) {
+        if (index < 0 || offset < 0 || length < 0 || offset > arrayLength - length)
+            throw new ArrayIndexOutOfBoundsException("index " + index + ", offset " + offset + ", length " + length + ", array length " + arrayLength);
+        if (length > Integer.MAX_VALUE - index)
+            throw new ArrayIndexOutOfBoundsException("index " + index + ", length " + length);
+    }
+
     @Override
     public String toString() {
         Object ret = callProperty("toString");
@@ -134,6 +337,6 @@ public class JavaScriptObject implements QuackObject {
     @Override
     protected void finalize() throws Throwable {
         super.finalize();
-        quackContext.finalizeJavaScriptObject(pointer);
+        quackContext.finalizeJavaScriptObject(handle);
     }
 }
@@ -0,0 +1,135 @@
+package com.koushikdutta.quack;
+
+/**
+ * A sample of the bridge instrumentation of a {@link QuackContext}, from
+ * {@link QuackContext#getBridgeStats}, kept while {@link QuackContext#setBridgeStatsEnabled}
+ * is on. Everything is zero if it never was, or if the native library was built with
+ * QUACK_NO_BRIDGE_STATS.
+ */
+public final class QuackBridgeStats {
+  // layout of the native stats array, must match BridgeStats.h.
+  static final int SUB_BUCKET_BITS = 2;
+  static final int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static final int MAX_BITS = 40;
+  static final int BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+  static final int ENTRY_COUNT = 8;
+  static final int ENTRY_STRIDE = 3 + BUCKET_COUNT;
+  static final int CONVERSIONS = ENTRY_COUNT * ENTRY_STRIDE;
+  static final int DIRECTION_COUNT = 2;
+  static final int CONVERSION_COUNT = 6;
+  static final int GLOBAL_REFS = CONVERSIONS + DIRECTION_COUNT * CONVERSION_COUNT;
+  static final int WEAK_REFS = GLOBAL_REFS + 1;
+  static final int COUNT = WEAK_REFS + 1;
+
+  /** Conversion direction: from JavaScript to Java. */
+  public static final int TO_JAVA = 0;
+  /** Conversion direction: from Java to JavaScript. */
+  public static final int TO_JAVASCRIPT = 1;
+
+  /** Conversion type: null and undefined. */
+  public static final int CONVERSION_NULL = 0;
+  /** Conversion type: booleans, numbers and strings. */
+  public static final int CONVERSION_PRIMITIVE = 1;
+  /** Conversion type: ByteBuffers and JavaScript buffers, copied or shared. */
+  public static final int CONVERSION_BUFFER = 2;
+  /** Conversion type: a {@link QuackJsonObject} parsed into JavaScript. */
+  public static final int CONVERSION_JSON = 3;
+  /** Conversion type: a JavaScript object, as a {@link JavaScriptObject} in Java. */
+  public static final int CONVERSION_JAVASCRIPT_OBJECT = 4;
+  /** Conversion type: a Java object, as a proxy in JavaScript. */
+  public static final int CONVERSION_JAVA_OBJECT = 5;
+
+  /**
+   * How often, and how long, a bridge entry point or trap ran. Times are inclusive: a trap
+   * run by an evaluate is counted in both.
+   */
+  public static final class Latency {
+    public final long count;
+    public final long totalNanos;
+    public final long maxNanos;
+    private final long[] buckets;
+
+    Latency(long[] stats, int entry) {
+      int offset = entry * ENTRY_STRIDE;
+      count = stats[offset];
+      totalNanos = stats[offset + 1];
+      maxNanos = stats[offset + 2];
+      buckets = new long[BUCKET_COUNT];
+      System.arraycopy(stats, offset + 3, buckets, 0, BUCKET_COUNT);
+    }
+
+    public long meanNanos() {
+      return count == 0 ? 0 : totalNanos / count;
+    }
+
+    /**
+     * The latency under which {@code percentile} percent of the calls completed, as the lower
+     * bound of its histogram bucket, which is within 25% of the recorded latencies.
+     */
+    public long percentileNanos(double percentile) {
+      if (count == 0)
+        return 0;
+      long threshold = (long)Math.ceil(count * Math.min(Math.max(percentile, 0), 100) / 100);
+      long seen = 0;
+      for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i];
+        if (seen >= threshold && seen > 0)
+          return Math.min(bucketLowerBound(i), maxNanos);
+      }
+      return maxNanos;
+    }
+
+    static long bucketLowerBound(int bucket) {
+      if (bucket < SUB_BUCKETS)
+        return bucket;
+      int shift = bucket / SUB_BUCKETS - 1;
+      return (long)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    }
+  }
+
+  /** {@link QuackContext#evaluate} and {@link QuackContext#evaluateBytecode}. */
+  public final Latency evaluate;
+  /** Calls of JavaScript functions from Java, in all their forms. */
+  public final Latency call;
+  /** Property reads of JavaScript objects from Java. */
+  public final Latency getKey;
+  /** Property writes of JavaScript objects from Java. */
+  public final Latency setKey;
+  /** The traps of the proxies of Java objects, run when JavaScript uses them. */
+  public final Latency trapHas;
+  public final Latency trapGet;
+  public final Latency trapSet;
+  /** Calls and constructions of Java proxies from JavaScript. */
+  public final Latency trapApply;
+
+  /** JNI global refs created for values, such as the targets of Java proxies. */
+  public final long globalRefCount;
+  /** JNI weak refs created for values, such as the back references of JavaScriptObjects. */
+  public final long weakRefCount;
+
+  private final long[] conversions;
+
+  QuackBridgeStats(long[] stats) {
+    evaluate = new Latency(stats, 0);
+    call = new Latency(stats, 1);
+    getKey = new Latency(stats, 2);
+    setKey = new Latency(stats, 3);
+    trapHas = new Latency(stats, 4);
+    trapGet = new Latency(stats, 5);
+    trapSet = new Latency(stats, 6);
+    trapApply = new Latency(stats, 7);
+    conversions = new long[DIRECTION_COUNT * CONVERSION_COUNT];
+    System.arraycopy(stats, CONVERSIONS, conversions, 0, conversions.length);
+    globalRefCount = stats[GLOBAL_REFS];
+    weakRefCount = stats[WEAK_REFS];
+  }
+
+  /**
+   * Values converted by the bridge.
+   * @param direction {@link #TO_JAVA} or {@link #TO_JAVASCRIPT}.
+   * @param type one of the CONVERSION_ types.
+   */
+  public long conversionCount(int direction, int type) {
+    return conversions[direction * CONVERSION_COUNT + type];
+  }
+}
@@ -0,0 +1,135 @@
+package com.koushikdutta.quack;
+
+import java.io.DataInputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.nio.charset.Charset;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
+
+/**
+ * On disk cache of compiled bytecode, keyed by a hash of the engine, file name, and script
+ * contents. The first evaluation of a script compiles and stores its bytecode, later
+ * evaluations (including across process launches) skip parsing entirely.
+ *
+ * Bytecode is tied to the native library build that produced it, so use a directory
+ * that is cleared or versioned when the library is updated.
+ */
+public class QuackBytecodeCache {
+  // StandardCharsets is API 19.
+  private static final Charset UTF_8 = Charset.forName("UTF-8");
+  private static final String EXTENSION = ".qbc";
+  private final File directory;
+
+  public QuackBytecodeCache(File directory) {
+    this.directory = directory;
+  }
+
+  /**
+   * Evaluate {@code script}, using cached bytecode if available.
+   *
+   * @throws QuackException if there is an error evaluating the script.
+   */
+  public Object evaluate(QuackContext quackContext, String script, String fileName) {
+    return quackContext.evaluateBytecode(getBytecode(quackContext, script, fileName));
+  }
+
+  /**
+   * Get the bytecode for {@code script}, compiling and caching it if necessary.
+   *
+   * @throws QuackException if there is an error compiling the script.
+   */
+  public synchronized byte[] getBytecode(QuackContext quackContext, String script, String fileName) {
+    File file = new File(directory, getKey(quackContext.isQuickJS(), script, fileName) + EXTENSION);
+    byte[] bytecode = read(file);
+    if (bytecode != null)
+      return bytecode;
+
+    bytecode = quackContext.compileBytecode(script, fileName);
+    if (bytecode != null)
+      write(file, bytecode);
+    return bytecode;
+  }
+
+  // the cached bytecode of a module, see QuackContext.quackLoadModule, or null.
+  synchronized byte[] readModule(QuackContext quackContext, String source, String id, int kind) {
+    return read(getModuleFile(quackContext, source, id, kind));
+  }
+
+  // store the bytecode of a module, as compiled when it was first loaded.
+  synchronized void writeModule(QuackContext quackContext, String source, String id, int kind, byte[] bytecode) {
+    write(getModuleFile(quackContext, source, id, kind), bytecode);
+  }
+
+  private File getModuleFile(QuackContext quackContext, String source, String id, int kind) {
+    // modules compile differently than scripts of the same name and source.
+    return new File(directory, getKey(quackContext.isQuickJS(), source, "module:" + kind + ":" + id) + EXTENSION);
+  }
+
+  /**
+   * Remove all cached bytecode.
+   */
+  public synchronized void clear() {
+    File[] files = directory.listFiles();
+    if (files == null)
+      return;
+    for (File file: files) {
+      if (file.getName().endsWith(EXTENSION))
+        file.delete();
+    }
+  }
+
+  static String getKey(boolean useQuickJS, String script, String fileName) {
+    MessageDigest digest;
+    try {
+      digest = MessageDigest.getInstance("SHA-256");
+    }
+    catch (NoSuchAlgorithmException e) {
+      throw new AssertionError(e);
+    }
+    digest.update((useQuickJS ? "quickjs" : "duktape").getBytes(UTF_8));
+    digest.update((byte)0);
+    digest.update(String.valueOf(fileName).getBytes(UTF_8));
+    digest.update((byte)0);
+    digest.update(script.getBytes(UTF_8));
+
+    StringBuilder builder = new StringBuilder();
+    for (byte b: digest.digest()) {
+      builder.append(String.format("%02x", b));
+    }
+    return builder.toString();
+  }
+
+  private static byte[] read(File file) {
+    if (!file.isFile())
+      return null;
+    try (DataInputStream input = new DataInputStream(new FileInputStream(file))) {
+      byte[] bytecode = new byte[(int)file.length()];
+      input.readFully(bytecode);
+      return bytecode;
+    }
+    catch (IOException e) {
+      // unreadable entries are recompiled and overwritten.
+      return null;
+    }
+  }
+
+  private void write(File file, byte[] bytecode) {
+    // write to a temporary file and rename it into place, so a crash or concurrent
+    // reader never sees a partial entry.
+    directory.mkdirs();
+    File temp = new File(directory, file.getName() + ".tmp");
+    try (FileOutputStream output = new FileOutputStream(temp)) {
+      output.write(bytecode);
+    }
+    catch (IOException e) {
+      // the cache is best effort.
+      temp.delete();
+      return;
+    }
+    if (!temp.renameTo(file))
+      temp.delete();
+  }
+}
@@ -0,0 +1,22 @@
+package com.koushikdutta.quack;
+
+/**
+ * Receives the messages logged through the global {@code console} installed by
+ * {@link QuackContext#setConsole}. Messages are formatted natively, so each console call
+ * is a single call with a finished string, and no arguments are marshalled to Java.
+ */
+public interface QuackConsole {
+  // levels, must match ConsoleFormatter.h.
+  int LOG = 0;
+  int DEBUG = 1;
+  int INFO = 2;
+  int WARN = 3;
+  int ERROR = 4;
+
+  /**
+   * @param level the level of the console method called, with console.assert logging at
+   *              {@link #ERROR}.
+   * @param message the formatted message.
+   */
+  void log(int level, String message);
+}
@@ -16,6 +16,9 @@
 package com.koushikdutta.quack;
 
 import java.io.Closeable;
+import java.lang.ref.PhantomReference;
+import java.lang.ref.Reference;
+import java.lang.ref.ReferenceQueue;
 import java.lang.reflect.Array;
 import java.lang.reflect.Constructor;
 import java.lang.reflect.Field;
@@ -26,8 +29,11 @@ import java.lang.reflect.Proxy;
 import java.lang.reflect.UndeclaredThrowableException;
 import java.nio.ByteBuffer;
 import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.HashSet;
 import java.util.LinkedHashMap;
 import java.util.Map;
+import java.util.concurrent.Executor;
 import java.util.logging.Logger;
 
 /** A simple EMCAScript (Javascript) interpreter. */
@@ -35,6 +41,8 @@ import java.util.logging.Logger;
 public final class QuackContext implements Closeable {
   private final Map<Class, QuackCoercion> JavaScriptToJavaCoercions = new LinkedHashMap<>();
   private final Map<Class, QuackCoercion> JavaToJavascriptCoercions = new LinkedHashMap<>();
+  // classes with a JavaScript to Java coercion registered by the user, rather than a builtin.
+  private final HashSet<Class> userJavaScriptToJavaCoercions = new HashSet<>();
   final Map<Method, QuackMethodCoercion> JavaScriptToJavaMethodCoercions = new LinkedHashMap<>();
   final Map<Method, QuackMethodCoercion> JavaToJavascriptMethodCoercions = new LinkedHashMap<>();
   private QuackInvocationHandlerWrapper invocationHandlerWrapper;
@@ -90,6 +98,9 @@ public final class QuackContext implements Closeable {
    */
   public synchronized <T> void putJavaScriptToJavaCoercion(Class<T> clazz, QuackCoercion<T, Object> coercion) {
     JavaScriptToJavaCoercions.put(clazz, coercion);
+    userJavaScriptToJavaCoercions.add(clazz);
+    if (context != 0)
+      clearFieldCache(context);
   }
 
   /**
@@ -101,6 +112,25 @@ public final class QuackContext implements Closeable {
    */
   public synchronized <F> void putJavaToJavaScriptCoercion(Class<F> clazz, QuackCoercion<Object, F> coercion) {
     JavaToJavascriptCoercions.put(clazz, coercion);
+    // the native field cache skips coercions, so it needs to resolve fields again.
+    if (context != 0)
+      clearFieldCache(context);
+  }
+
+  /**
+   * Whether values of the given field or parameter type may be passed between the runtimes
+   * as is, in either direction. This holds unless a coercion was registered that applies to them.
+   */
+  boolean isUncoercedType(Class type, Class boxedType) {
+    if (userJavaScriptToJavaCoercions.contains(type))
+      return false;
+    if (JavaToJavascriptCoercions.containsKey(boxedType))
+      return false;
+    for (Class clazz: JavaToJavascriptCoercions.keySet()) {
+      if (clazz.isAssignableFrom(boxedType))
+        return false;
+    }
+    return true;
   }
 
   /**
@@ -139,24 +169,7 @@ public final class QuackContext implements Closeable {
 
     if (clazz.isInterface() && clazz.getMethods().length == 1) {
       // automatically coerce functional interfaces into functions
-      Method method = clazz.getMethods()[0];
-      return new QuackMethodObject() {
-        @Override
-        public Object callMethod(Object thiz, Object... args) {
-          try {
-            if (args != null) {
-              Class[] parameters = method.getParameterTypes();
-              for (int i = 0; i < args.length; i++) {
-                args[i] = coerceJavaScriptToJava(parameters[i], args[i]);
-              }
-            }
-            return coerceJavaToJavaScript(method.invoke(o, args));
-          }
-          catch (Exception e) {
-            throw new IllegalArgumentException(e);
-          }
-        }
-      };
+      return new QuackNativeMethod(this, o, clazz.getMethods()[0]);
     }
 
     return o;
@@ -322,11 +335,16 @@ public final class QuackContext implements Closeable {
   public synchronized void putJavaScriptToJavaMethodCoercion(Method method, QuackMethodCoercion coercion) {
     JavaScriptToJavaMethodCoercions.put(method, coercion);
     interfaceMethods.clear();
+    // the native method cache skips method coercions.
+    if (context != 0)
+      clearFieldCache(context);
   }
 
   public synchronized void putJavaToJavaScriptMethodCoercion(Method method, QuackMethodCoercion coercion) {
     JavaToJavascriptMethodCoercions.put(method, coercion);
     interfaceMethods.clear();
+    if (context != 0)
+      clearFieldCache(context);
   }
 
   private static class MethodException extends Exception {
@@ -413,18 +431,37 @@ public final class QuackContext implements Closeable {
     return null;
   }
 
+  /**
+   * Duktape allocator that prefixes each allocation with its size for heap accounting.
+   */
+  public static final int DUKTAPE_ALLOCATOR_HEADER = 0;
+  /**
+   * Duktape allocator that serves small allocations from size class slabs. Faster for
+   * allocation heavy scripts, but slab memory is only released when the context is closed.
+   */
+  public static final int DUKTAPE_ALLOCATOR_SLAB = 1;
+
   /**
    * Create a new interpreter instance. Calls to this method <strong>must</strong> matched with
    * calls to {@link #close()} on the returned instance to avoid leaking native memory.
    */
   public static QuackContext create(boolean useQuickJS) {
+    return create(useQuickJS, DUKTAPE_ALLOCATOR_HEADER);
+  }
+
+  /**
+   * Create a context, choosing the allocator used by the Duktape heap.
+   * {@code duktapeAllocator} is ignored by QuickJS.
+   */
+  public static QuackContext create(boolean useQuickJS, int duktapeAllocator) {
     QuackContext quack = new QuackContext();
     // context will hold a weak ref, so this doesn't matter if it fails.
-    long context = createContext(quack, useQuickJS);
+    long context = createContext(quack, useQuickJS, duktapeAllocator);
     if (context == 0) {
       throw new OutOfMemoryError("Cannot create Duktape instance");
     }
     quack.context = context;
+    quack.useQuickJS = useQuickJS;
     return quack;
   }
 
@@ -433,6 +470,14 @@ public final class QuackContext implements Closeable {
   }
 
   private long context;
+  private boolean useQuickJS;
+
+  /**
+   * Check whether this context is backed by QuickJS, or by Duktape.
+   */
+  public boolean isQuickJS() {
+    return useQuickJS;
+  }
 
   private QuackContext() {
     // coercing javascript string into an enum for java
@@ -507,6 +552,59 @@ public final class QuackContext implements Closeable {
     totalElapsedScriptExecutionMs = 0;
   }
 
+  // nanoseconds each call into JavaScript from Java may run, or 0 for no limit.
+  private long executionTimeoutNanos;
+  // calls into JavaScript on the stack, the budget covers the outermost one.
+  private int executionDepth;
+  // whether the native budget needs resetting once the outermost call returns.
+  private volatile boolean executionBudgetArmed;
+  // held while the native context is destroyed, so interrupt() does not need the context lock.
+  private final Object interruptLock = new Object();
+
+  /**
+   * Limit how long each call into JavaScript from Java may run, including the Java it calls
+   * back into. Calls that run past the timeout throw a {@link QuackInterruptedException},
+   * which scripts can not catch. Nested calls, such as a function called from Java while
+   * inside a callback from JavaScript, share the deadline of the outermost call.
+   * The engines check the deadline every few thousand instructions, so time spent in Java,
+   * or in a single long native operation, can overrun it.
+   *
+   * @param timeoutMillis the timeout, or 0 for no limit, which is the default.
+   */
+  public synchronized void setExecutionTimeout(long timeoutMillis) {
+    executionTimeoutNanos = Math.max(0, timeoutMillis) * 1000000;
+  }
+
+  /**
+   * Abort the script currently running on this context, which throws a
+   * {@link QuackInterruptedException} to the caller. This may be called from any thread.
+   * Does nothing if no script is running.
+   */
+  public void interrupt() {
+    synchronized (interruptLock) {
+      if (context == 0)
+        return;
+      executionBudgetArmed = true;
+      interrupt(context);
+    }
+  }
+
+  private void startExecutionLocked() {
+    if (executionDepth++ != 0 || (executionTimeoutNanos == 0 && !executionBudgetArmed))
+      return;
+    // this also drops an interrupt() that came in while no script was running.
+    executionBudgetArmed = true;
+    startExecutionBudget(context, executionTimeoutNanos);
+  }
+
+  private void finishExecutionLocked() {
+    if (--executionDepth != 0 || !executionBudgetArmed)
+      return;
+    executionBudgetArmed = false;
+    if (context != 0)
+      stopExecutionBudget(context);
+  }
+
   /**
    * Evaluate {@code script} and return a result. {@code fileName} will be used in error
    * reporting.
@@ -517,11 +615,13 @@ public final class QuackContext implements Closeable {
     if (context == 0)
       return null;
     long start = System.nanoTime() / 1000000;
+    startExecutionLocked();
     try {
       return evaluate(context, script, fileName);
     }
     finally {
       totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
+      finishExecutionLocked();
     }
   }
 
@@ -563,15 +663,116 @@ public final class QuackContext implements Closeable {
     return compileFunction(context, script, fileName);
   }
 
+  /**
+   * Compile {@code script} into a serialized bytecode blob that can later be run with
+   * {@link #evaluateBytecode(byte[])} without parsing the source again. The bytecode is
+   * only valid for the engine, and native library build, that produced it.
+   *
+   * @throws QuackException if there is an error compiling the script.
+   */
+  public synchronized byte[] compileBytecode(String script, String fileName) {
+    if (context == 0)
+      return null;
+    return compileBytecode(context, script, fileName);
+  }
+
+  /**
+   * Evaluate bytecode produced by {@link #compileBytecode(String, String)} and return a result.
+   * The result is the same as evaluating the original script.
+   *
+   * @throws QuackException if there is an error loading or evaluating the bytecode.
+   */
+  public synchronized Object evaluateBytecode(byte[] bytecode) {
+    if (context == 0)
+      return null;
+    long start = System.nanoTime() / 1000000;
+    startExecutionLocked();
+    try {
+      return evaluateBytecode(context, bytecode);
+    }
+    finally {
+      totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
+      finishExecutionLocked();
+    }
+  }
+
+  /**
+   * Serialize a value to a compact binary form that {@link #deserialize(byte[])} on any
+   * context, of either engine, turns back into a copy of it. Unlike JSON, this keeps
+   * ArrayBuffers, typed arrays, Dates, undefined, and shared or cyclic references.
+   * Other objects are copied as plain objects, with their own enumerable properties.
+   *
+   * @throws QuackException if the value holds a function, a symbol, or a Java object.
+   */
+  public synchronized byte[] serialize(Object value) {
+    if (context == 0)
+      return null;
+    startExecutionLocked();
+    try {
+      return serialize(context, coerceJavaToJavaScript(value));
+    }
+    finally {
+      finishExecutionLocked();
+    }
+  }
+
+  /**
+   * Create a copy of a value serialized by {@link #serialize(Object)}, possibly in another
+   * context.
+   *
+   * @throws QuackException if the data is malformed.
+   */
+  public synchronized Object deserialize(byte[] data) {
+    if (context == 0)
+      return null;
+    startExecutionLocked();
+    try {
+      return coerceJavaScriptToJava(null, deserialize(context, data));
+    }
+    finally {
+      finishExecutionLocked();
+    }
+  }
+
+  /**
+   * Create an Int32Array holding a copy of {@code values}, in one call into the engine.
+   * See {@link JavaScriptObject#getArrayRange(int, int[], int, int)} to copy it back.
+   */
+  public JavaScriptObject newTypedArray(int[] values) {
+    return newTypedArray(values, ARRAY_INT);
+  }
+
+  /**
+   * Create a Float32Array holding a copy of {@code values}.
+   */
+  public JavaScriptObject newTypedArray(float[] values) {
+    return newTypedArray(values, ARRAY_FLOAT);
+  }
+
+  /**
+   * Create a Float64Array holding a copy of {@code values}.
+   */
+  public JavaScriptObject newTypedArray(double[] values) {
+    return newTypedArray(values, ARRAY_DOUBLE);
+  }
+
+  private synchronized JavaScriptObject newTypedArray(Object values, int type) {
+    if (context == 0)
+      return null;
+    return (JavaScriptObject)newTypedArray(context, values, type);
+  }
+
   /**
    * Release the native resources associated with this object. You <strong>must</strong> call this
    * method for each instance to avoid leaking native memory.
    */
   @Override public synchronized void close() {
-    if (context != 0) {
-      long contextToClose = context;
-      context = 0;
-      destroyContext(contextToClose);
+    synchronized (interruptLock) {
+      if (context != 0) {
+        long contextToClose = context;
+        context = 0;
+        destroyContext(contextToClose);
+      }
     }
   }
 
@@ -660,80 +861,580 @@ public final class QuackContext implements Closeable {
       return false;
     return setKeyInteger(context, object, index, value);
   }
+  // element types of the primitive arrays copied by getArrayRange and setArrayRange.
+  // must match ArrayRange.h.
+  static final int ARRAY_INT = 0;
+  static final int ARRAY_FLOAT = 1;
+  static final int ARRAY_DOUBLE = 2;
+  synchronized void getArrayRange(long object, int index, Object array, int type, int offset, int length) {
+    if (context == 0)
+      return;
+    getArrayRange(context, object, index, array, type, offset, length);
+  }
+  synchronized void setArrayRange(long object, int index, Object array, int type, int offset, int length) {
+    if (context == 0)
+      return;
+    setArrayRange(context, object, index, array, type, offset, length);
+  }
+  /**
+   * Intern a property name for fast repeated access through
+   * {@link JavaScriptObject#get(QuackPropertyKey)}, {@link JavaScriptObject#set(QuackPropertyKey, Object)}
+   * and {@link JavaScriptObject#callProperty(QuackPropertyKey, Object...)}.
+   */
+  public synchronized QuackPropertyKey internKey(String name) {
+    if (context == 0)
+      return null;
+    return new QuackPropertyKey(this, internKey(context, name), name);
+  }
+  synchronized Object getKeyHandle(long object, long key) {
+    if (context == 0)
+      return null;
+    return getKeyHandle(context, object, key);
+  }
+  synchronized boolean setKeyHandle(long object, long key, Object value) {
+    if (context == 0)
+      return false;
+    return setKeyHandle(context, object, key, value);
+  }
+  synchronized Object callPropertyHandle(long object, long key, Object... args) {
+    if (context == 0)
+      return null;
+    return invokeLocked(() -> callPropertyHandle(context, object, key, args));
+  }
   synchronized Object call(long object, Object... args) {
     if (context == 0)
       return null;
-    long start = System.nanoTime() / 1000000;
-    try {
-      return call(context, object, args);
-    }
-    finally {
-      totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
-      postInvocationLocked();
-    }
+    return invokeLocked(() -> call(context, object, args));
+  }
+  synchronized Object[] callBatch(long object, Object[][] argsList) {
+    if (context == 0)
+      return null;
+    return invokeLocked(() -> callBatch(context, object, argsList));
   }
   synchronized Object callMethod(long object, Object thiz, Object... args) {
     if (context == 0)
       return null;
-    long start = System.nanoTime() / 1000000;
-    try {
-      return callMethod(context, object, thiz, args);
-    }
-    finally {
-      totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
-      postInvocationLocked();
-    }
+    return invokeLocked(() -> callMethod(context, object, thiz, args));
   }
   synchronized Object callProperty(long object, Object property, Object... args) {
     if (context == 0)
       return null;
-    long start = System.nanoTime() / 1000000;
-    try {
-      return callProperty(context, object, property, args);
-    }
-    finally {
-      totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
-      postInvocationLocked();
-    }
+    return invokeLocked(() -> callProperty(context, object, property, args));
   }
   synchronized String stringify(long object) {
       if (context == 0)
         return null;
       return stringify(context, object);
   }
+  synchronized ByteBuffer stringify(long object, ByteBuffer buffer) {
+      if (context == 0)
+        return null;
+      return stringifyUtf8(context, object, buffer);
+  }
   public synchronized long getHeapSize() {
     if (context == 0)
       return 0;
     return getHeapSize(context);
   }
 
+  /**
+   * Cap the memory the JavaScript heap of this context may allocate. Scripts that allocate
+   * past the limit fail with a catchable error, thrown to Java as a {@link QuackException},
+   * after which the context may be used again. Duktape only enforces the limit while JavaScript
+   * runs: values converted from Java, for a call or by a callback into Java, may be allocated past
+   * it, though they count toward it. QuickJS enforces it on every allocation, so converting a
+   * value from Java may fail with the same error.
+   *
+   * @param limit the limit in bytes, or 0 for no limit, which is the default.
+   */
+  public synchronized void setHeapLimit(long limit) {
+    if (context == 0)
+      return;
+    setHeapLimit(context, limit);
+  }
+
+  /**
+   * Get the most memory allocated by the JavaScript heap since the context was created, or
+   * since {@link #resetHeapHighWaterMark()}. On QuickJS this counts allocated bytes, which is
+   * a different measure than {@link #getHeapSize()}.
+   */
+  public synchronized long getHeapHighWaterMark() {
+    if (context == 0)
+      return 0;
+    return getHeapHighWaterMark(context);
+  }
+
+  /**
+   * Reset the heap high water mark to the current heap size.
+   */
+  public synchronized void resetHeapHighWaterMark() {
+    if (context == 0)
+      return;
+    resetHeapHighWaterMark(context);
+  }
+
+  /**
+   * Sample the memory use of this context. Only the detailed sample breaks the heap down by
+   * kind, which walks the whole heap; the others are counters, cheap enough to sample often.
+   */
+  public synchronized QuackMemoryStats getMemoryStats(boolean detailed) {
+    long[] stats = new long[QuackMemoryStats.COUNT];
+    if (context != 0)
+      getMemoryStats(context, stats, detailed);
+    return new QuackMemoryStats(stats, pinnedBuffers.size());
+  }
+
+  /**
+   * Sample the memory use of this context, including the breakdown of the heap by kind.
+   */
+  public synchronized QuackMemoryStats getMemoryStats() {
+    return getMemoryStats(true);
+  }
+
+  /**
+   * Count and time the calls across the bridge: each entry point from Java into JavaScript,
+   * each trap from JavaScript into a Java object, the values converted each way by type, and
+   * the JNI refs created for them. On Android, entry points and traps also show up as
+   * systrace/Perfetto sections while tracing. Costs a clock read on each side of every call.
+   */
+  public synchronized void setBridgeStatsEnabled(boolean enabled) {
+    if (context == 0)
+      return;
+    setBridgeStatsEnabled(context, enabled);
+  }
+
+  /**
+   * Sample the bridge counters and latency histograms kept since they were enabled or reset.
+   */
+  public synchronized QuackBridgeStats getBridgeStats() {
+    long[] stats = new long[QuackBridgeStats.COUNT];
+    if (context != 0)
+      getBridgeStats(context, stats);
+    return new QuackBridgeStats(stats);
+  }
+
+  public synchronized void resetBridgeStats() {
+    if (context == 0)
+      return;
+    resetBridgeStats(context);
+  }
+
+  /**
+   * Start sampling the JavaScript stack of the scripts run on this context. Samples record the
+   * bridge trap, such as {@code quickjs_get} or {@code duktapeApply}, when taken as one returns,
+   * so time spent in Java called from JavaScript is attributed to it. Starting again discards
+   * the samples taken so far.
+   * The engines only sample as often as they poll for interrupts, every few thousand
+   * instructions, so short intervals are rounded up to that.
+   *
+   * @param intervalMicros the time between samples.
+   */
+  public synchronized void startProfiling(long intervalMicros) {
+    if (context == 0)
+      return;
+    startProfiling(context, Math.max(1, intervalMicros) * 1000);
+  }
+
+  /**
+   * Start sampling the JavaScript stack every millisecond.
+   */
+  public synchronized void startProfiling() {
+    startProfiling(1000);
+  }
+
+  /**
+   * Stop sampling, and get the samples as collapsed stacks, the input format of flamegraph.pl
+   * and speedscope: one line per distinct stack, frames from the outermost call down separated
+   * by ';', followed by a space and the number of samples. Frames are named
+   * {@code name (file)}, and bridge traps are {@code [trap]} frames.
+   */
+  public synchronized String stopProfiling() {
+    if (context == 0)
+      return "";
+    return stopProfiling(context);
+  }
+
+  // module kinds, must match ModuleLoader.h.
+  static final int MODULE_COMMONJS = 0;
+  static final int MODULE_ES = 1;
+
+  private QuackModuleLoader moduleLoader;
+  private QuackBytecodeCache moduleCache;
+
+  /**
+   * Define a global CommonJS {@code require} that resolves and loads modules through
+   * {@code loader}. On QuickJS, ES modules are loaded through it as well, for
+   * {@code import} and {@code import()}. A module is only compiled the first time it is
+   * required, so code paths a script never reaches are never parsed, and its bytecode is
+   * cached in {@code cache} for later contexts, as {@link QuackBytecodeCache} does for scripts.
+   * Setting a loader again defines a new require, with no modules loaded yet.
+   *
+   * @param cache the bytecode cache, or null to compile modules from source each time.
+   */
+  public synchronized void setModuleLoader(QuackModuleLoader loader, QuackBytecodeCache cache) {
+    if (context == 0)
+      return;
+    moduleLoader = loader;
+    moduleCache = cache;
+    installModuleLoader(context, cache != null);
+  }
+
+  /**
+   * Define a global CommonJS {@code require}, without a bytecode cache.
+   *
+   * @see #setModuleLoader(QuackModuleLoader, QuackBytecodeCache)
+   */
+  public synchronized void setModuleLoader(QuackModuleLoader loader) {
+    setModuleLoader(loader, null);
+  }
+
+  private QuackConsole console;
+
+  /**
+   * Define a global {@code console}, with log, debug, info, warn, error and assert, that
+   * logs to {@code console}. Arguments are formatted natively, as Node does, with the
+   * substitutions %s, %d, %i, %f, %o, %O, %j and %%, and objects written as JSON, so a
+   * message reaches Java as one string instead of through reflection on a Java object.
+   * An exception thrown by the console is thrown to the script that logged.
+   *
+   * @param console the console, or null to drop messages. The global is left in place.
+   */
+  public synchronized void setConsole(QuackConsole console) {
+    if (context == 0)
+      return;
+    boolean install = this.console == null && console != null;
+    this.console = console;
+    if (install)
+      installConsole(context);
+  }
+
+  /**
+   * Exception stack mode: errors crossing between JavaScript and Java carry the stack of both
+   * sides. The stacks are merged when first read, from {@link Throwable#getStackTrace()} or
+   * an error's {@code stack}, so an exception that is only caught costs no more than a
+   * message. This is the default.
+   */
+  public static final int EXCEPTION_STACK_MERGED = 0;
+  /**
+   * Exception stack mode: stacks are not merged across the boundary. A JavaScript error
+   * reaches Java with its message only, and a Java exception reaches JavaScript with the
+   * JavaScript stack only. A Java exception caught by neither side is still rethrown as is.
+   */
+  public static final int EXCEPTION_STACK_NONE = 1;
+
+  /**
+   * Set how stacks are carried by exceptions that cross between JavaScript and Java.
+   * @param mode {@link #EXCEPTION_STACK_MERGED} or {@link #EXCEPTION_STACK_NONE}.
+   */
+  public synchronized void setExceptionStackMode(int mode) {
+    if (context == 0)
+      return;
+    setExceptionStackMode(context, mode);
+  }
+
+  /**
+   * Garbage collection policy: only collect when {@link #gc()} is called. The engine may still
+   * collect on its own as it allocates.
+   */
+  public static final int GC_NEVER = 0;
+  /**
+   * Garbage collection policy: collect after every {@code value} calls into JavaScript.
+   * This is the Duktape default, with a {@code value} of 1.
+   */
+  public static final int GC_EVERY_N_CALLS = 1;
+  /**
+   * Garbage collection policy: collect after a call into JavaScript once the heap has grown by
+   * {@code value} bytes since the last collection forced by this policy or {@link #gc()}.
+   */
+  public static final int GC_HEAP_GROWTH = 2;
+
+  /**
+   * Set when garbage collection is forced after calls into JavaScript. Reference counting
+   * frees most garbage immediately, so collection is only needed to reclaim cycles.
+   * QuickJS defaults to {@link #GC_NEVER}, Duktape defaults to {@link #GC_EVERY_N_CALLS}.
+   */
+  public synchronized void setGCPolicy(int policy, long value) {
+    if (context == 0)
+      return;
+    setGCPolicy(context, policy, value);
+  }
+
+  /**
+   * Run a full garbage collection.
+   */
+  public synchronized void gc() {
+    if (context == 0)
+      return;
+    gc(context);
+  }
+
+  /**
+   * Share buffer memory between Java and JavaScript instead of copying it. A direct ByteBuffer
+   * passed to JavaScript becomes a Uint8Array over the same memory, and an ArrayBuffer or
+   * Uint8Array passed to Java becomes a direct ByteBuffer over the JavaScript memory, which
+   * is kept alive until the ByteBuffer is collected.
+   * ByteBuffers created this way must not be used after the context is closed.
+   */
+  public synchronized void setZeroCopyBuffers(boolean zeroCopy) {
+    if (context == 0)
+      return;
+    setZeroCopyBuffers(context, zeroCopy);
+  }
+
+  // JavaScript buffers that are shared with Java ByteBuffers, released once the
+  // ByteBuffer is collected.
+  private static class PinnedBuffer extends PhantomReference<ByteBuffer> {
+    final long pin;
+    PinnedBuffer(ByteBuffer buffer, ReferenceQueue<ByteBuffer> queue, long pin) {
+      super(buffer, queue);
+      this.pin = pin;
+    }
+  }
+  private final ReferenceQueue<ByteBuffer> pinnedBufferQueue = new ReferenceQueue<>();
+  private final HashSet<PinnedBuffer> pinnedBuffers = new HashSet<>();
+  private void unpinBuffersLocked() {
+    if (context == 0)
+      return;
+    Reference<? extends ByteBuffer> reference;
+    while ((reference = pinnedBufferQueue.poll()) != null) {
+      PinnedBuffer pinned = (PinnedBuffer)reference;
+      pinnedBuffers.remove(pinned);
+      unpinBuffer(context, pinned.pin);
+    }
+  }
+
   // to prevent from blocking the JavaScriptObject finalizer, create
-  // a finalization queue for the JS side.
-  final ArrayList<Long> finalizationQueue = new ArrayList<>();
-  void finalizeJavaScriptObject(long object) {
+  // a finalization queue for the JS side. handles are queued unboxed and released in bulk.
+  private static final int MIN_FINALIZATION_QUEUE = 64;
+  private final Object finalizationLock = new Object();
+  private long[] finalizationQueue = new long[MIN_FINALIZATION_QUEUE];
+  private int finalizationCount;
+  private long finalizationBudgetNanos;
+  void finalizeJavaScriptObject(long handle) {
     if (context == 0)
       return;
-    synchronized (finalizationQueue) {
-      finalizationQueue.add(object);
+    synchronized (finalizationLock) {
+      if (finalizationCount == finalizationQueue.length)
+        finalizationQueue = Arrays.copyOf(finalizationQueue, finalizationCount * 2);
+      finalizationQueue[finalizationCount++] = handle;
     }
   }
   private void finalizeObjectsLocked() {
+    releaseKeysLocked();
+    long[] handles;
+    int count;
+    synchronized (finalizationLock) {
+      if (finalizationCount == 0)
+        return;
+      handles = finalizationQueue;
+      count = finalizationCount;
+      finalizationQueue = new long[MIN_FINALIZATION_QUEUE];
+      finalizationCount = 0;
+    }
+    if (context == 0)
+      return;
+    int released = finalizeJavaScriptObjects(context, handles, count, finalizationBudgetNanos);
+    if (released == count)
+      return;
+    // out of budget, the rest go back to the front of the queue for the next call.
+    synchronized (finalizationLock) {
+      int remaining = count - released;
+      long[] queue = new long[Math.max(MIN_FINALIZATION_QUEUE, remaining + finalizationCount)];
+      System.arraycopy(handles, released, queue, 0, remaining);
+      System.arraycopy(finalizationQueue, 0, queue, remaining, finalizationCount);
+      finalizationQueue = queue;
+      finalizationCount += remaining;
+    }
+  }
+
+  /**
+   * Limit the time spent releasing collected JavaScriptObjects when a call into JavaScript
+   * returns. After a burst of garbage, the objects are then released over several calls
+   * rather than stalling one. Objects are released in batches of a few hundred, so a call
+   * may overrun the budget slightly.
+   *
+   * @param micros the budget, or 0, the default, to release every collected object each time.
+   */
+  public synchronized void setFinalizationBudget(long micros) {
+    finalizationBudgetNanos = Math.max(0, micros) * 1000;
+  }
+
+  // interned keys are released the same way.
+  final ArrayList<Long> releasedKeyQueue = new ArrayList<>();
+  void releaseKey(long key) {
+    if (context == 0)
+      return;
+    synchronized (releasedKeyQueue) {
+      releasedKeyQueue.add(key);
+    }
+  }
+  private void releaseKeysLocked() {
     ArrayList<Long> copy;
-    synchronized (finalizationQueue) {
-      if (finalizationQueue.isEmpty())
+    synchronized (releasedKeyQueue) {
+      if (releasedKeyQueue.isEmpty())
         return;
-      copy = new ArrayList<>(finalizationQueue);
-      finalizationQueue.clear();
+      copy = new ArrayList<>(releasedKeyQueue);
+      releasedKeyQueue.clear();
     }
     if (context == 0)
       return;
-    for (Long object: copy) {
-      finalizeJavaScriptObject(object);
+    for (Long key: copy) {
+      releaseKey(context, key);
     }
   }
-  private void postInvocationLocked() {
-    finalizeObjectsLocked();
-    runJobs(context);
+  private interface Invocation<T> {
+    T invoke();
+  }
+
+  // a call into JavaScript, followed by the work it leaves queued. a promise job that fails
+  // then does not replace the result of the call: it is suppressed by the exception of the
+  // call, or thrown from the next call or runJobs() if the call returned.
+  private <T> T invokeLocked(Invocation<T> invocation) {
+    throwFailedJobLocked();
+    long start = System.nanoTime() / 1000000;
+    startExecutionLocked();
+    T ret;
+    try {
+      ret = invocation.invoke();
+    }
+    catch (RuntimeException | Error e) {
+      totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
+      RuntimeException jobFailure = postInvocationLocked();
+      if (jobFailure != null)
+        e.addSuppressed(jobFailure);
+      throw e;
+    }
+    totalElapsedScriptExecutionMs += System.nanoTime() / 1000000 - start;
+    RuntimeException jobFailure = postInvocationLocked();
+    if (jobFailure != null)
+      addFailedJobLocked(jobFailure);
+    return ret;
+  }
+
+  // promise jobs run within the execution budget of the call, unless they are left to the
+  // job executor. returns the failure of a job, rather than throwing it.
+  private RuntimeException postInvocationLocked() {
+    try {
+      finalizeObjectsLocked();
+      unpinBuffersLocked();
+      if (jobExecutor == null) {
+        try {
+          runJobs(context);
+        }
+        catch (RuntimeException e) {
+          return e;
+        }
+      }
+      else {
+        scheduleJobsLocked();
+      }
+      return null;
+    }
+    finally {
+      finishExecutionLocked();
+    }
+  }
+
+  // a job that failed as a call returned or on the job executor, for the next call or runJobs().
+  private RuntimeException failedJob;
+
+  private void addFailedJobLocked(RuntimeException jobFailure) {
+    if (failedJob == null)
+      failedJob = jobFailure;
+    else
+      failedJob.addSuppressed(jobFailure);
+  }
+
+  private void throwFailedJobLocked() {
+    if (failedJob == null)
+      return;
+    RuntimeException failure = failedJob;
+    failedJob = null;
+    throw failure;
+  }
+
+  // runs pending promise jobs, or null to run them as each call into JavaScript returns.
+  private Executor jobExecutor;
+  // whether a run of the jobs is queued on the job executor.
+  private boolean jobsScheduled;
+
+  /**
+   * Run promise jobs on {@code executor} instead of at the end of each call into JavaScript.
+   * Once a call leaves jobs pending, a single run of them is queued on the executor, so
+   * promises make progress without polling. On Android, pass {@code new Handler(looper)::post}
+   * to run them on a Looper. A job failing there is not thrown into the executor, but from the
+   * next call into JavaScript or runJobs().
+   *
+   * @param executor the executor, or null to go back to running jobs as calls return.
+   */
+  public synchronized void setJobExecutor(Executor executor) {
+    jobExecutor = executor;
+    if (context != 0 && executor != null)
+      scheduleJobsLocked();
+  }
+
+  private void scheduleJobsLocked() {
+    if (jobsScheduled || !hasPendingJobs(context))
+      return;
+    jobsScheduled = true;
+    jobExecutor.execute(this::runScheduledJobs);
+  }
+
+  private synchronized void runScheduledJobs() {
+    jobsScheduled = false;
+    try {
+      runJobsLocked();
+    }
+    catch (RuntimeException e) {
+      addFailedJobLocked(e);
+    }
+  }
+
+  /**
+   * Run promise jobs until none are pending, including the jobs they queue.
+   * A job that fails outside of a promise, such as one that was interrupted or ran out of
+   * time, throws here and leaves the remaining jobs pending. Without a job executor, jobs run
+   * as calls into JavaScript return, and one failing then does not replace the result of the
+   * call: it is suppressed by the exception the call threw, or, if the call returned, thrown
+   * from the next call or runJobs() before anything runs. A job failing on the job executor is
+   * thrown the same way.
+   */
+  public synchronized void runJobs() {
+    throwFailedJobLocked();
+    runJobsLocked();
+  }
+
+  private void runJobsLocked() {
+    if (context == 0)
+      return;
+    startExecutionLocked();
+    try {
+      runJobs(context);
+    }
+    finally {
+      finishExecutionLocked();
+      // jobs are only left over if one failed.
+      if (jobExecutor != null && context != 0)
+        scheduleJobsLocked();
+    }
+  }
+
+  // the exceptions JavaScript throwing values turns into, for rejected promises.
+  private JavaScriptObject rethrowFunction;
+
+  // the exception Java would get if JavaScript threw the value.
+  synchronized RuntimeException toJavaException(Object thrown) {
+    if (context != 0) {
+      if (rethrowFunction == null)
+        rethrowFunction = compileFunction("function(e) { throw e; }", "?");
+      try {
+        rethrowFunction.call(thrown);
+      }
+      catch (RuntimeException e) {
+        return e;
+      }
+    }
+    return new QuackException(String.valueOf(thrown));
   }
 
   // hooks from js/jni to java
@@ -746,6 +1447,55 @@ public final class QuackContext implements Closeable {
   private boolean quackSet(QuackObject quackObject, Object key, Object value) {
     return quackObject.set(key, value);
   }
+  private void quackPinBuffer(ByteBuffer buffer, long pin) {
+    pinnedBuffers.add(new PinnedBuffer(buffer, pinnedBufferQueue, pin));
+  }
+  // field kinds, as resolved for the native field cache. must match FieldCache.h.
+  static final int FIELD_NONE = 0;
+  static final int FIELD_INT = 1;
+  static final int FIELD_BOOLEAN = 2;
+  static final int FIELD_DOUBLE = 3;
+  static final int FIELD_STRING = 4;
+  static final int FIELD_FINAL = 0x100;
+  private int quackResolveField(JavaObject javaObject, String key) {
+    return javaObject.resolveField(key);
+  }
+  // the buffer that JSON of the given length is written into, see JavaScriptObject.stringify.
+  private ByteBuffer quackJsonBuffer(ByteBuffer buffer, int length) {
+    if (buffer == null || !buffer.isDirect() || buffer.remaining() < length)
+      return ByteBuffer.allocateDirect(length);
+    ByteBuffer target = buffer.duplicate();
+    target.limit(target.position() + length);
+    return target.slice();
+  }
+  private String quackResolveModule(String referrer, String specifier) {
+    String id = moduleLoader == null ? null : moduleLoader.resolve(referrer, specifier);
+    if (id == null)
+      throw new QuackException("Cannot find module '" + specifier + "'");
+    return id;
+  }
+  // the cached bytecode of the module, or its source to compile, which quackStoreModule is
+  // then called with if there is a cache.
+  private Object quackLoadModule(String id, int kind) {
+    String source = moduleLoader == null ? null : moduleLoader.load(id);
+    if (source == null)
+      throw new QuackException("Cannot find module '" + id + "'");
+    if (moduleCache != null) {
+      byte[] bytecode = moduleCache.readModule(this, source, id, kind);
+      if (bytecode != null)
+        return bytecode;
+    }
+    return source;
+  }
+  private void quackStoreModule(String id, int kind, String source, byte[] bytecode) {
+    if (moduleCache != null && bytecode != null)
+      moduleCache.writeModule(this, source, id, kind, bytecode);
+  }
+  private void quackConsole(int level, String message) {
+    QuackConsole console = this.console;
+    if (console != null)
+      console.log(level, message);
+  }
   private Object[] empty = new Object[0];
   private Object quackApply(QuackObject quackObject, Object thiz, Object... args) {
     return quackObject.callMethod(thiz, args == null ? empty : args);
@@ -755,11 +1505,22 @@ public final class QuackContext implements Closeable {
   }
 
   private static native long getHeapSize(long context);
-
-  private static native long createContext(QuackContext quackContext, boolean useQuickJS);
+  private static native void setHeapLimit(long context, long limit);
+  private static native long getHeapHighWaterMark(long context);
+  private static native void resetHeapHighWaterMark(long context);
+  private static native void getMemoryStats(long context, long[] stats, boolean detailed);
+  private static native void getBridgeStats(long context, long[] stats);
+  private static native void setBridgeStatsEnabled(long context, boolean enabled);
+  private static native void resetBridgeStats(long context);
+
+  private static native long createContext(QuackContext quackContext, boolean useQuickJS, int duktapeAllocator);
   private static native void destroyContext(long context);
   private static native Object evaluate(long context, String sourceCode, String fileName);
   private static native JavaScriptObject compileFunction(long context, String script, String fileName);
+  private static native byte[] compileBytecode(long context, String script, String fileName);
+  private static native Object evaluateBytecode(long context, byte[] bytecode);
+  private static native byte[] serialize(long context, Object value);
+  private static native Object deserialize(long context, byte[] data);
 
   private static native void cooperateDebugger(long context);
   private static native void waitForDebugger(long context, String connectionString);
@@ -771,11 +1532,35 @@ public final class QuackContext implements Closeable {
   private static native boolean setKeyObject(long context, long object, Object key, Object value);
   private static native boolean setKeyString(long context, long object, String key, Object value);
   private static native boolean setKeyInteger(long context, long object, int index, Object value);
+  private static native void getArrayRange(long context, long object, int index, Object array, int type, int offset, int length);
+  private static native void setArrayRange(long context, long object, int index, Object array, int type, int offset, int length);
+  private static native Object newTypedArray(long context, Object array, int type);
+  private static native long internKey(long context, String key);
+  private static native void releaseKey(long context, long key);
+  private static native Object getKeyHandle(long context, long object, long key);
+  private static native boolean setKeyHandle(long context, long object, long key, Object value);
+  private static native Object callPropertyHandle(long context, long object, long key, Object... args);
   private static native Object call(long context, long object, Object... args);
+  private static native Object[] callBatch(long context, long object, Object[][] argsList);
   private static native Object callMethod(long context, long object, Object thiz, Object... args);
   private static native Object callProperty(long context, long object, Object property, Object... args);
   private static native void setGlobalProperty(long context, Object property, Object value);
   private static native String stringify(long context, long object);
-  private static native void finalizeJavaScriptObject(long context, long object);
+  private static native ByteBuffer stringifyUtf8(long context, long object, ByteBuffer buffer);
+  private static native int finalizeJavaScriptObjects(long context, long[] handles, int count, long budgetNanos);
   private static native void runJobs(long context);
+  private static native boolean hasPendingJobs(long context);
+  private static native void setGCPolicy(long context, int policy, long value);
+  private static native void gc(long context);
+  private static native void setZeroCopyBuffers(long context, boolean zeroCopy);
+  private static native void unpinBuffer(long context, long pin);
+  private static native void clearFieldCache(long context);
+  private static native void startExecutionBudget(long context, long timeoutNanos);
+  private static native void stopExecutionBudget(long context);
+  private static native void interrupt(long context);
+  private static native void startProfiling(long context, long intervalNanos);
+  private static native String stopProfiling(long context);
+  private static native void installConsole(long context);
+  private static native void installModuleLoader(long context, boolean cacheModules);
+  private static native void setExceptionStackMode(long context, int mode);
 }
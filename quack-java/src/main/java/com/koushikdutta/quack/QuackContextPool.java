@@ -0,0 +1,168 @@
+package com.koushikdutta.quack;
+
+import java.io.Closeable;
+import java.util.ArrayDeque;
+
+/**
+ * A bounded pool of QuackContexts that are set up identically, so that independent work
+ * can run on several threads at once. A context is single threaded, so each one is checked
+ * out by one thread at a time with {@link #acquire()} and given back with {@link #release}.
+ *
+ * New contexts run the {@link Initializer} and then evaluate the shared bytecode snapshot,
+ * so the bundle is only parsed once for the whole pool. A thread is handed the context it
+ * used last when that context is idle, which keeps its JavaScript heap warm in that
+ * thread's cache.
+ */
+public class QuackContextPool implements Closeable {
+  public interface Initializer {
+    void initialize(QuackContext quackContext);
+  }
+
+  private final boolean useQuickJS;
+  private final int maxSize;
+  private final byte[] snapshot;
+  private final Initializer initializer;
+  private final ArrayDeque<QuackContext> idle = new ArrayDeque<>();
+  private final ThreadLocal<QuackContext> lastUsed = new ThreadLocal<>();
+  private int created;
+  private boolean closed;
+
+  /**
+   * @param snapshot bytecode from {@link QuackContext#compileBytecode} or a
+   *                 {@link QuackBytecodeCache} for the same engine, evaluated in every new
+   *                 context. May be null.
+   * @param initializer called on every new context before the snapshot is evaluated,
+   *                    for example to set global properties. May be null.
+   */
+  public QuackContextPool(boolean useQuickJS, int maxSize, byte[] snapshot, Initializer initializer) {
+    if (maxSize < 1)
+      throw new IllegalArgumentException("maxSize must be at least 1");
+    this.useQuickJS = useQuickJS;
+    this.maxSize = maxSize;
+    this.snapshot = snapshot;
+    this.initializer = initializer;
+  }
+
+  /**
+   * Create a pool whose snapshot is {@code script} compiled once to bytecode.
+   *
+   * @throws QuackException if there is an error compiling the script.
+   */
+  public QuackContextPool(boolean useQuickJS, int maxSize, String script, String fileName, Initializer initializer) {
+    this(useQuickJS, maxSize, compileSnapshot(useQuickJS, script, fileName), initializer);
+  }
+
+  private static byte[] compileSnapshot(boolean useQuickJS, String script, String fileName) {
+    QuackContext quack = QuackContext.create(useQuickJS);
+    try {
+      return quack.compileBytecode(script, fileName);
+    }
+    finally {
+      quack.close();
+    }
+  }
+
+  private QuackContext createContext() {
+    QuackContext quack = QuackContext.create(useQuickJS);
+    try {
+      if (initializer != null)
+        initializer.initialize(quack);
+      if (snapshot != null)
+        quack.evaluateBytecode(snapshot);
+      return quack;
+    }
+    catch (RuntimeException e) {
+      quack.close();
+      throw e;
+    }
+  }
+
+  /**
+   * Create idle contexts ahead of time, up to {@code count} or the pool size.
+   */
+  public void prewarm(int count) {
+    for (int i = 0; i < count; i++) {
+      synchronized (this) {
+        if (closed || created >= maxSize)
+          return;
+        created++;
+      }
+      release(createNewOrUncount());
+    }
+  }
+
+  private QuackContext createNewOrUncount() {
+    try {
+      return createContext();
+    }
+    catch (RuntimeException e) {
+      synchronized (this) {
+        created--;
+        notify();
+      }
+      throw e;
+    }
+  }
+
+  /**
+   * Check out a context, creating one if none are idle and the pool is not full, otherwise
+   * waiting for one to be released. The context must be given back with {@link #release}.
+   *
+   * @throws IllegalStateException if the pool is closed.
+   */
+  public QuackContext acquire() throws InterruptedException {
+    synchronized (this) {
+      while (true) {
+        if (closed)
+          throw new IllegalStateException("QuackContextPool is closed");
+        QuackContext preferred = lastUsed.get();
+        if (preferred != null && idle.remove(preferred))
+          return preferred;
+        QuackContext quack = idle.poll();
+        if (quack != null) {
+          lastUsed.set(quack);
+          return quack;
+        }
+        if (created < maxSize) {
+          created++;
+          break;
+        }
+        wait();
+      }
+    }
+
+    // contexts are created outside the lock, so other threads can keep checking out.
+    QuackContext quack = createNewOrUncount();
+    lastUsed.set(quack);
+    return quack;
+  }
+
+  /**
+   * Give a context back to the pool. Contexts released after the pool is closed are closed.
+   */
+  public synchronized void release(QuackContext quack) {
+    if (closed) {
+      quack.close();
+      created--;
+      return;
+    }
+    idle.push(quack);
+    notify();
+  }
+
+  /**
+   * Close all idle contexts, and any that are checked out once they are released.
+   */
+  @Override
+  public synchronized void close() {
+    if (closed)
+      return;
+    closed = true;
+    for (QuackContext quack: idle) {
+      quack.close();
+    }
+    created -= idle.size();
+    idle.clear();
+    notifyAll();
+  }
+}
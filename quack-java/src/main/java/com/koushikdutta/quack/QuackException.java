@@ -16,12 +16,15 @@
 package com.koushikdutta.quack;
 
 
+import java.io.ObjectStreamException;
+import java.io.PrintStream;
+import java.io.PrintWriter;
 import java.util.ArrayList;
 import java.util.List;
 import java.util.regex.Matcher;
 import java.util.regex.Pattern;
 
-public final class QuackException extends RuntimeException {
+public class QuackException extends RuntimeException {
   /**
    *
    */
@@ -36,9 +39,91 @@ public final class QuackException extends RuntimeException {
   /** Java StackTraceElements require a class name.  We don't have one in JS, so use this. */
   private final static String STACK_TRACE_CLASS_NAME = "JavaScript";
 
+  /**
+   * The JavaScript stack, parsed and spliced into the stack trace only once the trace is read,
+   * so exceptions that are caught and handled never pay for it. Wrapping the exception in
+   * another, through the Throwable(Throwable) constructors, or serializing it, reads it too.
+   * A wrapper built with Throwable(String, Throwable) or initCause before the trace is read
+   * prints it without the JavaScript frames.
+   */
+  private transient String jsStack;
+
   public QuackException(String detailMessage) {
     super(getErrorMessage(detailMessage));
-    addJSStack(this, detailMessage);
+    if (detailMessage.indexOf('\n') >= 0)
+      jsStack = detailMessage;
+  }
+
+  @Override
+  public StackTraceElement[] getStackTrace() {
+    spliceJSStack();
+    return super.getStackTrace();
+  }
+
+  @Override
+  public void printStackTrace(PrintStream s) {
+    spliceJSStack();
+    super.printStackTrace(s);
+  }
+
+  @Override
+  public void printStackTrace(PrintWriter s) {
+    spliceJSStack();
+    super.printStackTrace(s);
+  }
+
+  // Throwable(Throwable) reads this, and the wrapper prints this exception as a cause from its
+  // own copy of the trace, past the overrides above.
+  @Override
+  public String toString() {
+    spliceJSStack();
+    return super.toString();
+  }
+
+  // jsStack is transient, so the serialized exception carries the spliced trace instead.
+  protected Object writeReplace() throws ObjectStreamException {
+    spliceJSStack();
+    return this;
+  }
+
+  /**
+   * Splices the JavaScript stack into the trace of a QuackException now, before it is handed to
+   * code that may only read it as the cause of another exception.
+   */
+  static <T extends Throwable> T withJSStack(T throwable) {
+    if (throwable instanceof QuackException)
+      ((QuackException)throwable).spliceJSStack();
+    return throwable;
+  }
+
+  private synchronized void spliceJSStack() {
+    if (jsStack == null)
+      return;
+    String[] lines = jsStack.split("\n", -1);
+    jsStack = null;
+
+    // Splice the JavaScript stack in right above the native call that threw, the first frame
+    // past the exception constructors.
+    StackTraceElement[] trace = super.getStackTrace();
+    int splice = 0;
+    while (splice < trace.length && "<init>".equals(trace[splice].getMethodName()))
+      splice++;
+
+    List<StackTraceElement> elements = new ArrayList<>();
+    for (int i = 0; i < splice; i++) {
+      elements.add(trace[i]);
+    }
+    for (int i = 1; i < lines.length; ++i) {
+      StackTraceElement jsElement = toStackTraceElement(lines[i]);
+      if (jsElement == null) {
+        continue;
+      }
+      elements.add(jsElement);
+    }
+    for (int i = splice; i < trace.length; i++) {
+      elements.add(trace[i]);
+    }
+    setStackTrace(elements.toArray(new StackTraceElement[elements.size()]));
   }
 
   /**
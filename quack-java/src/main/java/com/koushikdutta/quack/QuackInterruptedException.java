@@ -0,0 +1,13 @@
+package com.koushikdutta.quack;
+
+/**
+ * Thrown when a script is aborted because it ran past the execution timeout of its
+ * {@link QuackContext}, or because {@link QuackContext#interrupt()} was called.
+ */
+public class QuackInterruptedException extends QuackException {
+  private static final long serialVersionUID = 4961082548417163801L;
+
+  public QuackInterruptedException(String detailMessage) {
+    super(detailMessage);
+  }
+}
@@ -1,8 +1,35 @@
 package com.koushikdutta.quack;
 
+import java.nio.ByteBuffer;
+
 public final class QuackJsonObject {
     final public String json;
+    // UTF-8 JSON between position and limit of a direct buffer, instead of json.
+    final ByteBuffer utf8;
+    final int position;
+    final int limit;
+
     public QuackJsonObject(String json) {
         this.json = json;
+        this.utf8 = null;
+        this.position = 0;
+        this.limit = 0;
+    }
+
+    /**
+     * JSON parsed straight from the UTF-8 bytes between the position and limit of a direct
+     * buffer, without decoding it into a Java String first. The bytes are read when this is
+     * passed to JavaScript, so they must not change until then.
+     *
+     * QuickJS needs the JSON to be zero terminated. If the byte at the limit is within the
+     * buffer's capacity and zero, the JSON is parsed in place, otherwise it is copied.
+     */
+    public QuackJsonObject(ByteBuffer utf8) {
+        if (!utf8.isDirect())
+            throw new IllegalArgumentException("QuackJsonObject requires a direct ByteBuffer");
+        this.json = null;
+        this.utf8 = utf8;
+        this.position = utf8.position();
+        this.limit = utf8.limit();
     }
 }
@@ -0,0 +1,93 @@
+package com.koushikdutta.quack;
+
+/**
+ * A sample of the memory use of a {@link QuackContext}, from {@link QuackContext#getMemoryStats}.
+ *
+ * Counts and sizes the engine does not report, and the heap breakdown when the sample was
+ * not detailed, are -1. Duktape never reports the heap breakdown.
+ */
+public final class QuackMemoryStats {
+  // indices of the native stats array, must match MemoryStats.h.
+  static final int HEAP_SIZE = 0;
+  static final int HEAP_HIGH_WATER_MARK = 1;
+  static final int HEAP_LIMIT = 2;
+  static final int ALLOCATION_COUNT = 3;
+  static final int GC_COUNT = 4;
+  static final int GC_PAUSE_NANOS = 5;
+  static final int MAX_GC_PAUSE_NANOS = 6;
+  static final int JAVASCRIPT_OBJECT_COUNT = 7;
+  static final int JAVA_OBJECT_REFERENCE_COUNT = 8;
+  static final int BUFFER_REFERENCE_COUNT = 9;
+  static final int OBJECT_COUNT = 10;
+  static final int OBJECT_SIZE = 11;
+  static final int STRING_COUNT = 12;
+  static final int STRING_SIZE = 13;
+  static final int ATOM_COUNT = 14;
+  static final int ATOM_SIZE = 15;
+  static final int SHAPE_COUNT = 16;
+  static final int SHAPE_SIZE = 17;
+  static final int FUNCTION_COUNT = 18;
+  static final int FUNCTION_BYTECODE_SIZE = 19;
+  static final int COUNT = 20;
+
+  /** Bytes currently allocated by the engine. */
+  public final long heapSize;
+  /** The most bytes allocated, see {@link QuackContext#getHeapHighWaterMark()}. */
+  public final long heapHighWaterMark;
+  /** The heap limit, or 0 for none. */
+  public final long heapLimit;
+  /** Blocks currently allocated by the engine. */
+  public final long allocationCount;
+
+  /**
+   * Collections run by the context, from {@link QuackContext#gc()} and the GC policy, and
+   * their total and longest pause. Collections the engine starts on its own are not counted.
+   */
+  public final long gcCount;
+  public final long gcPauseNanos;
+  public final long maxGcPauseNanos;
+
+  /** JavaScript objects kept alive by JavaScriptObjects in Java. */
+  public final long javaScriptObjectCount;
+  /** Java objects referenced by JavaScript, as JNI global refs released by finalizers. */
+  public final long javaObjectReferenceCount;
+  /** Direct ByteBuffers shared with JavaScript through zero copy buffers. */
+  public final long bufferReferenceCount;
+  /** JavaScript buffers shared with Java ByteBuffers through zero copy buffers. */
+  public final long pinnedBufferCount;
+
+  public final long objectCount;
+  public final long objectSize;
+  public final long stringCount;
+  public final long stringSize;
+  public final long atomCount;
+  public final long atomSize;
+  public final long shapeCount;
+  public final long shapeSize;
+  public final long functionCount;
+  public final long functionBytecodeSize;
+
+  QuackMemoryStats(long[] stats, long pinnedBufferCount) {
+    heapSize = stats[HEAP_SIZE];
+    heapHighWaterMark = stats[HEAP_HIGH_WATER_MARK];
+    heapLimit = stats[HEAP_LIMIT];
+    allocationCount = stats[ALLOCATION_COUNT];
+    gcCount = stats[GC_COUNT];
+    gcPauseNanos = stats[GC_PAUSE_NANOS];
+    maxGcPauseNanos = stats[MAX_GC_PAUSE_NANOS];
+    javaScriptObjectCount = stats[JAVASCRIPT_OBJECT_COUNT];
+    javaObjectReferenceCount = stats[JAVA_OBJECT_REFERENCE_COUNT];
+    bufferReferenceCount = stats[BUFFER_REFERENCE_COUNT];
+    this.pinnedBufferCount = pinnedBufferCount;
+    objectCount = stats[OBJECT_COUNT];
+    objectSize = stats[OBJECT_SIZE];
+    stringCount = stats[STRING_COUNT];
+    stringSize = stats[STRING_SIZE];
+    atomCount = stats[ATOM_COUNT];
+    atomSize = stats[ATOM_SIZE];
+    shapeCount = stats[SHAPE_COUNT];
+    shapeSize = stats[SHAPE_SIZE];
+    functionCount = stats[FUNCTION_COUNT];
+    functionBytecodeSize = stats[FUNCTION_BYTECODE_SIZE];
+  }
+}
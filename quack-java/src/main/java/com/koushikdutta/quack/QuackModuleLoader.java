@@ -0,0 +1,25 @@
+package com.koushikdutta.quack;
+
+/**
+ * Resolves and loads the modules of a {@link QuackContext}, see
+ * {@link QuackContext#setModuleLoader(QuackModuleLoader, QuackBytecodeCache)}.
+ */
+public interface QuackModuleLoader {
+  /**
+   * Resolve a module specifier to the id of the module, which it is loaded and cached by.
+   *
+   * @param referrer the id of the requiring or importing module. For the global require, it is
+   *                 the empty string, and for an import() in a script, the file name of the script.
+   * @param specifier the module specifier, as required or imported.
+   * @return the module id, or null if there is no such module.
+   */
+  String resolve(String referrer, String specifier);
+
+  /**
+   * Load the source of a module, the first time it is required or imported.
+   *
+   * @param id the module id, as resolved.
+   * @return the source, or null if there is no such module.
+   */
+  String load(String id);
+}
@@ -0,0 +1,114 @@
+package com.koushikdutta.quack;
+
+import java.lang.reflect.InvocationTargetException;
+import java.lang.reflect.Method;
+import java.lang.reflect.Modifier;
+import java.util.ArrayList;
+
+/**
+ * A Java method bound to a target, callable as a JavaScript function.
+ *
+ * When every parameter and the return type are int, double, boolean or String, the runtime
+ * calls the method through JNI with unboxed arguments, skipping the Object[] of arguments
+ * and reflection. Calls whose JavaScript arguments do not already match the parameter types,
+ * and methods with other types, go through {@link #callMethod} instead.
+ *
+ * Whether the method is called directly is decided when this is created, so coercions for
+ * these types must be registered beforehand.
+ */
+@SuppressWarnings({"unchecked", "rawtypes"})
+public final class QuackNativeMethod implements QuackMethodObject {
+    private final QuackContext quackContext;
+    final Object target;
+    final Method method;
+    // JNI descriptor of the method if the runtime may call it directly, otherwise null.
+    final String signature;
+
+    public QuackNativeMethod(QuackContext quackContext, Object target, Method method) {
+        this.quackContext = quackContext;
+        this.target = target;
+        this.method = method;
+        this.signature = getSignature(quackContext, target, method);
+    }
+
+    private static String getSignatureType(QuackContext quackContext, Class type) {
+        if (type == void.class)
+            return "V";
+
+        String signatureType;
+        Class boxedType;
+        if (type == int.class) {
+            signatureType = "I";
+            boxedType = Integer.class;
+        }
+        else if (type == double.class) {
+            signatureType = "D";
+            boxedType = Double.class;
+        }
+        else if (type == boolean.class) {
+            signatureType = "Z";
+            boxedType = Boolean.class;
+        }
+        else if (type == String.class) {
+            signatureType = "Ljava/lang/String;";
+            boxedType = String.class;
+        }
+        else {
+            return null;
+        }
+
+        if (!quackContext.isUncoercedType(type, boxedType))
+            return null;
+        return signatureType;
+    }
+
+    private static String getSignature(QuackContext quackContext, Object target, Method method) {
+        if (target == null || Modifier.isStatic(method.getModifiers()))
+            return null;
+        if (quackContext.JavaScriptToJavaMethodCoercions.containsKey(QuackContext.getInterfaceMethod(method)))
+            return null;
+
+        StringBuilder signature = new StringBuilder("(");
+        for (Class parameterType: method.getParameterTypes()) {
+            String type = getSignatureType(quackContext, parameterType);
+            if (type == null || "V".equals(type))
+                return null;
+            signature.append(type);
+        }
+        signature.append(')');
+        String returnType = getSignatureType(quackContext, method.getReturnType());
+        if (returnType == null)
+            return null;
+        signature.append(returnType);
+        return signature.toString();
+    }
+
+    @Override
+    public Object callMethod(Object thiz, Object... args) {
+        Method interfaceMethod = QuackContext.getInterfaceMethod(method);
+        QuackMethodCoercion methodCoercion = quackContext.JavaScriptToJavaMethodCoercions.get(interfaceMethod);
+
+        try {
+            if (methodCoercion != null)
+                return methodCoercion.invoke(interfaceMethod, target, args);
+
+            Class[] parameterTypes = method.getParameterTypes();
+            ArrayList<Object> coerced = new ArrayList<>();
+            for (int i = 0; i < parameterTypes.length; i++) {
+                if (i < args.length)
+                    coerced.add(quackContext.coerceJavaScriptToJava(parameterTypes[i], args[i]));
+                else
+                    coerced.add(null);
+            }
+            return quackContext.coerceJavaToJavaScript(method.invoke(target, coerced.toArray()));
+        }
+        catch (IllegalAccessException e) {
+            throw new IllegalArgumentException(method.toString(), e);
+        }
+        catch (InvocationTargetException e) {
+            if (e.getTargetException() instanceof RuntimeException)
+                throw (RuntimeException)e.getTargetException();
+            throw new IllegalArgumentException(method.toString(), e);
+        }
+    }
+}
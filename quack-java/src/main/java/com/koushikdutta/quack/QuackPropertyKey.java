@@ -0,0 +1,29 @@
+package com.koushikdutta.quack;
+
+/**
+ * A property name interned into a specific QuackContext with
+ * {@link QuackContext#internKey(String)}. Property access through a key skips converting
+ * and interning the name on every access.
+ */
+public final class QuackPropertyKey {
+    final QuackContext quackContext;
+    final long handle;
+    public final String name;
+
+    QuackPropertyKey(QuackContext quackContext, long handle, String name) {
+        this.quackContext = quackContext;
+        this.handle = handle;
+        this.name = name;
+    }
+
+    @Override
+    public String toString() {
+        return name;
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        super.finalize();
+        quackContext.releaseKey(handle);
+    }
+}
@@ -3,16 +3,30 @@ package com.koushikdutta.quack;
 import org.junit.Assert;
 import org.junit.Test;
 
+import java.io.ByteArrayInputStream;
+import java.io.ByteArrayOutputStream;
 import java.io.File;
 import java.io.IOException;
+import java.io.ObjectInputStream;
+import java.io.ObjectOutputStream;
 import java.io.PrintStream;
+import java.io.PrintWriter;
+import java.io.StringWriter;
+import java.lang.reflect.Method;
 import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
 import java.util.Arrays;
+import java.util.HashMap;
 import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
 import java.util.regex.Pattern;
 
 import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertFalse;
 import static org.junit.Assert.assertNotNull;
+import static org.junit.Assert.assertSame;
 import static org.junit.Assert.assertTrue;
 
 public class QuackTests {
@@ -39,7 +53,8 @@ public class QuackTests {
     // @Test
     public void testOctane() throws IOException {
         QuackContext quack = QuackContext.create(false);
-        File files[] = new File("/Volumes/Dev/Scrypted/quack.android/tests/src/main/assets/octane").listFiles();
+        // relative to the quack-java project directory, where gradle runs the tests.
+        File files[] = new File("src/test/assets/octane").listFiles();
         Arrays.sort(files, (a, b) -> {
             return a.getAbsolutePath().compareTo(b.getAbsolutePath());            
         });
@@ -47,7 +62,7 @@ public class QuackTests {
             String script = StreamUtility.readFile(file);
             quack.evaluate(script, file.getAbsolutePath());
         }
-        String script = StreamUtility.readFile("/Volumes/Dev/Scrypted/quack.android/tests/src/main/assets/octane.js");
+        String script = StreamUtility.readFile("src/test/assets/octane.js");
         quack.evaluate(script);
         String ret = quack.evaluateForJavaScriptObject("getResults").call().toString();
         System.out.println(ret);
@@ -768,4 +783,992 @@ public class QuackTests {
         QuackContext quack = QuackContext.create(useQuickJS);
         quack.putJavaToJavaScriptCoercion(Foo.class, (clazz, o) -> "hello world");
     }
+
+    @Test
+    public void testBytecodeCache() throws IOException {
+        File directory = File.createTempFile("quack", "bytecode");
+        directory.delete();
+        QuackBytecodeCache cache = new QuackBytecodeCache(directory);
+        String script = "var cached = 21; cached * 2;";
+
+        QuackContext quack = QuackContext.create(useQuickJS);
+        assertEquals(42, ((Number)cache.evaluate(quack, script, "cached.js")).intValue());
+        quack.close();
+        assertEquals(1, directory.listFiles().length);
+
+        // the second context loads the stored bytecode.
+        quack = QuackContext.create(useQuickJS);
+        assertEquals(42, ((Number)cache.evaluate(quack, script, "cached.js")).intValue());
+        assertEquals(21, ((Number)quack.evaluate("cached")).intValue());
+        quack.close();
+
+        cache.clear();
+        directory.delete();
+    }
+
+    @Test
+    public void testDuktapeSlabAllocator() {
+        QuackContext quack = QuackContext.create(false, QuackContext.DUKTAPE_ALLOCATOR_SLAB);
+        long before = quack.getHeapSize();
+        assertEquals(100000, ((Number)quack.evaluate("var o = []; for (var i = 0; i < 100000; i++) { o.push({ i: i }); } o.length;")).intValue());
+        assertTrue(quack.getHeapSize() > before);
+        quack.evaluate("o = null;");
+        quack.close();
+    }
+
+    @Test
+    public void testGCPolicy() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.setGCPolicy(QuackContext.GC_NEVER, 0);
+        JavaScriptObject func = quack.compileFunction("function(i) { var a = {}; var b = { a: a }; a.b = b; return i; }", "?");
+        for (int i = 0; i < 1000; i++) {
+            assertEquals(i, ((Number)func.call(i)).intValue());
+        }
+        long grown = quack.getHeapSize();
+        quack.gc();
+        assertTrue(quack.getHeapSize() <= grown);
+
+        quack.setGCPolicy(QuackContext.GC_EVERY_N_CALLS, 100);
+        quack.setGCPolicy(QuackContext.GC_HEAP_GROWTH, 1024 * 1024);
+        for (int i = 0; i < 1000; i++) {
+            assertEquals(i, ((Number)func.call(i)).intValue());
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testZeroCopyBuffers() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.setZeroCopyBuffers(true);
+
+        // JavaScript writes into the Java buffer directly.
+        ByteBuffer in = ByteBuffer.allocateDirect(10);
+        quack.compileFunction("function(buf) { for (var i = 0; i < buf.length; i++) buf[i] = i; }", "?").call(in);
+        for (int i = 0; i < 10; i++) {
+            assertEquals(i, in.get(i));
+        }
+
+        // Java writes into the JavaScript buffer directly.
+        JavaScriptObject holder = quack.evaluateForJavaScriptObject("var holder = { buf: new Uint8Array(10) }; holder;");
+        ByteBuffer out = (ByteBuffer)quack.coerceJavaScriptToJava(ByteBuffer.class, holder.get("buf"));
+        out.put(3, (byte)42);
+        assertEquals(42, ((Number)quack.evaluate("holder.buf[3]")).intValue());
+
+        quack.close();
+    }
+
+    @Test
+    public void testCallBatch() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        JavaScriptObject func = quack.compileFunction("function(a, b) { if (a < 0) throw new Error('negative'); return a + b; }", "?");
+        Object[] results = func.callBatch(new Object[] { 1, 2 }, new Object[] { -1, 0 }, new Object[] { 3, 4 });
+        assertEquals(3, results.length);
+        assertEquals(3, ((Number)results[0]).intValue());
+        assertTrue(results[1] instanceof QuackException);
+        assertTrue(((QuackException)results[1]).getMessage().contains("negative"));
+        assertEquals(7, ((Number)results[2]).intValue());
+        quack.close();
+    }
+
+    @Test
+    public void testPropertyKey() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        QuackPropertyKey render = quack.internKey("render");
+        QuackPropertyKey count = quack.internKey("count");
+        JavaScriptObject obj = quack.evaluateForJavaScriptObject("var obj = { count: 0, render: function(n) { return this.count += n; } }; obj;");
+        for (int i = 1; i <= 10; i++) {
+            assertEquals(i, ((Number)obj.callProperty(render, 1)).intValue());
+        }
+        assertEquals(10, ((Number)obj.get(count)).intValue());
+        assertTrue(obj.set(count, 42));
+        assertEquals(42, ((Number)obj.get("count")).intValue());
+        quack.close();
+    }
+
+    @Test
+    public void testNonBmpStrings() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        String emoji = "caf\u00e9 \ud83d\ude00";
+        quack.setGlobalProperty("emoji", emoji);
+        assertEquals(emoji, quack.evaluate("emoji"));
+        assertEquals(emoji.length(), ((Number)quack.evaluate("emoji.length")).intValue());
+        assertEquals(0x1F600, ((Number)quack.evaluate("emoji.codePointAt(5)")).intValue());
+        assertEquals(emoji, quack.evaluate("'" + emoji + "'"));
+
+        JavaScriptObject obj = quack.evaluateForJavaScriptObject("var o = {}; o['" + emoji + "'] = 1; o;");
+        assertEquals(1, ((Number)obj.get(emoji)).intValue());
+        try {
+            quack.evaluate("throw new Error(emoji)");
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+            assertTrue(e.getMessage().contains(emoji));
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testJavaScriptObjectHandles() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        JavaScriptObject kept = quack.evaluateForJavaScriptObject("({ value: -1 })");
+        for (int round = 0; round < 3; round++) {
+            ArrayList<JavaScriptObject> objects = new ArrayList<>();
+            for (int i = 0; i < 1000; i++) {
+                objects.add(quack.evaluateForJavaScriptObject("({ value: " + i + " })"));
+            }
+            for (int i = 0; i < objects.size(); i++) {
+                assertEquals(i, ((Number)objects.get(i).get("value")).intValue());
+            }
+            objects = null;
+            System.gc();
+            System.runFinalization();
+            // released handles are reused by the next round, after which the kept object must be intact.
+            quack.evaluate("0");
+        }
+        assertEquals(-1, ((Number)kept.get("value")).intValue());
+        quack.close();
+    }
+
+    @Test
+    public void testContextPool() throws Exception {
+        QuackContextPool pool = new QuackContextPool(useQuickJS, 2,
+            "var counter = 0; function next() { return prefix + (++counter); }", "bundle.js",
+            quack -> quack.setGlobalProperty("prefix", "n"));
+
+        QuackContext first = pool.acquire();
+        assertEquals("n1", first.evaluate("next()"));
+        pool.release(first);
+
+        // the same thread gets its last context back.
+        QuackContext again = pool.acquire();
+        assertTrue(first == again);
+        assertEquals("n2", again.evaluate("next()"));
+
+        // a second context is created from the same snapshot.
+        QuackContext second = pool.acquire();
+        assertTrue(first != second);
+        assertEquals("n1", second.evaluate("next()"));
+
+        pool.release(again);
+        pool.release(second);
+        pool.close();
+    }
+
+    public static class FieldObject {
+        public int count;
+        public double ratio;
+        public boolean enabled;
+        public String name;
+        public final int id = 7;
+    }
+
+    @Test
+    public void testJavaFieldAccess() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        FieldObject o = new FieldObject();
+        quack.setGlobalProperty("o", o);
+        quack.evaluate("for (var i = 0; i < 100; i++) { o.count = o.count + 1; o.ratio = o.ratio + 0.5; o.enabled = !o.enabled; o.name = 'n' + i; }");
+        assertEquals(100, o.count);
+        assertEquals(50.0, o.ratio, 0);
+        assertEquals(false, o.enabled);
+        assertEquals("n99", o.name);
+        assertEquals("n99:100:7", quack.evaluate("o.name + ':' + o.count + ':' + o.id"));
+
+        quack.evaluate("o.ratio = 2; o.count = 3.7; o.name = null;");
+        assertEquals(2.0, o.ratio, 0);
+        assertEquals(3, o.count);
+        assertEquals(null, o.name);
+        assertEquals(null, quack.evaluate("o.name"));
+
+        // final fields take the regular path, where Field.set refuses the write.
+        try {
+            quack.evaluate("o.id = 5");
+            Assert.fail("failure expected");
+        }
+        catch (Exception e) {
+        }
+        assertEquals(7, ((Number)quack.evaluate("o.id")).intValue());
+
+        // coercions registered later apply to cached fields too.
+        o.name = "plain";
+        quack.putJavaToJavaScriptCoercion(String.class, (clazz, value) -> "coerced");
+        assertEquals("coerced", quack.evaluate("o.name"));
+        quack.close();
+    }
+
+    public static class NativeMethods {
+        public int calls;
+        public int add(int a, int b) {
+            calls++;
+            return a + b;
+        }
+        public String greet(String name, boolean loud) {
+            String greeting = "hello " + name;
+            return loud ? greeting.toUpperCase() : greeting;
+        }
+        public double half(double value) {
+            return value / 2;
+        }
+        public void fail(String message) {
+            throw new IllegalStateException(message);
+        }
+    }
+
+    @Test
+    public void testNativeMethod() throws Exception {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        NativeMethods methods = new NativeMethods();
+        quack.setGlobalProperty("add", new QuackNativeMethod(quack, methods, NativeMethods.class.getMethod("add", int.class, int.class)));
+        quack.setGlobalProperty("greet", new QuackNativeMethod(quack, methods, NativeMethods.class.getMethod("greet", String.class, boolean.class)));
+        quack.setGlobalProperty("half", new QuackNativeMethod(quack, methods, NativeMethods.class.getMethod("half", double.class)));
+        quack.setGlobalProperty("fail", new QuackNativeMethod(quack, methods, NativeMethods.class.getMethod("fail", String.class)));
+
+        assertEquals(4950, ((Number)quack.evaluate("var s = 0; for (var i = 0; i < 100; i++) s = add(s, i); s")).intValue());
+        assertEquals(100, methods.calls);
+        assertEquals("HELLO QUACK", quack.evaluate("greet('quack', true)"));
+        assertEquals("hello null", quack.evaluate("greet(null, false)"));
+        assertEquals(1.25, ((Number)quack.evaluate("half(2.5)")).doubleValue(), 0);
+        assertEquals(2, ((Number)quack.evaluate("half(4)")).intValue());
+
+        // arguments of other types are coerced through the regular path.
+        assertEquals(3, ((Number)quack.evaluate("add('1', 2)")).intValue());
+
+        try {
+            quack.evaluate("fail('quack.')");
+            Assert.fail("failure expected");
+        }
+        catch (Exception e) {
+            assertTrue(e.getMessage().contains("quack."));
+        }
+        quack.close();
+    }
+
+    interface IntAdder {
+        int add(int a, int b);
+    }
+
+    interface AdderCaller {
+        Object call(IntAdder adder);
+    }
+
+    @Test
+    public void testNativeMethodCoercedLater() throws Exception {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        Method add = IntAdder.class.getMethod("add", int.class, int.class);
+        IntAdder adder = (a, b) -> a + b;
+        AdderCaller caller = ((JavaScriptObject)quack.evaluate("({ call: function(adder) { return adder(1, 2); } })")).proxyInterface(AdderCaller.class);
+        assertEquals(3, ((Number)caller.call(adder)).intValue());
+
+        // registered after the method was called directly.
+        quack.putJavaScriptToJavaMethodCoercion(add, (method, target, args) -> 10 * ((IntAdder)target).add(((Number)args[0]).intValue(), ((Number)args[1]).intValue()));
+        assertEquals(30, ((Number)caller.call(adder)).intValue());
+
+        // a method without a target is never called directly.
+        quack.setGlobalProperty("add", new QuackNativeMethod(quack, null, add));
+        try {
+            quack.evaluate("add(1, 2)");
+            Assert.fail("failure expected");
+        }
+        catch (Exception e) {
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testJsonBuffers() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        String emoji = "\uD83D\uDE00";
+        byte[] bytes = ("{\"name\":\"quack " + emoji + "\",\"values\":[1,2,3]}").getBytes(StandardCharsets.UTF_8);
+
+        // zero terminated, and not zero terminated.
+        for (int extra = 0; extra < 2; extra++) {
+            ByteBuffer input = ByteBuffer.allocateDirect(bytes.length + extra);
+            input.put(bytes);
+            input.flip();
+            JavaScriptObject parsed = (JavaScriptObject)quack.compileFunction("function(o) { return o; }", "?").call(new QuackJsonObject(input));
+            assertEquals("quack " + emoji, parsed.get("name"));
+            assertEquals(3, ((Number)((JavaScriptObject)parsed.get("values")).get(2)).intValue());
+
+            // fits in the provided buffer.
+            ByteBuffer output = ByteBuffer.allocateDirect(1024);
+            ByteBuffer json = parsed.stringify(output);
+            assertEquals(bytes.length, json.remaining());
+            byte[] written = new byte[json.remaining()];
+            json.get(written);
+            assertEquals(new String(bytes, StandardCharsets.UTF_8), new String(written, StandardCharsets.UTF_8));
+            assertEquals(0, output.position());
+
+            // grows past a small buffer.
+            json = parsed.stringify(ByteBuffer.allocateDirect(4));
+            assertEquals(bytes.length, json.remaining());
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testDuktapeJsonBufferSurrogates() {
+        QuackContext quack = QuackContext.create(false);
+        byte[] bytes = "{\"emoji\":\"\uD83D\uDE00\"}".getBytes(StandardCharsets.UTF_8);
+        ByteBuffer input = ByteBuffer.allocateDirect(bytes.length);
+        input.put(bytes);
+        input.flip();
+
+        // a surrogate pair, as when the same JSON is parsed from a String.
+        JavaScriptObject isPair = quack.compileFunction("function(o) { return o.emoji.length === 2 && o.emoji.charCodeAt(0) === 0xd83d; }", "?");
+        assertEquals(true, isPair.call(new QuackJsonObject(input)));
+        assertEquals(true, isPair.call(new QuackJsonObject("{\"emoji\":\"\uD83D\uDE00\"}")));
+        quack.close();
+    }
+
+    @Test
+    public void testExecutionBudget() throws Exception {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.setExecutionTimeout(100);
+        try {
+            // catching the error does not keep the script running.
+            quack.evaluate("while (true) { try { while (true); } catch (e) {} }");
+            Assert.fail("failure expected");
+        }
+        catch (QuackInterruptedException e) {
+        }
+
+        // the next call starts a new budget.
+        JavaScriptObject spin = quack.compileFunction("function(n) { var i = 0; while (i < n) i++; return i; }", "?");
+        assertEquals(1000, ((Number)spin.call(1000)).intValue());
+        try {
+            spin.call(Double.POSITIVE_INFINITY);
+            Assert.fail("failure expected");
+        }
+        catch (QuackInterruptedException e) {
+        }
+
+        quack.setExecutionTimeout(0);
+        Thread interrupter = new Thread(() -> {
+            try {
+                Thread.sleep(100);
+            }
+            catch (InterruptedException e) {
+            }
+            quack.interrupt();
+        });
+        interrupter.start();
+        try {
+            quack.evaluate("while (true);");
+            Assert.fail("failure expected");
+        }
+        catch (QuackInterruptedException e) {
+        }
+        interrupter.join();
+
+        // errors that are not from the budget are unaffected.
+        assertEquals(3, ((Number)quack.evaluate("1 + 2")).intValue());
+        try {
+            quack.evaluate("throw new Error('quack.')");
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+            assertTrue(!(e instanceof QuackInterruptedException));
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testHeapLimit() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.evaluate("var held = [];");
+        long baseline = quack.getHeapHighWaterMark();
+        assertTrue(baseline > 0);
+
+        quack.setHeapLimit(quack.getHeapSize() + 4 * 1024 * 1024);
+        String grow = "for (var i = 0; i < 100000; i++) held.push(new Array(1000).join('x') + i);";
+        try {
+            quack.evaluate(grow);
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+        }
+        assertTrue(quack.getHeapHighWaterMark() > baseline);
+
+        // scripts can catch the failure, and the context remains usable.
+        quack.evaluate("held = [];");
+        quack.gc();
+        assertEquals("caught", quack.evaluate("try { " + grow + " } catch (e) { held = []; 'caught' }"));
+        assertEquals(3, ((Number)quack.evaluate("1 + 2")).intValue());
+
+        quack.setHeapLimit(0);
+        quack.resetHeapHighWaterMark();
+        assertTrue(quack.getHeapHighWaterMark() > 0);
+        quack.close();
+    }
+
+    @Test
+    public void testMemoryStats() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.setGlobalProperty("held", new Object());
+        JavaScriptObject array = quack.evaluateForJavaScriptObject("var strings = []; for (var i = 0; i < 1000; i++) strings.push('s' + i); strings");
+
+        QuackMemoryStats stats = quack.getMemoryStats(false);
+        assertTrue(stats.heapSize > 0);
+        assertTrue(stats.heapHighWaterMark >= stats.heapSize);
+        assertTrue(stats.allocationCount > 0);
+        assertEquals(0, stats.heapLimit);
+        assertTrue(stats.javaScriptObjectCount >= 1);
+        assertTrue(stats.javaObjectReferenceCount >= 1);
+        // not walked.
+        assertEquals(-1, stats.objectCount);
+
+        long gcCount = stats.gcCount;
+        quack.gc();
+        stats = quack.getMemoryStats();
+        assertEquals(gcCount + 1, stats.gcCount);
+        assertTrue(stats.gcPauseNanos >= stats.maxGcPauseNanos);
+        if (useQuickJS) {
+            assertTrue(stats.objectCount > 0);
+            assertTrue(stats.stringCount >= 1000);
+            assertTrue(stats.functionBytecodeSize > 0);
+        }
+        else {
+            assertEquals(-1, stats.objectCount);
+        }
+        assertNotNull(array);
+        quack.close();
+    }
+
+    @Test
+    public void testProfiler() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.evaluate("function hot(n) { var t = 0; for (var i = 0; i < n; i++) t += Math.sqrt(i); return t; }\n" +
+                "function outer(ms) { var start = Date.now(); while (Date.now() - start < ms) hot(10000); }", "profiled.js");
+
+        quack.startProfiling(1000);
+        quack.evaluate("outer(200)");
+        String collapsed = quack.stopProfiling();
+
+        assertTrue(collapsed.contains("hot (profiled.js)"));
+        assertTrue(collapsed.contains("outer (profiled.js);"));
+        for (String line: collapsed.split("\n")) {
+            assertTrue(line, line.matches(".+ \\d+"));
+        }
+        // stopped, and the samples were handed off.
+        quack.evaluate("outer(50)");
+        assertEquals("", quack.stopProfiling());
+        quack.close();
+    }
+
+    @Test
+    public void testProfilerInDuktapeThread() {
+        QuackContext quack = QuackContext.create(false);
+        quack.evaluate("function hot(n) { var t = 0; for (var i = 0; i < n; i++) t += Math.sqrt(i); return t; }\n" +
+                "function resumed(ms) { var start = Date.now(); while (Date.now() - start < ms) hot(10000); }", "profiled.js");
+
+        quack.startProfiling(1000);
+        quack.evaluate("Duktape.Thread.resume(new Duktape.Thread(resumed), 200)");
+        String collapsed = quack.stopProfiling();
+
+        // samples are of the coroutine's callstack, not the resuming one.
+        assertTrue(collapsed.contains("resumed (profiled.js);hot (profiled.js)"));
+        for (String line: collapsed.split("\n")) {
+            assertTrue(line, line.matches(".+ \\d+"));
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testCallAsync() throws Exception {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        // thenables settle the future on either engine.
+        JavaScriptObject thenable = quack.compileFunction("function(v) { return { then: function(resolve) { resolve(v * 2); } }; }", "?");
+        assertEquals(42, ((Number)thenable.callAsync(21).get()).intValue());
+        JavaScriptObject plain = quack.compileFunction("function(v) { return v; }", "?");
+        assertEquals("hello", plain.callAsync("hello").get());
+        JavaScriptObject throwing = quack.compileFunction("function() { throw new Error('sync'); }", "?");
+        CompletableFuture<Object> failed = throwing.callAsync();
+        assertTrue(failed.isCompletedExceptionally());
+
+        if (useQuickJS) {
+            ArrayList<Runnable> tasks = new ArrayList<>();
+            quack.setJobExecutor(tasks::add);
+            JavaScriptObject doubler = quack.compileFunction("function(v) { return Promise.resolve(v).then(function(x) { return x * 2; }); }", "?");
+            CompletableFuture<Object> future = doubler.callAsync(21);
+            // nothing runs until the executor does.
+            assertFalse(future.isDone());
+            assertEquals(1, tasks.size());
+            tasks.remove(0).run();
+            assertEquals(42, ((Number)future.get()).intValue());
+            assertTrue(tasks.isEmpty());
+
+            JavaScriptObject rejecting = quack.compileFunction("function() { return Promise.resolve().then(function() { throw new Error('boom'); }); }", "?");
+            future = rejecting.callAsync();
+            tasks.remove(0).run();
+            try {
+                future.get();
+                Assert.fail("failure expected");
+            }
+            catch (ExecutionException e) {
+                assertTrue(e.getCause() instanceof QuackException);
+                assertTrue(e.getCause().getMessage().contains("boom"));
+            }
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testFailedJobKeepsCallResult() {
+        if (!useQuickJS)
+            return;
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.setExecutionTimeout(100);
+        // the job runs out of the budget of the call that queued it.
+        JavaScriptObject returning = quack.compileFunction("function() { Promise.resolve().then(function() { while (true); }); return 7; }", "?");
+        assertEquals(7, ((Number)returning.call()).intValue());
+        try {
+            quack.runJobs();
+            Assert.fail("failure expected");
+        }
+        catch (QuackInterruptedException e) {
+        }
+        quack.runJobs();
+
+        JavaScriptObject throwing = quack.compileFunction("function() { Promise.resolve().then(function() { while (true); }); throw new Error('sync'); }", "?");
+        try {
+            throwing.call();
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+            assertTrue(e.getMessage().contains("sync"));
+            assertEquals(1, e.getSuppressed().length);
+            assertTrue(e.getSuppressed()[0] instanceof QuackInterruptedException);
+        }
+        quack.runJobs();
+        quack.close();
+    }
+
+    @Test
+    public void testFailedScheduledJob() {
+        if (!useQuickJS)
+            return;
+        QuackContext quack = QuackContext.create(useQuickJS);
+        quack.setExecutionTimeout(100);
+        ArrayList<Runnable> tasks = new ArrayList<>();
+        quack.setJobExecutor(tasks::add);
+        JavaScriptObject returning = quack.compileFunction("function() { Promise.resolve().then(function() { while (true); }); return 7; }", "?");
+        assertEquals(7, ((Number)returning.call()).intValue());
+        assertEquals(1, tasks.size());
+        // the job runs out of time, which the executor does not see.
+        tasks.remove(0).run();
+        assertTrue(tasks.isEmpty());
+        try {
+            returning.call();
+            Assert.fail("failure expected");
+        }
+        catch (QuackInterruptedException e) {
+        }
+        // thrown once, the call then runs.
+        assertEquals(7, ((Number)returning.call()).intValue());
+        quack.close();
+    }
+
+    @Test
+    public void testSerialize() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        JavaScriptObject value = quack.evaluateForJavaScriptObject("(function() {\n" +
+                "var shared = { name: 'shared' };\n" +
+                "var v = { n: 1, d: 1.5, s: 'h\\u00e9llo \\ud83d\\ude00', u: undefined, nil: null, t: true,\n" +
+                "  list: [1, 'two', shared], shared: shared, date: new Date(1000),\n" +
+                "  bytes: new Uint8Array([1, 2, 3]), floats: new Float64Array([0.5]), buffer: new ArrayBuffer(4) };\n" +
+                "v.self = v;\n" +
+                "return v;\n" +
+                "})()");
+        byte[] data = quack.serialize(value);
+
+        // either engine reads what the other wrote.
+        for (boolean quickJS: new boolean[] { useQuickJS, !useQuickJS }) {
+            QuackContext other = QuackContext.create(quickJS);
+            other.setGlobalProperty("v", other.deserialize(data));
+            assertEquals(true, other.evaluate("v.n === 1 && v.d === 1.5 && 'u' in v && v.u === undefined && v.nil === null && v.t === true"));
+            assertEquals(true, other.evaluate("v.s === 'h\\u00e9llo \\ud83d\\ude00' && v.s.length === 8"));
+            assertEquals(true, other.evaluate("v.list.length === 3 && v.list[1] === 'two' && v.list[2] === v.shared && v.self === v"));
+            assertEquals(true, other.evaluate("v.date instanceof Date && v.date.getTime() === 1000"));
+            assertEquals(true, other.evaluate("v.bytes instanceof Uint8Array && v.bytes.length === 3 && v.bytes[2] === 3"));
+            assertEquals(true, other.evaluate("v.floats instanceof Float64Array && v.floats[0] === 0.5"));
+            assertEquals(true, other.evaluate("v.buffer instanceof ArrayBuffer && v.buffer.byteLength === 4"));
+
+            try {
+                other.deserialize(new byte[] { 1, 99 });
+                Assert.fail("failure expected");
+            }
+            catch (QuackException e) {
+            }
+            other.close();
+        }
+
+        assertEquals("hello", quack.deserialize(quack.serialize("hello")));
+        try {
+            quack.serialize(quack.evaluate("({ f: function() {} })"));
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+        }
+        try {
+            quack.serialize(new FieldObject());
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+            if (useQuickJS)
+                assertTrue(e.getMessage().contains("Java object"));
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testArrayRange() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        JavaScriptObject list = quack.evaluateForJavaScriptObject("[1, 2.5, '3', -1, 4294967297]");
+        Assert.assertArrayEquals(new int[] { 1, 2, 3, -1, 1 }, list.toIntArray());
+        Assert.assertArrayEquals(new double[] { 1, 2.5, 3, -1, 4294967297.0 }, list.toDoubleArray(), 0);
+
+        // ranges past the end of the array grow it.
+        list.setArrayRange(4, new double[] { 0, 5.5, 6.5 }, 1, 2);
+        assertEquals("1,2.5,3,-1,5.5,6.5", list.callProperty("join"));
+        int[] part = new int[4];
+        list.getArrayRange(2, part, 1, 2);
+        Assert.assertArrayEquals(new int[] { 0, 3, -1, 0 }, part);
+
+        JavaScriptObject ints = quack.newTypedArray(new int[] { 1, 2, 3 });
+        JavaScriptObject sum = quack.compileFunction("function(a) { var s = 0; for (var i = 0; i < a.length; i++) s += a[i]; return a instanceof Int32Array ? s : -1; }", "?");
+        assertEquals(6, ((Number)sum.call(ints)).intValue());
+        ints.setArrayRange(1, new int[] { 20, 30 }, 0, 2);
+        Assert.assertArrayEquals(new int[] { 1, 20, 30 }, ints.toIntArray());
+        // elements of other types are converted.
+        Assert.assertArrayEquals(new double[] { 1, 20, 30 }, ints.toDoubleArray(), 0);
+
+        JavaScriptObject floats = quack.newTypedArray(new float[] { 0.5f, 1.5f });
+        Assert.assertArrayEquals(new float[] { 0.5f, 1.5f }, floats.toFloatArray(), 0);
+
+        try {
+            list.getArrayRange(0, part, 3, 2);
+            Assert.fail("failure expected");
+        }
+        catch (ArrayIndexOutOfBoundsException e) {
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testFinalizationBudget() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        // a budget this small leaves most of each burst queued for later calls.
+        quack.setFinalizationBudget(1);
+        JavaScriptObject kept = quack.evaluateForJavaScriptObject("({ value: -1 })");
+        long baseline = quack.getMemoryStats().javaScriptObjectCount;
+        for (int round = 0; round < 3; round++) {
+            long burst = collectBurst(quack, baseline);
+            quack.evaluate("0");
+            long afterOne = quack.getMemoryStats().javaScriptObjectCount;
+            assertTrue(afterOne < burst);
+            assertTrue(afterOne > baseline);
+
+            // the rest drain over the following calls.
+            for (int i = 0; i < 50; i++) {
+                quack.evaluate("0");
+            }
+            assertEquals(baseline, quack.getMemoryStats().javaScriptObjectCount);
+        }
+
+        // without a budget, one call releases whatever is left queued.
+        long burst = collectBurst(quack, baseline);
+        quack.evaluate("0");
+        assertTrue(quack.getMemoryStats().javaScriptObjectCount < burst);
+        quack.setFinalizationBudget(0);
+        quack.evaluate("0");
+        assertEquals(baseline, quack.getMemoryStats().javaScriptObjectCount);
+        assertEquals(-1, ((Number)kept.get("value")).intValue());
+        quack.close();
+    }
+
+    // creates and drops a burst of JavaScriptObjects, and returns the count with them alive.
+    private static long collectBurst(QuackContext quack, long baseline) {
+        ArrayList<JavaScriptObject> objects = new ArrayList<>();
+        for (int i = 0; i < 5000; i++) {
+            objects.add(quack.evaluateForJavaScriptObject("({ value: " + i + " })"));
+        }
+        long burst = quack.getMemoryStats().javaScriptObjectCount;
+        assertEquals(baseline + 5000, burst);
+        objects = null;
+        System.gc();
+        System.runFinalization();
+        return burst;
+    }
+
+    @Test
+    public void testBackReferences() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        // passing an object to Java leaves it untouched, so even a frozen object keeps its identity.
+        JavaScriptObject frozen = quack.evaluateForJavaScriptObject("var frozen = Object.freeze({ a: 1 }); frozen");
+        assertTrue(frozen == quack.evaluate("frozen"));
+        assertEquals("a", quack.evaluate("Object.getOwnPropertyNames(frozen).join()"));
+
+        JavaScriptObject identity = quack.compileFunction("function(o) { return o; }", "?");
+        JavaScriptObject object = quack.evaluateForJavaScriptObject("({})");
+        for (int i = 0; i < 10; i++) {
+            assertTrue(object == identity.call(object));
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testNativeConsole() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        ArrayList<String> messages = new ArrayList<>();
+        quack.setConsole((level, message) -> {
+            if (message.equals("throw"))
+                throw new IllegalStateException("console failed.");
+            messages.add(level + " " + message);
+        });
+        quack.evaluate("console.log('a %d b %s%%', 1.5, 'c', { x: 1 }, [2])");
+        quack.evaluate("console.warn(new Error('quack.').message, null)");
+        quack.evaluate("console.assert(true, 'not logged'); console.assert(false, 'x=%i', 3.5)");
+        assertEquals(Arrays.asList(
+                QuackConsole.LOG + " a 1.5 b c% {\"x\":1} [2]",
+                QuackConsole.WARN + " quack. null",
+                QuackConsole.ERROR + " Assertion failed: x=3"), messages);
+
+        try {
+            quack.evaluate("console.info('throw')");
+            Assert.fail("failure expected");
+        }
+        catch (Exception e) {
+            assertTrue(e.getMessage().contains("console failed."));
+        }
+
+        // without a console, messages are dropped.
+        quack.setConsole(null);
+        quack.evaluate("console.log('dropped')");
+        assertEquals(3, messages.size());
+        quack.close();
+    }
+
+    @Test
+    public void testModuleLoader() throws Exception {
+        HashMap<String, String> sources = new HashMap<>();
+        sources.put("math", "exports.add = function(a, b) { return a + b; }; exports.loads = (exports.loads || 0) + 1;");
+        sources.put("lib/twice", "var math = require('../math'); module.exports = function(x) { return math.add(x, x); };");
+        sources.put("a", "exports.done = false; exports.b = require('b'); exports.done = true;");
+        sources.put("b", "exports.sawPartialA = !require('a').done;");
+        sources.put("broken", "throw new Error('broken module');");
+        if (useQuickJS) {
+            sources.put("esm/math", "export function add(a, b) { return a + b; }");
+            sources.put("esm", "import { add } from 'esm/math'; export const value = add(20, 22);");
+        }
+        ArrayList<String> loaded = new ArrayList<>();
+        QuackModuleLoader loader = new QuackModuleLoader() {
+            @Override
+            public String resolve(String referrer, String specifier) {
+                if (!specifier.startsWith("../"))
+                    return sources.containsKey(specifier) ? specifier : null;
+                return specifier.substring(3);
+            }
+
+            @Override
+            public String load(String id) {
+                loaded.add(id);
+                return sources.get(id);
+            }
+        };
+
+        File directory = File.createTempFile("quack", "modules");
+        directory.delete();
+        QuackBytecodeCache cache = new QuackBytecodeCache(directory);
+        for (int run = 0; run < 2; run++) {
+            QuackContext quack = QuackContext.create(useQuickJS);
+            quack.setModuleLoader(loader, cache);
+            loaded.clear();
+            // modules are loaded lazily, once each.
+            assertEquals(42, ((Number)quack.evaluate("require('lib/twice')(21)")).intValue());
+            assertEquals(1, ((Number)quack.evaluate("require('math').loads")).intValue());
+            assertEquals(Arrays.asList("lib/twice", "math"), loaded);
+            assertEquals(true, quack.evaluate("require('a').b.sawPartialA"));
+            try {
+                quack.evaluate("require('missing')");
+                Assert.fail("failure expected");
+            }
+            catch (Exception e) {
+                assertTrue(e.getMessage().contains("Cannot find module 'missing'"));
+            }
+            try {
+                quack.evaluate("require('broken')");
+                Assert.fail("failure expected");
+            }
+            catch (Exception e) {
+                assertTrue(e.getMessage().contains("broken module"));
+            }
+            if (useQuickJS) {
+                JavaScriptObject importValue = quack.compileFunction("function(id) { return import(id).then(function(m) { return m.value; }); }", "?");
+                assertEquals(42, ((Number)importValue.callAsync("esm").get()).intValue());
+            }
+            quack.close();
+        }
+        // the second run loaded modules from the bytecode cache.
+        assertTrue(directory.listFiles().length >= 5);
+
+        cache.clear();
+        directory.delete();
+    }
+
+    @Test
+    public void testJavaProxyReuse() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        JavaScriptObject same = quack.compileFunction("function(a, b) { return a === b; }", "?");
+        JavaScriptObject count = quack.compileFunction("function(list) { var n = 0; for (var i = 0; i < list.size(); i++) n += list.get(i).size(); return n; }", "?");
+        ArrayList<ArrayList<Object>> list = new ArrayList<>();
+        for (int i = 0; i < 1000; i++) {
+            ArrayList<Object> item = new ArrayList<>();
+            item.add(i);
+            list.add(item);
+        }
+        for (int round = 0; round < 3; round++) {
+            assertEquals(1000, ((Number)count.call(list)).intValue());
+            quack.gc();
+        }
+        if (!useQuickJS) {
+            // Duktape pushes a Java object that is still in JavaScript as the same proxy.
+            assertEquals(true, same.call(list, list));
+        }
+        assertEquals(false, same.call(list, list.get(0)));
+        quack.close();
+    }
+
+    @Test
+    public void testExceptionStackMode() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        String script = "function(cb) {" +
+                "function func1() {" +
+                "cb.callback();" +
+                "}" +
+                "try {" +
+                "func1();" +
+                "}" +
+                "catch(e) {" +
+                "return [e.stack, e.stack];" +
+                "}" +
+                "}";
+        final IllegalArgumentException[] thrown = new IllegalArgumentException[1];
+        Callback cb = new Callback() {
+            @Override
+            public void callback() {
+                thrown[0] = new IllegalArgumentException("java!");
+                throw thrown[0];
+            }
+        };
+        JavaScriptObject func = quack.compileFunction(script, "?");
+        JavaScriptObject fail = quack.compileFunction("function(cb) { function func1() { cb.callback(); } func1(); }", "?");
+
+        // the stacks are merged on first read, and only once.
+        JavaScriptObject stacks = (JavaScriptObject)func.call(cb);
+        String stack = stacks.get(0).toString();
+        assertEquals(stack, stacks.get(1).toString());
+        findStack(stack.split("\n"), "callback.*?QuackTests");
+        findStack(stack.split("\n"), "func1");
+
+        quack.setExceptionStackMode(QuackContext.EXCEPTION_STACK_NONE);
+        stacks = (JavaScriptObject)func.call(cb);
+        stack = stacks.get(0).toString();
+        findStack(stack.split("\n"), "func1");
+        assertFalse(stack.contains("QuackTests"));
+        try {
+            quack.evaluate("(function func1() { throw new Error('js!'); })()");
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+            assertTrue(e.getMessage().contains("js!"));
+            for (StackTraceElement element: e.getStackTrace()) {
+                assertFalse(element.getMethodName().equals("func1"));
+            }
+        }
+        try {
+            fail.call(cb);
+            Assert.fail("failure expected");
+        }
+        catch (IllegalArgumentException e) {
+            // the Java exception itself, without the JavaScript stack spliced in.
+            assertSame(thrown[0], e);
+            for (StackTraceElement element: e.getStackTrace()) {
+                assertFalse(element.getMethodName().equals("func1"));
+            }
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testWrappedExceptionStack() throws Exception {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        try {
+            quack.evaluate("(function func1() { throw new Error('js!'); })()");
+            Assert.fail("failure expected");
+        }
+        catch (QuackException e) {
+            // printed as the cause, without reading the trace of the exception itself.
+            StringWriter printed = new StringWriter();
+            new ExecutionException(e).printStackTrace(new PrintWriter(printed));
+            findStack(printed.toString().split("\n"), "func1");
+
+            ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+            new ObjectOutputStream(bytes).writeObject(new QuackException("js!\n    at func2 (script.js:1)"));
+            Exception deserialized = (Exception)new ObjectInputStream(new ByteArrayInputStream(bytes.toByteArray())).readObject();
+            findStack(deserialized, "func2");
+        }
+
+        JavaScriptObject throwing = quack.compileFunction("function() { function func3() { throw new Error('async!'); } func3(); }", "?");
+        try {
+            throwing.callAsync().get();
+            Assert.fail("failure expected");
+        }
+        catch (ExecutionException e) {
+            StringWriter printed = new StringWriter();
+            e.printStackTrace(new PrintWriter(printed));
+            findStack(printed.toString().split("\n"), "func3");
+        }
+        quack.close();
+    }
+
+    @Test
+    public void testBridgeStats() {
+        QuackContext quack = QuackContext.create(useQuickJS);
+        JavaScriptObject func = quack.compileFunction("function(cb) { cb.callback(); return { value: 1 }; }", "?");
+        Callback cb = new Callback() {
+            @Override
+            public void callback() {
+            }
+        };
+
+        // nothing is kept until enabled.
+        func.call(cb);
+        assertEquals(0, quack.getBridgeStats().call.count);
+
+        quack.setBridgeStatsEnabled(true);
+        for (int i = 0; i < 100; i++) {
+            JavaScriptObject ret = (JavaScriptObject)func.call(cb);
+            ret.set("value", 2);
+            assertEquals(2, ((Number)ret.get("value")).intValue());
+        }
+        quack.evaluate("1 + 1");
+
+        QuackBridgeStats stats = quack.getBridgeStats();
+        assertEquals(1, stats.evaluate.count);
+        assertEquals(100, stats.call.count);
+        assertEquals(100, stats.getKey.count);
+        assertEquals(100, stats.setKey.count);
+        assertTrue(stats.trapApply.count >= 100);
+        assertTrue(stats.trapGet.count >= 100);
+        assertTrue(stats.call.totalNanos >= stats.call.maxNanos);
+        assertTrue(stats.call.percentileNanos(50) <= stats.call.percentileNanos(99));
+        assertTrue(stats.call.percentileNanos(99) <= stats.call.maxNanos);
+        assertTrue(stats.conversionCount(QuackBridgeStats.TO_JAVA, QuackBridgeStats.CONVERSION_JAVASCRIPT_OBJECT) >= 100);
+        assertTrue(stats.conversionCount(QuackBridgeStats.TO_JAVASCRIPT, QuackBridgeStats.CONVERSION_PRIMITIVE) >= 100);
+        assertTrue(stats.weakRefCount >= 100);
+
+        quack.resetBridgeStats();
+        assertEquals(0, quack.getBridgeStats().call.count);
+        quack.close();
+    }
 }
@@ -0,0 +1,122 @@
+#ifndef ARRAY_RANGE_H
+#define ARRAY_RANGE_H
+
+#include <jni.h>
+#include <cmath>
+#include <cstdint>
+#include "ValueSerializer.h"
+
+/**
+ * Copies between Java primitive arrays and JavaScript arrays, for JavaScriptObject.getArrayRange
+ * and setArrayRange. Typed arrays with the element type of the Java array are copied as is, any
+ * other array is read and written as numbers by the engine, and converted here in one pass.
+ */
+class ArrayRange {
+public:
+    // Must match the QuackContext ARRAY_ types.
+    enum Type {
+        INT = 0,
+        FLOAT,
+        DOUBLE,
+    };
+
+    static int typedArrayKind(Type type) {
+        switch (type) {
+            case INT:
+                return ValueSerializer::INT32_ARRAY;
+            case FLOAT:
+                return ValueSerializer::FLOAT32_ARRAY;
+            default:
+                return ValueSerializer::FLOAT64_ARRAY;
+        }
+    }
+
+    static size_t elementSize(Type type) {
+        return type == DOUBLE ? sizeof(jdouble) : sizeof(jint);
+    }
+
+    // copy the elements of a typed array of the same type into the Java array.
+    static void fromElements(JNIEnv *env, jarray array, Type type, jint offset, jint length, const void *elements) {
+        switch (type) {
+            case INT:
+                env->SetIntArrayRegion((jintArray)array, offset, length, static_cast<const jint *>(elements));
+                break;
+            case FLOAT:
+                env->SetFloatArrayRegion((jfloatArray)array, offset, length, static_cast<const jfloat *>(elements));
+                break;
+            case DOUBLE:
+                env->SetDoubleArrayRegion((jdoubleArray)array, offset, length, static_cast<const jdouble *>(elements));
+                break;
+        }
+    }
+
+    // copy the Java array into the elements of a typed array of the same type.
+    static void toElements(JNIEnv *env, jarray array, Type type, jint offset, jint length, void *elements) {
+        switch (type) {
+            case INT:
+                env->GetIntArrayRegion((jintArray)array, offset, length, static_cast<jint *>(elements));
+                break;
+            case FLOAT:
+                env->GetFloatArrayRegion((jfloatArray)array, offset, length, static_cast<jfloat *>(elements));
+                break;
+            case DOUBLE:
+                env->GetDoubleArrayRegion((jdoubleArray)array, offset, length, static_cast<jdouble *>(elements));
+                break;
+        }
+    }
+
+    // store numbers read from JavaScript into the Java array, converted as a typed array would.
+    static void fromNumbers(JNIEnv *env, jarray array, Type type, jint offset, jint length, const double *numbers) {
+        // no JNI calls are made while the array is pinned.
+        void *pinned = env->GetPrimitiveArrayCritical(array, nullptr);
+        if (pinned == nullptr)
+            return;
+        for (jint i = 0; i < length; i++) {
+            switch (type) {
+                case INT:
+                    static_cast<jint *>(pinned)[offset + i] = toInt32(numbers[i]);
+                    break;
+                case FLOAT:
+                    static_cast<jfloat *>(pinned)[offset + i] = (jfloat)numbers[i];
+                    break;
+                case DOUBLE:
+                    static_cast<jdouble *>(pinned)[offset + i] = numbers[i];
+                    break;
+            }
+        }
+        env->ReleasePrimitiveArrayCritical(array, pinned, 0);
+    }
+
+    // load the Java array as numbers to write to JavaScript.
+    static void toNumbers(JNIEnv *env, jarray array, Type type, jint offset, jint length, double *numbers) {
+        void *pinned = env->GetPrimitiveArrayCritical(array, nullptr);
+        if (pinned == nullptr)
+            return;
+        for (jint i = 0; i < length; i++) {
+            switch (type) {
+                case INT:
+                    numbers[i] = static_cast<const jint *>(pinned)[offset + i];
+                    break;
+                case FLOAT:
+                    numbers[i] = static_cast<const jfloat *>(pinned)[offset + i];
+                    break;
+                case DOUBLE:
+                    numbers[i] = static_cast<const jdouble *>(pinned)[offset + i];
+                    break;
+            }
+        }
+        env->ReleasePrimitiveArrayCritical(array, pinned, JNI_ABORT);
+    }
+
+    // ECMAScript ToInt32.
+    static int32_t toInt32(double value) {
+        if (!std::isfinite(value))
+            return 0;
+        double modulo = std::fmod(std::trunc(value), 4294967296.0);
+        if (modulo < 0)
+            modulo += 4294967296.0;
+        return (int32_t)(uint32_t)modulo;
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef BACK_REFERENCES_H
+#define BACK_REFERENCES_H
+
+#include <jni.h>
+#include <unordered_map>
+
+/**
+ * The Java JavaScriptObject of each JavaScript object passed to Java, by heap pointer, so an
+ * object that crosses again comes back as the same Java instance. Nothing is stored on the
+ * JavaScript object itself, so passing it to Java does not change its shape.
+ *
+ * An entry lives as long as its handle, whose table slot keeps the JavaScript object alive,
+ * so the heap pointer can not be reused while the entry exists.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+class BackReferences {
+public:
+    // A new local ref to the JavaScriptObject of the object, or null if there is none or it was
+    // collected on the Java side.
+    jobject find(JNIEnv *env, const void *ptr) const {
+        auto found = entries.find(ptr);
+        if (found == entries.end())
+            return nullptr;
+        // the weak ref may be cleared by a gc at any point, so check the new local ref.
+        return env->NewLocalRef(found->second.javaThis);
+    }
+
+    // Link an object to a new JavaScriptObject, replacing a collected one.
+    void add(JNIEnv *env, const void *ptr, jobject javaThis, jlong handle) {
+        Entry &entry = entries[ptr];
+        if (entry.javaThis != nullptr)
+            env->DeleteWeakGlobalRef(entry.javaThis);
+        entry.javaThis = env->NewWeakGlobalRef(javaThis);
+        entry.handle = handle;
+    }
+
+    // A handle was released. Its entry is dropped unless the object was linked to a newer
+    // JavaScriptObject since.
+    void remove(JNIEnv *env, const void *ptr, jlong handle) {
+        auto found = entries.find(ptr);
+        if (found == entries.end() || found->second.handle != handle)
+            return;
+        env->DeleteWeakGlobalRef(found->second.javaThis);
+        entries.erase(found);
+    }
+
+    void clear(JNIEnv *env) {
+        for (const auto &entry: entries) {
+            env->DeleteWeakGlobalRef(entry.second.javaThis);
+        }
+        entries.clear();
+    }
+
+private:
+    struct Entry {
+        Entry()
+            : javaThis(nullptr)
+            , handle(-1) {
+        }
+
+        jweak javaThis;
+        jlong handle;
+    };
+
+    std::unordered_map<const void *, Entry> entries;
+};
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef BRIDGE_STATS_H
+#define BRIDGE_STATS_H
+
+#include <jni.h>
+#include <chrono>
+#include <cstring>
+#ifdef __ANDROID__
+#include <dlfcn.h>
+#endif
+
+/**
+ * Instrumentation of the bridge, behind QuackContext.getBridgeStats: how often and how long
+ * each JSContext entry point and each reverse trap from JavaScript into Java runs, how many
+ * values are converted in each direction by type, and how many JNI global and weak refs are
+ * created for values. On Android, entry points and traps are also systrace/Perfetto sections
+ * while tracing is on.
+ *
+ * Disabled until QuackContext.setBridgeStatsEnabled, when it costs a branch per call. Building
+ * with QUACK_NO_BRIDGE_STATS compiles it out.
+ *
+ * Latencies are recorded in log-linear buckets, as HdrHistogram does: SUB_BUCKETS per power
+ * of two, so a bucket's lower bound is within 1/SUB_BUCKETS of the values recorded in it.
+ * Times are inclusive, a trap run by an evaluate is counted in both.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+class BridgeStats {
+public:
+    // Must match the QuackBridgeStats entries.
+    enum Entry {
+        EVALUATE = 0,
+        CALL,
+        GET_KEY,
+        SET_KEY,
+        TRAP_HAS,
+        TRAP_GET,
+        TRAP_SET,
+        TRAP_APPLY,
+        ENTRY_COUNT,
+    };
+
+    // Must match the QuackBridgeStats conversions.
+    enum Direction {
+        TO_JAVA = 0,
+        TO_JAVASCRIPT,
+        DIRECTION_COUNT,
+    };
+    enum Conversion {
+        // null and undefined.
+        NULL_VALUE = 0,
+        // booleans, numbers and strings.
+        PRIMITIVE,
+        BUFFER,
+        JSON,
+        // a JavaScript object, as a JavaScriptObject in Java.
+        JAVASCRIPT_OBJECT,
+        // a Java object, as a proxy in JavaScript.
+        JAVA_OBJECT,
+        CONVERSION_COUNT,
+    };
+
+    // Must match QuackBridgeStats. Latencies of 2^MAX_BITS nanoseconds, about 18 minutes, and
+    // up are recorded in the last bucket.
+    static const int SUB_BUCKET_BITS = 2;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_BITS = 40;
+    static const int BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // Layout of the stats array: count, total and max nanoseconds, and the buckets of each
+    // entry, then the conversion counts by direction, then the ref counts.
+    static const int ENTRY_STRIDE = 3 + BUCKET_COUNT;
+    static const int CONVERSIONS = ENTRY_COUNT * ENTRY_STRIDE;
+    static const int GLOBAL_REFS = CONVERSIONS + DIRECTION_COUNT * CONVERSION_COUNT;
+    static const int WEAK_REFS = GLOBAL_REFS + 1;
+    static const int COUNT = WEAK_REFS + 1;
+
+    BridgeStats()
+        : enabled(false) {
+        reset();
+    }
+
+    bool isEnabled() const {
+#ifdef QUACK_NO_BRIDGE_STATS
+        return false;
+#else
+        return enabled;
+#endif
+    }
+
+    void setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        memset(totalNanos, 0, sizeof(totalNanos));
+        memset(maxNanos, 0, sizeof(maxNanos));
+        memset(buckets, 0, sizeof(buckets));
+        memset(conversions, 0, sizeof(conversions));
+        globalRefs = 0;
+        weakRefs = 0;
+    }
+
+    static int bucket(jlong nanos) {
+        if (nanos < SUB_BUCKETS)
+            return nanos < 0 ? 0 : (int)nanos;
+        int bits = 63 - __builtin_clzll((unsigned long long)nanos);
+        int shift = bits - SUB_BUCKET_BITS;
+        int index = (shift + 1) * SUB_BUCKETS + (int)((nanos >> shift) - SUB_BUCKETS);
+        return index < BUCKET_COUNT ? index : BUCKET_COUNT - 1;
+    }
+
+    // Times an entry point or trap for its scope.
+    class Scope {
+    public:
+        Scope(BridgeStats &stats, Entry entry)
+            : stats(stats.isEnabled() ? &stats : nullptr)
+            , entry(entry)
+            , traced(false) {
+            if (this->stats == nullptr)
+                return;
+#ifdef __ANDROID__
+            const ATrace &trace = atrace();
+            if (trace.isEnabled != nullptr && trace.isEnabled()) {
+                trace.beginSection(sectionName(entry));
+                traced = true;
+            }
+#endif
+            start = std::chrono::steady_clock::now();
+        }
+
+        ~Scope() {
+            if (stats == nullptr)
+                return;
+            stats->record(entry, (jlong)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#ifdef __ANDROID__
+            if (traced)
+                atrace().endSection();
+#endif
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        BridgeStats *stats;
+        Entry entry;
+        bool traced;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void converted(Direction direction, Conversion conversion) {
+        if (isEnabled())
+            conversions[direction][conversion]++;
+    }
+
+    void globalRefCreated() {
+        if (isEnabled())
+            globalRefs++;
+    }
+
+    void weakRefCreated() {
+        if (isEnabled())
+            weakRefs++;
+    }
+
+    void fill(jlong *stats) const {
+        for (int entry = 0; entry < ENTRY_COUNT; entry++) {
+            jlong *entryStats = stats + entry * ENTRY_STRIDE;
+            entryStats[0] = counts[entry];
+            entryStats[1] = totalNanos[entry];
+            entryStats[2] = maxNanos[entry];
+            memcpy(entryStats + 3, buckets[entry], sizeof(buckets[entry]));
+        }
+        memcpy(stats + CONVERSIONS, conversions, sizeof(conversions));
+        stats[GLOBAL_REFS] = globalRefs;
+        stats[WEAK_REFS] = weakRefs;
+    }
+
+private:
+    void record(Entry entry, jlong nanos) {
+        counts[entry]++;
+        totalNanos[entry] += nanos;
+        if (nanos > maxNanos[entry])
+            maxNanos[entry] = nanos;
+        buckets[entry][bucket(nanos)]++;
+    }
+
+#ifdef __ANDROID__
+    static const char *sectionName(Entry entry) {
+        static const char *names[ENTRY_COUNT] = {
+            "Quack evaluate",
+            "Quack call",
+            "Quack getKey",
+            "Quack setKey",
+            "Quack has trap",
+            "Quack get trap",
+            "Quack set trap",
+            "Quack apply trap",
+        };
+        return names[entry];
+    }
+
+    // ATrace is API 23, past the minSdkVersion, so it is looked up at runtime.
+    struct ATrace {
+        ATrace()
+            : isEnabled(nullptr)
+            , beginSection(nullptr)
+            , endSection(nullptr) {
+            void *android = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+            if (android == nullptr)
+                return;
+            beginSection = reinterpret_cast<void (*)(const char *)>(dlsym(android, "ATrace_beginSection"));
+            endSection = reinterpret_cast<void (*)()>(dlsym(android, "ATrace_endSection"));
+            if (beginSection != nullptr && endSection != nullptr)
+                isEnabled = reinterpret_cast<bool (*)()>(dlsym(android, "ATrace_isEnabled"));
+        }
+
+        bool (*isEnabled)();
+        void (*beginSection)(const char *);
+        void (*endSection)();
+    };
+
+    static const ATrace &atrace() {
+        static const ATrace trace;
+        return trace;
+    }
+#endif
+
+    bool enabled;
+    jlong counts[ENTRY_COUNT];
+    jlong totalNanos[ENTRY_COUNT];
+    jlong maxNanos[ENTRY_COUNT];
+    jlong buckets[ENTRY_COUNT][BUCKET_COUNT];
+    jlong conversions[DIRECTION_COUNT][CONVERSION_COUNT];
+    jlong globalRefs;
+    jlong weakRefs;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef CONSOLE_FORMATTER_H
+#define CONSOLE_FORMATTER_H
+
+#include <cstring>
+#include <string>
+
+/**
+ * Formats the arguments of a console call into one message, so the Java QuackConsole is called
+ * once per call with a finished string, rather than with marshalled arguments.
+ *
+ * As in Node, a string first argument may contain the substitutions %s, %d, %i, %f, %o, %O,
+ * %j and %%. %d and %f are Number(value), only %i is truncated to an integer. The remaining
+ * arguments follow, separated by spaces. Strings are written as is, anything else as the
+ * engine inspects it: the stack of an Error, JSON for other objects, and String(value) for the
+ * rest.
+ *
+ * Args is the engine's view of the call's arguments, providing:
+ *   size_t count();
+ *   bool isString(size_t i);
+ *   std::string toString(size_t i);                  // String(value)
+ *   std::string toNumber(size_t i, bool integer);    // String(Number(value)), truncated
+ *                                                    // if integer
+ *   std::string inspect(size_t i);
+ */
+class ConsoleFormatter {
+public:
+    // Must match the QuackConsole levels. ASSERT logs at ERROR, if its first argument is falsy.
+    enum Method {
+        LOG = 0,
+        DEBUG,
+        INFO,
+        WARN,
+        ERROR,
+        ASSERT,
+        METHOD_COUNT,
+    };
+
+    static const char *methodName(int method) {
+        static const char *names[METHOD_COUNT] = {
+            "log",
+            "debug",
+            "info",
+            "warn",
+            "error",
+            "assert",
+        };
+        return names[method];
+    }
+
+    // format the arguments from first on.
+    template <typename Args>
+    static std::string format(Args &args, size_t first) {
+        std::string message;
+        size_t next = first;
+        if (next < args.count() && args.isString(next)) {
+            const std::string pattern = args.toString(next++);
+            for (size_t i = 0; i < pattern.size(); i++) {
+                char c = pattern[i];
+                if (c != '%' || i + 1 == pattern.size()) {
+                    message += c;
+                    continue;
+                }
+                char spec = pattern[i + 1];
+                if (spec == '%') {
+                    message += '%';
+                    i++;
+                    continue;
+                }
+                // unknown specifiers, and those without an argument left, are written as is.
+                if (next >= args.count() || strchr("sdifoOj", spec) == nullptr) {
+                    message += c;
+                    continue;
+                }
+                i++;
+                switch (spec) {
+                    case 's':
+                        message += text(args, next);
+                        break;
+                    case 'i':
+                        message += args.toNumber(next, true);
+                        break;
+                    case 'd':
+                    case 'f':
+                        message += args.toNumber(next, false);
+                        break;
+                    default:
+                        message += args.inspect(next);
+                        break;
+                }
+                next++;
+            }
+        }
+        for (; next < args.count(); next++) {
+            if (next != first)
+                message += ' ';
+            message += text(args, next);
+        }
+        return message;
+    }
+
+    // the message of an assertion that failed.
+    static std::string assertion(const std::string &message) {
+        if (message.empty())
+            return "Assertion failed";
+        return "Assertion failed: " + message;
+    }
+
+private:
+    template <typename Args>
+    static std::string text(Args &args, size_t i) {
+        return args.isString(i) ? args.toString(i) : args.inspect(i);
+    }
+};
+
+#endif
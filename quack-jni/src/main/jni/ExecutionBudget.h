@@ -0,0 +1,66 @@
+#ifndef EXECUTION_BUDGET_H
+#define EXECUTION_BUDGET_H
+
+#include <jni.h>
+#include <atomic>
+#include <chrono>
+
+/**
+ * Deadline and interrupt request for the script running on a context, polled by the engine
+ * every few thousand instructions.
+ *
+ * Once expired, the budget keeps reporting so until stop(), so a script can not catch the
+ * resulting error and keep running.
+ *
+ * interrupt() may be called from any thread, everything else is called with the QuackContext
+ * lock held.
+ */
+class ExecutionBudget {
+public:
+    ExecutionBudget()
+        : interrupted(false)
+        , hasDeadline(false)
+        , expired(false) {
+    }
+
+    // a timeout of 0 only arms the budget for interrupt().
+    void start(jlong timeoutNanos) {
+        interrupted.store(false, std::memory_order_relaxed);
+        expired = false;
+        hasDeadline = timeoutNanos > 0;
+        if (hasDeadline)
+            deadline = Clock::now() + std::chrono::nanoseconds(timeoutNanos);
+    }
+
+    void stop() {
+        interrupted.store(false, std::memory_order_relaxed);
+        expired = false;
+        hasDeadline = false;
+    }
+
+    void interrupt() {
+        interrupted.store(true, std::memory_order_relaxed);
+    }
+
+    // Called from the engine's interrupt handler, returns true if the script should be aborted.
+    bool check() {
+        if (!expired)
+            expired = interrupted.load(std::memory_order_relaxed) || (hasDeadline && Clock::now() >= deadline);
+        return expired;
+    }
+
+    // whether errors raised by the engine are due to this budget.
+    bool isExpired() const {
+        return expired;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::atomic<bool> interrupted;
+    bool hasDeadline;
+    bool expired;
+    Clock::time_point deadline;
+};
+
+#endif
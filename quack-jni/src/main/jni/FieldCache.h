@@ -0,0 +1,147 @@
+#ifndef FIELD_CACHE_H
+#define FIELD_CACHE_H
+
+#include <jni.h>
+#include <climits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Resolves property reads and writes on JavaObject proxies to public instance fields of the
+ * wrapped object's class, so later accesses go straight to Get/Set<Type>Field instead of
+ * calling into QuackContext and JavaObject reflection.
+ *
+ * Eligibility is decided once per (class, key) by QuackContext.quackResolveField, and only
+ * field types whose JavaScript value is the same either way are resolved. Unresolvable
+ * properties are cached too, and take the regular path.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+template <typename Key>
+class FieldCache {
+public:
+    // Must match the QuackContext.FIELD_* constants.
+    enum Kind {
+        NONE = 0,
+        INT = 1,
+        BOOLEAN = 2,
+        DOUBLE = 3,
+        STRING = 4,
+    };
+    static const jint FINAL = 0x100;
+
+    struct Field {
+        jfieldID id;
+        Kind kind;
+        bool isFinal;
+    };
+
+    FieldCache()
+        : entries(0) {
+    }
+    FieldCache(const FieldCache &) = delete;
+    FieldCache & operator=(const FieldCache &) = delete;
+
+    // Find the field for key on the class of the JavaObject's target. onAdd(key) is called
+    // once for each new entry, and must return the key's name as UTF-8.
+    template <typename OnAdd>
+    Field lookup(JNIEnv *env, jobject javaQuack, jmethodID resolveMethod, jobject javaObject,
+                 jclass targetClass, const Key &key, OnAdd onAdd) {
+        auto found = fields.find(key);
+        if (found != fields.end()) {
+            for (const Entry &entry: found->second) {
+                if (env->IsSameObject(entry.clazz, targetClass))
+                    return entry.field;
+            }
+        }
+
+        Field field = { nullptr, NONE, false };
+        if (entries >= MAX_ENTRIES)
+            return field;
+
+        std::string name = onAdd(key);
+        if (isAscii(name)) {
+            jstring jname = env->NewStringUTF(name.c_str());
+            jint resolved = env->CallIntMethod(javaQuack, resolveMethod, javaObject, jname);
+            env->DeleteLocalRef(jname);
+            if (env->ExceptionCheck()) {
+                env->ExceptionClear();
+                resolved = NONE;
+            }
+            field.kind = (Kind)(resolved & ~FINAL);
+            field.isFinal = (resolved & FINAL) != 0;
+            if (field.kind != NONE) {
+                field.id = env->GetFieldID(targetClass, name.c_str(), signature(field.kind));
+                if (field.id == nullptr) {
+                    env->ExceptionClear();
+                    field.kind = NONE;
+                }
+            }
+        }
+
+        fields[key].push_back({ (jclass)env->NewGlobalRef(targetClass), field });
+        entries++;
+        return field;
+    }
+
+    // Drop every entry, calling releaseKey once per entry added.
+    template <typename ReleaseKey>
+    void clear(JNIEnv *env, ReleaseKey releaseKey) {
+        for (auto &keyed: fields) {
+            for (Entry &entry: keyed.second) {
+                env->DeleteGlobalRef(entry.clazz);
+                releaseKey(keyed.first);
+            }
+        }
+        fields.clear();
+        entries = 0;
+    }
+
+    // Java's double to int conversion, as used by Double.intValue().
+    static jint toJavaInt(double value) {
+        if (value != value)
+            return 0;
+        if (value >= (double)INT_MAX)
+            return INT_MAX;
+        if (value <= (double)INT_MIN)
+            return INT_MIN;
+        return (jint)value;
+    }
+
+private:
+    struct Entry {
+        jclass clazz;
+        Field field;
+    };
+
+    // bounds the number of global class refs held, past this properties take the regular path.
+    static const size_t MAX_ENTRIES = 1024;
+
+    static bool isAscii(const std::string &name) {
+        // modified UTF-8 only matches UTF-8 for ascii, which covers real world field names.
+        for (char c: name) {
+            if ((unsigned char)c >= 0x80 || c == '\0')
+                return false;
+        }
+        return !name.empty();
+    }
+
+    static const char *signature(Kind kind) {
+        switch (kind) {
+            case INT:
+                return "I";
+            case BOOLEAN:
+                return "Z";
+            case DOUBLE:
+                return "D";
+            default:
+                return "Ljava/lang/String;";
+        }
+    }
+
+    std::unordered_map<Key, std::vector<Entry>> fields;
+    size_t entries;
+};
+
+#endif
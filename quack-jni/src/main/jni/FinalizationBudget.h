@@ -0,0 +1,37 @@
+#ifndef FINALIZATION_BUDGET_H
+#define FINALIZATION_BUDGET_H
+
+#include <jni.h>
+#include <chrono>
+
+/**
+ * Time budget for releasing a batch of collected JavaScriptObjects, so a burst of garbage is
+ * released over several calls instead of stalling one of them. The clock is read once every
+ * CHECK_INTERVAL objects, and at least that many are released per batch so the queue always
+ * drains.
+ */
+class FinalizationBudget {
+public:
+    static const jint CHECK_INTERVAL = 256;
+
+    // a budget of 0 releases the whole batch.
+    explicit FinalizationBudget(jlong budgetNanos)
+        : limited(budgetNanos > 0)
+        , deadline(Clock::now() + std::chrono::nanoseconds(budgetNanos > 0 ? budgetNanos : 0)) {
+    }
+
+    // whether the next object may be released, after released objects so far.
+    bool allows(jint released) const {
+        if (!limited || released == 0 || released % CHECK_INTERVAL != 0)
+            return true;
+        return Clock::now() < deadline;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    bool limited;
+    Clock::time_point deadline;
+};
+
+#endif
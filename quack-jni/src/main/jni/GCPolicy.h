@@ -0,0 +1,67 @@
+#ifndef GC_POLICY_H
+#define GC_POLICY_H
+
+#include <jni.h>
+
+/**
+ * Decides when the bridge forces a garbage collection after a call into JavaScript.
+ * Automatic collection by the engine itself is not affected.
+ */
+class GCPolicy {
+public:
+    // Must match the QuackContext.GC_* constants.
+    enum Mode {
+        // only collect when gc() is called explicitly.
+        NEVER = 0,
+        // collect after every N calls.
+        EVERY_N_CALLS = 1,
+        // collect once the heap has grown by N bytes since the last collection.
+        HEAP_GROWTH = 2,
+    };
+
+    GCPolicy(Mode mode, jlong value)
+        : mode(mode)
+        , value(value)
+        , callsSinceCollection(0)
+        , heapSizeAfterCollection(0) {
+    }
+
+    void set(jint newMode, jlong newValue) {
+        mode = newMode == EVERY_N_CALLS || newMode == HEAP_GROWTH ? (Mode)newMode : NEVER;
+        value = newValue < 1 ? 1 : newValue;
+        callsSinceCollection = 0;
+    }
+
+    Mode getMode() const {
+        return mode;
+    }
+
+    jlong getValue() const {
+        return value;
+    }
+
+    // Record a completed call and check whether a collection is due.
+    bool shouldCollect(jlong heapSize) {
+        switch (mode) {
+            case EVERY_N_CALLS:
+                return ++callsSinceCollection >= value;
+            case HEAP_GROWTH:
+                return heapSize - heapSizeAfterCollection >= value;
+            default:
+                return false;
+        }
+    }
+
+    void collected(jlong heapSize) {
+        callsSinceCollection = 0;
+        heapSizeAfterCollection = heapSize;
+    }
+
+private:
+    Mode mode;
+    jlong value;
+    jlong callsSinceCollection;
+    jlong heapSizeAfterCollection;
+};
+
+#endif
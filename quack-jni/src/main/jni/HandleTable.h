@@ -0,0 +1,61 @@
+#ifndef HANDLE_TABLE_H
+#define HANDLE_TABLE_H
+
+#include <jni.h>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Slots holding the engine values that Java JavaScriptObjects keep alive. The slot index is
+ * the handle given to Java, so adding and releasing are O(1) and two live values can never
+ * share a slot. Released slots are reset to the empty value and reused through a free list.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+template <typename T>
+class HandleTable {
+public:
+    explicit HandleTable(const T &empty)
+        : empty(empty) {
+    }
+
+    jlong add(const T &value) {
+        if (freeSlots.empty()) {
+            slots.push_back(value);
+            return (jlong)(slots.size() - 1);
+        }
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[slot] = value;
+        return (jlong)slot;
+    }
+
+    // Returns the released value, which the caller is responsible for freeing.
+    T remove(jlong handle) {
+        T value = slots[(size_t)handle];
+        slots[(size_t)handle] = empty;
+        freeSlots.push_back((uint32_t)handle);
+        return value;
+    }
+
+    const T &get(jlong handle) const {
+        return slots[(size_t)handle];
+    }
+
+    // live values, not counting released slots.
+    size_t size() const {
+        return slots.size() - freeSlots.size();
+    }
+
+    // Every slot, including released ones which hold the empty value.
+    const std::vector<T> &values() const {
+        return slots;
+    }
+
+private:
+    const T empty;
+    std::vector<T> slots;
+    std::vector<uint32_t> freeSlots;
+};
+
+#endif
@@ -2,12 +2,21 @@
 #define JS_CONTEXT_H
 
 #include <jni.h>
+#include "GCPolicy.h"
+#include "BridgeStats.h"
 
 inline JNIEnv* getEnvFromJavaVM(JavaVM* javaVM) {
   if (javaVM == nullptr) {
     return nullptr;
   }
 
+  // there is a single JavaVM per process, and threads attached here are never detached,
+  // so a thread's env stays valid for the life of the thread.
+  static thread_local JNIEnv* cachedEnv = nullptr;
+  if (cachedEnv != nullptr) {
+    return cachedEnv;
+  }
+
   JNIEnv* env;
   javaVM->AttachCurrentThread(
 #ifdef __ANDROID__
@@ -16,6 +25,7 @@ inline JNIEnv* getEnvFromJavaVM(JavaVM* javaVM) {
       reinterpret_cast<void**>(&env),
 #endif
       nullptr);
+  cachedEnv = env;
   return env;
 }
 
@@ -23,13 +33,24 @@ class JSContext {
 public:
     virtual ~JSContext() {};
 
-    virtual void finalizeJavaScriptObject(JNIEnv *env, jlong object) = 0;
+    // kept by the dispatchers in context-jni.cpp for entry points, and by the engines for
+    // traps and conversions, which may happen in const methods.
+    mutable BridgeStats bridgeStats;
+
+    // releases the first count handles, or as many as fit in the budget, and returns how many.
+    virtual jint finalizeJavaScriptObjects(JNIEnv *env, jlongArray handles, jint count, jlong budgetNanos) = 0;
 
     virtual jobject evaluate(JNIEnv *env, jstring code, jstring filename) = 0;
     virtual jobject compile(JNIEnv* env, jstring code, jstring filename) = 0;
+    virtual jbyteArray compileBytecode(JNIEnv *env, jstring code, jstring filename) = 0;
+    virtual jobject evaluateBytecode(JNIEnv *env, jbyteArray bytecode) = 0;
+    // values in the ValueSerializer format, which any context can read.
+    virtual jbyteArray serialize(JNIEnv *env, jobject value) = 0;
+    virtual jobject deserialize(JNIEnv *env, jbyteArray data) = 0;
 
     virtual void setGlobalProperty(JNIEnv *env, jobject property, jobject value) = 0;
     virtual jstring stringify(JNIEnv *env, jlong object) = 0;
+    virtual jobject stringifyUtf8(JNIEnv *env, jlong object, jobject buffer) = 0;
 
     virtual jobject getKeyString(JNIEnv* env, jlong object, jstring key) = 0;
     virtual jobject getKeyInteger(JNIEnv* env, jlong object, jint index) = 0;
@@ -38,17 +59,65 @@ public:
     virtual jboolean setKeyInteger(JNIEnv* env, jlong object, jint index, jobject value) = 0;
     virtual jboolean setKeyObject(JNIEnv* env, jlong object, jobject key, jobject value) = 0;
 
+    // copies between an array and a Java primitive array of ArrayRange::Type, in one call.
+    virtual void getArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length) = 0;
+    virtual void setArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length) = 0;
+    virtual jobject newTypedArray(JNIEnv *env, jarray array, jint type) = 0;
+
+    virtual jlong internKey(JNIEnv *env, jstring key) = 0;
+    virtual void releaseKey(JNIEnv *env, jlong key) = 0;
+    virtual jobject getKeyHandle(JNIEnv* env, jlong object, jlong key) = 0;
+    virtual jboolean setKeyHandle(JNIEnv* env, jlong object, jlong key, jobject value) = 0;
+    virtual jobject callPropertyHandle(JNIEnv *env, jlong object, jlong key, jobjectArray args) = 0;
+
     virtual jobject call(JNIEnv *env, jlong object, jobjectArray args) = 0;
+    virtual jobjectArray callBatch(JNIEnv *env, jlong object, jobjectArray argsList) = 0;
     virtual jobject callProperty(JNIEnv *env, jlong object, jobject property, jobjectArray args) = 0;
     virtual jobject callMethod(JNIEnv *env, jlong method, jobject object, jobjectArray args) = 0;
 
     virtual void runJobs(JNIEnv *env) = 0;
+    virtual jboolean hasPendingJobs(JNIEnv *env) = 0;
 
     virtual void waitForDebugger(JNIEnv *env, jstring connectionString) = 0;
     virtual void cooperateDebugger() = 0;
     virtual jboolean isDebugging() = 0;
     virtual void debuggerAppNotify(JNIEnv *env, jobjectArray args) = 0;
     virtual jlong getHeapSize(JNIEnv *env) = 0;
+    virtual void setHeapLimit(JNIEnv *env, jlong limit) = 0;
+    virtual jlong getHeapHighWaterMark(JNIEnv *env) = 0;
+    virtual void resetHeapHighWaterMark(JNIEnv *env) = 0;
+    virtual void getMemoryStats(JNIEnv *env, jlongArray stats, jboolean detailed) = 0;
+
+    virtual void setGCPolicy(JNIEnv *env, jint mode, jlong value) = 0;
+    virtual void gc(JNIEnv *env) = 0;
+
+    virtual void setZeroCopyBuffers(JNIEnv *env, jboolean zeroCopy) = 0;
+    virtual void unpinBuffer(JNIEnv *env, jlong pin) = 0;
+
+    // drops the field and native method caches, which skip coercions.
+    virtual void clearFieldCache(JNIEnv *env) = 0;
+
+    virtual void startExecutionBudget(JNIEnv *env, jlong timeoutNanos) = 0;
+    virtual void stopExecutionBudget(JNIEnv *env) = 0;
+    // may be called from any thread, while a script is running.
+    virtual void interrupt() = 0;
+
+    virtual void startProfiling(JNIEnv *env, jlong intervalNanos) = 0;
+    // returns the samples as collapsed stacks.
+    virtual jstring stopProfiling(JNIEnv *env) = 0;
+
+    // defines the global console, which formats natively and logs through QuackContext.quackConsole.
+    virtual void installConsole(JNIEnv *env) = 0;
+    // defines the global require, and on QuickJS the ES module loader, resolving and loading
+    // through QuackContext.quackResolveModule and quackLoadModule.
+    virtual void installModuleLoader(JNIEnv *env, jboolean cacheModules) = 0;
+
+    // Must match the QuackContext EXCEPTION_STACK_ modes.
+    enum ExceptionStackMode {
+        EXCEPTION_STACK_MERGED = 0,
+        EXCEPTION_STACK_NONE,
+    };
+    virtual void setExceptionStackMode(JNIEnv *env, jint mode) = 0;
 };
 
 #endif
\ No newline at end of file
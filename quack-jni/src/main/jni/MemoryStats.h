@@ -0,0 +1,95 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <jni.h>
+#include <chrono>
+
+/**
+ * Counters behind QuackContext.getMemoryStats that the bridge keeps itself, so sampling them
+ * is O(1): collections run by the bridge, and the JNI references that JavaScript values hold
+ * until they are finalized.
+ *
+ * Not thread safe; callers hold the QuackContext lock, or are finalizers run by the engine.
+ */
+class MemoryStats {
+public:
+    // Must match the QuackMemoryStats indices.
+    enum Index {
+        HEAP_SIZE = 0,
+        HEAP_HIGH_WATER_MARK,
+        HEAP_LIMIT,
+        ALLOCATION_COUNT,
+        GC_COUNT,
+        GC_PAUSE_NANOS,
+        MAX_GC_PAUSE_NANOS,
+        JAVASCRIPT_OBJECT_COUNT,
+        JAVA_OBJECT_REFERENCE_COUNT,
+        BUFFER_REFERENCE_COUNT,
+        // only filled in by a detailed sample, which walks the heap.
+        OBJECT_COUNT,
+        OBJECT_SIZE,
+        STRING_COUNT,
+        STRING_SIZE,
+        ATOM_COUNT,
+        ATOM_SIZE,
+        SHAPE_COUNT,
+        SHAPE_SIZE,
+        FUNCTION_COUNT,
+        FUNCTION_BYTECODE_SIZE,
+        COUNT,
+    };
+
+    MemoryStats()
+        : gcCount(0)
+        , gcPauseNanos(0)
+        , maxGcPauseNanos(0)
+        , javaObjectReferences(0)
+        , bufferReferences(0) {
+    }
+
+    // Run a collection, timing its pause.
+    template <typename Collect>
+    void collect(Collect collect) {
+        auto start = std::chrono::steady_clock::now();
+        collect();
+        jlong pause = (jlong)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        gcCount++;
+        gcPauseNanos += pause;
+        if (pause > maxGcPauseNanos)
+            maxGcPauseNanos = pause;
+    }
+
+    // global refs to Java objects held by JavaScript proxies.
+    void javaObjectReferenced() {
+        javaObjectReferences++;
+    }
+    void javaObjectReleased() {
+        javaObjectReferences--;
+    }
+
+    // global refs to direct ByteBuffers shared with JavaScript.
+    void bufferReferenced() {
+        bufferReferences++;
+    }
+    void bufferReleased() {
+        bufferReferences--;
+    }
+
+    // Fill in the bridge counters, every other stat is left to the engine.
+    void fill(jlong *stats) const {
+        stats[GC_COUNT] = gcCount;
+        stats[GC_PAUSE_NANOS] = gcPauseNanos;
+        stats[MAX_GC_PAUSE_NANOS] = maxGcPauseNanos;
+        stats[JAVA_OBJECT_REFERENCE_COUNT] = javaObjectReferences;
+        stats[BUFFER_REFERENCE_COUNT] = bufferReferences;
+    }
+
+private:
+    jlong gcCount;
+    jlong gcPauseNanos;
+    jlong maxGcPauseNanos;
+    jlong javaObjectReferences;
+    jlong bufferReferences;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef MODULE_LOADER_H
+#define MODULE_LOADER_H
+
+#include <string>
+
+/**
+ * Shared pieces of the module loader installed by QuackContext.setModuleLoader.
+ *
+ * Both engines get a CommonJS require. Module ids are resolved, and sources (or cached
+ * bytecode) loaded, through QuackContext.quackResolveModule and quackLoadModule, and a module
+ * is only compiled the first time it is required. The engine supplies the two native functions
+ * the require shim is called with:
+ *   resolve(referrer, specifier): the id of the module, from the id of the requiring module.
+ *   load(id): the function the module runs in, compiled from its wrapped source or bytecode.
+ * QuickJS also loads ES modules through the same callbacks, for import.
+ */
+class ModuleLoader {
+public:
+    // Must match the QuackContext MODULE_ kinds.
+    enum Kind {
+        COMMONJS = 0,
+        ES,
+    };
+
+    // the source of a CommonJS module, as the expression of the function it runs in. Evaluating
+    // it, or its bytecode, gives the function.
+    static std::string wrapCommonJS(const char *source, size_t length) {
+        std::string wrapped = "(function(exports, require, module, __filename) {";
+        wrapped.append(source, length);
+        // the source may end in a line comment.
+        wrapped += "\n})";
+        return wrapped;
+    }
+
+    // evaluates to a function of resolve and load, which returns the global require.
+    // A module is registered before it runs, so cyclic requires see its partial exports, as in
+    // Node, and unregistered again if it throws.
+    static const char *requireShim() {
+        return "(function(resolve, load) {\n"
+               "\tvar modules = Object.create(null);\n"
+               "\tfunction requireFrom(referrer) {\n"
+               "\t\treturn function require(specifier) {\n"
+               "\t\t\tvar id = resolve(referrer, String(specifier));\n"
+               "\t\t\tvar module = modules[id];\n"
+               "\t\t\tif (module)\n"
+               "\t\t\t\treturn module.exports;\n"
+               "\t\t\tvar factory = load(id);\n"
+               "\t\t\tmodule = modules[id] = { id: id, exports: {} };\n"
+               "\t\t\ttry {\n"
+               "\t\t\t\tfactory.call(module.exports, module.exports, requireFrom(id), module, id);\n"
+               "\t\t\t}\n"
+               "\t\t\tcatch (e) {\n"
+               "\t\t\t\tdelete modules[id];\n"
+               "\t\t\t\tthrow e;\n"
+               "\t\t\t}\n"
+               "\t\t\treturn module.exports;\n"
+               "\t\t};\n"
+               "\t}\n"
+               "\treturn requireFrom('');\n"
+               "})";
+    }
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef NATIVE_METHOD_CACHE_H
+#define NATIVE_METHOD_CACHE_H
+
+#include <jni.h>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Parsed signatures of QuackNativeMethods, by jmethodID, so that calls from JavaScript can
+ * marshal their arguments straight into a jvalue array and call the method through JNI.
+ *
+ * Types are the JNI descriptor characters I, D, Z and V, with L for java.lang.String.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+class NativeMethodCache {
+public:
+    // longer parameter lists take the regular path, so callers can marshal on the stack.
+    static const size_t MAX_PARAMETERS = 8;
+
+    struct Method {
+        jmethodID id;
+        std::string parameterTypes;
+        char returnType;
+    };
+
+    NativeMethodCache() = default;
+    NativeMethodCache(const NativeMethodCache &) = delete;
+    NativeMethodCache & operator=(const NativeMethodCache &) = delete;
+
+    // Find the method of a QuackNativeMethod, or nullptr if it is not called directly.
+    // Whether it is depends on the instance, its target and the coercions registered when it
+    // was created, so that is checked on every call and only the parsed signature is cached.
+    const Method *lookup(JNIEnv *env, jobject nativeMethod, jfieldID targetField, jfieldID methodField, jfieldID signatureField) {
+        jstring signature = (jstring)env->GetObjectField(nativeMethod, signatureField);
+        if (signature == nullptr)
+            return nullptr;
+        jobject target = env->GetObjectField(nativeMethod, targetField);
+        if (target == nullptr) {
+            env->DeleteLocalRef(signature);
+            return nullptr;
+        }
+        env->DeleteLocalRef(target);
+
+        jobject reflected = env->GetObjectField(nativeMethod, methodField);
+        jmethodID id = env->FromReflectedMethod(reflected);
+        auto found = methods.find(id);
+        if (found != methods.end()) {
+            env->DeleteLocalRef(signature);
+            env->DeleteLocalRef(reflected);
+            return found->second.method.id == nullptr ? nullptr : &found->second.method;
+        }
+
+        if (methods.size() >= MAX_ENTRIES) {
+            env->DeleteLocalRef(signature);
+            env->DeleteLocalRef(reflected);
+            return nullptr;
+        }
+
+        // the signature only depends on the method once it is set, so its parse can be shared.
+        Entry entry;
+        entry.method.id = nullptr;
+        const char *chars = env->GetStringUTFChars(signature, nullptr);
+        if (parse(chars, &entry.method))
+            entry.method.id = id;
+        env->ReleaseStringUTFChars(signature, chars);
+        env->DeleteLocalRef(signature);
+        // holding the Method keeps its class loaded, so the jmethodID can not be reused.
+        entry.reflected = env->NewGlobalRef(reflected);
+        env->DeleteLocalRef(reflected);
+        auto added = methods.emplace(id, entry).first;
+        return added->second.method.id == nullptr ? nullptr : &added->second.method;
+    }
+
+    void clear(JNIEnv *env) {
+        for (auto &method: methods) {
+            env->DeleteGlobalRef(method.second.reflected);
+        }
+        methods.clear();
+    }
+
+private:
+    struct Entry {
+        jobject reflected;
+        Method method;
+    };
+
+    static const size_t MAX_ENTRIES = 1024;
+
+    static bool parse(const char *signature, Method *method) {
+        if (*signature++ != '(')
+            return false;
+        while (*signature != ')') {
+            char type = parseType(&signature);
+            if (type == '\0' || type == 'V' || method->parameterTypes.size() >= MAX_PARAMETERS)
+                return false;
+            method->parameterTypes.push_back(type);
+        }
+        signature++;
+        method->returnType = parseType(&signature);
+        return method->returnType != '\0' && *signature == '\0';
+    }
+
+    static char parseType(const char **signature) {
+        static const char stringType[] = "Ljava/lang/String;";
+        char type = **signature;
+        switch (type) {
+            case 'I':
+            case 'D':
+            case 'Z':
+            case 'V':
+                (*signature)++;
+                return type;
+            case 'L':
+                if (strncmp(*signature, stringType, sizeof(stringType) - 1) != 0)
+                    return '\0';
+                *signature += sizeof(stringType) - 1;
+                return 'L';
+            default:
+                return '\0';
+        }
+    }
+
+    std::unordered_map<jmethodID, Entry> methods;
+};
+
+#endif
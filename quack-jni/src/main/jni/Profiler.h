@@ -0,0 +1,149 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <jni.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Sampling profiler for the scripts running on a context. The engine's interrupt handler asks
+ * whether a sample is due, which is a clock read while profiling, and records the JavaScript
+ * stack if so. Bridge traps do the same once they return, with the trap as the leaf frame, so
+ * time spent in Java called from JavaScript is attributed to the trap.
+ *
+ * Samples are aggregated into collapsed stacks, the input format of flamegraph tools:
+ * one line per distinct stack, frames from the root down separated by ';', then the count.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+class Profiler {
+public:
+    // deeper stacks are truncated at the root end.
+    static const size_t MAX_FRAMES = 64;
+
+    Profiler()
+        : running(false) {
+    }
+
+    void start(jlong intervalNanos) {
+        stacks.clear();
+        interval = std::chrono::nanoseconds(intervalNanos > 0 ? intervalNanos : 1);
+        next = Clock::now() + interval;
+        running = true;
+    }
+
+    std::string stop() {
+        running = false;
+        std::string collapsed;
+        for (const auto &stack: stacks) {
+            collapsed += stack.first;
+            collapsed += ' ';
+            collapsed += std::to_string(stack.second);
+            collapsed += '\n';
+        }
+        stacks.clear();
+        return collapsed;
+    }
+
+    // Whether a sample should be taken now. Calling this schedules the next sample.
+    bool due() {
+        if (!running)
+            return false;
+        auto now = Clock::now();
+        if (now < next)
+            return false;
+        next = now + interval;
+        return true;
+    }
+
+    // Record a stack, with frames from the leaf up, and an optional bridge trap below the leaf.
+    void record(const std::vector<std::string> &frames, const char *trap) {
+        std::string stack;
+        for (size_t i = frames.size(); i > 0; i--) {
+            if (!stack.empty())
+                stack += ';';
+            stack += frames[i - 1];
+        }
+        if (trap != nullptr) {
+            if (!stack.empty())
+                stack += ';';
+            stack += '[';
+            stack += trap;
+            stack += ']';
+        }
+        if (stack.empty())
+            stack = "[native]";
+        stacks[stack]++;
+    }
+
+    // Record a stack from an Error stack trace, with lines of the form "    at name (file:line)".
+    // Frames from skipFile, the function that created the error, are dropped.
+    void recordStackTrace(const char *stackTrace, const char *skipFile, const char *trap) {
+        std::vector<std::string> frames;
+        const char *line = stackTrace;
+        while (line != nullptr && *line != '\0' && frames.size() < MAX_FRAMES) {
+            const char *end = strchr(line, '\n');
+            std::string frame = end != nullptr ? std::string(line, end - line) : std::string(line);
+            line = end != nullptr ? end + 1 : nullptr;
+
+            size_t at = frame.find("at ");
+            if (at == std::string::npos)
+                continue;
+            frame = frame.substr(at + 3);
+            if (skipFile != nullptr && frame.find(skipFile) != std::string::npos)
+                continue;
+            frames.push_back(stripLine(frame));
+        }
+        record(frames, trap);
+    }
+
+    bool isRunning() const {
+        return running;
+    }
+
+    // frames are named "name (file)", line numbers would split a function by call site.
+    static std::string frameName(const char *name, const char *file) {
+        std::string frame = name != nullptr && *name != '\0' ? name : "<anonymous>";
+        if (file != nullptr && *file != '\0') {
+            frame += " (";
+            frame += file;
+            frame += ')';
+        }
+        return sanitize(frame);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static std::string stripLine(const std::string &frame) {
+        // "name (file:line)" or "name (file:line:column)"
+        size_t open = frame.rfind(" (");
+        if (open == std::string::npos || frame.back() != ')')
+            return sanitize(frame);
+        std::string file = frame.substr(open + 2, frame.size() - open - 3);
+        size_t colon;
+        while ((colon = file.rfind(':')) != std::string::npos && colon + 1 < file.size()
+               && file.find_first_not_of("0123456789", colon + 1) == std::string::npos)
+            file.resize(colon);
+        return frameName(frame.substr(0, open).c_str(), file.c_str());
+    }
+
+    // ';' separates frames in collapsed stacks, the count follows the last space.
+    static std::string sanitize(std::string frame) {
+        for (char &c: frame) {
+            if (c == ';')
+                c = ',';
+        }
+        return frame;
+    }
+
+    bool running;
+    std::chrono::nanoseconds interval;
+    Clock::time_point next;
+    std::unordered_map<std::string, jlong> stacks;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef VALUE_SERIALIZER_H
+#define VALUE_SERIALIZER_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Binary format of QuackContext.serialize. Both engines read and write the same format, so a
+ * value can move between any two contexts.
+ *
+ * A version byte is followed by the value. Each value is a tag, then its payload:
+ *   INT32: zigzag varint. DOUBLE: 8 bytes, little endian. DATE: the time value as a DOUBLE.
+ *   STRING: varint byte length, then UTF-8.
+ *   ARRAY: varint length, then that many values. Holes are written as undefined.
+ *   OBJECT: STRING key and value pairs of the own enumerable properties, then an END tag.
+ *   ARRAY_BUFFER: varint byte length, then the bytes.
+ *   TYPED_ARRAY: the TypedArrayKind byte, then the bytes of the view as an ARRAY_BUFFER payload.
+ *   REFERENCE: varint number of an earlier object.
+ * Objects, arrays, buffers and dates are numbered as they are written, so a reference to one
+ * written earlier preserves shared and cyclic references.
+ */
+class ValueSerializer {
+public:
+    enum Tag {
+        TAG_END = 0,
+        TAG_UNDEFINED,
+        TAG_NULL,
+        TAG_FALSE,
+        TAG_TRUE,
+        TAG_INT32,
+        TAG_DOUBLE,
+        TAG_STRING,
+        TAG_ARRAY,
+        TAG_OBJECT,
+        TAG_ARRAY_BUFFER,
+        TAG_TYPED_ARRAY,
+        TAG_DATE,
+        TAG_REFERENCE,
+    };
+
+    // in the order of the Duktape DUK_BUFOBJ_ typed array flags.
+    enum TypedArrayKind {
+        INT8_ARRAY = 0,
+        UINT8_ARRAY,
+        UINT8_CLAMPED_ARRAY,
+        INT16_ARRAY,
+        UINT16_ARRAY,
+        INT32_ARRAY,
+        UINT32_ARRAY,
+        FLOAT32_ARRAY,
+        FLOAT64_ARRAY,
+        TYPED_ARRAY_KIND_COUNT,
+    };
+
+    enum {
+        VERSION = 1,
+        // nesting deeper than this fails, rather than overflow the native stack.
+        MAX_DEPTH = 1000,
+    };
+
+    static const char *typedArrayName(int kind) {
+        static const char *names[TYPED_ARRAY_KIND_COUNT] = {
+            "Int8Array",
+            "Uint8Array",
+            "Uint8ClampedArray",
+            "Int16Array",
+            "Uint16Array",
+            "Int32Array",
+            "Uint32Array",
+            "Float32Array",
+            "Float64Array",
+        };
+        return names[kind];
+    }
+
+    // numbers that are exactly an int32, other than -0, are written as INT32.
+    static bool isInt32(double value) {
+        if (!(value >= INT32_MIN && value <= INT32_MAX))
+            return false;
+        int32_t i = (int32_t)value;
+        return i == value && (i != 0 || !std::signbit(value));
+    }
+};
+
+class SerializedWriter {
+public:
+    SerializedWriter() {
+        bytes.push_back(ValueSerializer::VERSION);
+    }
+
+    void writeTag(int tag) {
+        bytes.push_back((uint8_t)tag);
+    }
+
+    void writeLength(uint64_t value) {
+        while (value >= 0x80) {
+            bytes.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back((uint8_t)value);
+    }
+
+    void writeInt32(int32_t value) {
+        writeTag(ValueSerializer::TAG_INT32);
+        writeLength(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+    }
+
+    void writeDouble(int tag, double value) {
+        writeTag(tag);
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 8; i++) {
+            bytes.push_back((uint8_t)(bits >> (i * 8)));
+        }
+    }
+
+    void writeNumber(double value) {
+        if (ValueSerializer::isInt32(value))
+            writeInt32((int32_t)value);
+        else
+            writeDouble(ValueSerializer::TAG_DOUBLE, value);
+    }
+
+    // the payload of STRING and ARRAY_BUFFER.
+    void writeData(const void *data, size_t length) {
+        writeLength(length);
+        const uint8_t *start = static_cast<const uint8_t *>(data);
+        bytes.insert(bytes.end(), start, start + length);
+    }
+
+    // Write a reference if the object was written before, otherwise number it and return false
+    // so the caller writes it.
+    bool writeReference(const void *object) {
+        auto found = objects.find(object);
+        if (found != objects.end()) {
+            writeTag(ValueSerializer::TAG_REFERENCE);
+            writeLength(found->second);
+            return true;
+        }
+        uint32_t number = (uint32_t)objects.size();
+        objects[object] = number;
+        return false;
+    }
+
+    const std::vector<uint8_t> &data() const {
+        return bytes;
+    }
+
+private:
+    std::vector<uint8_t> bytes;
+    std::unordered_map<const void *, uint32_t> objects;
+};
+
+// Reads are bounds checked: past the end, or on malformed data, the reader fails and returns
+// zeroes from then on.
+class SerializedReader {
+public:
+    SerializedReader(const uint8_t *data, size_t length)
+        : position(data)
+        , end(data + length)
+        , failed(false) {
+        if (readByte() != ValueSerializer::VERSION)
+            failed = true;
+    }
+
+    bool ok() const {
+        return !failed;
+    }
+
+    bool atEnd() const {
+        return position == end;
+    }
+
+    // every value takes at least a byte, which bounds the length of arrays.
+    size_t remaining() const {
+        return (size_t)(end - position);
+    }
+
+    int readTag() {
+        return (int)readByte();
+    }
+
+    uint64_t readLength() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = readByte();
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        failed = true;
+        return 0;
+    }
+
+    int32_t readInt32() {
+        uint32_t zigzag = (uint32_t)readLength();
+        return (int32_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+    }
+
+    double readDouble() {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            bits |= (uint64_t)readByte() << (i * 8);
+        }
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // the payload of STRING and ARRAY_BUFFER, which stays owned by the reader's data.
+    const uint8_t *readData(size_t *length) {
+        uint64_t size = readLength();
+        if (failed || size > (uint64_t)(end - position)) {
+            failed = true;
+            *length = 0;
+            return position;
+        }
+        const uint8_t *start = position;
+        position += size;
+        *length = (size_t)size;
+        return start;
+    }
+
+    void fail() {
+        failed = true;
+    }
+
+private:
+    uint8_t readByte() {
+        if (failed || position == end) {
+            failed = true;
+            return 0;
+        }
+        return *position++;
+    }
+
+    const uint8_t *position;
+    const uint8_t *end;
+    bool failed;
+};
+
+#endif
@@ -16,6 +16,7 @@
 #include <memory>
 #include <mutex>
 #include <chrono>
+#include <vector>
 #include <jni.h>
 #include "JSContext.h"
 #include "quickjs-jni/QuickJSContext.h"
@@ -24,14 +25,14 @@
 extern "C" {
 
 JNIEXPORT jlong JNICALL
-Java_com_koushikdutta_quack_QuackContext_createContext(JNIEnv* env, jclass type, jobject javaDuktape, jboolean useQuickJS) {
+Java_com_koushikdutta_quack_QuackContext_createContext(JNIEnv* env, jclass type, jobject javaDuktape, jboolean useQuickJS, jint duktapeAllocator) {
     JavaVM* javaVM;
     env->GetJavaVM(&javaVM);
     try {
         if (useQuickJS)
             return reinterpret_cast<jlong>(new QuickJSContext(javaVM, javaDuktape));
         else
-            return reinterpret_cast<jlong>(new DuktapeContext(javaVM, javaDuktape));
+            return reinterpret_cast<jlong>(new DuktapeContext(javaVM, javaDuktape, duktapeAllocator));
     }
     catch (std::bad_alloc&) {
         return 0L;
@@ -70,29 +71,43 @@ Java_com_koushikdutta_quack_QuackContext_stringify(JNIEnv *env, jclass type, jlo
   return reinterpret_cast<JSContext *>(context)->stringify(env, object);
 }
 
+JNIEXPORT jobject JNICALL
+Java_com_koushikdutta_quack_QuackContext_stringifyUtf8(JNIEnv *env, jclass type, jlong context, jlong object, jobject buffer) {
+  return reinterpret_cast<JSContext *>(context)->stringifyUtf8(env, object, buffer);
+}
+
 JNIEXPORT void JNICALL
 Java_com_koushikdutta_quack_QuackContext_setGlobalProperty(JNIEnv *env, jclass type, jlong context,
                                                     jobject property, jobject value) {
     return reinterpret_cast<JSContext *>(context)->setGlobalProperty(env, property, value);
 }
 
-JNIEXPORT void JNICALL
-Java_com_koushikdutta_quack_QuackContext_finalizeJavaScriptObject__JJ(JNIEnv *env, jclass type,
-                                                               jlong context, jlong object) {
-    return reinterpret_cast<JSContext *>(context)->finalizeJavaScriptObject(env, object);
-                                       
+JNIEXPORT jint JNICALL
+Java_com_koushikdutta_quack_QuackContext_finalizeJavaScriptObjects(JNIEnv *env, jclass type, jlong context,
+                                                                   jlongArray handles, jint count, jlong budgetNanos) {
+    return reinterpret_cast<JSContext *>(context)->finalizeJavaScriptObjects(env, handles, count, budgetNanos);
 }
 
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_call(JNIEnv *env, jclass type,
                                            jlong context, jlong object,
                                            jobjectArray args) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::CALL);
     return reinterpret_cast<JSContext *>(context)->call(env, object, args);
 }
 
+JNIEXPORT jobjectArray JNICALL
+Java_com_koushikdutta_quack_QuackContext_callBatch(JNIEnv *env, jclass type,
+                                           jlong context, jlong object,
+                                           jobjectArray argsList) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::CALL);
+    return reinterpret_cast<JSContext *>(context)->callBatch(env, object, argsList);
+}
+
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_callMethod(
         JNIEnv *env, jclass type, jlong context, jlong object, jobject thiz, jobjectArray args) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::CALL);
     return reinterpret_cast<JSContext *>(context)->callMethod(env, object, thiz, args);
 }
 
@@ -101,41 +116,96 @@ Java_com_koushikdutta_quack_QuackContext_callProperty(JNIEnv *env, jclass type,
                                            jlong context, jlong object,
                                            jobject property,
                                            jobjectArray args) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::CALL);
     return reinterpret_cast<JSContext *>(context)->callProperty(env, object, property, args);
 }
 
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_getKeyObject(JNIEnv *env, jclass type, jlong context,
                                                jlong object, jobject key) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::GET_KEY);
     return reinterpret_cast<JSContext *>(context)->getKeyObject(env, object, key);
 }
 
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_getKeyInteger(JNIEnv *env, jclass type, jlong context, jlong object, jint index) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::GET_KEY);
     return reinterpret_cast<JSContext *>(context)->getKeyInteger(env, object, index);
 }
 
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_getKeyString(JNIEnv *env, jclass type, jlong context, jlong object, jstring key) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::GET_KEY);
     return reinterpret_cast<JSContext *>(context)->getKeyString(env, object, key);
 }
 
 JNIEXPORT jboolean JNICALL
 Java_com_koushikdutta_quack_QuackContext_setKeyObject(JNIEnv *env, jclass type, jlong context,
                                                jlong object, jobject key, jobject value) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::SET_KEY);
     return reinterpret_cast<JSContext *>(context)->setKeyObject(env, object, key, value);
 }
 
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_getArrayRange(JNIEnv *env, jclass type, jlong context, jlong object,
+                                                       jint index, jobject array, jint arrayType, jint offset, jint length) {
+    reinterpret_cast<JSContext *>(context)->getArrayRange(env, object, index, (jarray)array, arrayType, offset, length);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_setArrayRange(JNIEnv *env, jclass type, jlong context, jlong object,
+                                                       jint index, jobject array, jint arrayType, jint offset, jint length) {
+    reinterpret_cast<JSContext *>(context)->setArrayRange(env, object, index, (jarray)array, arrayType, offset, length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_koushikdutta_quack_QuackContext_newTypedArray(JNIEnv *env, jclass type, jlong context, jobject array, jint arrayType) {
+    return reinterpret_cast<JSContext *>(context)->newTypedArray(env, (jarray)array, arrayType);
+}
+
 JNIEXPORT jboolean JNICALL
 Java_com_koushikdutta_quack_QuackContext_setKeyInteger(JNIEnv *env, jclass type, jlong context, jlong object, jint index, jobject value) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::SET_KEY);
     return reinterpret_cast<JSContext *>(context)->setKeyInteger(env, object, index, value);
 }
 
 JNIEXPORT jboolean JNICALL
 Java_com_koushikdutta_quack_QuackContext_setKeyString(JNIEnv *env, jclass type, jlong context, jlong object, jstring key, jobject value) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::SET_KEY);
     return reinterpret_cast<JSContext *>(context)->setKeyString(env, object, key, value);
 }
 
+JNIEXPORT jlong JNICALL
+Java_com_koushikdutta_quack_QuackContext_internKey(JNIEnv *env, jclass type, jlong context, jstring key) {
+    return reinterpret_cast<JSContext *>(context)->internKey(env, key);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_releaseKey(JNIEnv *env, jclass type, jlong context, jlong key) {
+    reinterpret_cast<JSContext *>(context)->releaseKey(env, key);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_koushikdutta_quack_QuackContext_getKeyHandle(JNIEnv *env, jclass type, jlong context, jlong object, jlong key) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::GET_KEY);
+    return reinterpret_cast<JSContext *>(context)->getKeyHandle(env, object, key);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_koushikdutta_quack_QuackContext_setKeyHandle(JNIEnv *env, jclass type, jlong context, jlong object, jlong key, jobject value) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::SET_KEY);
+    return reinterpret_cast<JSContext *>(context)->setKeyHandle(env, object, key, value);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_koushikdutta_quack_QuackContext_callPropertyHandle(JNIEnv *env, jclass type,
+                                           jlong context, jlong object,
+                                           jlong key,
+                                           jobjectArray args) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::CALL);
+    return reinterpret_cast<JSContext *>(context)->callPropertyHandle(env, object, key, args);
+}
+
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_compileFunction(
         JNIEnv* env, jclass type, jlong context, jstring code, jstring fname) {
@@ -145,17 +215,148 @@ Java_com_koushikdutta_quack_QuackContext_compileFunction(
 JNIEXPORT jobject JNICALL
 Java_com_koushikdutta_quack_QuackContext_evaluate(
     JNIEnv* env, jclass type, jlong context, jstring code, jstring fname) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::EVALUATE);
     return reinterpret_cast<JSContext *>(context)->evaluate(env, code, fname);
 }
 
+JNIEXPORT jbyteArray JNICALL
+Java_com_koushikdutta_quack_QuackContext_compileBytecode(
+    JNIEnv* env, jclass type, jlong context, jstring code, jstring fname) {
+    return reinterpret_cast<JSContext *>(context)->compileBytecode(env, code, fname);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_koushikdutta_quack_QuackContext_evaluateBytecode(
+    JNIEnv* env, jclass type, jlong context, jbyteArray bytecode) {
+    const BridgeStats::Scope stats(reinterpret_cast<JSContext *>(context)->bridgeStats, BridgeStats::EVALUATE);
+    return reinterpret_cast<JSContext *>(context)->evaluateBytecode(env, bytecode);
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_com_koushikdutta_quack_QuackContext_serialize(JNIEnv *env, jclass type, jlong context, jobject value) {
+    return reinterpret_cast<JSContext *>(context)->serialize(env, value);
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_koushikdutta_quack_QuackContext_deserialize(JNIEnv *env, jclass type, jlong context, jbyteArray data) {
+    return reinterpret_cast<JSContext *>(context)->deserialize(env, data);
+}
+
 JNIEXPORT jlong JNICALL
 Java_com_koushikdutta_quack_QuackContext_getHeapSize__J(JNIEnv *env, jclass type, jlong context) {
     return reinterpret_cast<JSContext *>(context)->getHeapSize(env);
 }
 
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_setHeapLimit(JNIEnv *env, jclass type, jlong context, jlong limit) {
+    reinterpret_cast<JSContext *>(context)->setHeapLimit(env, limit);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_koushikdutta_quack_QuackContext_getHeapHighWaterMark(JNIEnv *env, jclass type, jlong context) {
+    return reinterpret_cast<JSContext *>(context)->getHeapHighWaterMark(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_resetHeapHighWaterMark(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->resetHeapHighWaterMark(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_getMemoryStats(JNIEnv *env, jclass type, jlong context, jlongArray stats, jboolean detailed) {
+    reinterpret_cast<JSContext *>(context)->getMemoryStats(env, stats, detailed);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_getBridgeStats(JNIEnv *env, jclass type, jlong context, jlongArray stats) {
+    std::vector<jlong> values(BridgeStats::COUNT);
+    reinterpret_cast<JSContext *>(context)->bridgeStats.fill(values.data());
+    env->SetLongArrayRegion(stats, 0, BridgeStats::COUNT, values.data());
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_setBridgeStatsEnabled(JNIEnv *env, jclass type, jlong context, jboolean enabled) {
+    reinterpret_cast<JSContext *>(context)->bridgeStats.setEnabled(enabled == JNI_TRUE);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_resetBridgeStats(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->bridgeStats.reset();
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_setGCPolicy(JNIEnv *env, jclass type, jlong context, jint mode, jlong value) {
+    reinterpret_cast<JSContext *>(context)->setGCPolicy(env, mode, value);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_gc(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->gc(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_setZeroCopyBuffers(JNIEnv *env, jclass type, jlong context, jboolean zeroCopy) {
+    reinterpret_cast<JSContext *>(context)->setZeroCopyBuffers(env, zeroCopy);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_unpinBuffer(JNIEnv *env, jclass type, jlong context, jlong pin) {
+    reinterpret_cast<JSContext *>(context)->unpinBuffer(env, pin);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_clearFieldCache(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->clearFieldCache(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_startExecutionBudget(JNIEnv *env, jclass type, jlong context, jlong timeoutNanos) {
+    reinterpret_cast<JSContext *>(context)->startExecutionBudget(env, timeoutNanos);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_stopExecutionBudget(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->stopExecutionBudget(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_interrupt(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->interrupt();
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_startProfiling(JNIEnv *env, jclass type, jlong context, jlong intervalNanos) {
+    reinterpret_cast<JSContext *>(context)->startProfiling(env, intervalNanos);
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_koushikdutta_quack_QuackContext_stopProfiling(JNIEnv *env, jclass type, jlong context) {
+    return reinterpret_cast<JSContext *>(context)->stopProfiling(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_installConsole(JNIEnv *env, jclass type, jlong context) {
+    reinterpret_cast<JSContext *>(context)->installConsole(env);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_installModuleLoader(JNIEnv *env, jclass type, jlong context, jboolean cacheModules) {
+    reinterpret_cast<JSContext *>(context)->installModuleLoader(env, cacheModules);
+}
+
+JNIEXPORT void JNICALL
+Java_com_koushikdutta_quack_QuackContext_setExceptionStackMode(JNIEnv *env, jclass type, jlong context, jint mode) {
+    reinterpret_cast<JSContext *>(context)->setExceptionStackMode(env, mode);
+}
+
 JNIEXPORT void JNICALL
 Java_com_koushikdutta_quack_QuackContext_runJobs(JNIEnv *env, jclass type, jlong context) {
     reinterpret_cast<JSContext *>(context)->runJobs(env);
 }
 
+JNIEXPORT jboolean JNICALL
+Java_com_koushikdutta_quack_QuackContext_hasPendingJobs(JNIEnv *env, jclass type, jlong context) {
+    return reinterpret_cast<JSContext *>(context)->hasPendingJobs(env);
+}
+
 } // extern "C"
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2016 Square, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "DuktapeAllocator.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// The header is padded so the block handed to Duktape keeps malloc's alignment.
+const size_t HEADER_SIZE = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+// Slab size classes are multiples of SLAB_GRANULE, up to SLAB_MAX_SIZE.
+const size_t SLAB_GRANULE = 16;
+const size_t SLAB_MAX_SIZE = 256;
+const size_t SLAB_CLASS_COUNT = SLAB_MAX_SIZE / SLAB_GRANULE;
+const size_t CHUNK_SIZE = 64 * 1024;
+
+inline size_t& blockSize(void* block) {
+  return *static_cast<size_t*>(block);
+}
+
+inline void* toUser(void* block) {
+  return static_cast<char*>(block) + HEADER_SIZE;
+}
+
+inline void* toBlock(void* ptr) {
+  return static_cast<char*>(ptr) - HEADER_SIZE;
+}
+
+} // anonymous namespace
+
+DuktapeAllocator::DuktapeAllocator(int mode)
+    : m_mode(mode == SLAB ? SLAB : HEADER)
+    , m_heapSize(0)
+    , m_allocationCount(0)
+    , m_heapLimit(0)
+    , m_enforceHeapLimit(false)
+    , m_highWaterMark(0)
+    , m_freeLists(SLAB_CLASS_COUNT, nullptr)
+    , m_chunkCursor(nullptr)
+    , m_chunkEnd(nullptr) {
+}
+
+DuktapeAllocator::~DuktapeAllocator() {
+  for (void* chunk : m_chunks) {
+    ::free(chunk);
+  }
+}
+
+int DuktapeAllocator::sizeClass(size_t size) {
+  if (size > SLAB_MAX_SIZE)
+    return -1;
+  if (size == 0)
+    return 0;
+  return (int)((size - 1) / SLAB_GRANULE);
+}
+
+void* DuktapeAllocator::allocSlab(int sizeClass, size_t size) {
+  void* block;
+  FreeBlock* head = m_freeLists[sizeClass];
+  if (head != nullptr) {
+    m_freeLists[sizeClass] = head->next;
+    block = head;
+  }
+  else {
+    const size_t stride = HEADER_SIZE + (sizeClass + 1) * SLAB_GRANULE;
+    if (m_chunkCursor == nullptr || m_chunkCursor + stride > m_chunkEnd) {
+      // the tail of the previous chunk is abandoned, it is smaller than any block.
+      char* chunk = static_cast<char*>(::malloc(CHUNK_SIZE));
+      if (chunk == nullptr)
+        return nullptr;
+      m_chunks.push_back(chunk);
+      m_chunkCursor = chunk;
+      m_chunkEnd = chunk + CHUNK_SIZE;
+    }
+    block = m_chunkCursor;
+    m_chunkCursor += stride;
+  }
+  blockSize(block) = size;
+  m_heapSize += size;
+  m_allocationCount++;
+  grew();
+  return toUser(block);
+}
+
+void* DuktapeAllocator::alloc(size_t size) {
+  if (exceedsHeapLimit(size))
+    return nullptr;
+  return allocBlock(size);
+}
+
+void* DuktapeAllocator::allocBlock(size_t size) {
+  if (m_mode == SLAB) {
+    int slabClass = sizeClass(size);
+    if (slabClass >= 0)
+      return allocSlab(slabClass, size);
+  }
+
+  void* block = ::malloc(HEADER_SIZE + size);
+  if (block == nullptr)
+    return nullptr;
+  blockSize(block) = size;
+  m_heapSize += size;
+  m_allocationCount++;
+  grew();
+  return toUser(block);
+}
+
+void* DuktapeAllocator::realloc(void* ptr, size_t size) {
+  if (ptr == nullptr)
+    return alloc(size);
+
+  void* block = toBlock(ptr);
+  const size_t oldSize = blockSize(block);
+  if (size > oldSize && exceedsHeapLimit(size - oldSize))
+    return nullptr;
+
+  if (m_mode == SLAB) {
+    int oldClass = sizeClass(oldSize);
+    int newClass = sizeClass(size);
+    if (oldClass >= 0 && oldClass == newClass) {
+      // still fits the same slab block.
+      m_heapSize += size - oldSize;
+      grew();
+      blockSize(block) = size;
+      return ptr;
+    }
+    if (oldClass >= 0 || newClass >= 0) {
+      // moving into, out of, or between slab classes. the limit was checked for the growth.
+      void* ret = allocBlock(size);
+      if (ret == nullptr)
+        return nullptr;
+      memcpy(ret, ptr, oldSize < size ? oldSize : size);
+      free(ptr);
+      return ret;
+    }
+  }
+
+  void* ret = ::realloc(block, HEADER_SIZE + size);
+  if (ret == nullptr)
+    return nullptr;
+  m_heapSize += size - oldSize;
+  grew();
+  blockSize(ret) = size;
+  return toUser(ret);
+}
+
+void DuktapeAllocator::free(void* ptr) {
+  if (ptr == nullptr)
+    return;
+
+  void* block = toBlock(ptr);
+  const size_t size = blockSize(block);
+  m_heapSize -= size;
+  m_allocationCount--;
+
+  if (m_mode == SLAB) {
+    int slabClass = sizeClass(size);
+    if (slabClass >= 0) {
+      FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+      freeBlock->next = m_freeLists[slabClass];
+      m_freeLists[slabClass] = freeBlock;
+      return;
+    }
+  }
+
+  ::free(block);
+}
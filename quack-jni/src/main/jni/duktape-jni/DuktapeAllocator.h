@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 Square, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef DUKTAPE_ANDROID_DUKTAPE_ALLOCATOR_H
+#define DUKTAPE_ANDROID_DUKTAPE_ALLOCATOR_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Memory allocator backing a Duktape heap. Every block carries a small header holding its
+ * requested size, so heap size accounting is O(1) per allocation.
+ *
+ * In slab mode, small blocks are additionally carved out of larger chunks and recycled
+ * through per size class free lists, which avoids a malloc/free for the many short lived
+ * allocations Duktape makes. Chunks are only returned to the system when the heap is destroyed.
+ *
+ * An optional heap limit fails allocations that would grow the heap past it, which Duktape
+ * reports as a RangeError after an emergency collection. The limit is only enforced while
+ * enabled, because a failed allocation outside a protected call is fatal to Duktape.
+ *
+ * Not thread safe; a Duktape heap is only ever used by one thread at a time.
+ */
+class DuktapeAllocator {
+public:
+  // Must match the QuackContext.DUKTAPE_ALLOCATOR_* constants.
+  enum Mode {
+    HEADER = 0,
+    SLAB = 1,
+  };
+
+  explicit DuktapeAllocator(int mode);
+  ~DuktapeAllocator();
+  DuktapeAllocator(const DuktapeAllocator &) = delete;
+  DuktapeAllocator & operator=(const DuktapeAllocator &) = delete;
+
+  void* alloc(size_t size);
+  void* realloc(void* ptr, size_t size);
+  void free(void* ptr);
+
+  size_t getHeapSize() const {
+    return m_heapSize;
+  }
+
+  size_t getAllocationCount() const {
+    return m_allocationCount;
+  }
+
+  // 0 for no limit.
+  void setHeapLimit(size_t limit) {
+    m_heapLimit = limit;
+  }
+
+  size_t getHeapLimit() const {
+    return m_heapLimit;
+  }
+
+  // returns whether the limit was enforced before.
+  bool enforceHeapLimit(bool enforce) {
+    bool previous = m_enforceHeapLimit;
+    m_enforceHeapLimit = enforce;
+    return previous;
+  }
+
+  size_t getHighWaterMark() const {
+    return m_highWaterMark;
+  }
+
+  void resetHighWaterMark() {
+    m_highWaterMark = m_heapSize;
+  }
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static int sizeClass(size_t size);
+  bool exceedsHeapLimit(size_t growth) const {
+    return m_enforceHeapLimit && m_heapLimit != 0 && m_heapSize + growth > m_heapLimit;
+  }
+  void grew() {
+    if (m_heapSize > m_highWaterMark)
+      m_highWaterMark = m_heapSize;
+  }
+  void* allocBlock(size_t size);
+  void* allocSlab(int sizeClass, size_t size);
+
+  const Mode m_mode;
+  size_t m_heapSize;
+  size_t m_allocationCount;
+  size_t m_heapLimit;
+  bool m_enforceHeapLimit;
+  size_t m_highWaterMark;
+  std::vector<FreeBlock*> m_freeLists;
+  std::vector<void*> m_chunks;
+  char* m_chunkCursor;
+  char* m_chunkEnd;
+};
+
+#endif // DUKTAPE_ANDROID_DUKTAPE_ALLOCATOR_H
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include "DuktapeContext.h"
+#include <cmath>
 #include <memory>
 #include <string>
 #include <stdexcept>
@@ -28,28 +29,37 @@ namespace {
 
 // Internal names used for properties in the Duktape context's global stash and bound variables.
 // The \xff\xff part keeps the variable hidden from JavaScript (visible through C API only).
-const char* JAVA_VM_PROP_NAME = "\xff\xffjavaVM";
-const char* JAVA_THIS_PROP_NAME = "\xff\xffjava_this";
 const char* JAVASCRIPT_THIS_PROP_NAME = "__javascript_this";
-const char* DUKTAPE_CONTEXT_PROP_NAME = "\xff\xffjava_duktapecontext";
 const char* JAVA_EXCEPTION_PROP_NAME = "\xff\xffjava_exception";
-
-JNIEnv* getJNIEnv(duk_context *ctx) {
-  duk_push_global_stash(ctx);
-  duk_get_prop_string(ctx, -1, JAVA_VM_PROP_NAME);
-  JavaVM* javaVM = static_cast<JavaVM*>(duk_require_pointer(ctx, -1));
-  duk_pop_2(ctx);
-
-  return getEnvFromJavaVM(javaVM);
+const char* JAVA_BUFFER_PROP_NAME = "\xff\xffjava_buffer";
+const char* PINNED_BUFFERS_PROP_NAME = "\xff\xffpinned_buffers";
+const char* INTERNED_KEYS_PROP_NAME = "\xff\xffinterned_keys";
+const char* JAVASCRIPT_OBJECTS_PROP_NAME = "\xff\xffjavascript_objects";
+const char* JAVA_PROXY_PROP_NAME = "\xff\xffjava_proxy";
+const char* JAVA_PROXY_HANDLER_PROP_NAME = "\xff\xffjava_proxy_handler";
+const char* JAVA_OBJECT_FINALIZER_PROP_NAME = "\xff\xffjava_object_finalizer";
+const char* JS_STACK_GETTER_PROP_NAME = "\xff\xffjs_stack_getter";
+const char* JAVA_STACK_GETTER_PROP_NAME = "\xff\xffjava_stack_getter";
+
+// the DuktapeContext is the heap udata passed to duk_create_heap, so finding it does not
+// touch the value stack.
+DuktapeContext* getDuktapeContext(duk_context *ctx) {
+  duk_memory_functions funcs;
+  duk_get_memory_functions(ctx, &funcs);
+  return static_cast<DuktapeContext*>(funcs.udata);
 }
 
-DuktapeContext* getDuktapeContext(duk_context *ctx) {
-  duk_push_global_stash(ctx);
-  duk_get_prop_string(ctx, -1, DUKTAPE_CONTEXT_PROP_NAME);
-  DuktapeContext* duktapeContext = static_cast<DuktapeContext*>(duk_require_pointer(ctx, -1));
-  duk_pop_2(ctx);
+// DUK_USE_EXEC_TIMEOUT_CHECK, polled by Duktape while running scripts. Returning true throws
+// a RangeError, and must keep doing so until the error has bubbled out of Duktape. ctx is the
+// thread being run, which is a coroutine's while it is resumed.
+extern "C" duk_bool_t quack_duktape_exec_timeout_check(void *udata, duk_context *ctx) {
+  DuktapeContext *duktapeContext = static_cast<DuktapeContext*>(udata);
+  duktapeContext->sampleProfileIfDue(ctx, nullptr);
+  return duktapeContext->checkExecutionBudget() ? 1 : 0;
+}
 
-  return duktapeContext;
+JNIEnv* getJNIEnv(duk_context *ctx) {
+  return getEnvFromJavaVM(getDuktapeContext(ctx)->m_javaVM);
 }
 
 duk_int_t eval_string_with_filename(duk_context *ctx, const char *src, const char *fileName) {
@@ -59,11 +69,24 @@ duk_int_t eval_string_with_filename(duk_context *ctx, const char *src, const cha
                                    DUK_COMPILE_NOSOURCE | DUK_COMPILE_STRLEN);
 }
 
+// duk_load_function throws on malformed bytecode, so loading and running the dumped
+// program happens inside a safe call. Mirrors the explicit 'this' binding of duk_eval_raw.
+duk_ret_t load_and_call_bytecode(duk_context *ctx, void *udata) {
+  duk_load_function(ctx);
+  duk_push_global_object(ctx);
+  duk_call_method(ctx, 0);
+  return 1;
+}
+
 // Called by Duktape to handle finalization of bound JavaObjects.
 duk_ret_t javaObjectFinalizer(duk_context *ctx) {
   {
     CHECK_STACK(ctx);
 
+    // the proxy is no longer reused, and the cycle back to it broken.
+    getDuktapeContext(ctx)->m_javaProxies.remove(getJNIEnv(ctx), duk_get_heapptr(ctx, -1));
+    duk_del_prop_string(ctx, -1, JAVA_PROXY_PROP_NAME);
+
     // todo: should this EVER be null? it's a global ref.
     if (duk_get_prop_string(ctx, -1, JAVASCRIPT_THIS_PROP_NAME)) {
       // Remove the global reference from the bound Java object.
@@ -71,6 +94,7 @@ duk_ret_t javaObjectFinalizer(duk_context *ctx) {
       duk_del_prop_string(ctx, -2, JAVASCRIPT_THIS_PROP_NAME);
       if (ptr) {
         getJNIEnv(ctx)->DeleteGlobalRef(static_cast<jobject>(ptr));
+        getDuktapeContext(ctx)->m_memoryStats.javaObjectReleased();
       }
     }
     duk_pop(ctx);
@@ -81,25 +105,17 @@ duk_ret_t javaObjectFinalizer(duk_context *ctx) {
   return 0;
 }
 
-// Called by Duktape to handle finalization of bound JavaScriptObjects.
-void javascriptObjectFinalizerInternal(duk_context *ctx) {
-  CHECK_STACK(ctx);
-
-  // get the pointer or undefined
-  if (duk_get_prop_string(ctx, -1, JAVA_THIS_PROP_NAME)) {
+// Called by Duktape to handle finalization of ArrayBuffers backed by a direct ByteBuffer.
+duk_ret_t javaBufferFinalizer(duk_context *ctx) {
+  if (duk_get_prop_string(ctx, -1, JAVA_BUFFER_PROP_NAME)) {
     void* ptr = duk_require_pointer(ctx, -1);
-    duk_del_prop_string(ctx, -2, JAVA_THIS_PROP_NAME);
+    duk_del_prop_string(ctx, -2, JAVA_BUFFER_PROP_NAME);
     if (ptr) {
-      getJNIEnv(ctx)->DeleteWeakGlobalRef(static_cast<jobject>(ptr));
+      getJNIEnv(ctx)->DeleteGlobalRef(static_cast<jobject>(ptr));
+      getDuktapeContext(ctx)->m_memoryStats.bufferReleased();
     }
   }
-  // pop the pointer or undefined
   duk_pop(ctx);
-}
-
-// Called by Duktape to handle finalization of bound JavaScriptObjects.
-duk_ret_t javascriptObjectFinalizer(duk_context *ctx) {
-  javascriptObjectFinalizerInternal(ctx);
 
   // Pop the object passed in as an argument.
   duk_pop(ctx);
@@ -118,39 +134,28 @@ void fatalErrorHandler(void* udata, const char* msg) {
 #endif
 }
 
+// pushes the JavaScript stack of the error, without any Java stack merged in, through the
+// inherited Error.prototype.stack accessor.
+void pushJavaScriptStack(duk_context *ctx, duk_idx_t error) {
+  error = duk_normalize_index(ctx, error);
+  duk_push_global_stash(ctx);
+  duk_get_prop_string(ctx, -1, JS_STACK_GETTER_PROP_NAME);
+  duk_remove(ctx, -2);
+  duk_dup(ctx, error);
+  // the result, or the error, is read with duk_safe_to_string.
+  duk_pcall_method(ctx, 0);
+}
+
 } // anonymous namespace
 
 static void* tracked_alloc(void *udata, duk_size_t size) {
-  DuktapeContext* context = reinterpret_cast<DuktapeContext*>(udata);
-  void* ret = malloc(size);
-  if (ret != nullptr) {
-      context->pointers[ret] = size;
-      context->m_heapSize += size;
-  }
-  return ret;
+  return reinterpret_cast<DuktapeContext*>(udata)->m_allocator.alloc(size);
 }
 static void *tracked_realloc(void *udata, void *ptr, duk_size_t size) {
-  DuktapeContext* context = reinterpret_cast<DuktapeContext*>(udata);
-  void* ret = realloc(ptr, size);
-  if (ret != nullptr) {
-      if (context->pointers.find(ptr) != context->pointers.end()) {
-          size_t allocated = context->pointers[ptr];
-          context->pointers.erase(ptr);
-          context->m_heapSize -= allocated;
-      }
-      context->pointers[ret] = size;
-      context->m_heapSize += size;
-  }
-  return ret;
+  return reinterpret_cast<DuktapeContext*>(udata)->m_allocator.realloc(ptr, size);
 }
 static void tracked_free(void *udata, void *ptr) {
-  DuktapeContext* context = reinterpret_cast<DuktapeContext*>(udata);
-  if (context->pointers.find(ptr) != context->pointers.end()) {
-    size_t allocated = context->pointers[ptr];
-    context->pointers.erase(ptr);
-    context->m_heapSize -= allocated;
-  }
-  free(ptr);
+  reinterpret_cast<DuktapeContext*>(udata)->m_allocator.free(ptr);
 }
 
 class ContextSwitcher {
@@ -167,16 +172,66 @@ public:
     }
 };
 
+// the heap limit is enforced within protected calls, where a failed allocation becomes a
+// RangeError instead of a fatal error.
+class HeapLimitScope {
+public:
+    DuktapeAllocator& allocator;
+    bool previous;
+    HeapLimitScope(DuktapeAllocator& allocator, bool enforce)
+        : allocator(allocator)
+        , previous(allocator.enforceHeapLimit(enforce)) {
+    }
+    ~HeapLimitScope() {
+        allocator.enforceHeapLimit(previous);
+    }
+};
+
+// run a protected call with the heap limit enforced, values pushed before or popped after it
+// are not limited.
+template <typename ProtectedCall>
+static duk_int_t withHeapLimit(DuktapeAllocator& allocator, ProtectedCall call) {
+    const HeapLimitScope heapLimit(allocator, true);
+    return call();
+}
+
+// samples the profiler as a trap returns, so time spent in Java is attributed to the trap.
+class ProfiledTrap {
+public:
+    DuktapeContext* context;
+    const char* name;
+    ProfiledTrap(DuktapeContext* context, const char* name)
+        : context(context)
+        , name(name) {
+    }
+    ~ProfiledTrap() {
+        context->sampleProfileIfDue(context->m_context, name);
+    }
+};
+
 static duk_ret_t __duktape_get(duk_context *ctx);
 static duk_ret_t __duktape_has(duk_context *ctx);
 static duk_ret_t __duktape_set(duk_context *ctx);
 static duk_ret_t __duktape_apply(duk_context *ctx);
+static duk_ret_t __duktape_console(duk_context *ctx);
+static duk_ret_t __duktape_resolve_module(duk_context *ctx);
+static duk_ret_t __duktape_load_module(duk_context *ctx);
+static duk_ret_t __duktape_java_stack(duk_context *ctx);
 static duk_ret_t __duktape_noop(duk_context *) { return 0; }
 
-DuktapeContext::DuktapeContext(JavaVM* javaVM, jobject javaDuktape)
-    : m_context(duk_create_heap(tracked_alloc, tracked_realloc, tracked_free, this, fatalErrorHandler))
-    , m_heapSize(0)
-    , m_objectType(m_javaValues.getObjectType(getEnvFromJavaVM(javaVM))) {
+DuktapeContext::DuktapeContext(JavaVM* javaVM, jobject javaDuktape, int allocatorMode)
+    : m_javaVM(javaVM)
+    , m_allocator(allocatorMode)
+    , m_context(duk_create_heap(tracked_alloc, tracked_realloc, tracked_free, this, fatalErrorHandler))
+    , m_javaProxies(getEnvFromJavaVM(javaVM))
+    , m_objectType(m_javaValues.getObjectType(getEnvFromJavaVM(javaVM)))
+    // collect after every call, reference counting alone does not free cycles.
+    , m_gcPolicy(GCPolicy::EVERY_N_CALLS, 1)
+    , m_zeroCopyBuffers(false)
+    , m_cacheModules(false)
+    , m_exceptionStackMode(EXCEPTION_STACK_MERGED)
+    , m_nextPinnedBuffer(0)
+    , m_javaScriptObjects(nullptr) {
   if (!m_context) {
     throw std::bad_alloc();
   }
@@ -192,67 +247,145 @@ DuktapeContext::DuktapeContext(JavaVM* javaVM, jobject javaDuktape)
   m_duktapeObjectClass = findClass(env, "com/koushikdutta/quack/QuackObject");
   m_javaScriptObjectClass = findClass(env, "com/koushikdutta/quack/JavaScriptObject");
   m_javaObjectClass = findClass(env, "com/koushikdutta/quack/JavaObject");
+  m_nativeMethodClass = findClass(env, "com/koushikdutta/quack/QuackNativeMethod");
   m_jsonObjectClass = findClass(env, "com/koushikdutta/quack/QuackJsonObject");
   m_byteBufferClass = findClass(env, "java/nio/ByteBuffer");
+  m_byteArrayClass = findClass(env, "[B");
+  m_quackExceptionClass = findClass(env, "com/koushikdutta/quack/QuackException");
 
   m_duktapeHasMethod = env->GetMethodID(m_duktapeClass, "quackHas", "(Lcom/koushikdutta/quack/QuackObject;Ljava/lang/Object;)Z");
   m_duktapeGetMethod = env->GetMethodID(m_duktapeClass, "quackGet", "(Lcom/koushikdutta/quack/QuackObject;Ljava/lang/Object;)Ljava/lang/Object;");
   m_duktapeSetMethod = env->GetMethodID(m_duktapeClass, "quackSet", "(Lcom/koushikdutta/quack/QuackObject;Ljava/lang/Object;Ljava/lang/Object;)Z");
   m_duktapeCallMethodMethod = env->GetMethodID(m_duktapeClass, "quackApply", "(Lcom/koushikdutta/quack/QuackObject;Ljava/lang/Object;[Ljava/lang/Object;)Ljava/lang/Object;");
-
-  m_javaScriptObjectConstructor = env->GetMethodID(m_javaScriptObjectClass, "<init>", "(Lcom/koushikdutta/quack/QuackContext;JJ)V");
+  m_duktapeConsoleMethod = env->GetMethodID(m_duktapeClass, "quackConsole", "(ILjava/lang/String;)V");
+  m_duktapeResolveModuleMethod = env->GetMethodID(m_duktapeClass, "quackResolveModule", "(Ljava/lang/String;Ljava/lang/String;)Ljava/lang/String;");
+  m_duktapeLoadModuleMethod = env->GetMethodID(m_duktapeClass, "quackLoadModule", "(Ljava/lang/String;I)Ljava/lang/Object;");
+  m_duktapeStoreModuleMethod = env->GetMethodID(m_duktapeClass, "quackStoreModule", "(Ljava/lang/String;ILjava/lang/String;[B)V");
+  m_duktapePinBufferMethod = env->GetMethodID(m_duktapeClass, "quackPinBuffer", "(Ljava/nio/ByteBuffer;J)V");
+  m_duktapeJsonBufferMethod = env->GetMethodID(m_duktapeClass, "quackJsonBuffer", "(Ljava/nio/ByteBuffer;I)Ljava/nio/ByteBuffer;");
+  m_duktapeResolveFieldMethod = env->GetMethodID(m_duktapeClass, "quackResolveField", "(Lcom/koushikdutta/quack/JavaObject;Ljava/lang/String;)I");
+
+  m_javaScriptObjectConstructor = env->GetMethodID(m_javaScriptObjectClass, "<init>", "(Lcom/koushikdutta/quack/QuackContext;JJJ)V");
   m_javaObjectConstructor = env->GetMethodID(m_javaObjectClass, "<init>", "(Lcom/koushikdutta/quack/QuackContext;Ljava/lang/Object;)V");
+  m_javaObjectTargetField = env->GetFieldID(m_javaObjectClass, "target", "Ljava/lang/Object;");
+  m_nativeMethodTargetField = env->GetFieldID(m_nativeMethodClass, "target", "Ljava/lang/Object;");
+  m_nativeMethodMethodField = env->GetFieldID(m_nativeMethodClass, "method", "Ljava/lang/reflect/Method;");
+  m_nativeMethodSignatureField = env->GetFieldID(m_nativeMethodClass, "signature", "Ljava/lang/String;");
   m_javaObjectGetObject = env->GetMethodID(duktapeJavaObject, "getObject", "(Ljava/lang/Class;)Ljava/lang/Object;");
   m_byteBufferAllocateDirect = env->GetStaticMethodID(m_byteBufferClass, "allocateDirect", "(I)Ljava/nio/ByteBuffer;");
+  m_addJavaStackMethod = env->GetStaticMethodID(m_quackExceptionClass, "addJavaStack", "(Ljava/lang/String;Ljava/lang/Throwable;)Ljava/lang/String;");
 
   m_contextField = env->GetFieldID(m_javaScriptObjectClass, "context", "J");
   m_pointerField = env->GetFieldID(m_javaScriptObjectClass, "pointer", "J");
 
   m_jsonField = env->GetFieldID(m_jsonObjectClass, "json", "Ljava/lang/String;");
+  m_jsonUtf8Field = env->GetFieldID(m_jsonObjectClass, "utf8", "Ljava/nio/ByteBuffer;");
+  m_jsonPositionField = env->GetFieldID(m_jsonObjectClass, "position", "I");
+  m_jsonLimitField = env->GetFieldID(m_jsonObjectClass, "limit", "I");
 
   m_DebuggerSocket.client_sock = -1;
 
-  // Stash the JVM object in the context, so we can find our way back from a Duktape C callback.
   duk_push_global_stash(m_context);
-  duk_push_pointer(m_context, javaVM);
-  duk_put_prop_string(m_context, -2, JAVA_VM_PROP_NAME);
-  duk_push_pointer(m_context, this);
-  duk_put_prop_string(m_context, -2, DUKTAPE_CONTEXT_PROP_NAME);
+  // JavaScript buffers handed to Java without a copy, by pin id.
+  duk_push_object(m_context);
+  duk_put_prop_string(m_context, -2, PINNED_BUFFERS_PROP_NAME);
+  // interned key strings mapped to their use count. Being a property name keeps the string
+  // alive, so its heap pointer can be used as the key handle.
+  duk_push_object(m_context);
+  duk_put_prop_string(m_context, -2, INTERNED_KEYS_PROP_NAME);
+  // objects held by Java, indexed by handle. Handles are reused densely, so this stays
+  // in the array part.
+  duk_push_array(m_context);
+  duk_put_prop_string(m_context, -2, JAVASCRIPT_OBJECTS_PROP_NAME);
   duk_pop(m_context);
 
-  // bind the traps
+  // the handler and finalizer shared by the proxies of Java objects, see pushObject.
   duk_push_global_stash(m_context);
-
-  std::string proxyScript =
-    "(function(__duktape_has, __duktape_get, __duktape_set, __duktape_apply) {\n"
-    "var __proxyHandler = {\n"
-    "\thas: function(f, prop) { return __duktape_has(f.target, prop); },\n"
-    "\tget: function(f, prop, receiver) { return __duktape_get(f.target, prop, receiver); },\n"
-    "\tset: function(f, prop, value, receiver) { return __duktape_set(f.target, prop, value, receiver); },\n"
-    "\tapply: function(f, thisArg, argumentsList) { return __duktape_apply(f.target, thisArg, argumentsList); },\n"
-    "};\n"
-    "return function(obj) {\n"
-    "\tfunction f() {};\n"
-    "\tf.target = obj;\n"
-    "\treturn new Proxy(f, __proxyHandler);\n"
-    "};\n"
-    "});\n";
-  duk_eval_string(m_context, proxyScript.c_str());
-
-  // proxy traps
+  duk_push_object(m_context);
   duk_push_c_function(m_context, __duktape_has, 2);
+  duk_put_prop_string(m_context, -2, "has");
   duk_push_c_function(m_context, __duktape_get, 3);
+  duk_put_prop_string(m_context, -2, "get");
   duk_push_c_function(m_context, __duktape_set, 4);
+  duk_put_prop_string(m_context, -2, "set");
   duk_push_c_function(m_context, __duktape_apply, 3);
-
-  duk_pcall(m_context, 4);
-  duk_put_prop_string(m_context, -2, "__makeProxy");
-
+  duk_put_prop_string(m_context, -2, "apply");
+  duk_put_prop_string(m_context, -2, JAVA_PROXY_HANDLER_PROP_NAME);
+  duk_push_c_function(m_context, javaObjectFinalizer, 1);
+  duk_put_prop_string(m_context, -2, JAVA_OBJECT_FINALIZER_PROP_NAME);
+  // errors thrown from Java replace the inherited stack accessor with one that merges in the
+  // Java stack when read, see checkRethrowDuktapeErrorInternal.
+  duk_get_global_string(m_context, "Error");
+  duk_get_prop_string(m_context, -1, "prototype");
+  duk_push_string(m_context, "stack");
+  duk_get_prop_desc(m_context, -2, 0);
+  duk_get_prop_string(m_context, -1, "get");
+  duk_put_prop_string(m_context, -5, JS_STACK_GETTER_PROP_NAME);
+  duk_pop_3(m_context);
+  duk_push_c_function(m_context, __duktape_java_stack, 0);
+  duk_put_prop_string(m_context, -2, JAVA_STACK_GETTER_PROP_NAME);
   duk_pop(m_context);
 }
 
 jlong DuktapeContext::getHeapSize(JNIEnv *env) {
-  return m_heapSize;
+  return (jlong)m_allocator.getHeapSize();
+}
+
+void DuktapeContext::setHeapLimit(JNIEnv *env, jlong limit) {
+  m_allocator.setHeapLimit(limit > 0 ? (size_t)limit : 0);
+}
+
+jlong DuktapeContext::getHeapHighWaterMark(JNIEnv *env) {
+  return (jlong)m_allocator.getHighWaterMark();
+}
+
+void DuktapeContext::resetHeapHighWaterMark(JNIEnv *env) {
+  m_allocator.resetHighWaterMark();
+}
+
+void DuktapeContext::getMemoryStats(JNIEnv *env, jlongArray stats, jboolean detailed) {
+  // Duktape has no API to walk its heap, so the detailed stats are never filled in.
+  jlong values[MemoryStats::COUNT];
+  for (jlong &value: values) {
+    value = -1;
+  }
+  values[MemoryStats::HEAP_SIZE] = (jlong)m_allocator.getHeapSize();
+  values[MemoryStats::HEAP_HIGH_WATER_MARK] = (jlong)m_allocator.getHighWaterMark();
+  values[MemoryStats::HEAP_LIMIT] = (jlong)m_allocator.getHeapLimit();
+  values[MemoryStats::ALLOCATION_COUNT] = (jlong)m_allocator.getAllocationCount();
+  values[MemoryStats::JAVASCRIPT_OBJECT_COUNT] = (jlong)m_javaScriptObjects.size();
+  m_memoryStats.fill(values);
+  env->SetLongArrayRegion(stats, 0, MemoryStats::COUNT, values);
+}
+
+void DuktapeContext::setGCPolicy(JNIEnv *env, jint mode, jlong value) {
+  m_gcPolicy.set(mode, value);
+  m_gcPolicy.collected((jlong)m_allocator.getHeapSize());
+}
+
+void DuktapeContext::gc(JNIEnv *env) {
+  m_memoryStats.collect([this] {
+    duk_gc(m_context, 0);
+  });
+  m_gcPolicy.collected((jlong)m_allocator.getHeapSize());
+}
+
+void DuktapeContext::collectGarbageIfNeeded() {
+  if (m_gcPolicy.shouldCollect((jlong)m_allocator.getHeapSize()))
+    gc(nullptr);
+}
+
+void DuktapeContext::setZeroCopyBuffers(JNIEnv *env, jboolean zeroCopy) {
+  m_zeroCopyBuffers = zeroCopy != JNI_FALSE;
+}
+
+void DuktapeContext::unpinBuffer(JNIEnv *env, jlong pin) {
+  CHECK_STACK(m_context);
+
+  duk_push_global_stash(m_context);
+  duk_get_prop_string(m_context, -1, PINNED_BUFFERS_PROP_NAME);
+  duk_del_prop_index(m_context, -1, (duk_uarridx_t)pin);
+  duk_pop_2(m_context);
 }
 
 jclass DuktapeContext::findClass(JNIEnv *env, const char *className) {
@@ -260,9 +393,13 @@ jclass DuktapeContext::findClass(JNIEnv *env, const char *className) {
 }
 
 DuktapeContext::~DuktapeContext() {
+  JNIEnv* env = getEnvFromJavaVM(m_javaVM);
+  clearFieldCache(env);
   duk_trans_socket_finish(&m_DebuggerSocket);
   // Delete the proxies before destroying the heap.
   duk_destroy_heap(m_context);
+  m_backReferences.clear(env);
+  m_javaProxies.clear(env);
 }
 
 jobject DuktapeContext::popObject(JNIEnv *env) const {
@@ -270,110 +407,96 @@ jobject DuktapeContext::popObject(JNIEnv *env) const {
   const int supportedTypeMask = DUK_TYPE_MASK_BOOLEAN | DUK_TYPE_MASK_NUMBER | DUK_TYPE_MASK_STRING;
   if (duk_check_type_mask(m_context, -1, supportedTypeMask)) {
     // The result is a supported scalar type - return it.
+    bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::PRIMITIVE);
     return m_objectType->pop(m_context, env, false).l;
   }
   else if (duk_is_buffer_data(m_context, -1)) {
+      bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::BUFFER);
       duk_size_t size;
       void* p = duk_get_buffer_data(m_context, -1, &size);
-      jobject byteBuffer = env->CallStaticObjectMethod(m_byteBufferClass, m_byteBufferAllocateDirect, (jint)size);
-      memcpy(env->GetDirectBufferAddress(byteBuffer), p, size);
+      jobject byteBuffer;
+      // dynamic buffers may be reallocated, so they are always copied.
+      if (m_zeroCopyBuffers && p != nullptr && !duk_is_dynamic_buffer(m_context, -1)) {
+        byteBuffer = env->NewDirectByteBuffer(p, (jlong)size);
+        // keep the buffer alive until the Java side is collected and unpinBuffer is called.
+        duk_uint_t pin = m_nextPinnedBuffer++;
+        duk_push_global_stash(m_context);
+        duk_get_prop_string(m_context, -1, PINNED_BUFFERS_PROP_NAME);
+        duk_dup(m_context, -3);
+        duk_put_prop_index(m_context, -2, pin);
+        duk_pop_2(m_context);
+        env->CallVoidMethod(m_javaDuktape, m_duktapePinBufferMethod, byteBuffer, (jlong)pin);
+      }
+      else {
+        byteBuffer = env->CallStaticObjectMethod(m_byteBufferClass, m_byteBufferAllocateDirect, (jint)size);
+        memcpy(env->GetDirectBufferAddress(byteBuffer), p, size);
+      }
       duk_pop(m_context);
       return byteBuffer;
   }
   else if (duk_get_type(m_context, -1) == DUK_TYPE_OBJECT) {
-    jobject javaThis = nullptr;
-
-    // JavaScriptObject and JavaObject both contain an internal "this" which points to the Java
-    // instance of that object. Try to extract that object.
-
-    // Duktape Java Proxy can NOT be queried for JAVA_THIS_PROP_NAME since it is a special hidden
-    // key (check the string prefix). So, query for JAVASCRIPT_THIS_PROP_NAME, which is
-    // a "normal" key. The proxy trap will not be invoked otherwise. This key is not enumerated
-    // due to the Java side proxy implementation.
-
-    // However, Duktape JavaScript objects should use JAVA_THIS_PROP_NAME, because
-    // JAVASCRIPT_THIS_PROP_NAME is publicly visible and this causes key iteration pollution issues.
-
-    duk_bool_t hasThis = duk_has_prop_string(m_context, -1, JAVASCRIPT_THIS_PROP_NAME);
-    if (hasThis) {
-        duk_get_prop_string(m_context, -1, JAVASCRIPT_THIS_PROP_NAME);
-    }
-    else {
-        // this code will not be trapped on Duktape Java Proxy due to the key name.
-        hasThis = duk_has_prop_string(m_context, -1, JAVA_THIS_PROP_NAME);
-        if (hasThis) {
-            duk_get_prop_string(m_context, -1, JAVA_THIS_PROP_NAME);
-        }
+    // an object that was passed to Java before comes back as the same JavaScriptObject.
+    jobject javaThis = m_backReferences.find(env, duk_get_heapptr(m_context, -1));
+    if (javaThis != nullptr) {
+      bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::JAVASCRIPT_OBJECT);
+      duk_pop(m_context);
+      return javaThis;
     }
 
-    if (hasThis) {
+    // JavaObject contains an internal "this" which points to the Java instance of that object.
+    // Try to extract that object. Duktape Java Proxy can NOT be queried for a hidden key (check
+    // the string prefix), so JAVASCRIPT_THIS_PROP_NAME is a "normal" key, which the proxy trap
+    // will not be invoked for. This key is not enumerated due to the Java side proxy
+    // implementation.
+    if (duk_get_prop_string(m_context, -1, JAVASCRIPT_THIS_PROP_NAME)) {
       javaThis = reinterpret_cast<jobject>(duk_get_pointer(m_context, -1));
-      // pop the pointer
-      duk_pop(m_context);
-      // Duktape JavaScript objects only hold weak references to their Java counterparts, which
-      // may be invalid. Check this, and delete as necessary.
-      if (javaThis && env->IsSameObject(javaThis, nullptr)) {
-        env->DeleteWeakGlobalRef(javaThis);
-        javaThis = nullptr;
-        duk_del_prop_string(m_context, -1, JAVA_THIS_PROP_NAME);
-      }
     }
+    // pop the pointer
+    duk_pop(m_context);
 
     if (javaThis != nullptr) {
-      // found an existing Java proxy tucked away in this object. Must create a
-      // local ref before popping, because the pop finalizer may destroy the global (weak) ref.
+      // found an existing Java proxy tucked away in this object.
+      bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::JAVA_OBJECT);
       javaThis = env->NewLocalRef(javaThis);
       duk_pop(m_context);
       return javaThis;
     }
 
-    // get the pointer to this JavaScript object
-    void* ptr = duk_get_heapptr(m_context, -1);
-
-    // hold a reference to this JavaScript object in the stash by mapping the JavaScript object pointer to
-    // object itself.
-    duk_push_global_stash(m_context);
-    duk_dup(m_context, -2);
-    // use the pointer as an index for uniqueness. might be risky due to precision loss, but probably not.
-    // can't use use duk_put_prop_heapptr since Objects as keys clobber each other:
-    //      > f[{}] = 0
-    //      0
-    //      > f
-    //              { '[object Object]': 0 }
-    //      > f[{}] = 2
-    //      2
-    //      > f
-    //              { '[object Object]': 2 }
-    //      > f[{2:3}] = 4
-    //      4
-    //      > f
-    //              { '[object Object]': 4 }
-    duk_uarridx_t heapIndex = (duk_uarridx_t)reinterpret_cast<long>(ptr);
-    duk_put_prop_index(m_context, -2, heapIndex);
-    // pop the stash containing the hard reference
+    return popJavaScriptObject(env);
+  } else {
+    // The result is an unsupported type, undefined, or null.
+    bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::NULL_VALUE);
     duk_pop(m_context);
+    return nullptr;
+  }
+}
 
-    // create a new holder for this JavaScript object
-    javaThis = env->NewObject(m_javaScriptObjectClass, m_javaScriptObjectConstructor, m_javaDuktape, reinterpret_cast<jlong>(this), reinterpret_cast<jlong>(ptr));
+// Wrap the object on top of the stack in a new JavaScriptObject, and pop it.
+jobject DuktapeContext::popJavaScriptObject(JNIEnv *env) const {
+  // get the pointer to this JavaScript object
+  void* ptr = duk_get_heapptr(m_context, -1);
 
-    jweak weakRef = env->NewWeakGlobalRef(javaThis);
-    // set a finalizer for the weak ref
-    duk_push_c_function(m_context, javascriptObjectFinalizer, 1);
-    duk_set_finalizer(m_context, -2);
+  // hold a reference to this JavaScript object at its handle's index in the stash.
+  jlong handle = m_javaScriptObjects.add(ptr);
+  duk_push_global_stash(m_context);
+  duk_get_prop_string(m_context, -1, JAVASCRIPT_OBJECTS_PROP_NAME);
+  duk_dup(m_context, -3);
+  duk_put_prop_index(m_context, -2, (duk_uarridx_t)handle);
+  // pop the objects array and the stash
+  duk_pop_2(m_context);
 
-    // attach the Java object's weak reference to the JavaScript object
-    duk_push_pointer(m_context, weakRef);
-    duk_put_prop_string(m_context, -2, JAVA_THIS_PROP_NAME);
+  // create a new holder for this JavaScript object
+  jobject javaThis = env->NewObject(m_javaScriptObjectClass, m_javaScriptObjectConstructor, m_javaDuktape, reinterpret_cast<jlong>(this), reinterpret_cast<jlong>(ptr), handle);
 
-    // pop the JavaScript object, it is hard referenced
-    duk_pop(m_context);
+  // remember the Java object, without touching the JavaScript object.
+  m_backReferences.add(env, ptr, javaThis, handle);
+  bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::JAVASCRIPT_OBJECT);
+  bridgeStats.weakRefCreated();
 
-    return javaThis;
-  } else {
-    // The result is an unsupported type, undefined, or null.
-    duk_pop(m_context);
-    return nullptr;
-  }
+  // pop the JavaScript object, it is hard referenced
+  duk_pop(m_context);
+
+  return javaThis;
 }
 
 jobject DuktapeContext::popObject2(JNIEnv *env) const {
@@ -382,12 +505,113 @@ jobject DuktapeContext::popObject2(JNIEnv *env) const {
   return ret;
 }
 
+void DuktapeContext::clearFieldCache(JNIEnv *env) {
+  m_fieldCache.clear(env, [](const std::string&) {});
+  m_nativeMethods.clear(env);
+}
+
+jstring DuktapeContext::stopProfiling(JNIEnv *env) {
+  return env->NewStringUTF(m_profiler.stop().c_str());
+}
+
+// called from the executor interrupt and bridge traps, so it may only leave the value stack of
+// ctx, the running thread, as it was found.
+void DuktapeContext::sampleProfile(duk_context *ctx, const char *trap) {
+  const HeapLimitScope heapLimit(m_allocator, false);
+  if (!duk_check_stack(ctx, 3)) {
+    return;
+  }
+  std::vector<std::string> frames;
+  // a trap's own entry is the native wrapper, which the trap frame replaces.
+  for (duk_int_t level = trap != nullptr ? -2 : -1; frames.size() < Profiler::MAX_FRAMES; level--) {
+    duk_inspect_callstack_entry(ctx, level);
+    if (duk_is_undefined(ctx, -1)) {
+      duk_pop(ctx);
+      break;
+    }
+    duk_get_prop_string(ctx, -1, "function");
+    duk_get_prop_string(ctx, -1, "name");
+    duk_get_prop_string(ctx, -2, "fileName");
+    frames.push_back(Profiler::frameName(duk_get_string(ctx, -2), duk_get_string(ctx, -1)));
+    duk_pop_n(ctx, 4);
+  }
+  m_profiler.record(frames, trap);
+}
+
+// check for a public field on the object wrapped by a JavaObject, which can be accessed directly.
+bool DuktapeContext::findField(JNIEnv *env, jobject object, const std::string& prop, jobject* target, FieldCache<std::string>::Field* field) {
+  if (!env->IsInstanceOf(object, m_javaObjectClass))
+    return false;
+  jobject found = env->GetObjectField(object, m_javaObjectTargetField);
+  if (found == nullptr)
+    return false;
+  jclass targetClass = env->GetObjectClass(found);
+  *field = m_fieldCache.lookup(env, m_javaDuktape, m_duktapeResolveFieldMethod, object, targetClass, prop, [](const std::string& key) {
+    return key;
+  });
+  env->DeleteLocalRef(targetClass);
+  if (field->kind == FieldCache<std::string>::NONE) {
+    env->DeleteLocalRef(found);
+    return false;
+  }
+  *target = found;
+  return true;
+}
+
 duk_ret_t DuktapeContext::duktapeSet() {
   JNIEnv *env = getJNIEnv(m_context);
 
   // pop the receiver, useless
   duk_pop(m_context);
 
+  // the value, prop, and target are still on the stack. try a direct field write first.
+  if (duk_get_type(m_context, -2) == DUK_TYPE_STRING) {
+    std::string prop = duk_get_string(m_context, -2);
+    duk_get_prop_string(m_context, -3, JAVASCRIPT_THIS_PROP_NAME);
+    jobject object = static_cast<jobject>(duk_get_pointer(m_context, -1));
+    duk_pop(m_context);
+
+    jobject target;
+    FieldCache<std::string>::Field field;
+    if (object != nullptr && findField(env, object, prop, &target, &field)) {
+      // final fields and values that need coercion take the regular path, which reports errors.
+      bool set = false;
+      if (!field.isFinal) {
+        set = true;
+        duk_int_t type = duk_get_type(m_context, -1);
+        if (field.kind == FieldCache<std::string>::INT && type == DUK_TYPE_NUMBER) {
+          env->SetIntField(target, field.id, FieldCache<std::string>::toJavaInt(duk_get_number(m_context, -1)));
+        }
+        else if (field.kind == FieldCache<std::string>::DOUBLE && type == DUK_TYPE_NUMBER) {
+          env->SetDoubleField(target, field.id, duk_get_number(m_context, -1));
+        }
+        else if (field.kind == FieldCache<std::string>::BOOLEAN && type == DUK_TYPE_BOOLEAN) {
+          env->SetBooleanField(target, field.id, (jboolean)duk_get_boolean(m_context, -1));
+        }
+        else if (field.kind == FieldCache<std::string>::STRING && type == DUK_TYPE_STRING) {
+          jobject value = popObject(env);
+          // keep the stack layout for the pop below.
+          duk_push_undefined(m_context);
+          env->SetObjectField(target, field.id, value);
+          env->DeleteLocalRef(value);
+        }
+        else if (field.kind == FieldCache<std::string>::STRING && (type == DUK_TYPE_NULL || type == DUK_TYPE_UNDEFINED)) {
+          env->SetObjectField(target, field.id, nullptr);
+        }
+        else {
+          set = false;
+        }
+      }
+      env->DeleteLocalRef(target);
+      if (set) {
+        // pop the value, prop, and target
+        duk_pop_3(m_context);
+        duk_push_boolean(m_context, true);
+        return 1;
+      }
+    }
+  }
+
   // pop the value
   jobject value = popObject(env);
   // pop the prop
@@ -426,6 +650,10 @@ static duk_ret_t __duktape_set(duk_context *ctx) {
     DuktapeContext *duktapeContext = getDuktapeContext(ctx);
     {
         const ContextSwitcher _(duktapeContext, ctx);
+        // Java may call back into the context, pushing values outside a protected call.
+        const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+        const ProfiledTrap trap(duktapeContext, "duktapeSet");
+        const BridgeStats::Scope stats(duktapeContext->bridgeStats, BridgeStats::TRAP_SET);
         duk_ret_t ret = duktapeContext->duktapeSet();
         if (ret != DUK_RET_ERROR) {
             return ret;
@@ -444,7 +672,8 @@ duk_ret_t DuktapeContext::duktapeGet() {
   jobject object;
   {
     std::string prop;
-    if (duk_get_type(m_context, -1) == DUK_TYPE_STRING) {
+    bool stringProp = duk_get_type(m_context, -1) == DUK_TYPE_STRING;
+    if (stringProp) {
       // get the property name
       const char* cprop = duk_get_string(m_context, -1);
       prop = cprop;
@@ -454,7 +683,8 @@ duk_ret_t DuktapeContext::duktapeGet() {
           duk_push_undefined(m_context);
           return 1;
       }
-      jprop = env->NewStringUTF(cprop);
+      // created below, unless the property is a field that can be read directly.
+      jprop = nullptr;
       // pop the property
       duk_pop(m_context);
     }
@@ -479,6 +709,30 @@ duk_ret_t DuktapeContext::duktapeGet() {
       duk_push_pointer(m_context, object);
       return 1;
     }
+
+    if (stringProp) {
+      jobject target;
+      FieldCache<std::string>::Field field;
+      if (findField(env, object, prop, &target, &field)) {
+        switch (field.kind) {
+          case FieldCache<std::string>::INT:
+            duk_push_int(m_context, env->GetIntField(target, field.id));
+            break;
+          case FieldCache<std::string>::BOOLEAN:
+            duk_push_boolean(m_context, env->GetBooleanField(target, field.id));
+            break;
+          case FieldCache<std::string>::DOUBLE:
+            duk_push_number(m_context, env->GetDoubleField(target, field.id));
+            break;
+          default:
+            pushObject(env, env->GetObjectField(target, field.id));
+            break;
+        }
+        env->DeleteLocalRef(target);
+        return 1;
+      }
+      jprop = env->NewStringUTF(prop.c_str());
+    }
   }
 
   jclass objectClass = env->GetObjectClass(object);
@@ -505,6 +759,10 @@ static duk_ret_t __duktape_get(duk_context *ctx) {
   DuktapeContext *duktapeContext = getDuktapeContext(ctx);
     {
         const ContextSwitcher _(duktapeContext, ctx);
+        // Java may call back into the context, pushing values outside a protected call.
+        const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+        const ProfiledTrap trap(duktapeContext, "duktapeGet");
+        const BridgeStats::Scope stats(duktapeContext->bridgeStats, BridgeStats::TRAP_GET);
         duk_ret_t ret = duktapeContext->duktapeGet();
         if (ret != DUK_RET_ERROR) {
             return ret;
@@ -567,6 +825,10 @@ static duk_ret_t __duktape_has(duk_context *ctx) {
   DuktapeContext *duktapeContext = getDuktapeContext(ctx);
     {
         const ContextSwitcher _(duktapeContext, ctx);
+        // Java may call back into the context, pushing values outside a protected call.
+        const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+        const ProfiledTrap trap(duktapeContext, "duktapeHas");
+        const BridgeStats::Scope stats(duktapeContext->bridgeStats, BridgeStats::TRAP_HAS);
         duk_ret_t ret = duktapeContext->duktapeHas();
         if (ret != DUK_RET_ERROR) {
             return ret;
@@ -575,90 +837,570 @@ static duk_ret_t __duktape_has(duk_context *ctx) {
     duk_throw(ctx);
 }
 
-duk_ret_t DuktapeContext::duktapeApply() {
+static duk_ret_t console_to_string(duk_context *ctx, void *) {
+  if (!duk_is_symbol(ctx, 0)) {
+    duk_to_string(ctx, 0);
+    return 1;
+  }
+  // symbols can not be converted implicitly.
+  duk_get_global_string(ctx, "String");
+  duk_dup(ctx, 0);
+  duk_call(ctx, 1);
+  return 1;
+}
+
+static duk_ret_t console_to_number(duk_context *ctx, void *udata) {
+  const bool integer = *static_cast<bool*>(udata);
+  const double number = duk_to_number(ctx, 0);
+  duk_push_number(ctx, integer ? std::trunc(number) : number);
+  duk_to_string(ctx, -1);
+  return 1;
+}
+
+static duk_ret_t console_json(duk_context *ctx, void *) {
+  duk_json_encode(ctx, 0);
+  return 1;
+}
+
+static duk_ret_t console_inspect(duk_context *ctx, void *udata) {
+  if (duk_is_error(ctx, 0)) {
+    duk_get_prop_string(ctx, 0, "stack");
+    if (duk_is_string(ctx, -1))
+      return 1;
+    duk_pop(ctx);
+  } else if (duk_is_object(ctx, 0) && !duk_is_function(ctx, 0)) {
+    // cycles can not be written as JSON, fall back to String(value).
+    duk_dup(ctx, 0);
+    if (duk_safe_call(ctx, console_json, nullptr, 1, 1) == DUK_EXEC_SUCCESS && duk_is_string(ctx, -1))
+      return 1;
+    duk_pop(ctx);
+  }
+  return console_to_string(ctx, udata);
+}
+
+// console arguments for ConsoleFormatter, at the bottom of the stack. Each conversion runs in a
+// safe call; the error of one that fails is left on top of the stack and fails the rest.
+class DuktapeConsoleArgs {
+public:
+  DuktapeConsoleArgs(duk_context *ctx)
+    : m_ctx(ctx)
+    , m_count((size_t)duk_get_top(ctx))
+    , m_failed(false) {
+  }
+
+  size_t count() const {
+    return m_count;
+  }
+
+  bool isString(size_t i) const {
+    return duk_is_string(m_ctx, (duk_idx_t)i) != 0;
+  }
+
+  std::string toString(size_t i) {
+    return convert(i, console_to_string, nullptr);
+  }
+
+  std::string toNumber(size_t i, bool integer) {
+    return convert(i, console_to_number, &integer);
+  }
+
+  std::string inspect(size_t i) {
+    return convert(i, console_inspect, nullptr);
+  }
+
+  bool ok() const {
+    return !m_failed;
+  }
+
+private:
+  std::string convert(size_t i, duk_safe_call_function func, void *udata) {
+    if (m_failed)
+      return std::string();
+    duk_dup(m_ctx, (duk_idx_t)i);
+    if (duk_safe_call(m_ctx, func, udata, 1, 1) != DUK_EXEC_SUCCESS) {
+      m_failed = true;
+      return std::string();
+    }
+    duk_size_t length;
+    const char* str = duk_get_lstring(m_ctx, -1, &length);
+    std::string ret(str, length);
+    duk_pop(m_ctx);
+    return ret;
+  }
+
+  duk_context* m_ctx;
+  size_t m_count;
+  bool m_failed;
+};
+
+duk_ret_t DuktapeContext::duktapeConsole(int method) {
   JNIEnv *env = getJNIEnv(m_context);
 
-  // unpack the arguments
-  duk_size_t argLen = duk_get_length(m_context, -1);
-  jobjectArray javaArgs = env->NewObjectArray((jsize)argLen, m_objectClass, nullptr);
-  for (duk_uarridx_t i = 0; i < argLen; i++) {
-    duk_get_prop_index(m_context, -1, i);
-    env->SetObjectArrayElement(javaArgs, (jsize)i, popObject(env));
+  int level = method;
+  size_t first = 0;
+  if (method == ConsoleFormatter::ASSERT) {
+    if (duk_get_top(m_context) > 0 && duk_to_boolean(m_context, 0))
+      return 0;
+    level = ConsoleFormatter::ERROR;
+    first = 1;
   }
-  // done, pop the argument list
-  duk_pop(m_context);
 
-  // get java this
-  jobject javaThis = popObject(env);
+  DuktapeConsoleArgs args(m_context);
+  std::string message = ConsoleFormatter::format(args, first);
+  if (!args.ok())
+    return DUK_RET_ERROR;
+  if (method == ConsoleFormatter::ASSERT)
+    message = ConsoleFormatter::assertion(message);
 
-  // get the java reference
-  duk_get_prop_string(m_context, -1, JAVASCRIPT_THIS_PROP_NAME);
-  jobject object = static_cast<jobject>(duk_require_pointer(m_context, -1));
-  duk_pop_2(m_context);
+  jstring jmessage = env->NewStringUTF(message.c_str());
+  env->CallVoidMethod(m_javaDuktape, m_duktapeConsoleMethod, (jint)level, jmessage);
+  env->DeleteLocalRef(jmessage);
+  if (!checkRethrowDuktapeErrorException(env, m_context)) {
+    return DUK_RET_ERROR;
+  }
+  return 0;
+}
 
-  jclass objectClass = env->GetObjectClass(object);
-  jboolean assignable = env->IsAssignableFrom(objectClass, m_duktapeObjectClass);
-  env->DeleteLocalRef(objectClass);
-  if (!assignable) {
-    env->DeleteLocalRef(javaArgs);
-    fatalErrorHandler(object, "Object is not DuktapeObject");
-    return DUK_RET_REFERENCE_ERROR;
+static duk_ret_t __duktape_console(duk_context *ctx) {
+  DuktapeContext *duktapeContext = getDuktapeContext(ctx);
+  {
+    const ContextSwitcher _(duktapeContext, ctx);
+    const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+    const ProfiledTrap trap(duktapeContext, "duktapeConsole");
+    duk_ret_t ret = duktapeContext->duktapeConsole(duk_get_current_magic(ctx));
+    if (ret != DUK_RET_ERROR) {
+      return ret;
+    }
   }
+  duk_throw(ctx);
+}
 
-  jobject push = env->CallObjectMethod(m_javaDuktape, m_duktapeCallMethodMethod, object, javaThis, javaArgs);
-  env->DeleteLocalRef(javaArgs);
+// the stack of an error thrown from Java, merged with the Java stack on first read.
+duk_ret_t DuktapeContext::duktapeJavaStack() {
+  JNIEnv *env = getJNIEnv(m_context);
+
+  duk_push_this(m_context);
+  if (!duk_get_prop_string(m_context, -1, JAVA_EXCEPTION_PROP_NAME)) {
+    duk_pop(m_context);
+    pushJavaScriptStack(m_context, -1);
+    return 1;
+  }
+  jobject wrappedEx = popObject(env);
+  jthrowable ex = (jthrowable)env->CallObjectMethod(wrappedEx, m_javaObjectGetObject, nullptr);
+  env->DeleteLocalRef(wrappedEx);
+  pushJavaScriptStack(m_context, -1);
+  jstring jsStack = env->NewStringUTF(duk_safe_to_string(m_context, -1));
+  duk_pop(m_context);
+
+  jobject newStack = env->CallStaticObjectMethod(m_quackExceptionClass, m_addJavaStackMethod, jsStack, ex);
+  env->DeleteLocalRef(jsStack);
+  env->DeleteLocalRef(ex);
   if (!checkRethrowDuktapeErrorException(env, m_context)) {
     return DUK_RET_ERROR;
   }
 
-  pushObject(env, push);
+  // replace the accessor, so the merge happens once.
+  duk_push_string(m_context, "stack");
+  pushObject(env, newStack);
+  env->DeleteLocalRef(newStack);
+  duk_dup_top(m_context);
+  duk_insert(m_context, -4);
+  // [stack this "stack" stack]
+  duk_def_prop(m_context, -3, DUK_DEFPROP_HAVE_VALUE | DUK_DEFPROP_SET_WRITABLE | DUK_DEFPROP_SET_CONFIGURABLE);
+  duk_pop(m_context);
   return 1;
 }
 
-static duk_ret_t __duktape_apply(duk_context *ctx) {
+static duk_ret_t __duktape_java_stack(duk_context *ctx) {
   DuktapeContext *duktapeContext = getDuktapeContext(ctx);
-    {
-        const ContextSwitcher _(duktapeContext, ctx);
-        duk_ret_t ret = duktapeContext->duktapeApply();
-        if (ret != DUK_RET_ERROR) {
-            return ret;
-        }
+  {
+    const ContextSwitcher _(duktapeContext, ctx);
+    const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+    const ProfiledTrap trap(duktapeContext, "duktapeJavaStack");
+    duk_ret_t ret = duktapeContext->duktapeJavaStack();
+    if (ret != DUK_RET_ERROR) {
+      return ret;
     }
-    duk_throw(ctx);
+  }
+  duk_throw(ctx);
 }
 
-void DuktapeContext::pushObject(JNIEnv *env, jlong object) {
-    duk_push_heapptr(m_context, reinterpret_cast<void*>(object));
+static duk_ret_t install_console(duk_context *ctx, void *) {
+  duk_push_object(ctx);
+  for (int method = 0; method < ConsoleFormatter::METHOD_COUNT; method++) {
+    duk_push_c_function(ctx, __duktape_console, DUK_VARARGS);
+    duk_set_magic(ctx, -1, method);
+    duk_put_prop_string(ctx, -2, ConsoleFormatter::methodName(method));
+  }
+  duk_put_global_string(ctx, "console");
+  return 0;
 }
 
-void DuktapeContext::pushObject(JNIEnv *env, jobject object, bool deleteLocalRef) {
-  if (object == nullptr) {
-    duk_push_null(m_context);
+void DuktapeContext::installConsole(JNIEnv *env) {
+  CHECK_STACK(m_context);
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, install_console, nullptr, 0, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
     return;
   }
+  duk_pop(m_context);
+}
 
-  jclass objectClass = env->GetObjectClass(object);
-
-  // try to push a native object first.
-  {
-    const JavaType* type = m_javaValues.get(env, objectClass);
-    if (type != nullptr) {
-      jvalue value;
-      value.l = object;
-      type->push(m_context, env, value);
-      // safe to delete the local refs now
-      if (deleteLocalRef)
-          env->DeleteLocalRef(object);
-      env->DeleteLocalRef(objectClass);
-      return;
-    }
+// compiles the wrapped source of a CommonJS module and runs the program for the function the
+// module runs in. The program is also dumped, if udata is set, for the module cache.
+// [ source filename ] -> [ dump|undefined function ]
+static duk_ret_t compile_module_source(duk_context *ctx, void *udata) {
+  const bool dump = *static_cast<bool*>(udata);
+  duk_compile(ctx, DUK_COMPILE_EVAL);
+  if (dump) {
+    duk_dup(ctx, -1);
+    duk_dump_function(ctx);
+  } else {
+    duk_push_undefined(ctx);
   }
+  duk_insert(ctx, -2);
+  duk_push_global_object(ctx);
+  duk_call_method(ctx, 0);
+  return 2;
+}
 
-  // a JavaScriptObject can be unpacked back into a native duktape heap pointer/object
-  // a DuktapeObject can support a duktape Proxy, and does not need any further boxing
-  if (env->IsAssignableFrom(objectClass, m_javaScriptObjectClass)) {
+duk_ret_t DuktapeContext::duktapeResolveModule() {
+  JNIEnv *env = getJNIEnv(m_context);
+
+  // the require shim passes strings.
+  jstring referrer = env->NewStringUTF(duk_get_string_default(m_context, 0, ""));
+  jstring specifier = env->NewStringUTF(duk_get_string_default(m_context, 1, ""));
+  jstring id = static_cast<jstring>(env->CallObjectMethod(m_javaDuktape, m_duktapeResolveModuleMethod, referrer, specifier));
+  env->DeleteLocalRef(referrer);
+  env->DeleteLocalRef(specifier);
+  if (!checkRethrowDuktapeErrorException(env, m_context)) {
+    return DUK_RET_ERROR;
+  }
+
+  const std::string str = JString(env, id).str();
+  env->DeleteLocalRef(id);
+  duk_push_lstring(m_context, str.data(), str.size());
+  return 1;
+}
+
+static duk_ret_t __duktape_resolve_module(duk_context *ctx) {
+  DuktapeContext *duktapeContext = getDuktapeContext(ctx);
+  {
+    const ContextSwitcher _(duktapeContext, ctx);
+    const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+    const ProfiledTrap trap(duktapeContext, "duktapeResolveModule");
+    duk_ret_t ret = duktapeContext->duktapeResolveModule();
+    if (ret != DUK_RET_ERROR) {
+      return ret;
+    }
+  }
+  duk_throw(ctx);
+}
+
+duk_ret_t DuktapeContext::duktapeLoadModule() {
+  JNIEnv *env = getJNIEnv(m_context);
+
+  const std::string idStr = duk_get_string_default(m_context, 0, "");
+  jstring id = env->NewStringUTF(idStr.c_str());
+  jobject loaded = env->CallObjectMethod(m_javaDuktape, m_duktapeLoadModuleMethod, id, (jint)ModuleLoader::COMMONJS);
+  if (!checkRethrowDuktapeErrorException(env, m_context)) {
+    env->DeleteLocalRef(id);
+    return DUK_RET_ERROR;
+  }
+
+  // cached bytecode.
+  if (env->IsInstanceOf(loaded, m_byteArrayClass)) {
+    jbyteArray bytecode = static_cast<jbyteArray>(loaded);
+    jsize length = env->GetArrayLength(bytecode);
+    void* data = duk_push_fixed_buffer(m_context, (duk_size_t)length);
+    env->GetByteArrayRegion(bytecode, 0, length, static_cast<jbyte*>(data));
+    env->DeleteLocalRef(loaded);
+    env->DeleteLocalRef(id);
+    if (duk_safe_call(m_context, load_and_call_bytecode, nullptr, 1, 1) != DUK_EXEC_SUCCESS) {
+      return DUK_RET_ERROR;
+    }
+    return 1;
+  }
+
+  {
+    const std::string source = JString(env, static_cast<jstring>(loaded)).str();
+    const std::string wrapped = ModuleLoader::wrapCommonJS(source.data(), source.size());
+    duk_push_lstring(m_context, wrapped.data(), wrapped.size());
+  }
+  duk_push_string(m_context, idStr.c_str());
+  bool dump = m_cacheModules;
+  if (duk_safe_call(m_context, compile_module_source, &dump, 2, 2) != DUK_EXEC_SUCCESS) {
+    env->DeleteLocalRef(loaded);
+    env->DeleteLocalRef(id);
+    // the error is the first of the results.
+    duk_pop(m_context);
+    return DUK_RET_ERROR;
+  }
+
+  if (dump) {
+    duk_size_t size;
+    void* data = duk_get_buffer_data(m_context, -2, &size);
+    jbyteArray bytecode = env->NewByteArray((jsize)size);
+    if (bytecode != nullptr)
+      env->SetByteArrayRegion(bytecode, 0, (jsize)size, static_cast<const jbyte*>(data));
+    env->CallVoidMethod(m_javaDuktape, m_duktapeStoreModuleMethod, id, (jint)ModuleLoader::COMMONJS, loaded, bytecode);
+    env->DeleteLocalRef(bytecode);
+  }
+  env->DeleteLocalRef(loaded);
+  env->DeleteLocalRef(id);
+  if (!checkRethrowDuktapeErrorException(env, m_context)) {
+    return DUK_RET_ERROR;
+  }
+  // drop the dump, leaving the module function.
+  duk_remove(m_context, -2);
+  return 1;
+}
+
+static duk_ret_t __duktape_load_module(duk_context *ctx) {
+  DuktapeContext *duktapeContext = getDuktapeContext(ctx);
+  {
+    const ContextSwitcher _(duktapeContext, ctx);
+    const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+    const ProfiledTrap trap(duktapeContext, "duktapeLoadModule");
+    duk_ret_t ret = duktapeContext->duktapeLoadModule();
+    if (ret != DUK_RET_ERROR) {
+      return ret;
+    }
+  }
+  duk_throw(ctx);
+}
+
+static duk_ret_t install_require(duk_context *ctx, void *) {
+  duk_eval_string(ctx, ModuleLoader::requireShim());
+  duk_push_c_function(ctx, __duktape_resolve_module, 2);
+  duk_push_c_function(ctx, __duktape_load_module, 1);
+  duk_call(ctx, 2);
+  duk_put_global_string(ctx, "require");
+  return 0;
+}
+
+void DuktapeContext::installModuleLoader(JNIEnv *env, jboolean cacheModules) {
+  CHECK_STACK(m_context);
+  m_cacheModules = cacheModules == JNI_TRUE;
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, install_require, nullptr, 0, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return;
+  }
+  duk_pop(m_context);
+}
+
+const JavaType* DuktapeContext::getSignatureType(JNIEnv* env, char type) {
+  auto found = m_signatureTypes.find(type);
+  if (found != m_signatureTypes.end()) {
+    return found->second;
+  }
+  const JavaType* javaType = m_javaValues.getForSignature(env, type == 'L' ? "Ljava/lang/String;" : std::string(1, type));
+  m_signatureTypes[type] = javaType;
+  return javaType;
+}
+
+// call a QuackNativeMethod through JNI, if the arguments already match its parameter types.
+bool DuktapeContext::callNativeMethod(JNIEnv* env, jobject nativeMethod, duk_ret_t* ret) {
+  const NativeMethodCache::Method* method = m_nativeMethods.lookup(env, nativeMethod, m_nativeMethodTargetField, m_nativeMethodMethodField, m_nativeMethodSignatureField);
+  if (method == nullptr || duk_get_length(m_context, -1) != method->parameterTypes.size()) {
+    return false;
+  }
+
+  jvalue args[NativeMethodCache::MAX_PARAMETERS];
+  for (duk_uarridx_t i = 0; i < method->parameterTypes.size(); i++) {
+    const char type = method->parameterTypes[i];
+    duk_get_prop_index(m_context, -1, i);
+    const duk_int_t dukType = duk_get_type(m_context, -1);
+    if (type == 'L' && (dukType == DUK_TYPE_NULL || dukType == DUK_TYPE_UNDEFINED)) {
+      args[i].l = nullptr;
+      duk_pop(m_context);
+      continue;
+    }
+    // JavaType pops with matching types can not throw.
+    bool matches;
+    if (type == 'L') {
+      matches = dukType == DUK_TYPE_STRING;
+    }
+    else if (type == 'Z') {
+      matches = dukType == DUK_TYPE_BOOLEAN;
+    }
+    else {
+      matches = dukType == DUK_TYPE_NUMBER;
+    }
+    if (!matches) {
+      duk_pop(m_context);
+      for (duk_uarridx_t j = 0; j < i; j++) {
+        if (method->parameterTypes[j] == 'L') {
+          env->DeleteLocalRef(args[j].l);
+        }
+      }
+      return false;
+    }
+    args[i] = getSignatureType(env, type)->pop(m_context, env, true);
+  }
+  // pop the arguments, this, and the target
+  duk_pop_3(m_context);
+
+  jobject target = env->GetObjectField(nativeMethod, m_nativeMethodTargetField);
+  const JavaType* returnType = getSignatureType(env, method->returnType);
+  jvalue result = returnType->invokeMethod(env, method->id, target, args);
+  env->DeleteLocalRef(target);
+  for (size_t i = 0; i < method->parameterTypes.size(); i++) {
+    if (method->parameterTypes[i] == 'L') {
+      env->DeleteLocalRef(args[i].l);
+    }
+  }
+  if (!checkRethrowDuktapeErrorException(env, m_context)) {
+    *ret = DUK_RET_ERROR;
+    return true;
+  }
+
+  if (method->returnType == 'V') {
+    // match the null pushed for a void return on the regular path.
+    duk_push_null(m_context);
+  }
+  else {
+    returnType->push(m_context, env, result);
+    if (method->returnType == 'L') {
+      env->DeleteLocalRef(result.l);
+    }
+  }
+  *ret = 1;
+  return true;
+}
+
+duk_ret_t DuktapeContext::duktapeApply() {
+  JNIEnv *env = getJNIEnv(m_context);
+
+  // QuackNativeMethods are called before any arguments are boxed.
+  duk_get_prop_string(m_context, -3, JAVASCRIPT_THIS_PROP_NAME);
+  jobject nativeMethod = static_cast<jobject>(duk_get_pointer(m_context, -1));
+  duk_pop(m_context);
+  duk_ret_t nativeRet;
+  if (nativeMethod != nullptr && env->IsInstanceOf(nativeMethod, m_nativeMethodClass) && callNativeMethod(env, nativeMethod, &nativeRet)) {
+    return nativeRet;
+  }
+
+  // unpack the arguments
+  duk_size_t argLen = duk_get_length(m_context, -1);
+  jobjectArray javaArgs = env->NewObjectArray((jsize)argLen, m_objectClass, nullptr);
+  for (duk_uarridx_t i = 0; i < argLen; i++) {
+    duk_get_prop_index(m_context, -1, i);
+    env->SetObjectArrayElement(javaArgs, (jsize)i, popObject(env));
+  }
+  // done, pop the argument list
+  duk_pop(m_context);
+
+  // get java this
+  jobject javaThis = popObject(env);
+
+  // get the java reference
+  duk_get_prop_string(m_context, -1, JAVASCRIPT_THIS_PROP_NAME);
+  jobject object = static_cast<jobject>(duk_require_pointer(m_context, -1));
+  duk_pop_2(m_context);
+
+  jclass objectClass = env->GetObjectClass(object);
+  jboolean assignable = env->IsAssignableFrom(objectClass, m_duktapeObjectClass);
+  env->DeleteLocalRef(objectClass);
+  if (!assignable) {
+    env->DeleteLocalRef(javaArgs);
+    fatalErrorHandler(object, "Object is not DuktapeObject");
+    return DUK_RET_REFERENCE_ERROR;
+  }
+
+  jobject push = env->CallObjectMethod(m_javaDuktape, m_duktapeCallMethodMethod, object, javaThis, javaArgs);
+  env->DeleteLocalRef(javaArgs);
+  if (!checkRethrowDuktapeErrorException(env, m_context)) {
+    return DUK_RET_ERROR;
+  }
+
+  pushObject(env, push);
+  return 1;
+}
+
+static duk_ret_t __duktape_apply(duk_context *ctx) {
+  DuktapeContext *duktapeContext = getDuktapeContext(ctx);
+    {
+        const ContextSwitcher _(duktapeContext, ctx);
+        // Java may call back into the context, pushing values outside a protected call.
+        const HeapLimitScope heapLimit(duktapeContext->m_allocator, false);
+        const ProfiledTrap trap(duktapeContext, "duktapeApply");
+        const BridgeStats::Scope stats(duktapeContext->bridgeStats, BridgeStats::TRAP_APPLY);
+        duk_ret_t ret = duktapeContext->duktapeApply();
+        if (ret != DUK_RET_ERROR) {
+            return ret;
+        }
+    }
+    duk_throw(ctx);
+}
+
+// Duktape keeps characters outside the BMP as CESU-8 surrogate pairs. For UTF-8 from outside
+// Duktape, converts 4 byte sequences to those, writing to cesu8 unless it is null, and returns
+// the CESU-8 length.
+static size_t utf8ToCesu8(const uint8_t* utf8, size_t length, uint8_t* cesu8) {
+  size_t written = 0;
+  size_t i = 0;
+  while (i < length) {
+    if ((utf8[i] & 0xf8) == 0xf0 && i + 4 <= length) {
+      const uint32_t codePoint = ((utf8[i] & 0x07) << 18) | ((utf8[i + 1] & 0x3f) << 12)
+          | ((utf8[i + 2] & 0x3f) << 6) | (utf8[i + 3] & 0x3f);
+      const uint32_t high = 0xd800 + ((codePoint - 0x10000) >> 10);
+      const uint32_t low = 0xdc00 + ((codePoint - 0x10000) & 0x3ff);
+      if (cesu8 != nullptr) {
+        cesu8[written] = 0xed;
+        cesu8[written + 1] = (uint8_t)(0xa0 | ((high >> 6) & 0x0f));
+        cesu8[written + 2] = (uint8_t)(0x80 | (high & 0x3f));
+        cesu8[written + 3] = 0xed;
+        cesu8[written + 4] = (uint8_t)(0xb0 | ((low >> 6) & 0x0f));
+        cesu8[written + 5] = (uint8_t)(0x80 | (low & 0x3f));
+      }
+      written += 6;
+      i += 4;
+      continue;
+    }
+    if (cesu8 != nullptr) {
+      cesu8[written] = utf8[i];
+    }
+    written++;
+    i++;
+  }
+  return written;
+}
+
+void DuktapeContext::pushObject(JNIEnv *env, jlong object) {
+    duk_push_heapptr(m_context, reinterpret_cast<void*>(object));
+}
+
+void DuktapeContext::pushObject(JNIEnv *env, jobject object, bool deleteLocalRef) {
+  if (object == nullptr) {
+    bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::NULL_VALUE);
+    duk_push_null(m_context);
+    return;
+  }
+
+  jclass objectClass = env->GetObjectClass(object);
+
+  // try to push a native object first.
+  {
+    const JavaType* type = m_javaValues.get(env, objectClass);
+    if (type != nullptr) {
+      bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::PRIMITIVE);
+      jvalue value;
+      value.l = object;
+      type->push(m_context, env, value);
+      // safe to delete the local refs now
+      if (deleteLocalRef)
+          env->DeleteLocalRef(object);
+      env->DeleteLocalRef(objectClass);
+      return;
+    }
+  }
+
+  // a JavaScriptObject can be unpacked back into a native duktape heap pointer/object
+  // a DuktapeObject can support a duktape Proxy, and does not need any further boxing
+  if (env->IsAssignableFrom(objectClass, m_javaScriptObjectClass)) {
     DuktapeContext* context = reinterpret_cast<DuktapeContext*>(env->GetLongField(object, m_contextField));
     if (context == this) {
+      bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::JAVASCRIPT_OBJECT);
       void* ptr = reinterpret_cast<void*>(env->GetLongField(object, m_pointerField));
       duk_push_heapptr(m_context, ptr);
 
@@ -672,12 +1414,30 @@ void DuktapeContext::pushObject(JNIEnv *env, jobject object, bool deleteLocalRef
     // pointer can't be used.
   }
   else if (env->IsAssignableFrom(objectClass, m_byteBufferClass)) {
+    bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::BUFFER);
     jlong capacity = env->GetDirectBufferCapacity(object);
-    void *p = duk_push_fixed_buffer(m_context, (duk_size_t)capacity);
-    memcpy(p, env->GetDirectBufferAddress(object), (size_t)capacity);
-    // duk_push_buffer_object(m_context, -1, 0, capacity, DUK_BUFOBJ_ARRAYBUFFER);
-    // duk_swap_top(m_context, -2);
-    // duk_pop(m_context);
+    void* address = env->GetDirectBufferAddress(object);
+    if (m_zeroCopyBuffers && address != nullptr) {
+      // wrap the ByteBuffer memory in an ArrayBuffer that holds a global ref to the
+      // ByteBuffer until it is finalized. The Uint8Array references the ArrayBuffer through
+      // its .buffer, as do any subarrays, so the memory outlives every view.
+      duk_get_global_string(m_context, "Uint8Array");
+      duk_push_external_buffer(m_context);
+      duk_config_buffer(m_context, -1, address, (duk_size_t)capacity);
+      duk_push_buffer_object(m_context, -1, 0, (duk_size_t)capacity, DUK_BUFOBJ_ARRAYBUFFER);
+      duk_remove(m_context, -2);
+      duk_push_pointer(m_context, env->NewGlobalRef(object));
+      m_memoryStats.bufferReferenced();
+      bridgeStats.globalRefCreated();
+      duk_put_prop_string(m_context, -2, JAVA_BUFFER_PROP_NAME);
+      duk_push_c_function(m_context, javaBufferFinalizer, 1);
+      duk_set_finalizer(m_context, -2);
+      duk_new(m_context, 1);
+    }
+    else {
+      void *p = duk_push_fixed_buffer(m_context, (duk_size_t)capacity);
+      memcpy(p, address, (size_t)capacity);
+    }
 
     if (deleteLocalRef)
       env->DeleteLocalRef(object);
@@ -685,9 +1445,31 @@ void DuktapeContext::pushObject(JNIEnv *env, jobject object, bool deleteLocalRef
     return;
   }
   else if (env->IsAssignableFrom(objectClass, m_jsonObjectClass)) {
-    jstring json = (jstring)env->GetObjectField(object, m_jsonField);
-    JString jString(env, json);
-    duk_push_string(m_context, jString);
+    bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::JSON);
+    jobject utf8 = env->GetObjectField(object, m_jsonUtf8Field);
+    if (utf8 != nullptr) {
+      // push the UTF-8 bytes without decoding them to a Java String, as is unless they have
+      // characters outside the BMP.
+      const uint8_t* address = static_cast<const uint8_t*>(env->GetDirectBufferAddress(utf8));
+      jint position = env->GetIntField(object, m_jsonPositionField);
+      jint limit = env->GetIntField(object, m_jsonLimitField);
+      const size_t length = (size_t)(limit - position);
+      const size_t cesu8Length = utf8ToCesu8(address + position, length, nullptr);
+      if (cesu8Length == length) {
+        duk_push_lstring(m_context, reinterpret_cast<const char*>(address + position), (duk_size_t)length);
+      }
+      else {
+        void* cesu8 = duk_push_fixed_buffer(m_context, (duk_size_t)cesu8Length);
+        utf8ToCesu8(address + position, length, static_cast<uint8_t*>(cesu8));
+        duk_buffer_to_string(m_context, -1);
+      }
+      env->DeleteLocalRef(utf8);
+    }
+    else {
+      jstring json = (jstring)env->GetObjectField(object, m_jsonField);
+      JString jString(env, json);
+      duk_push_string(m_context, jString);
+    }
     // if this is passed bad json, the process crashes. so do not pass bad json.
     // this is a fast path, so sanity checking is disabled. cleaning up a busted
     // stack due to an incomplete method call is gnarly as well.
@@ -696,43 +1478,65 @@ void DuktapeContext::pushObject(JNIEnv *env, jobject object, bool deleteLocalRef
         env->DeleteLocalRef(object);
     return;
   }
-  else if (!env->IsAssignableFrom(objectClass, m_duktapeObjectClass)) {
-    // this is a normal Java object, so create a proxy for it to access fields and methods
-    jobject wrappedObject = env->NewObject(m_javaObjectClass, m_javaObjectConstructor, m_javaDuktape, object);
-    // safe to delete the local ref now
+
+  // a Java object that is already in JavaScript comes back as the same proxy.
+  bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::JAVA_OBJECT);
+  jint hash;
+  void* existing = m_javaProxies.find(env, object, &hash);
+  if (existing != nullptr) {
+    duk_push_heapptr(m_context, existing);
     if (deleteLocalRef)
       env->DeleteLocalRef(object);
-    deleteLocalRef = true;
-    object = wrappedObject;
+    env->DeleteLocalRef(objectClass);
+    return;
+  }
+
+  // the identity of the proxy is that of the object as passed, not of its wrapper.
+  jobject key = object;
+  jobject target = object;
+  if (!env->IsAssignableFrom(objectClass, m_duktapeObjectClass)) {
+    // this is a normal Java object, so create a proxy for it to access fields and methods
+    target = env->NewObject(m_javaObjectClass, m_javaObjectConstructor, m_javaDuktape, object);
   }
 
   env->DeleteLocalRef(objectClass);
 
-  // at this point, the object is guaranteed to be a JavaScriptObject from another DuktapeContext
+  // at this point, the target is guaranteed to be a JavaScriptObject from another DuktapeContext
   // or a DuktapeObject (java proxy of some sort). JavaScriptObject implements DuktapeObject,
   // so, it works without any further coercion.
 
+  // the proxy is built natively around a callable target, which holds the Java reference, and
+  // the shared handler, so no JavaScript runs.
   duk_push_global_stash(m_context);
-  duk_get_prop_string(m_context, -1, "__makeProxy");
-  duk_swap(m_context, -2, -1);
-  duk_pop(m_context);
+  const duk_idx_t stashIndex = duk_get_top_index(m_context);
+  duk_push_c_function(m_context, __duktape_noop, 0);
+  const duk_idx_t targetIndex = duk_get_top_index(m_context);
 
-  const duk_idx_t objIndex = duk_require_normalize_index(m_context, duk_push_object(m_context));
-
-  jobject ptr = env->NewGlobalRef(object);
-  duk_push_pointer(m_context, ptr);
-  // safe to delete the local ref now
-  if (deleteLocalRef)
-      env->DeleteLocalRef(object);
-  duk_put_prop_string(m_context, objIndex, JAVASCRIPT_THIS_PROP_NAME);
+  m_memoryStats.javaObjectReferenced();
+  duk_push_pointer(m_context, env->NewGlobalRef(target));
+  bridgeStats.globalRefCreated();
+  duk_put_prop_string(m_context, targetIndex, JAVASCRIPT_THIS_PROP_NAME);
 
   // set a finalizer for the ref
-  duk_push_c_function(m_context, javaObjectFinalizer, 1);
-  duk_set_finalizer(m_context, objIndex);
+  duk_get_prop_string(m_context, stashIndex, JAVA_OBJECT_FINALIZER_PROP_NAME);
+  duk_set_finalizer(m_context, targetIndex);
 
   // make the proxy
-  if (duk_pcall(m_context, 1) != DUK_EXEC_SUCCESS)
-      queueJavaExceptionForDuktapeError(env, m_context);
+  duk_dup(m_context, targetIndex);
+  duk_get_prop_string(m_context, stashIndex, JAVA_PROXY_HANDLER_PROP_NAME);
+  duk_push_proxy(m_context, 0);
+  duk_dup_top(m_context);
+  duk_put_prop_string(m_context, targetIndex, JAVA_PROXY_PROP_NAME);
+  m_javaProxies.add(env, key, hash, duk_get_heapptr(m_context, targetIndex), duk_get_heapptr(m_context, -1));
+  bridgeStats.weakRefCreated();
+  duk_remove(m_context, targetIndex);
+  duk_remove(m_context, stashIndex);
+
+  // safe to delete the local refs now
+  if (target != key)
+    env->DeleteLocalRef(target);
+  if (deleteLocalRef)
+    env->DeleteLocalRef(key);
 }
 
 jobject DuktapeContext::call(JNIEnv *env, jlong object, jobjectArray args) {
@@ -749,15 +1553,62 @@ jobject DuktapeContext::call(JNIEnv *env, jlong object, jobjectArray args) {
       }
   }
 
-  if (duk_pcall(m_context, length) != DUK_EXEC_SUCCESS) {
+  if (withHeapLimit(m_allocator, [&] { return duk_pcall(m_context, length); }) != DUK_EXEC_SUCCESS) {
       queueJavaExceptionForDuktapeError(env, m_context);
       return nullptr;
   }
 
-  duk_gc(m_context, 0);
+  collectGarbageIfNeeded();
   return popObject(env);
 }
 
+jobjectArray DuktapeContext::callBatch(JNIEnv *env, jlong object, jobjectArray argsList) {
+  CHECK_STACK(m_context);
+
+  const jsize count = env->GetArrayLength(argsList);
+  jobjectArray results = env->NewObjectArray(count, m_objectClass, nullptr);
+  if (results == nullptr)
+    return nullptr;
+
+  for (jsize i = 0; i < count; i++) {
+    // each entry gets its own frame, so a large batch doesn't overflow the local ref table.
+    env->PushLocalFrame(16);
+
+    pushObject(env, object);
+
+    jobjectArray args = static_cast<jobjectArray>(env->GetObjectArrayElement(argsList, i));
+    jsize length = 0;
+    if (args != nullptr) {
+      length = env->GetArrayLength(args);
+      for (int j = 0; j < length; j++) {
+        jobject arg = env->GetObjectArrayElement(args, j);
+        pushObject(env, arg);
+      }
+    }
+
+    jobject result = nullptr;
+    if (withHeapLimit(m_allocator, [&] { return duk_pcall(m_context, length); }) != DUK_EXEC_SUCCESS) {
+      queueJavaExceptionForDuktapeError(env, m_context);
+    } else {
+      result = popObject(env);
+    }
+
+    // a failed entry holds its exception, and the batch continues.
+    if (env->ExceptionCheck()) {
+      result = env->ExceptionOccurred();
+      env->ExceptionClear();
+    }
+
+    result = env->PopLocalFrame(result);
+    env->SetObjectArrayElement(results, i, result);
+    env->DeleteLocalRef(result);
+  }
+
+  // the batch counts as a single call for the GC policy.
+  collectGarbageIfNeeded();
+  return results;
+}
+
 jobject DuktapeContext::callMethod(JNIEnv *env, jlong object, jobject thiz, jobjectArray args) {
   CHECK_STACK(m_context);
 
@@ -776,12 +1627,12 @@ jobject DuktapeContext::callMethod(JNIEnv *env, jlong object, jobject thiz, jobj
     }
   }
 
-  if (duk_pcall_method(m_context, length) != DUK_EXEC_SUCCESS) {
+  if (withHeapLimit(m_allocator, [&] { return duk_pcall_method(m_context, length); }) != DUK_EXEC_SUCCESS) {
     queueJavaExceptionForDuktapeError(env, m_context);
     return nullptr;
   }
 
-  duk_gc(m_context, 0);
+  collectGarbageIfNeeded();
   return popObject(env);
 }
 
@@ -801,14 +1652,14 @@ jobject DuktapeContext::callProperty(JNIEnv *env, jlong object, jobject property
       }
   }
 
-  if (duk_pcall_prop(m_context, objectIndex, length) != DUK_EXEC_SUCCESS) {
+  if (withHeapLimit(m_allocator, [&] { return duk_pcall_prop(m_context, objectIndex, length); }) != DUK_EXEC_SUCCESS) {
       queueJavaExceptionForDuktapeError(env, m_context);
       // pop off indexed object before rethrowing error
       duk_pop(m_context);
       return nullptr;
   }
 
-  duk_gc(m_context, 0);
+  collectGarbageIfNeeded();
   // pop twice since property call does not pop the indexed object
   return popObject2(env);
 }
@@ -845,13 +1696,103 @@ jobject DuktapeContext::getKeyObject(JNIEnv *env, jlong object, jobject key) {
   return popObject2(env);
 }
 
-jobject DuktapeContext::getKeyString(JNIEnv *env, jlong object, jstring key) {
-  CHECK_STACK(m_context);
+jobject DuktapeContext::getKeyString(JNIEnv *env, jlong object, jstring key) {
+  CHECK_STACK(m_context);
+
+  pushObject(env, object);
+  const JString instanceKey(env, key);
+  duk_get_prop_string(m_context, -1, instanceKey);
+  // pop twice since indexing does not pop the indexed object
+  return popObject2(env);
+}
+
+jlong DuktapeContext::internKey(JNIEnv *env, jstring key) {
+  CHECK_STACK(m_context);
+
+  const JString instanceKey(env, key);
+  duk_push_global_stash(m_context);
+  duk_get_prop_string(m_context, -1, INTERNED_KEYS_PROP_NAME);
+  duk_push_string(m_context, instanceKey);
+  void* ptr = duk_get_heapptr(m_context, -1);
+  duk_dup_top(m_context);
+  duk_get_prop(m_context, -3);
+  duk_uint_t count = duk_get_uint(m_context, -1);
+  duk_pop(m_context);
+  duk_push_uint(m_context, count + 1);
+  duk_put_prop(m_context, -3);
+  duk_pop_2(m_context);
+  return reinterpret_cast<jlong>(ptr);
+}
+
+void DuktapeContext::releaseKey(JNIEnv *env, jlong key) {
+  CHECK_STACK(m_context);
+
+  duk_push_global_stash(m_context);
+  duk_get_prop_string(m_context, -1, INTERNED_KEYS_PROP_NAME);
+  duk_push_heapptr(m_context, reinterpret_cast<void*>(key));
+  duk_dup_top(m_context);
+  duk_get_prop(m_context, -3);
+  duk_uint_t count = duk_get_uint(m_context, -1);
+  duk_pop(m_context);
+  if (count > 1) {
+    duk_push_uint(m_context, count - 1);
+    duk_put_prop(m_context, -3);
+  }
+  else {
+    duk_del_prop(m_context, -2);
+  }
+  duk_pop_2(m_context);
+}
+
+jobject DuktapeContext::getKeyHandle(JNIEnv *env, jlong object, jlong key) {
+  CHECK_STACK(m_context);
+
+  pushObject(env, object);
+  duk_push_heapptr(m_context, reinterpret_cast<void*>(key));
+  duk_get_prop(m_context, -2);
+  // pop twice since indexing does not pop the indexed object
+  return popObject2(env);
+}
+
+jboolean DuktapeContext::setKeyHandle(JNIEnv *env, jlong object, jlong key, jobject value) {
+  CHECK_STACK(m_context);
+
+  pushObject(env, object);
+  duk_push_heapptr(m_context, reinterpret_cast<void*>(key));
+  pushObject(env, value, false);
+  duk_bool_t ret = duk_put_prop(m_context, -3);
+
+  // pop indexed object
+  duk_pop(m_context);
+
+  return (jboolean)(ret == 1);
+}
+
+jobject DuktapeContext::callPropertyHandle(JNIEnv *env, jlong object, jlong key, jobjectArray args) {
+  CHECK_STACK(m_context);
+
+  pushObject(env, object);
+  duk_idx_t objectIndex = duk_normalize_index(m_context, -1);
+  duk_push_heapptr(m_context, reinterpret_cast<void*>(key));
+
+  jsize length = 0;
+  if (args != nullptr) {
+      length = env->GetArrayLength(args);
+      for (int i = 0; i < length; i++) {
+          jobject arg = env->GetObjectArrayElement(args, i);
+          pushObject(env, arg);
+      }
+  }
+
+  if (withHeapLimit(m_allocator, [&] { return duk_pcall_prop(m_context, objectIndex, length); }) != DUK_EXEC_SUCCESS) {
+      queueJavaExceptionForDuktapeError(env, m_context);
+      // pop off indexed object before rethrowing error
+      duk_pop(m_context);
+      return nullptr;
+  }
 
-  pushObject(env, object);
-  const JString instanceKey(env, key);
-  duk_get_prop_string(m_context, -1, instanceKey);
-  // pop twice since indexing does not pop the indexed object
+  collectGarbageIfNeeded();
+  // pop twice since property call does not pop the indexed object
   return popObject2(env);
 }
 
@@ -861,7 +1802,7 @@ jobject DuktapeContext::evaluate(JNIEnv* env, jstring code, jstring fname) {
   const JString sourceCode(env, code);
   const JString fileName(env, fname);
 
-  if (eval_string_with_filename(m_context, sourceCode, fileName) != DUK_EXEC_SUCCESS) {
+  if (withHeapLimit(m_allocator, [&] { return eval_string_with_filename(m_context, sourceCode, fileName); }) != DUK_EXEC_SUCCESS) {
     queueJavaExceptionForDuktapeError(env, m_context);
     return nullptr;
   }
@@ -876,14 +1817,57 @@ jobject DuktapeContext::compile(JNIEnv* env, jstring code, jstring fname) {
   const JString fileName(env, fname);
 
   duk_push_string(m_context, fileName);
-  if (duk_pcompile_string_filename(m_context, DUK_COMPILE_FUNCTION, sourceCode) != DUK_EXEC_SUCCESS) {
+  if (withHeapLimit(m_allocator, [&] { return duk_pcompile_string_filename(m_context, DUK_COMPILE_FUNCTION, sourceCode); }) != DUK_EXEC_SUCCESS) {
       queueJavaExceptionForDuktapeError(env, m_context);
       return nullptr;
   }
   return popObject(env);
 }
 
+jbyteArray DuktapeContext::compileBytecode(JNIEnv* env, jstring code, jstring fname) {
+  CHECK_STACK(m_context);
+
+  const JString sourceCode(env, code);
+  const JString fileName(env, fname);
+
+  // compile with the same flags as evaluate, so running the loaded bytecode
+  // behaves exactly like evaluating the source.
+  duk_push_string(m_context, fileName);
+  if (withHeapLimit(m_allocator, [&] { return duk_pcompile_string_filename(m_context, DUK_COMPILE_EVAL, sourceCode); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return nullptr;
+  }
+
+  duk_dump_function(m_context);
+  duk_size_t size;
+  void* data = duk_get_buffer_data(m_context, -1, &size);
+  jbyteArray ret = env->NewByteArray((jsize)size);
+  if (ret != nullptr)
+    env->SetByteArrayRegion(ret, 0, (jsize)size, static_cast<const jbyte*>(data));
+  duk_pop(m_context);
+  return ret;
+}
+
+jobject DuktapeContext::evaluateBytecode(JNIEnv* env, jbyteArray bytecode) {
+  CHECK_STACK(m_context);
+
+  jsize length = env->GetArrayLength(bytecode);
+  void* data = duk_push_fixed_buffer(m_context, (duk_size_t)length);
+  env->GetByteArrayRegion(bytecode, 0, length, static_cast<jbyte*>(data));
+
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, load_and_call_bytecode, nullptr, 1, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return nullptr;
+  }
+
+  return popObject(env);
+}
+
 void DuktapeContext::waitForDebugger(JNIEnv *env, jstring connectionString) {
+#if defined(QUACK_DUKTAPE_PERFORMANCE)
+  // attaching would throw outside of a protected call.
+  queueDuktapeException(env, "Duktape was built with the performance profile, which has no debugger support");
+#else
   duk_trans_socket_init();
   duk_trans_socket_waitconn(&m_DebuggerSocket);
 
@@ -896,11 +1880,12 @@ void DuktapeContext::waitForDebugger(JNIEnv *env, jstring connectionString) {
                       NULL,
                       duk_trans_socket_detached_cb,
                       &m_DebuggerSocket);
+#endif
 }
 
 void DuktapeContext::cooperateDebugger() {
   duk_debugger_cooperate(m_context);
-  duk_gc(m_context, 0);
+  collectGarbageIfNeeded();
 }
 
 jboolean DuktapeContext::isDebugging() {
@@ -973,7 +1958,7 @@ jstring DuktapeContext::stringify(JNIEnv *env, jlong object) {
 
   duk_push_string(m_context, "stringify");
   pushObject(env, object);
-  if (duk_pcall_prop(m_context, objectIndex, 1) != DUK_EXEC_SUCCESS) {
+  if (withHeapLimit(m_allocator, [&] { return duk_pcall_prop(m_context, objectIndex, 1); }) != DUK_EXEC_SUCCESS) {
     queueJavaExceptionForDuktapeError(env, m_context);
     // pop off indexed object before rethrowing error
     duk_pop(m_context);
@@ -983,29 +1968,554 @@ jstring DuktapeContext::stringify(JNIEnv *env, jlong object) {
   return (jstring)popObject2(env);
 }
 
-void DuktapeContext::finalizeJavaScriptObject(JNIEnv *env, jlong object) {
+// Duktape keeps characters outside the BMP as CESU-8 surrogate pairs, which are not valid UTF-8.
+// Converts those to 4 byte sequences, writing to utf8 unless it is null, and returns the UTF-8 length.
+static size_t cesu8ToUtf8(const uint8_t* cesu8, size_t length, uint8_t* utf8) {
+  size_t written = 0;
+  size_t i = 0;
+  while (i < length) {
+    // a high surrogate (ED A0-AF xx) followed by a low surrogate (ED B0-BF xx).
+    if (cesu8[i] == 0xed && i + 6 <= length && (cesu8[i + 1] & 0xf0) == 0xa0
+        && cesu8[i + 3] == 0xed && (cesu8[i + 4] & 0xf0) == 0xb0) {
+      const uint32_t high = ((cesu8[i + 1] & 0x0f) << 6) | (cesu8[i + 2] & 0x3f);
+      const uint32_t low = ((cesu8[i + 4] & 0x0f) << 6) | (cesu8[i + 5] & 0x3f);
+      const uint32_t codePoint = 0x10000 + (high << 10) + low;
+      if (utf8 != nullptr) {
+        utf8[written] = (uint8_t)(0xf0 | (codePoint >> 18));
+        utf8[written + 1] = (uint8_t)(0x80 | ((codePoint >> 12) & 0x3f));
+        utf8[written + 2] = (uint8_t)(0x80 | ((codePoint >> 6) & 0x3f));
+        utf8[written + 3] = (uint8_t)(0x80 | (codePoint & 0x3f));
+      }
+      written += 4;
+      i += 6;
+      continue;
+    }
+    if (utf8 != nullptr) {
+      utf8[written] = cesu8[i];
+    }
+    written++;
+    i++;
+  }
+  return written;
+}
+
+jobject DuktapeContext::stringifyUtf8(JNIEnv *env, jlong object, jobject buffer) {
   CHECK_STACK(m_context);
+  duk_get_global_string(m_context, "JSON");
+  duk_idx_t objectIndex = duk_normalize_index(m_context, -1);
 
-  // the JavaScriptObject (java representation) was collected.
+  duk_push_string(m_context, "stringify");
+  pushObject(env, object);
+  if (withHeapLimit(m_allocator, [&] { return duk_pcall_prop(m_context, objectIndex, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    // pop off indexed object before rethrowing error
+    duk_pop(m_context);
+    return nullptr;
+  }
 
-  // clean up the ref to the duktape heap object
-  void* ptr = reinterpret_cast<void*>(object);
-  duk_push_heapptr(m_context, ptr);
-  // unset the finalizer, no longer necessary
-  duk_push_undefined(m_context);
-  duk_set_finalizer(m_context, -2);
-  // release the ref to the javascript object
-  javascriptObjectFinalizerInternal(m_context);
+  jobject target = nullptr;
+  if (duk_is_string(m_context, -1)) {
+    duk_size_t length;
+    const uint8_t* cesu8 = reinterpret_cast<const uint8_t*>(duk_get_lstring(m_context, -1, &length));
+    const size_t utf8Length = cesu8ToUtf8(cesu8, length, nullptr);
+    target = env->CallObjectMethod(m_javaDuktape, m_duktapeJsonBufferMethod, buffer, (jint)utf8Length);
+    if (target != nullptr && !env->ExceptionCheck()) {
+      cesu8ToUtf8(cesu8, length, static_cast<uint8_t*>(env->GetDirectBufferAddress(target)));
+    }
+  }
+  // pop the result and the JSON object
+  duk_pop_2(m_context);
+  return target;
+}
+
+// Serialization runs as a Duktape safe call, and Duktape errors longjmp past C++ destructors,
+// so everything that needs one lives here, outside the call.
+struct SerializeState {
+  SerializedWriter* writer;
+  SerializedReader* reader;
+  // strings converted to or from CESU-8.
+  std::vector<uint8_t> scratch;
+};
+
+// stack indices of the constructors values are checked against, pushed after the value.
+enum {
+  SERIALIZE_DATE = 1,
+  SERIALIZE_ARRAY_BUFFER,
+  SERIALIZE_TYPED_ARRAYS,
+};
+
+// writes the value at the top of the stack, leaving it there.
+static void serialize_duktape_value(duk_context *ctx, SerializeState* state, int depth) {
+  SerializedWriter& writer = *state->writer;
+  if (depth > ValueSerializer::MAX_DEPTH) {
+    (void)duk_error(ctx, DUK_ERR_RANGE_ERROR, "value is nested too deeply to serialize");
+    return;
+  }
+  duk_require_stack(ctx, 4);
+
+  switch (duk_get_type(ctx, -1)) {
+    case DUK_TYPE_UNDEFINED:
+      writer.writeTag(ValueSerializer::TAG_UNDEFINED);
+      return;
+    case DUK_TYPE_NULL:
+      writer.writeTag(ValueSerializer::TAG_NULL);
+      return;
+    case DUK_TYPE_BOOLEAN:
+      writer.writeTag(duk_get_boolean(ctx, -1) ? ValueSerializer::TAG_TRUE : ValueSerializer::TAG_FALSE);
+      return;
+    case DUK_TYPE_NUMBER:
+      writer.writeNumber(duk_get_number(ctx, -1));
+      return;
+    case DUK_TYPE_STRING: {
+      if (duk_is_symbol(ctx, -1)) {
+        (void)duk_error(ctx, DUK_ERR_TYPE_ERROR, "symbol could not be serialized");
+        return;
+      }
+      duk_size_t length;
+      const uint8_t* cesu8 = reinterpret_cast<const uint8_t*>(duk_get_lstring(ctx, -1, &length));
+      const size_t utf8Length = cesu8ToUtf8(cesu8, length, nullptr);
+      writer.writeTag(ValueSerializer::TAG_STRING);
+      if (utf8Length == length) {
+        writer.writeData(cesu8, length);
+        return;
+      }
+      state->scratch.resize(utf8Length);
+      cesu8ToUtf8(cesu8, length, state->scratch.data());
+      writer.writeData(state->scratch.data(), utf8Length);
+      return;
+    }
+    case DUK_TYPE_BUFFER: {
+      // plain buffers behave as Uint8Arrays.
+      if (writer.writeReference(duk_get_heapptr(ctx, -1)))
+        return;
+      duk_size_t size;
+      void* data = duk_get_buffer_data(ctx, -1, &size);
+      writer.writeTag(ValueSerializer::TAG_TYPED_ARRAY);
+      writer.writeTag(ValueSerializer::UINT8_ARRAY);
+      writer.writeData(data, size);
+      return;
+    }
+    case DUK_TYPE_OBJECT:
+      break;
+    case DUK_TYPE_LIGHTFUNC:
+      (void)duk_error(ctx, DUK_ERR_TYPE_ERROR, "function could not be serialized");
+      return;
+    default:
+      (void)duk_error(ctx, DUK_ERR_TYPE_ERROR, "value could not be serialized");
+      return;
+  }
+
+  if (duk_is_function(ctx, -1)) {
+    (void)duk_error(ctx, DUK_ERR_TYPE_ERROR, "function could not be serialized");
+    return;
+  }
+  if (writer.writeReference(duk_get_heapptr(ctx, -1)))
+    return;
+
+  if (duk_is_buffer_data(ctx, -1)) {
+    duk_size_t size;
+    // the active slice, for views.
+    void* data = duk_get_buffer_data(ctx, -1, &size);
+    for (int kind = 0; kind < ValueSerializer::TYPED_ARRAY_KIND_COUNT; kind++) {
+      if (duk_instanceof(ctx, -1, SERIALIZE_TYPED_ARRAYS + kind)) {
+        writer.writeTag(ValueSerializer::TAG_TYPED_ARRAY);
+        writer.writeTag(kind);
+        writer.writeData(data, size);
+        return;
+      }
+    }
+    if (duk_instanceof(ctx, -1, SERIALIZE_ARRAY_BUFFER)) {
+      writer.writeTag(ValueSerializer::TAG_ARRAY_BUFFER);
+      writer.writeData(data, size);
+      return;
+    }
+    (void)duk_error(ctx, DUK_ERR_TYPE_ERROR, "value could not be serialized");
+    return;
+  }
+  if (duk_instanceof(ctx, -1, SERIALIZE_DATE)) {
+    duk_dup_top(ctx);
+    writer.writeDouble(ValueSerializer::TAG_DATE, duk_to_number(ctx, -1));
+    duk_pop(ctx);
+    return;
+  }
+
+  if (duk_is_array(ctx, -1)) {
+    const duk_size_t length = duk_get_length(ctx, -1);
+    writer.writeTag(ValueSerializer::TAG_ARRAY);
+    writer.writeLength(length);
+    for (duk_uarridx_t i = 0; i < length; i++) {
+      duk_get_prop_index(ctx, -1, i);
+      serialize_duktape_value(ctx, state, depth + 1);
+      duk_pop(ctx);
+    }
+    return;
+  }
+
+  // anything else is written as a plain object, like JSON.
+  writer.writeTag(ValueSerializer::TAG_OBJECT);
+  duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY);
+  while (duk_next(ctx, -1, 1)) {
+    duk_dup(ctx, -2);
+    serialize_duktape_value(ctx, state, depth + 1);
+    duk_pop(ctx);
+    serialize_duktape_value(ctx, state, depth + 1);
+    duk_pop_2(ctx);
+  }
+  duk_pop(ctx);
+  writer.writeTag(ValueSerializer::TAG_END);
+}
+
+static duk_ret_t serialize_value(duk_context *ctx, void *udata) {
+  duk_get_global_string(ctx, "Date");
+  duk_get_global_string(ctx, "ArrayBuffer");
+  for (int kind = 0; kind < ValueSerializer::TYPED_ARRAY_KIND_COUNT; kind++) {
+    duk_get_global_string(ctx, ValueSerializer::typedArrayName(kind));
+  }
+  duk_dup(ctx, 0);
+  serialize_duktape_value(ctx, static_cast<SerializeState*>(udata), 0);
+  return 0;
+}
+
+static duk_ret_t throw_malformed(duk_context *ctx) {
+  return duk_error(ctx, DUK_ERR_TYPE_ERROR, "malformed serialized value");
+}
+
+static void push_utf8(duk_context *ctx, SerializeState* state, const uint8_t* utf8, size_t length) {
+  // lead bytes that are not UTF-8 would make the string a Duktape symbol or internal key.
+  if (length != 0 && ((utf8[0] & 0xc0) == 0x80 || utf8[0] >= 0xf8)) {
+    (void)throw_malformed(ctx);
+    return;
+  }
+  const size_t cesu8Length = utf8ToCesu8(utf8, length, nullptr);
+  if (cesu8Length == length) {
+    duk_push_lstring(ctx, reinterpret_cast<const char*>(utf8), length);
+    return;
+  }
+  state->scratch.resize(cesu8Length);
+  utf8ToCesu8(utf8, length, state->scratch.data());
+  duk_push_lstring(ctx, reinterpret_cast<const char*>(state->scratch.data()), cesu8Length);
+}
+
+// number the object at the top of the stack, for later references to it.
+static void number_object(duk_context *ctx, duk_idx_t objects) {
+  duk_dup_top(ctx);
+  duk_put_prop_index(ctx, objects, (duk_uarridx_t)duk_get_length(ctx, objects));
+}
+
+static void push_buffer_object(duk_context *ctx, const uint8_t* data, size_t length, duk_uint_t flags) {
+  void* p = duk_push_fixed_buffer(ctx, (duk_size_t)length);
+  if (length != 0)
+    memcpy(p, data, length);
+  duk_push_buffer_object(ctx, -1, 0, (duk_size_t)length, flags);
+  duk_remove(ctx, -2);
+}
+
+// pushes the next value. objects is the stack index of an array of the objects read so far.
+static void deserialize_duktape_value(duk_context *ctx, SerializeState* state, duk_idx_t objects, int depth) {
+  SerializedReader& reader = *state->reader;
+  if (depth > ValueSerializer::MAX_DEPTH) {
+    (void)duk_error(ctx, DUK_ERR_RANGE_ERROR, "serialized value is nested too deeply");
+    return;
+  }
+  duk_require_stack(ctx, 4);
+
+  const int tag = reader.readTag();
+  switch (reader.ok() ? tag : -1) {
+    case ValueSerializer::TAG_UNDEFINED:
+      duk_push_undefined(ctx);
+      return;
+    case ValueSerializer::TAG_NULL:
+      duk_push_null(ctx);
+      return;
+    case ValueSerializer::TAG_FALSE:
+    case ValueSerializer::TAG_TRUE:
+      duk_push_boolean(ctx, tag == ValueSerializer::TAG_TRUE);
+      return;
+    case ValueSerializer::TAG_INT32: {
+      const int32_t i = reader.readInt32();
+      if (!reader.ok())
+        break;
+      duk_push_int(ctx, i);
+      return;
+    }
+    case ValueSerializer::TAG_DOUBLE: {
+      const double d = reader.readDouble();
+      if (!reader.ok())
+        break;
+      duk_push_number(ctx, d);
+      return;
+    }
+    case ValueSerializer::TAG_STRING: {
+      size_t length;
+      const uint8_t* data = reader.readData(&length);
+      if (!reader.ok())
+        break;
+      push_utf8(ctx, state, data, length);
+      return;
+    }
+    case ValueSerializer::TAG_DATE: {
+      const double time = reader.readDouble();
+      if (!reader.ok())
+        break;
+      duk_get_global_string(ctx, "Date");
+      duk_push_number(ctx, time);
+      duk_new(ctx, 1);
+      number_object(ctx, objects);
+      return;
+    }
+    case ValueSerializer::TAG_ARRAY_BUFFER: {
+      size_t length;
+      const uint8_t* data = reader.readData(&length);
+      if (!reader.ok())
+        break;
+      push_buffer_object(ctx, data, length, DUK_BUFOBJ_ARRAYBUFFER);
+      number_object(ctx, objects);
+      return;
+    }
+    case ValueSerializer::TAG_TYPED_ARRAY: {
+      const int kind = reader.readTag();
+      size_t length;
+      const uint8_t* data = reader.readData(&length);
+      if (!reader.ok() || kind >= ValueSerializer::TYPED_ARRAY_KIND_COUNT)
+        break;
+      push_buffer_object(ctx, data, length, (duk_uint_t)(DUK_BUFOBJ_INT8ARRAY + kind));
+      number_object(ctx, objects);
+      return;
+    }
+    case ValueSerializer::TAG_ARRAY: {
+      const uint64_t length = reader.readLength();
+      if (!reader.ok() || length > reader.remaining())
+        break;
+      const duk_idx_t array = duk_push_array(ctx);
+      number_object(ctx, objects);
+      for (duk_uarridx_t i = 0; i < length; i++) {
+        deserialize_duktape_value(ctx, state, objects, depth + 1);
+        duk_put_prop_index(ctx, array, i);
+      }
+      return;
+    }
+    case ValueSerializer::TAG_OBJECT: {
+      const duk_idx_t object = duk_push_object(ctx);
+      number_object(ctx, objects);
+      while (true) {
+        const int keyTag = reader.readTag();
+        if (keyTag == ValueSerializer::TAG_END && reader.ok())
+          return;
+        size_t length;
+        const uint8_t* key = reader.readData(&length);
+        if (keyTag != ValueSerializer::TAG_STRING || !reader.ok())
+          break;
+        push_utf8(ctx, state, key, length);
+        deserialize_duktape_value(ctx, state, objects, depth + 1);
+        // defined rather than put, so keys like __proto__ stay plain properties.
+        duk_def_prop(ctx, object, DUK_DEFPROP_HAVE_VALUE | DUK_DEFPROP_SET_WEC);
+      }
+      break;
+    }
+    case ValueSerializer::TAG_REFERENCE: {
+      const uint64_t number = reader.readLength();
+      if (!reader.ok() || number >= duk_get_length(ctx, objects))
+        break;
+      duk_get_prop_index(ctx, objects, (duk_uarridx_t)number);
+      return;
+    }
+    default:
+      break;
+  }
+  (void)throw_malformed(ctx);
+}
+
+static duk_ret_t deserialize_value(duk_context *ctx, void *udata) {
+  SerializeState* state = static_cast<SerializeState*>(udata);
+  const duk_idx_t objects = duk_push_array(ctx);
+  deserialize_duktape_value(ctx, state, objects, 0);
+  if (!state->reader->atEnd())
+    return throw_malformed(ctx);
+  return 1;
+}
+
+jbyteArray DuktapeContext::serialize(JNIEnv *env, jobject value) {
+  CHECK_STACK(m_context);
+  SerializedWriter writer;
+  SerializeState state = { &writer, nullptr, std::vector<uint8_t>() };
+  pushObject(env, value, false);
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, serialize_value, &state, 1, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return nullptr;
+  }
   duk_pop(m_context);
 
-  // the Java side kept this duktape heap object alive with a reference in the global stash.
-  // can delete that now.
-  duk_push_global_stash(m_context);
-  duk_uarridx_t heapIndex = (duk_uarridx_t)reinterpret_cast<long>(ptr);
-  duk_del_prop_index(m_context, -1, heapIndex);
+  const std::vector<uint8_t>& data = writer.data();
+  jbyteArray ret = env->NewByteArray((jsize)data.size());
+  if (ret != nullptr)
+    env->SetByteArrayRegion(ret, 0, (jsize)data.size(), reinterpret_cast<const jbyte*>(data.data()));
+  return ret;
+}
+
+jobject DuktapeContext::deserialize(JNIEnv *env, jbyteArray data) {
+  CHECK_STACK(m_context);
+  // copied out, as finalizers run by allocations may call into JNI.
+  std::vector<uint8_t> bytes((size_t)env->GetArrayLength(data));
+  env->GetByteArrayRegion(data, 0, (jsize)bytes.size(), reinterpret_cast<jbyte*>(bytes.data()));
+
+  SerializedReader reader(bytes.data(), bytes.size());
+  SerializeState state = { nullptr, &reader, std::vector<uint8_t>() };
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, deserialize_value, &state, 0, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return nullptr;
+  }
+  return popObject(env);
+}
+
+struct ArrayRangeState {
+  duk_uarridx_t index;
+  duk_uarridx_t length;
+  ArrayRange::Type type;
+  // the elements of the range, if the array is a typed array of the type.
+  void* elements;
+  // otherwise, the range as numbers.
+  double* numbers;
+};
+
+static duk_ret_t typed_array_elements(duk_context *ctx, void *udata) {
+  ArrayRangeState* state = static_cast<ArrayRangeState*>(udata);
+  if (!duk_is_buffer_data(ctx, 0))
+    return 0;
+  duk_get_global_string(ctx, ValueSerializer::typedArrayName(ArrayRange::typedArrayKind(state->type)));
+  if (!duk_is_function(ctx, -1) || !duk_instanceof(ctx, 0, -1))
+    return 0;
+  duk_size_t size;
+  uint8_t* data = static_cast<uint8_t*>(duk_get_buffer_data(ctx, 0, &size));
+  const size_t elementSize = ArrayRange::elementSize(state->type);
+  if (data != nullptr && (duk_size_t)state->index + state->length <= size / elementSize)
+    state->elements = data + state->index * elementSize;
+  return 0;
+}
+
+static duk_ret_t get_array_range(duk_context *ctx, void *udata) {
+  ArrayRangeState* state = static_cast<ArrayRangeState*>(udata);
+  for (duk_uarridx_t i = 0; i < state->length; i++) {
+    duk_get_prop_index(ctx, 0, state->index + i);
+    state->numbers[i] = duk_to_number(ctx, -1);
+    duk_pop(ctx);
+  }
+  return 0;
+}
+
+static duk_ret_t set_array_range(duk_context *ctx, void *udata) {
+  ArrayRangeState* state = static_cast<ArrayRangeState*>(udata);
+  for (duk_uarridx_t i = 0; i < state->length; i++) {
+    duk_push_number(ctx, state->numbers[i]);
+    duk_put_prop_index(ctx, 0, state->index + i);
+  }
+  return 0;
+}
+
+static duk_ret_t new_typed_array(duk_context *ctx, void *udata) {
+  ArrayRangeState* state = static_cast<ArrayRangeState*>(udata);
+  const duk_size_t size = (duk_size_t)state->length * ArrayRange::elementSize(state->type);
+  state->elements = duk_push_fixed_buffer(ctx, size);
+  duk_push_buffer_object(ctx, -1, 0, size, DUK_BUFOBJ_INT8ARRAY + ArrayRange::typedArrayKind(state->type));
+  return 1;
+}
+
+void DuktapeContext::getArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length) {
+  CHECK_STACK(m_context);
+  ArrayRangeState state = { (duk_uarridx_t)index, (duk_uarridx_t)length, (ArrayRange::Type)type, nullptr, nullptr };
+  pushObject(env, object);
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, typed_array_elements, &state, 1, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return;
+  }
+  duk_pop(m_context);
+  // the array holds on to its buffer, and no script runs before the copy.
+  if (state.elements != nullptr) {
+    ArrayRange::fromElements(env, array, state.type, offset, length, state.elements);
+    return;
+  }
+
+  std::vector<double> numbers((size_t)length);
+  state.numbers = numbers.data();
+  pushObject(env, object);
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, get_array_range, &state, 1, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return;
+  }
+  duk_pop(m_context);
+  ArrayRange::fromNumbers(env, array, state.type, offset, length, numbers.data());
+}
+
+void DuktapeContext::setArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length) {
+  CHECK_STACK(m_context);
+  ArrayRangeState state = { (duk_uarridx_t)index, (duk_uarridx_t)length, (ArrayRange::Type)type, nullptr, nullptr };
+  pushObject(env, object);
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, typed_array_elements, &state, 1, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return;
+  }
+  duk_pop(m_context);
+  if (state.elements != nullptr) {
+    ArrayRange::toElements(env, array, state.type, offset, length, state.elements);
+    return;
+  }
+
+  std::vector<double> numbers((size_t)length);
+  ArrayRange::toNumbers(env, array, state.type, offset, length, numbers.data());
+  state.numbers = numbers.data();
+  pushObject(env, object);
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, set_array_range, &state, 1, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return;
+  }
   duk_pop(m_context);
 }
 
+jobject DuktapeContext::newTypedArray(JNIEnv *env, jarray array, jint type) {
+  CHECK_STACK(m_context);
+  const jsize length = env->GetArrayLength(array);
+  ArrayRangeState state = { 0, (duk_uarridx_t)length, (ArrayRange::Type)type, nullptr, nullptr };
+  if (withHeapLimit(m_allocator, [&] { return duk_safe_call(m_context, new_typed_array, &state, 0, 1); }) != DUK_EXEC_SUCCESS) {
+    queueJavaExceptionForDuktapeError(env, m_context);
+    return nullptr;
+  }
+  if (length != 0)
+    ArrayRange::toElements(env, array, state.type, 0, length, state.elements);
+  // popObject would copy the typed array out to a ByteBuffer.
+  return popJavaScriptObject(env);
+}
+
+jint DuktapeContext::finalizeJavaScriptObjects(JNIEnv *env, jlongArray handles, jint count, jlong budgetNanos) {
+  CHECK_STACK(m_context);
+
+  // copied out, as releasing the objects may run finalizers that call into JNI.
+  std::vector<jlong> copy((size_t)count);
+  env->GetLongArrayRegion(handles, 0, count, copy.data());
+
+  // the objects array is looked up once for the whole batch.
+  duk_push_global_stash(m_context);
+  duk_get_prop_string(m_context, -1, JAVASCRIPT_OBJECTS_PROP_NAME);
+  const duk_idx_t objects = duk_get_top_index(m_context);
+  FinalizationBudget budget(budgetNanos);
+  jint released = 0;
+  while (released < count && budget.allows(released)) {
+    releaseJavaScriptObject(env, copy[released++], objects);
+  }
+  duk_pop_2(m_context);
+  return released;
+}
+
+// the JavaScriptObject (java representation) was collected.
+void DuktapeContext::releaseJavaScriptObject(JNIEnv *env, jlong handle, duk_idx_t objects) {
+  // clean up the ref to the duktape heap object
+  void* ptr = m_javaScriptObjects.remove(handle);
+  m_backReferences.remove(env, ptr, handle);
+
+  // the Java side kept this duktape heap object alive with a reference in the global stash.
+  // can clear that now. the slot is left undefined rather than deleted so the array stays dense.
+  duk_push_undefined(m_context);
+  duk_put_prop_index(m_context, objects, (duk_uarridx_t)handle);
+}
+
 
 void queueIllegalArgumentException(JNIEnv* env, const std::string& message) {
   const jclass illegalArgumentException = env->FindClass("java/lang/IllegalArgumentException");
@@ -1049,19 +2559,14 @@ bool checkRethrowDuktapeErrorInternal(JNIEnv* env, duk_context* ctx) {
   duk_swap_top(ctx, -2);
   duk_put_prop_string(ctx, -2, JAVA_EXCEPTION_PROP_NAME);
 
-  jclass exceptionClass = env->FindClass("com/koushikdutta/quack/QuackException");
-  duk_get_prop_string(ctx, -1, "stack");
-  std::string stack = duk_safe_to_string(ctx, -1);
-  duk_pop(ctx);
-
-  // add the Duktape JavaScript stack to this exception.
-  const jmethodID addJavaStack =
-          env->GetStaticMethodID(exceptionClass,
-                                 "addJavaStack",
-                                 "(Ljava/lang/String;Ljava/lang/Throwable;)Ljava/lang/String;");
-  jobject newStack = env->CallStaticObjectMethod(exceptionClass, addJavaStack, env->NewStringUTF(stack.c_str()), e);
-  duktapeContext->pushObject(env, newStack);
-  duk_put_prop_string(ctx, -2, "stack");
+  // the Java stack is merged in only if the stack is read.
+  if (duktapeContext->exceptionStackMode() == JSContext::EXCEPTION_STACK_MERGED) {
+    duk_push_string(ctx, "stack");
+    duk_push_global_stash(ctx);
+    duk_get_prop_string(ctx, -1, JAVA_STACK_GETTER_PROP_NAME);
+    duk_remove(ctx, -2);
+    duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_GETTER | DUK_DEFPROP_SET_CONFIGURABLE);
+  }
 
   return false;
 }
@@ -1079,37 +2584,47 @@ bool checkRethrowDuktapeErrorException(JNIEnv* env, duk_context* ctx) {
 }
 
 void queueJavaExceptionForDuktapeError(JNIEnv *env, duk_context *ctx) {
+  // reading the error allocates, which must not fail if the error was the heap limit.
+  const HeapLimitScope heapLimit(getDuktapeContext(ctx)->m_allocator, false);
   jclass exceptionClass = env->FindClass("com/koushikdutta/quack/QuackException");
-
-  // If it's a Duktape error object, try to pull out the full stacktrace.
-  if (duk_is_error(ctx, -1) && duk_has_prop_string(ctx, -1, "stack")) {
-    duk_get_prop_string(ctx, -1, "stack");
-    const char* stack = duk_safe_to_string(ctx, -1);
-
-    // Is there an exception thrown from a Java method?
-    if (duk_has_prop_string(ctx, -2, JAVA_EXCEPTION_PROP_NAME)) {
-      duk_get_prop_string(ctx, -2, JAVA_EXCEPTION_PROP_NAME);
-      DuktapeContext* duktapeContext = getDuktapeContext(ctx);
-      jobject wrappedEx = duktapeContext->popObject(env);
-      jthrowable ex = (jthrowable)env->CallObjectMethod(wrappedEx, duktapeContext->m_javaObjectGetObject, nullptr);
-
-      // add the Duktape JavaScript stack to this exception.
+  // errors while the budget is expired are the execution timeout unwinding the script.
+  jclass thrownClass = getDuktapeContext(ctx)->isExecutionBudgetExpired()
+      ? env->FindClass("com/koushikdutta/quack/QuackInterruptedException")
+      : exceptionClass;
+
+  const bool merged = getDuktapeContext(ctx)->exceptionStackMode() == JSContext::EXCEPTION_STACK_MERGED;
+
+  // Is there an exception thrown from a Java method?
+  if (duk_is_error(ctx, -1) && duk_has_prop_string(ctx, -1, JAVA_EXCEPTION_PROP_NAME)) {
+    duk_get_prop_string(ctx, -1, JAVA_EXCEPTION_PROP_NAME);
+    DuktapeContext* duktapeContext = getDuktapeContext(ctx);
+    jobject wrappedEx = duktapeContext->popObject(env);
+    jthrowable ex = (jthrowable)env->CallObjectMethod(wrappedEx, duktapeContext->m_javaObjectGetObject, nullptr);
+
+    if (merged) {
+      // add the Duktape JavaScript stack to this exception. The unmerged stack, as the Java
+      // one is already on the exception.
+      pushJavaScriptStack(ctx, -1);
       const jmethodID addDuktapeStack =
               env->GetStaticMethodID(exceptionClass,
                                      "addJSStack",
                                      "(Ljava/lang/Throwable;Ljava/lang/String;)V");
-      env->CallStaticVoidMethod(exceptionClass, addDuktapeStack, ex, env->NewStringUTF(stack));
-
-      // Rethrow the Java exception.
-      env->Throw(ex);
-    } else {
-      env->ThrowNew(exceptionClass, stack);
+      env->CallStaticVoidMethod(exceptionClass, addDuktapeStack, ex, env->NewStringUTF(duk_safe_to_string(ctx, -1)));
+      duk_pop(ctx);
     }
+
+    // Rethrow the Java exception.
+    env->Throw(ex);
+  } else if (merged && duk_is_error(ctx, -1) && duk_has_prop_string(ctx, -1, "stack")) {
+    // If it's a Duktape error object, pull out the full stacktrace. The QuackException
+    // splices it in only if its trace is read.
+    duk_get_prop_string(ctx, -1, "stack");
+    env->ThrowNew(thrownClass, duk_safe_to_string(ctx, -1));
     // Pop the stack text.
     duk_pop(ctx);
   } else {
-    // Not an error or no stacktrace, just convert to a string.
-    env->ThrowNew(exceptionClass, duk_safe_to_string(ctx, -1));
+    // Not an error, no stacktrace, or stacks are not merged: just convert to a string.
+    env->ThrowNew(thrownClass, duk_safe_to_string(ctx, -1));
   }
 
   duk_pop(ctx);
@@ -20,18 +20,34 @@
 #include <list>
 #include "../duktape/duktape.h"
 #include "java/JavaType.h"
+#include "DuktapeAllocator.h"
+#include "JavaProxies.h"
 #include "../duktape/duk_trans_socket.h"
 #include "../JSContext.h"
+#include "../HandleTable.h"
+#include "../FieldCache.h"
+#include "../NativeMethodCache.h"
+#include "../ExecutionBudget.h"
+#include "../MemoryStats.h"
+#include "../Profiler.h"
+#include "../ValueSerializer.h"
+#include "../ArrayRange.h"
+#include "../FinalizationBudget.h"
+#include "../BackReferences.h"
+#include "../ConsoleFormatter.h"
+#include "../ModuleLoader.h"
 
 class DuktapeContext : public JSContext {
 public:
-  explicit DuktapeContext(JavaVM* javaVM, jobject javaDuktape);
+  explicit DuktapeContext(JavaVM* javaVM, jobject javaDuktape, int allocatorMode = DuktapeAllocator::HEADER);
   ~DuktapeContext();
   DuktapeContext(const DuktapeContext &) = delete;
   DuktapeContext & operator=(const DuktapeContext &) = delete;
 
   jobject evaluate(JNIEnv* env, jstring sourceCode, jstring fileName);
   jobject compile(JNIEnv* env, jstring code, jstring fileName);
+  jbyteArray compileBytecode(JNIEnv* env, jstring code, jstring fileName);
+  jobject evaluateBytecode(JNIEnv* env, jbyteArray bytecode);
 
   void cooperateDebugger();
   void waitForDebugger(JNIEnv *env, jstring connectionString);
@@ -46,24 +62,70 @@ public:
   jboolean setKeyString(JNIEnv* env, jlong object, jstring key, jobject value);
   jboolean setKeyInteger(JNIEnv* env, jlong object, jint index, jobject value);
   jboolean setKeyObject(JNIEnv* env, jlong object, jobject key, jobject value);
+  void getArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length);
+  void setArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length);
+  jobject newTypedArray(JNIEnv *env, jarray array, jint type);
+  jlong internKey(JNIEnv* env, jstring key);
+  void releaseKey(JNIEnv* env, jlong key);
+  jobject getKeyHandle(JNIEnv* env, jlong object, jlong key);
+  jboolean setKeyHandle(JNIEnv* env, jlong object, jlong key, jobject value);
+  jobject callPropertyHandle(JNIEnv* env, jlong object, jlong key, jobjectArray args);
   jobject call(JNIEnv* env, jlong object, jobjectArray args);
+  jobjectArray callBatch(JNIEnv* env, jlong object, jobjectArray argsList);
   jobject callMethod(JNIEnv *env, jlong object, jobject thiz, jobjectArray args);
   jobject callProperty(JNIEnv* env, jlong object, jobject target, jobjectArray args);
   void setGlobalProperty(JNIEnv *env, jobject property, jobject value);
   jstring stringify(JNIEnv *env, jlong object);
-  void finalizeJavaScriptObject(JNIEnv *env, jlong object);
+  jobject stringifyUtf8(JNIEnv *env, jlong object, jobject buffer);
+  jint finalizeJavaScriptObjects(JNIEnv *env, jlongArray handles, jint count, jlong budgetNanos);
   jlong getHeapSize(JNIEnv *env);
+  void setHeapLimit(JNIEnv *env, jlong limit);
+  jlong getHeapHighWaterMark(JNIEnv *env);
+  void resetHeapHighWaterMark(JNIEnv *env);
+  void getMemoryStats(JNIEnv *env, jlongArray stats, jboolean detailed);
+  // Duktape has no job queue, promise polyfills settle through their own scheduling.
   void runJobs(JNIEnv *env) {}
+  jboolean hasPendingJobs(JNIEnv *env) { return JNI_FALSE; }
+  void setGCPolicy(JNIEnv *env, jint mode, jlong value);
+  void gc(JNIEnv *env);
+  void setZeroCopyBuffers(JNIEnv *env, jboolean zeroCopy);
+  void unpinBuffer(JNIEnv *env, jlong pin);
+  void clearFieldCache(JNIEnv *env);
+  void startExecutionBudget(JNIEnv *env, jlong timeoutNanos) { m_executionBudget.start(timeoutNanos); }
+  void stopExecutionBudget(JNIEnv *env) { m_executionBudget.stop(); }
+  void interrupt() { m_executionBudget.interrupt(); }
+  bool checkExecutionBudget() { return m_executionBudget.check(); }
+  bool isExecutionBudgetExpired() const { return m_executionBudget.isExpired(); }
+  void startProfiling(JNIEnv *env, jlong intervalNanos) { m_profiler.start(intervalNanos); }
+  jstring stopProfiling(JNIEnv *env);
+  jbyteArray serialize(JNIEnv *env, jobject value);
+  jobject deserialize(JNIEnv *env, jbyteArray data);
+  void installConsole(JNIEnv *env);
+  void installModuleLoader(JNIEnv *env, jboolean cacheModules);
+  void setExceptionStackMode(JNIEnv *env, jint mode) { m_exceptionStackMode = mode; }
+  int exceptionStackMode() const { return m_exceptionStackMode; }
+  // samples the JavaScript stack of ctx, with the bridge trap that is returning if any.
+  void sampleProfileIfDue(duk_context *ctx, const char *trap) {
+    if (m_profiler.due())
+      sampleProfile(ctx, trap);
+  }
 
   duk_ret_t duktapeHas();
   duk_ret_t duktapeGet();
   duk_ret_t duktapeSet();
   duk_ret_t duktapeApply();
+  duk_ret_t duktapeConsole(int method);
+  duk_ret_t duktapeResolveModule();
+  duk_ret_t duktapeLoadModule();
+  duk_ret_t duktapeJavaStack();
 
   jmethodID m_javaObjectGetObject;
-  long m_heapSize;
-  std::map<void*, size_t> pointers;
+  JavaVM* const m_javaVM;
+  DuktapeAllocator m_allocator;
   duk_context* m_context;
+  MemoryStats m_memoryStats;
+  // the proxies of the Java objects in JavaScript, see pushObject.
+  JavaProxies m_javaProxies;
 
 private:
   jclass m_objectClass;
@@ -74,26 +136,71 @@ private:
   jclass m_javaObjectClass;
   jclass m_jsonObjectClass;
   jclass m_byteBufferClass;
+  jclass m_byteArrayClass;
+  jclass m_quackExceptionClass;
   jmethodID m_duktapeHasMethod;
   jmethodID m_duktapeGetMethod;
   jmethodID m_duktapeSetMethod;
   jmethodID m_duktapeCallMethodMethod;
+  jmethodID m_duktapeConsoleMethod;
+  jmethodID m_duktapeResolveModuleMethod;
+  jmethodID m_duktapeLoadModuleMethod;
+  jmethodID m_duktapeStoreModuleMethod;
+  jmethodID m_duktapePinBufferMethod;
+  jmethodID m_duktapeJsonBufferMethod;
+  jmethodID m_duktapeResolveFieldMethod;
   jmethodID m_javaScriptObjectConstructor;
   jmethodID m_javaObjectConstructor;
   jmethodID m_byteBufferAllocateDirect;
+  jmethodID m_addJavaStackMethod;
   jfieldID m_contextField;
   jfieldID m_pointerField;
   jfieldID m_jsonField;
+  jfieldID m_jsonUtf8Field;
+  jfieldID m_jsonPositionField;
+  jfieldID m_jsonLimitField;
+  jfieldID m_javaObjectTargetField;
+  jclass m_nativeMethodClass;
+  jfieldID m_nativeMethodTargetField;
+  jfieldID m_nativeMethodMethodField;
+  jfieldID m_nativeMethodSignatureField;
 
   jobject popObject2(JNIEnv* env) const;
+  jobject popJavaScriptObject(JNIEnv* env) const;
+  void releaseJavaScriptObject(JNIEnv *env, jlong handle, duk_idx_t objects);
   void pushObject(JNIEnv* env, jlong object);
 
   jclass findClass(JNIEnv* env, const char* className);
+  bool findField(JNIEnv* env, jobject object, const std::string& prop, jobject* target, FieldCache<std::string>::Field* field);
+  bool callNativeMethod(JNIEnv* env, jobject nativeMethod, duk_ret_t* ret);
+  const JavaType* getSignatureType(JNIEnv* env, char type);
+  void collectGarbageIfNeeded();
 
   jobject m_javaDuktape;
   JavaTypeMap m_javaValues;
   const JavaType* m_objectType;
   client_sock_t m_DebuggerSocket;
+  GCPolicy m_gcPolicy;
+  bool m_zeroCopyBuffers;
+  // whether modules compiled from source are handed back to Java for the bytecode cache.
+  bool m_cacheModules;
+  // a JSContext::ExceptionStackMode.
+  int m_exceptionStackMode;
+  // popObject is const, but pinning a buffer has to hand out a new id.
+  mutable duk_uint_t m_nextPinnedBuffer;
+  // heap pointers of the objects held by Java JavaScriptObjects, by handle. The object itself
+  // is kept reachable at the same index of the JavaScript objects array in the stash.
+  mutable HandleTable<void*> m_javaScriptObjects;
+  // the JavaScriptObject of each of those objects, looked up when they cross again.
+  mutable BackReferences m_backReferences;
+  FieldCache<std::string> m_fieldCache;
+  NativeMethodCache m_nativeMethods;
+  // JavaTypes by NativeMethodCache type, for marshalling native method calls.
+  std::map<char, const JavaType*> m_signatureTypes;
+  ExecutionBudget m_executionBudget;
+  Profiler m_profiler;
+
+  void sampleProfile(duk_context *ctx, const char *trap);
 };
 
 #endif // DUKTAPE_ANDROID_DUKTAPE_CONTEXT_H
@@ -0,0 +1,87 @@
+#ifndef DUKTAPE_ANDROID_JAVAPROXIES_H
+#define DUKTAPE_ANDROID_JAVAPROXIES_H
+
+#include <jni.h>
+#include <unordered_map>
+
+/**
+ * The Duktape proxies of Java objects, by Java object identity, so pushing an object that is
+ * already in JavaScript reuses its proxy instead of building a new one.
+ *
+ * An entry is removed by the finalizer of its proxy target. The target references the proxy
+ * back, so the pair is only freed by mark and sweep, which runs the finalizer first: the proxy
+ * heap pointer stays valid for as long as the entry exists.
+ *
+ * Not thread safe; callers hold the QuackContext lock.
+ */
+class JavaProxies {
+public:
+  explicit JavaProxies(JNIEnv* env)
+      : m_systemClass(static_cast<jclass>(env->NewGlobalRef(env->FindClass("java/lang/System"))))
+      , m_identityHashCode(env->GetStaticMethodID(m_systemClass, "identityHashCode", "(Ljava/lang/Object;)I")) {
+  }
+
+  JavaProxies(const JavaProxies&) = delete;
+  JavaProxies& operator=(const JavaProxies&) = delete;
+
+  // the heap pointer of the proxy of the object, or null. hash is set for add.
+  void* find(JNIEnv* env, jobject object, jint* hash) const {
+    *hash = env->CallStaticIntMethod(m_systemClass, m_identityHashCode, object);
+    auto range = m_targets.equal_range(*hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const Entry& entry = m_entries.at(it->second);
+      if (env->IsSameObject(entry.object, object))
+        return entry.proxy;
+    }
+    return nullptr;
+  }
+
+  void add(JNIEnv* env, jobject object, jint hash, void* target, void* proxy) {
+    Entry& entry = m_entries[target];
+    entry.hash = hash;
+    // the target holds a global ref to the object, so a weak one is enough here.
+    entry.object = env->NewWeakGlobalRef(object);
+    entry.proxy = proxy;
+    m_targets.insert(std::make_pair(hash, target));
+  }
+
+  // the target of a proxy is being finalized.
+  void remove(JNIEnv* env, void* target) {
+    auto found = m_entries.find(target);
+    if (found == m_entries.end())
+      return;
+    auto range = m_targets.equal_range(found->second.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == target) {
+        m_targets.erase(it);
+        break;
+      }
+    }
+    env->DeleteWeakGlobalRef(found->second.object);
+    m_entries.erase(found);
+  }
+
+  void clear(JNIEnv* env) {
+    for (const auto& entry: m_entries) {
+      env->DeleteWeakGlobalRef(entry.second.object);
+    }
+    m_entries.clear();
+    m_targets.clear();
+  }
+
+private:
+  struct Entry {
+    jint hash;
+    jweak object;
+    void* proxy;
+  };
+
+  jclass m_systemClass;
+  jmethodID m_identityHashCode;
+  // by proxy target.
+  std::unordered_map<void*, Entry> m_entries;
+  // proxy targets by identity hash code of the Java object.
+  std::unordered_multimap<jint, void*> m_targets;
+};
+
+#endif //DUKTAPE_ANDROID_JAVAPROXIES_H
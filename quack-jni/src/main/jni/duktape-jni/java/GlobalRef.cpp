@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include "GlobalRef.h"
+#include "../../JSContext.h"
 
 GlobalRef::GlobalRef(JNIEnv* env, jobject object)
     : m_object(env->NewGlobalRef(object)) {
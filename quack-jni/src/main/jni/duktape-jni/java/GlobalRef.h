@@ -40,6 +40,5 @@ private:
   jobject m_object;
 };
 
-JNIEnv* getEnvFromJavaVM(JavaVM* javaVM);
 
 #endif //DUKTAPE_ANDROID_GLOBALREF_H
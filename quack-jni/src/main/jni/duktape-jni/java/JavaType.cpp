@@ -16,13 +16,18 @@
 #include "JavaType.h"
 #include "JString.h"
 #include "JavaExceptions.h"
+#include <algorithm>
 
 jvalue JavaType::callMethod(duk_context* ctx, JNIEnv *env, jmethodID methodId, jobject javaThis,
                             jvalue* args) const {
-  jobject returnValue = env->CallObjectMethodA(javaThis, methodId, args);
+  const jvalue result = invokeMethod(env, methodId, javaThis, args);
   checkRethrowDuktapeError(env, ctx);
+  return result;
+}
+
+jvalue JavaType::invokeMethod(JNIEnv *env, jmethodID methodId, jobject javaThis, jvalue* args) const {
   jvalue result;
-  result.l = returnValue;
+  result.l = env->CallObjectMethodA(javaThis, methodId, args);
   return result;
 }
 
@@ -60,10 +65,9 @@ struct Void : public JavaType {
     }
   }
 
-  jvalue callMethod(duk_context* ctx, JNIEnv* env, jmethodID methodId, jobject javaThis,
-                    jvalue *args) const override {
+  jvalue invokeMethod(JNIEnv* env, jmethodID methodId, jobject javaThis,
+                      jvalue* args) const override {
     env->CallVoidMethodA(javaThis, methodId, args);
-    checkRethrowDuktapeError(env, ctx);
     jvalue result;
     result.l = nullptr;
     return result;
@@ -148,12 +152,10 @@ struct Boolean : public Primitive {
     return 1;
   }
 
-  jvalue callMethod(duk_context* ctx, JNIEnv* env, jmethodID methodId, jobject javaThis,
-                    jvalue *args) const override {
-    jboolean returnValue = env->CallBooleanMethodA(javaThis, methodId, args);
-    checkRethrowDuktapeError(env, ctx);
+  jvalue invokeMethod(JNIEnv* env, jmethodID methodId, jobject javaThis,
+                      jvalue* args) const override {
     jvalue result;
-    result.z = returnValue;
+    result.z = env->CallBooleanMethodA(javaThis, methodId, args);
     return result;
   }
 
@@ -191,12 +193,10 @@ struct Integer : public Primitive {
     return 1;
   }
 
-  jvalue callMethod(duk_context* ctx, JNIEnv* env, jmethodID methodId, jobject javaThis,
-                    jvalue *args) const override {
-    jint returnValue = env->CallIntMethodA(javaThis, methodId, args);
-    checkRethrowDuktapeError(env, ctx);
+  jvalue invokeMethod(JNIEnv* env, jmethodID methodId, jobject javaThis,
+                      jvalue* args) const override {
     jvalue result;
-    result.i = returnValue;
+    result.i = env->CallIntMethodA(javaThis, methodId, args);
     return result;
   }
 
@@ -237,12 +237,10 @@ struct Double : public Primitive {
     return 1;
   }
 
-  jvalue callMethod(duk_context* ctx, JNIEnv* env, jmethodID methodId, jobject javaThis,
-                    jvalue* args) const override {
-    jdouble returnValue = env->CallDoubleMethodA(javaThis, methodId, args);
-    checkRethrowDuktapeError(env, ctx);
+  jvalue invokeMethod(JNIEnv* env, jmethodID methodId, jobject javaThis,
+                      jvalue* args) const override {
     jvalue result;
-    result.d = returnValue;
+    result.d = env->CallDoubleMethodA(javaThis, methodId, args);
     return result;
   }
 
@@ -404,7 +402,23 @@ JavaTypeMap::~JavaTypeMap() {
 }
 
 const JavaType* JavaTypeMap::get(JNIEnv* env, jclass c) {
-  return find(env, getName(env, c));
+  // compare class identity first, getName() calls back into Java.
+  for (const JavaType* type : m_fastTypes) {
+    if (env->IsSameObject(c, type->getClass())) {
+      return type;
+    }
+  }
+  for (const CachedType& cached : m_cachedTypes) {
+    if (env->IsSameObject(c, cached.classRef.get())) {
+      return cached.type;
+    }
+  }
+
+  const JavaType* type = find(env, getName(env, c));
+  if (m_cachedTypes.size() < MAX_CACHED_TYPES) {
+    m_cachedTypes.push_back({ GlobalRef(env, c), type });
+  }
+  return type;
 }
 
 const JavaType* JavaTypeMap::getObjectType(JNIEnv* env) {
@@ -412,6 +426,15 @@ const JavaType* JavaTypeMap::getObjectType(JNIEnv* env) {
   return m_ObjectType;
 }
 
+const JavaType* JavaTypeMap::getForSignature(JNIEnv* env, const std::string& signature) {
+  if (signature == "V") {
+    return find(env, "void");
+  }
+  std::string name = dropLandSemicolon(signature);
+  std::replace(name.begin(), name.end(), '/', '.');
+  return find(env, name);
+}
+
 const JavaType* JavaTypeMap::find(JNIEnv* env, const std::string& name) {
   if (m_types.empty()) {
     // Load up the map with the types we support.
@@ -432,6 +455,11 @@ const JavaType* JavaTypeMap::find(JNIEnv* env, const std::string& name) {
     const jclass objectClass = env->FindClass("java/lang/Object");
     m_ObjectType = new Object(GlobalRef(env, objectClass), *boxedBooleanType,
                                        *boxedDoubleType, *this);
+
+    m_fastTypes.push_back(stringType);
+    m_fastTypes.push_back(m_types["java.lang.Integer"]);
+    m_fastTypes.push_back(boxedDoubleType);
+    m_fastTypes.push_back(boxedBooleanType);
   }
 
   const auto I = m_types.find(name);
@@ -17,6 +17,7 @@
 #define DUKTAPE_ANDROID_JAVAVALUE_H
 
 #include <map>
+#include <vector>
 #include <jni.h>
 #include "../../duktape/duktape.h"
 #include "GlobalRef.h"
@@ -46,7 +47,12 @@ public:
    * Calls the given Java method with {@code javaThis} and {@code args}.  Returns the result from
    * the method.  The Duktape context is only modified to propagate exceptions thrown by the JVM.
    */
-  virtual jvalue callMethod(duk_context*, JNIEnv*, jmethodID, jobject javaThis, jvalue* args) const;
+  jvalue callMethod(duk_context*, JNIEnv*, jmethodID, jobject javaThis, jvalue* args) const;
+  /**
+   * Calls the given Java method like {@code callMethod}, but leaves any exception thrown by the
+   * JVM pending for the caller to check.
+   */
+  virtual jvalue invokeMethod(JNIEnv*, jmethodID, jobject javaThis, jvalue* args) const;
   /**
    * Return true if this is a primitive (int, boolean, etc.), false if not (String, Integer, etc.).
    */
@@ -70,11 +76,23 @@ public:
   const JavaType* getBoxed(JNIEnv*, jclass javaClass);
   /** Get the JavaType that represents Object. */
   const JavaType* getObjectType(JNIEnv*);
+  /** Get the JavaType for a JNI type signature, such as "I" or "Ljava/lang/String;". */
+  const JavaType* getForSignature(JNIEnv*, const std::string& signature);
 
 private:
+  /** Result of a previous lookup by class, including classes with no JavaType. */
+  struct CachedType {
+    GlobalRef classRef;
+    const JavaType* type;
+  };
+  static const size_t MAX_CACHED_TYPES = 32;
+
   JavaType* m_ObjectType;
   const JavaType* find(JNIEnv*, const std::string&);
   std::map<std::string, const JavaType*> m_types;
+  /** String, Integer, Double and Boolean, checked before anything else. */
+  std::vector<const JavaType*> m_fastTypes;
+  std::vector<CachedType> m_cachedTypes;
 };
 
 /** Calls getName() on the given class and returns a copy of the result. */
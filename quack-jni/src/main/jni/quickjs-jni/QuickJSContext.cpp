@@ -1,4 +1,8 @@
 #include "QuickJSContext.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -11,24 +15,21 @@ inline static JSValue toValueAsDup(JSContext *ctx, jlong object) {
     return JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, reinterpret_cast<void *>(object)));
 }
 
-inline uint32_t hash(uint64_t v) {
-    return ((v >> 32) & 0x00000000FFFFFFFF) ^ (v & 0x00000000FFFFFFFF);
-}
-
 static JSValue stacktrace_getter(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
     // JS_Throw(ctx, JS_NewError(ctx));
     return JS_EXCEPTION;
 }
 
-static JSClassID customFinalizerClassId = 0;
 static JSClassID quackObjectProxyClassId = 0;
-
-static void javaWeakRefFinalizer(QuickJSContext *ctx, JSValue val, void *udata) {
-    auto weakRef = reinterpret_cast<jobject>(udata);
-    if (nullptr == weakRef)
-        return;
-    JNIEnv *env = getEnvFromJavaVM(ctx->javaVM);
-    env->DeleteWeakGlobalRef(weakRef);
+// contexts may be created concurrently (QuackContextPool), and JS_NewClassID is not thread safe.
+static std::once_flag classIdsOnce;
+
+// releases the ByteBuffer backing an ArrayBuffer created without a copy.
+static void javaBufferFree(JSRuntime *rt, void *opaque, void *ptr) {
+    auto qctx = reinterpret_cast<QuickJSContext *>(JS_GetRuntimeOpaque(rt));
+    JNIEnv *env = getEnvFromJavaVM(qctx->javaVM);
+    env->DeleteGlobalRef(reinterpret_cast<jobject>(opaque));
+    qctx->memoryStats.bufferReleased();
 }
 
 static void javaRefFinalizer(QuickJSContext *ctx, JSValue val, void *udata) {
@@ -37,13 +38,7 @@ static void javaRefFinalizer(QuickJSContext *ctx, JSValue val, void *udata) {
         return;
     JNIEnv *env = getEnvFromJavaVM(ctx->javaVM);
     env->DeleteGlobalRef(strongRef);
-}
-
-static void customFinalizer(JSRuntime *rt, JSValue val) {
-    CustomFinalizerData *data = reinterpret_cast<CustomFinalizerData *>(JS_GetOpaque(val, customFinalizerClassId));
-    // prevent double finalization from when the java side dies
-    data->finalizer(data->ctx, val, data->udata);
-    free(data);
+    ctx->memoryStats.javaObjectReleased();
 }
 
 static void quackObjectFinalizer(JSRuntime *rt, JSValue val) {
@@ -53,34 +48,165 @@ static void quackObjectFinalizer(JSRuntime *rt, JSValue val) {
     free(data);
 }
 
-static struct JSClassDef customFinalizerClassDef = {
-    .class_name = "CustomFinalizer",
-    .finalizer = customFinalizer,
+// samples the profiler as a trap returns, so time spent in Java is attributed to the trap.
+class ProfiledTrap {
+public:
+    ProfiledTrap(QuickJSContext *context, const char *name)
+        : context(context)
+        , name(name) {
+    }
+    ~ProfiledTrap() {
+        if (context->profiler.due())
+            context->sampleProfile(name);
+    }
+
+private:
+    QuickJSContext *context;
+    const char *name;
 };
 
 int quickjs_has(JSContext *ctx, JSValueConst obj, JSAtom atom) {
     CustomFinalizerData *data = reinterpret_cast<CustomFinalizerData *>(JS_GetOpaque(obj, quackObjectProxyClassId));
     jobject object = reinterpret_cast<jobject>(data->udata);
+    ProfiledTrap trap(data->ctx, "quickjs_has");
+    const BridgeStats::Scope stats(data->ctx->bridgeStats, BridgeStats::TRAP_HAS);
     return data->ctx->quickjs_has(object, atom);
 }
 JSValue quickjs_get(JSContext *ctx, JSValueConst obj, JSAtom atom, JSValueConst receiver) {
     CustomFinalizerData *data = reinterpret_cast<CustomFinalizerData *>(JS_GetOpaque(obj, quackObjectProxyClassId));
     jobject object = reinterpret_cast<jobject>(data->udata);
+    ProfiledTrap trap(data->ctx, "quickjs_get");
+    const BridgeStats::Scope stats(data->ctx->bridgeStats, BridgeStats::TRAP_GET);
     return data->ctx->quickjs_get(object, atom, receiver);
 }
 /* return < 0 if exception or TRUE/FALSE */
 int quickjs_set(JSContext *ctx, JSValueConst obj, JSAtom atom, JSValueConst value, JSValueConst receiver, int flags) {
     CustomFinalizerData *data = reinterpret_cast<CustomFinalizerData *>(JS_GetOpaque(obj, quackObjectProxyClassId));
     jobject object = reinterpret_cast<jobject>(data->udata);
+    ProfiledTrap trap(data->ctx, "quickjs_set");
+    const BridgeStats::Scope stats(data->ctx->bridgeStats, BridgeStats::TRAP_SET);
     return data->ctx->quickjs_set(object, atom, value, receiver, flags);
 }
 JSValue quickjs_apply(JSContext *ctx, JSValueConst func_obj, JSValueConst this_val, int argc, JSValueConst *argv) {
     CustomFinalizerData *data = reinterpret_cast<CustomFinalizerData *>(JS_GetOpaque(func_obj, quackObjectProxyClassId));
     jobject object = reinterpret_cast<jobject>(data->udata);
+    ProfiledTrap trap(data->ctx, "quickjs_apply");
+    const BridgeStats::Scope stats(data->ctx->bridgeStats, BridgeStats::TRAP_APPLY);
     return data->ctx->quickjs_apply(object, this_val, argc, argv);
 }
+static JSValue quickjs_console(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic) {
+    auto context = reinterpret_cast<QuickJSContext *>(JS_GetContextOpaque(ctx));
+    ProfiledTrap trap(context, "quickjs_console");
+    return context->quickjs_console(argc, argv, magic);
+}
+static JSValue quickjs_java_stack(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    auto context = reinterpret_cast<QuickJSContext *>(JS_GetContextOpaque(ctx));
+    ProfiledTrap trap(context, "quickjs_java_stack");
+    return context->quickjs_java_stack(this_val);
+}
+static JSValue quickjs_resolve_module(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    auto context = reinterpret_cast<QuickJSContext *>(JS_GetContextOpaque(ctx));
+    ProfiledTrap trap(context, "quickjs_resolve_module");
+    return context->quickjs_resolve_module(argv[0], argv[1]);
+}
+static JSValue quickjs_load_module(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    auto context = reinterpret_cast<QuickJSContext *>(JS_GetContextOpaque(ctx));
+    ProfiledTrap trap(context, "quickjs_load_module");
+    return context->quickjs_load_module(argv[0]);
+}
+static char *quickjs_module_normalize(JSContext *ctx, const char *base, const char *name, void *opaque) {
+    auto context = reinterpret_cast<QuickJSContext *>(opaque);
+    ProfiledTrap trap(context, "quickjs_module_normalize");
+    return context->quickjs_module_normalize(base, name);
+}
+static JSModuleDef *quickjs_module_loader(JSContext *ctx, const char *name, void *opaque) {
+    auto context = reinterpret_cast<QuickJSContext *>(opaque);
+    ProfiledTrap trap(context, "quickjs_module_loader");
+    return context->quickjs_module_loader(name);
+}
+// QuickJS allocator that records the heap high water mark. Like the Duktape allocator, blocks
+// carry their size in a header, so the accounting does not depend on malloc_usable_size.
+// The header is padded so the block handed to QuickJS keeps malloc's alignment.
+static const size_t QUICKJS_HEADER_SIZE = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+
+static inline size_t &quickjs_block_size(void *block) {
+    return *static_cast<size_t *>(block);
+}
+
+// the runtime holds the malloc state, this mirrors it so sampling stats does not walk the heap.
+static void quickjs_account(JSMallocState *s, size_t size, size_t count) {
+    auto context = reinterpret_cast<QuickJSContext *>(s->opaque);
+    s->malloc_size = size;
+    s->malloc_count = count;
+    context->allocatedBytes = size;
+    context->allocationCount = count;
+    if (size > context->heapHighWaterMark)
+        context->heapHighWaterMark = size;
+}
+
+static void *quickjs_malloc(JSMallocState *s, size_t size) {
+    // QuickJS throws an out of memory error past the limit set by JS_SetMemoryLimit.
+    if (s->malloc_size + size > s->malloc_limit)
+        return nullptr;
+    void *block = malloc(QUICKJS_HEADER_SIZE + size);
+    if (block == nullptr)
+        return nullptr;
+    quickjs_block_size(block) = size;
+    quickjs_account(s, s->malloc_size + size, s->malloc_count + 1);
+    return static_cast<char *>(block) + QUICKJS_HEADER_SIZE;
+}
+
+static void quickjs_free(JSMallocState *s, void *ptr) {
+    if (ptr == nullptr)
+        return;
+    void *block = static_cast<char *>(ptr) - QUICKJS_HEADER_SIZE;
+    quickjs_account(s, s->malloc_size - quickjs_block_size(block), s->malloc_count - 1);
+    free(block);
+}
+
+static void *quickjs_realloc(JSMallocState *s, void *ptr, size_t size) {
+    if (ptr == nullptr)
+        return size == 0 ? nullptr : quickjs_malloc(s, size);
+    if (size == 0) {
+        quickjs_free(s, ptr);
+        return nullptr;
+    }
+    void *block = static_cast<char *>(ptr) - QUICKJS_HEADER_SIZE;
+    size_t oldSize = quickjs_block_size(block);
+    if (size > oldSize && s->malloc_size + size - oldSize > s->malloc_limit)
+        return nullptr;
+    block = realloc(block, QUICKJS_HEADER_SIZE + size);
+    if (block == nullptr)
+        return nullptr;
+    quickjs_block_size(block) = size;
+    quickjs_account(s, s->malloc_size + size - oldSize, s->malloc_count);
+    return static_cast<char *>(block) + QUICKJS_HEADER_SIZE;
+}
+
+static size_t quickjs_malloc_usable_size(const void *ptr) {
+    if (ptr == nullptr)
+        return 0;
+    return *reinterpret_cast<const size_t *>(static_cast<const char *>(ptr) - QUICKJS_HEADER_SIZE);
+}
+
+static const JSMallocFunctions quickjsMallocFunctions = {
+    quickjs_malloc,
+    quickjs_free,
+    quickjs_realloc,
+    quickjs_malloc_usable_size,
+};
+
+// polled by QuickJS while running scripts, a non zero return throws an uncatchable error.
+static int quickjs_interrupt_handler(JSRuntime *rt, void *opaque) {
+    QuickJSContext *context = reinterpret_cast<QuickJSContext *>(opaque);
+    if (context->profiler.due())
+        context->sampleProfile(nullptr);
+    return context->executionBudget.check() ? 1 : 0;
+}
 int quickjs_construct(JSContext *ctx, JSValue func_obj, JSValueConst this_val, int argc, JSValueConst *argv) {
     QuickJSContext *qctx = reinterpret_cast<QuickJSContext *>(JS_GetContextOpaque(ctx));
+    ProfiledTrap trap(qctx, "quickjs_construct");
+    const BridgeStats::Scope stats(qctx->bridgeStats, BridgeStats::TRAP_APPLY);
     return qctx->quickjs_construct(func_obj, this_val, argc, argv);
 }
 
@@ -99,28 +225,48 @@ static struct JSClassDef quackObjectProxyClassDef = {
 };
 
 QuickJSContext::QuickJSContext(JavaVM* javaVM, jobject javaQuack):
-    javaVM(javaVM) {
-    runtime = JS_NewRuntime();
+    javaVM(javaVM),
+    // QuickJS reference counting and its own allocation threshold are sufficient by default.
+    gcPolicy(GCPolicy::NEVER, 0),
+    zeroCopyBuffers(false),
+    cacheModules(false),
+    exceptionStackMode(EXCEPTION_STACK_MERGED),
+    nextPinnedBuffer(0),
+    heapLimit(0),
+    allocatedBytes(0),
+    allocationCount(0),
+    heapHighWaterMark(0),
+    javaScriptObjects(JS_UNDEFINED) {
+    runtime = JS_NewRuntime2(&quickjsMallocFunctions, this);
+    JS_SetRuntimeOpaque(runtime, this);
+    JS_SetInterruptHandler(runtime, quickjs_interrupt_handler, this);
     ctx = JS_NewContext(runtime);
     JS_SetMaxStackSize(ctx, 1024 * 1024 * 4);
-    stash = JS_NewObject(ctx);
+    pinnedBuffers = JS_NewObject(ctx);
 
     auto global = hold(JS_GetGlobalObject(ctx));
     uint8ArrayConstructor = JS_GetPropertyStr(ctx, global, "Uint8Array");
     uint8ArrayPrototype = JS_GetPropertyStr(ctx, uint8ArrayConstructor, "prototype");
+    for (int kind = 0; kind < ValueSerializer::TYPED_ARRAY_KIND_COUNT; kind++) {
+        typedArrayConstructors[kind] = JS_GetPropertyStr(ctx, global, ValueSerializer::typedArrayName(kind));
+        typedArrayPrototypes[kind] = JS_GetPropertyStr(ctx, typedArrayConstructors[kind], "prototype");
+    }
+    dateConstructor = JS_GetPropertyStr(ctx, global, "Date");
+    datePrototype = JS_GetPropertyStr(ctx, dateConstructor, "prototype");
 
     const char *thrower_str = "(function() { try { throw new Error(); } catch (e) { return e; } })";
     thrower_function = JS_Eval(ctx, thrower_str, strlen(thrower_str), "<thrower>", JS_EVAL_TYPE_GLOBAL);
+    javaStackGetter = JS_NewCFunction(ctx, ::quickjs_java_stack, "stack", 0);
 
     JS_SetContextOpaque(ctx, this);
 
     atomHoldsJavaObject = privateAtom("javaObject");
-    customFinalizerAtom = privateAtom("customFinalizer");
     javaExceptionAtom = privateAtom("javaException");
+    jsStackAtom = privateAtom("jsStack");
     // JS_NewClassID is static run once mechanism
-    JS_NewClassID(&customFinalizerClassId);
-    JS_NewClassID(&quackObjectProxyClassId);
-    JS_NewClass(runtime, customFinalizerClassId, &customFinalizerClassDef);
+    std::call_once(classIdsOnce, []() {
+        JS_NewClassID(&quackObjectProxyClassId);
+    });
     JS_NewClass(runtime, quackObjectProxyClassId, &quackObjectProxyClassDef);
 
     JNIEnv *env = getEnvFromJavaVM(javaVM);
@@ -139,6 +285,7 @@ QuickJSContext::QuickJSContext(JavaVM* javaVM, jobject javaQuack):
     doubleValueOf = env->GetStaticMethodID(doubleClass, "valueOf", "(D)Ljava/lang/Double;");
     doubleValue = env->GetMethodID(doubleClass, "doubleValue", "()D");
     stringClass = findClass(env, "java/lang/String");
+    byteArrayClass = findClass(env, "[B");
 
     // ByteBuffer
     byteBufferClass = findClass(env, "java/nio/ByteBuffer");
@@ -151,21 +298,38 @@ QuickJSContext::QuickJSContext(JavaVM* javaVM, jobject javaQuack):
     quackSetMethod = env->GetMethodID(quackClass, "quackSet", "(Lcom/koushikdutta/quack/QuackObject;Ljava/lang/Object;Ljava/lang/Object;)Z");
     quackApply = env->GetMethodID(quackClass, "quackApply", "(Lcom/koushikdutta/quack/QuackObject;Ljava/lang/Object;[Ljava/lang/Object;)Ljava/lang/Object;");
     quackConstruct = env->GetMethodID(quackClass, "quackConstruct", "(Lcom/koushikdutta/quack/QuackObject;[Ljava/lang/Object;)Ljava/lang/Object;");
+    quackConsole = env->GetMethodID(quackClass, "quackConsole", "(ILjava/lang/String;)V");
+    quackResolveModule = env->GetMethodID(quackClass, "quackResolveModule", "(Ljava/lang/String;Ljava/lang/String;)Ljava/lang/String;");
+    quackLoadModule = env->GetMethodID(quackClass, "quackLoadModule", "(Ljava/lang/String;I)Ljava/lang/Object;");
+    quackStoreModule = env->GetMethodID(quackClass, "quackStoreModule", "(Ljava/lang/String;ILjava/lang/String;[B)V");
+    quackPinBuffer = env->GetMethodID(quackClass, "quackPinBuffer", "(Ljava/nio/ByteBuffer;J)V");
+    quackJsonBuffer = env->GetMethodID(quackClass, "quackJsonBuffer", "(Ljava/nio/ByteBuffer;I)Ljava/nio/ByteBuffer;");
+    quackResolveField = env->GetMethodID(quackClass, "quackResolveField", "(Lcom/koushikdutta/quack/JavaObject;Ljava/lang/String;)I");
     quackObjectClass = findClass(env, "com/koushikdutta/quack/QuackObject");
 
     // QuackJsonObject
     quackjsonObjectClass = findClass(env, "com/koushikdutta/quack/QuackJsonObject");
     quackJsonField = env->GetFieldID(quackjsonObjectClass, "json", "Ljava/lang/String;");
+    quackJsonUtf8Field = env->GetFieldID(quackjsonObjectClass, "utf8", "Ljava/nio/ByteBuffer;");
+    quackJsonPositionField = env->GetFieldID(quackjsonObjectClass, "position", "I");
+    quackJsonLimitField = env->GetFieldID(quackjsonObjectClass, "limit", "I");
 
     // JavaScriptObject
     javaScriptObjectClass = findClass(env, "com/koushikdutta/quack/JavaScriptObject");
-    javaScriptObjectConstructor = env->GetMethodID(javaScriptObjectClass, "<init>", "(Lcom/koushikdutta/quack/QuackContext;JJ)V");
+    javaScriptObjectConstructor = env->GetMethodID(javaScriptObjectClass, "<init>", "(Lcom/koushikdutta/quack/QuackContext;JJJ)V");
     contextField = env->GetFieldID(javaScriptObjectClass, "context", "J");
     pointerField = env->GetFieldID(javaScriptObjectClass, "pointer", "J");
 
     // JavaObject
     javaObjectClass = findClass(env, "com/koushikdutta/quack/JavaObject");
     javaObjectConstructor = env->GetMethodID(javaObjectClass, "<init>", "(Lcom/koushikdutta/quack/QuackContext;Ljava/lang/Object;)V");
+    javaObjectTargetField = env->GetFieldID(javaObjectClass, "target", "Ljava/lang/Object;");
+
+    // QuackNativeMethod
+    nativeMethodClass = findClass(env, "com/koushikdutta/quack/QuackNativeMethod");
+    nativeMethodTargetField = env->GetFieldID(nativeMethodClass, "target", "Ljava/lang/Object;");
+    nativeMethodMethodField = env->GetFieldID(nativeMethodClass, "method", "Ljava/lang/reflect/Method;");
+    nativeMethodSignatureField = env->GetFieldID(nativeMethodClass, "signature", "Ljava/lang/String;");
 
     // QuackJavaObject
     quackJavaObject = findClass(env, "com/koushikdutta/quack/QuackJavaObject");
@@ -173,15 +337,30 @@ QuickJSContext::QuickJSContext(JavaVM* javaVM, jobject javaQuack):
 
     // exceptions
     quackExceptionClass = findClass(env, "com/koushikdutta/quack/QuackException");
+    quackExceptionConstructor = env->GetMethodID(quackExceptionClass, "<init>", "(Ljava/lang/String;)V");
+    quackInterruptedExceptionClass = findClass(env, "com/koushikdutta/quack/QuackInterruptedException");
+    quackInterruptedExceptionConstructor = env->GetMethodID(quackInterruptedExceptionClass, "<init>", "(Ljava/lang/String;)V");
     addJSStack =env->GetStaticMethodID(quackExceptionClass, "addJSStack","(Ljava/lang/Throwable;Ljava/lang/String;)V");
     addJavaStack = env->GetStaticMethodID(quackExceptionClass, "addJavaStack", "(Ljava/lang/String;Ljava/lang/Throwable;)Ljava/lang/String;");
 }
 
 QuickJSContext::~QuickJSContext() {
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    clearFieldCache(env);
     JS_FreeValue(ctx, uint8ArrayPrototype);
     JS_FreeValue(ctx, uint8ArrayConstructor);
-    JS_FreeValue(ctx, stash);
+    for (int kind = 0; kind < ValueSerializer::TYPED_ARRAY_KIND_COUNT; kind++) {
+        JS_FreeValue(ctx, typedArrayPrototypes[kind]);
+        JS_FreeValue(ctx, typedArrayConstructors[kind]);
+    }
+    JS_FreeValue(ctx, datePrototype);
+    JS_FreeValue(ctx, dateConstructor);
+    for (const JSValue &value: javaScriptObjects.values())
+        JS_FreeValue(ctx, value);
+    backReferences.clear(env);
+    JS_FreeValue(ctx, pinnedBuffers);
     JS_FreeValue(ctx, thrower_function);
+    JS_FreeValue(ctx, javaStackGetter);
     JS_FreeContext(ctx);
     JS_FreeRuntime(runtime);
 }
@@ -193,20 +372,26 @@ JSAtom QuickJSContext::privateAtom(const char *str) {
 // called when the JavaScriptObject on the Java side gets collected.
 // the object may continue living in the QuickJS side, but clean up all references
 // to the java side.
-void QuickJSContext::finalizeJavaScriptObject(JNIEnv *env, jlong object) {
+void QuickJSContext::finalizeJavaScriptObject(JNIEnv *env, jlong handle) {
     // the JavaScriptObject is referenced in two spots:
-    // on the private atom for the JSValue and also in the stash.
-    // delete them both, and the finalizer will be triggered.
-    JSValue value = toValueAsLocal(object);
+    // the back reference from the JSValue, and the handle table. delete them both.
+    JSValue value = javaScriptObjects.remove(handle);
+    backReferences.remove(env, JS_VALUE_GET_PTR(value), handle);
 
-    // JSValue prop that has the finalizer thats attached to the weak ref of the JavaScriptObject
-    JS_DeleteProperty(ctx, value, customFinalizerAtom, 0);
+    // release the reference that was keeping this alive from the java side.
+    JS_FreeValue(ctx, value);
+}
 
-    // delete the entry in the stash that was keeping this alive from the java side.
-    auto id = hash((uint64_t)object);
-    auto prop = JS_NewAtomUInt32(ctx, id);
-    assert(JS_DeleteProperty(ctx, stash, prop, 0));
-    JS_FreeAtom(ctx, prop);
+jint QuickJSContext::finalizeJavaScriptObjects(JNIEnv *env, jlongArray handles, jint count, jlong budgetNanos) {
+    // copied out, as freeing the values may run finalizers that call into JNI.
+    std::vector<jlong> copy((size_t)count);
+    env->GetLongArrayRegion(handles, 0, count, copy.data());
+    FinalizationBudget budget(budgetNanos);
+    jint released = 0;
+    while (released < count && budget.allows(released)) {
+        finalizeJavaScriptObject(env, copy[released++]);
+    }
+    return released;
 }
 
 void QuickJSContext::setFinalizerOnFinalizerObject(JSValue finalizerObject, CustomFinalizer finalizer, void *udata) {
@@ -220,20 +405,17 @@ void QuickJSContext::setFinalizerOnFinalizerObject(JSValue finalizerObject, Cust
     JS_SetOpaque(finalizerObject, data);
 }
 
-void QuickJSContext::setFinalizer(JSValue value, CustomFinalizer finalizer, void *udata) {
-    JSValue finalizerObject = JS_NewObjectClass(ctx, customFinalizerClassId);
-    setFinalizerOnFinalizerObject(finalizerObject, finalizer, udata);
-    JS_SetProperty(ctx, value, customFinalizerAtom, finalizerObject);
-}
-
 
 jclass QuickJSContext::findClass(JNIEnv *env, const char *className) {
     return (jclass)env->NewGlobalRef(env->FindClass(className));
 }
 
 jstring QuickJSContext::toString(JNIEnv *env, JSValue value) {
-    const char *str = JS_ToCString(ctx, value);
-    jstring ret = env->NewStringUTF(str);
+    size_t len;
+    const char *str = JS_ToCStringLen(ctx, &len, value);
+    if (str == nullptr)
+        return nullptr;
+    jstring ret = strings.toJavaString(env, str, len);
     JS_FreeCString(ctx, str);
     return ret;
 }
@@ -245,53 +427,106 @@ std::string QuickJSContext::toStdString(JSValue value) {
     return ret;
 }
 
-
-static std::string toStdString(JNIEnv *env, jstring value) {
-    const char *str = env->GetStringUTFChars(value, 0);
-    std::string ret = str;
-    return ret;
-}
-
 JSValue QuickJSContext::toString(JNIEnv *env, jstring value) {
-    return JS_NewString(ctx, env->GetStringUTFChars(value, 0));
+    JavaStringUTF8 str(strings, env, value);
+    return JS_NewStringLen(ctx, str.c_str(), str.size());
 }
 
 jstring QuickJSContext::stringify(JNIEnv *env, jlong object) {
-    return toString(env, js_debugger_json_stringify(ctx, toValueAsLocal(object)));
+    auto json = hold(js_debugger_json_stringify(ctx, toValueAsLocal(object)));
+    return toString(env, json);
+}
+
+jobject QuickJSContext::stringifyUtf8(JNIEnv *env, jlong object, jobject buffer) {
+    auto json = hold(js_debugger_json_stringify(ctx, toValueAsLocal(object)));
+    if (JS_IsException(json)) {
+        auto exception = hold(JS_GetException(ctx));
+        rethrowQuickJSErrorToJava(env, exception);
+        return nullptr;
+    }
+    if (!JS_IsString(json))
+        return nullptr;
+
+    size_t len;
+    const char *str = JS_ToCStringLen(ctx, &len, json);
+    if (str == nullptr)
+        return nullptr;
+    jobject target = env->CallObjectMethod(javaQuack, quackJsonBuffer, buffer, (jint)len);
+    if (target != nullptr && !env->ExceptionCheck())
+        memcpy(env->GetDirectBufferAddress(target), str, len);
+    JS_FreeCString(ctx, str);
+    return target;
 }
 
 
 JSValue QuickJSContext::toObject(JNIEnv *env, jobject value) {
-    if (value == nullptr)
+    if (value == nullptr) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::NULL_VALUE);
         return JS_NULL;
+    }
 
     auto clazz = env->GetObjectClass(value);
     const auto clazzHolder = LocalRefHolder(env, clazz);
 
-    if (env->IsAssignableFrom(clazz, booleanClass))
+    if (env->IsAssignableFrom(clazz, booleanClass)) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::PRIMITIVE);
         return JS_NewBool(ctx, env->CallBooleanMethodA(value, booleanValue, nullptr));
-    else if (env->IsAssignableFrom(clazz, intClass))
+    }
+    else if (env->IsAssignableFrom(clazz, intClass)) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::PRIMITIVE);
         return JS_NewInt32(ctx, env->CallIntMethod(value, intValue, nullptr));
-    else if (env->IsAssignableFrom(clazz, doubleClass))
+    }
+    else if (env->IsAssignableFrom(clazz, doubleClass)) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::PRIMITIVE);
         return JS_NewFloat64(ctx, env->CallDoubleMethodA(value, doubleValue, nullptr));
-    else if (env->IsAssignableFrom(clazz, stringClass))
+    }
+    else if (env->IsAssignableFrom(clazz, stringClass)) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::PRIMITIVE);
         return toString(env, reinterpret_cast<jstring>(value));
+    }
     else if (env->IsAssignableFrom(clazz, byteBufferClass)) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::BUFFER);
         jlong capacity = env->GetDirectBufferCapacity(value);
-        auto buffer = hold(JS_NewArrayBufferCopy(ctx, reinterpret_cast<uint8_t *>(env->GetDirectBufferAddress(value)), (size_t)capacity));
+        auto address = reinterpret_cast<uint8_t *>(env->GetDirectBufferAddress(value));
+        JSValue arrayBuffer;
+        // the ArrayBuffer holds a global ref to the ByteBuffer, released when the ArrayBuffer is freed.
+        if (zeroCopyBuffers && address != nullptr) {
+            arrayBuffer = JS_NewArrayBuffer(ctx, address, (size_t)capacity, javaBufferFree, env->NewGlobalRef(value), false);
+            memoryStats.bufferReferenced();
+            bridgeStats.globalRefCreated();
+        }
+        else
+            arrayBuffer = JS_NewArrayBufferCopy(ctx, address, (size_t)capacity);
+        auto buffer = hold(arrayBuffer);
         JSValue args[] = { (JSValue)buffer };
         return JS_CallConstructor(ctx, uint8ArrayConstructor, 1, args);
     }
     else if (env->IsAssignableFrom(clazz, quackjsonObjectClass)) {
+        bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::JSON);
+        const auto utf8 = LocalRefHolder(env, env->GetObjectField(value, quackJsonUtf8Field));
+        if ((jobject)utf8 != nullptr) {
+            auto address = reinterpret_cast<const char *>(env->GetDirectBufferAddress(utf8));
+            jlong capacity = env->GetDirectBufferCapacity(utf8);
+            jint position = env->GetIntField(value, quackJsonPositionField);
+            jint limit = env->GetIntField(value, quackJsonLimitField);
+            // JS_ParseJSON reads up to a terminating zero, so parse in place only if one follows.
+            if (limit < capacity && address[limit] == '\0')
+                return JS_ParseJSON(ctx, address + position, (size_t)(limit - position), "<QuackJsonObject>");
+            std::string copy(address + position, (size_t)(limit - position));
+            return JS_ParseJSON(ctx, copy.c_str(), copy.size(), "<QuackJsonObject>");
+        }
         jstring json = (jstring)env->GetObjectField(value, quackJsonField);
-        const char *jsonPtr = env->GetStringUTFChars(json, 0);
-        return JS_ParseJSON(ctx, jsonPtr, env->GetStringUTFLength(json), "<QuackJsonObject>");
+        const auto jsonHolder = LocalRefHolder(env, json);
+        JavaStringUTF8 jsonStr(strings, env, json);
+        return JS_ParseJSON(ctx, jsonStr.c_str(), jsonStr.size(), "<QuackJsonObject>");
     }
     else if (env->IsAssignableFrom(clazz, javaScriptObjectClass)) {
         QuickJSContext *context = reinterpret_cast<QuickJSContext *>(env->GetLongField(value, contextField));
         // matching context, grab the native JSValue
-        if (context == this)
+        if (context == this) {
+            bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::JAVASCRIPT_OBJECT);
             return toValueAsDup(ctx, env->GetLongField(value, pointerField));
+        }
         // a proxy already exists, but not for the correct QuackContext, so native javascript heap
         // pointer can't be used.
     }
@@ -307,17 +542,49 @@ JSValue QuickJSContext::toObject(JNIEnv *env, jobject value) {
 
     JSValue ret = JS_NewObjectClass(ctx, quackObjectProxyClassId);
     setFinalizerOnFinalizerObject(ret, javaRefFinalizer, env->NewGlobalRef(value));
+    memoryStats.javaObjectReferenced();
+    bridgeStats.converted(BridgeStats::TO_JAVASCRIPT, BridgeStats::JAVA_OBJECT);
+    bridgeStats.globalRefCreated();
     return ret;
 }
 
+jobject QuickJSContext::toByteBuffer(JNIEnv *env, JSValue arrayBuffer, uint8_t *ptr, size_t size) {
+    if (!zeroCopyBuffers || ptr == nullptr) {
+        jobject byteBuffer = env->CallStaticObjectMethod(byteBufferClass, byteBufferAllocateDirect, (jint)size);
+        memcpy(env->GetDirectBufferAddress(byteBuffer), ptr, size);
+        return byteBuffer;
+    }
+
+    // keep the ArrayBuffer alive until the Java side is collected and unpinBuffer is called.
+    jobject byteBuffer = env->NewDirectByteBuffer(ptr, (jlong)size);
+    uint32_t pin = nextPinnedBuffer++;
+    JS_SetPropertyUint32(ctx, pinnedBuffers, pin, JS_DupValue(ctx, arrayBuffer));
+    env->CallVoidMethod(javaQuack, quackPinBuffer, byteBuffer, (jlong)pin);
+    return byteBuffer;
+}
+
+void QuickJSContext::setZeroCopyBuffers(JNIEnv *env, jboolean zeroCopy) {
+    zeroCopyBuffers = zeroCopy != JNI_FALSE;
+}
+
+void QuickJSContext::unpinBuffer(JNIEnv *env, jlong pin) {
+    JSAtom atom = JS_NewAtomUInt32(ctx, (uint32_t)pin);
+    JS_DeleteProperty(ctx, pinnedBuffers, atom, 0);
+    JS_FreeAtom(ctx, atom);
+}
+
 static jobject box(JNIEnv *env, jclass boxedClass, jmethodID boxer, jvalue value) {
     return env->CallStaticObjectMethodA(boxedClass, boxer, &value);
 }
 
 // value will be cleaned up by caller.
 jobject QuickJSContext::toObject(JNIEnv *env, JSValue value) {
-    if (JS_IsUndefinedOrNull(value))
+    if (JS_IsUndefinedOrNull(value)) {
+        bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::NULL_VALUE);
         return nullptr;
+    }
+    if (JS_IsNumber(value) || JS_IsBool(value) || JS_IsString(value))
+        bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::PRIMITIVE);
 
     jvalue ret;
     if (JS_IsInteger(value)) {
@@ -336,11 +603,10 @@ jobject QuickJSContext::toObject(JNIEnv *env, JSValue value) {
         return toString(env, value);
     }
     else if (JS_IsArrayBuffer(value)) {
+        bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::BUFFER);
         size_t size;
         uint8_t *ptr = JS_GetArrayBuffer(ctx, &size, value);
-        jobject byteBuffer = env->CallStaticObjectMethod(byteBufferClass, byteBufferAllocateDirect, (jint)size);
-        memcpy(env->GetDirectBufferAddress(byteBuffer), ptr, size);
-        return byteBuffer;
+        return toByteBuffer(env, value, ptr, size);
     }
     else if (JS_IsException(value)) {
         const auto exception = JS_GetException(ctx);
@@ -355,6 +621,7 @@ jobject QuickJSContext::toObject(JNIEnv *env, JSValue value) {
     // this does not seem to be dup'd, so don't hold it.
     auto prototype = JS_GetPrototype(ctx, value);
     if (JS_VALUE_GET_PTR((JSValue)prototype) == JS_VALUE_GET_PTR(uint8ArrayPrototype)) {
+        bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::BUFFER);
         size_t offset;
         size_t size;
         size_t bpe;
@@ -362,51 +629,37 @@ jobject QuickJSContext::toObject(JNIEnv *env, JSValue value) {
 
         size_t ab_size;
         uint8_t *ptr = JS_GetArrayBuffer(ctx, &ab_size, ab);
-
-        jobject byteBuffer = env->CallStaticObjectMethod(byteBufferClass, byteBufferAllocateDirect, (jint)size);
-        memcpy(env->GetDirectBufferAddress(byteBuffer), ptr + offset, size);
-        return byteBuffer;
+        return toByteBuffer(env, ab, ptr + offset, size);
     }
 
     // attempt to find an existing JavaScriptObject that exists on the java side (weak ref)
-    auto finalizerFound = hold(JS_GetProperty(ctx, value, customFinalizerAtom));
-    if (!JS_IsUndefinedOrNull(finalizerFound)) {
-        auto data = reinterpret_cast<CustomFinalizerData *>(JS_GetOpaque(finalizerFound, customFinalizerClassId));
-        auto javaThis = reinterpret_cast<jobject>(data->udata);
-        if (javaThis) {
-            // found something, but make sure the weak ref is still alive.
-            // if so, return a new local ref, because the global weak ref could be by side effect gc.
-            if (!env->IsSameObject(javaThis, nullptr))
-                return env->NewLocalRef(javaThis);
-            // it was collected, so clean it up
-            data->udata = nullptr;
-            env->DeleteWeakGlobalRef(javaThis);
-            // remove the property to prevent double deletes.
-            JS_DeleteProperty(ctx, value, customFinalizerAtom, 0);
-        }
-    }
-    else {
-        // check if this is a JavaObject that just needs to be unboxed (global ref)
-        auto javaValue = JS_GetProperty(ctx, value, atomHoldsJavaObject);
-        if (!JS_IsUndefinedOrNull(javaValue)) {
-            int64_t javaPtr;
-            JS_ToInt64(ctx, &javaPtr, javaValue);
-            return env->NewLocalRef(reinterpret_cast<jobject>(javaPtr));
-        }
+    void* ptr = JS_VALUE_GET_PTR(value);
+    jobject existing = backReferences.find(env, ptr);
+    if (existing != nullptr) {
+        bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::JAVASCRIPT_OBJECT);
+        return existing;
     }
 
-    // no luck, so create a JavaScriptObject
-    void* ptr = JS_VALUE_GET_PTR(value);
-    jobject javaThis = env->NewObject(javaScriptObjectClass, javaScriptObjectConstructor, javaQuack,
-        reinterpret_cast<jlong>(this), reinterpret_cast<jlong>(ptr));
+    // check if this is a JavaObject that just needs to be unboxed (global ref)
+    auto javaValue = JS_GetProperty(ctx, value, atomHoldsJavaObject);
+    if (!JS_IsUndefinedOrNull(javaValue)) {
+        bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::JAVA_OBJECT);
+        int64_t javaPtr;
+        JS_ToInt64(ctx, &javaPtr, javaValue);
+        return env->NewLocalRef(reinterpret_cast<jobject>(javaPtr));
+    }
 
-    // stash this to hold a reference, and to free automatically on runtime shutdown.
-    auto id = hash(reinterpret_cast<uint64_t>(ptr));
+    // no luck, so create a JavaScriptObject.
+    // hold a reference in the handle table, released when the JavaScriptObject is finalized
+    // or on runtime shutdown.
     value = JS_DupValue(ctx, value);
-    auto prop = JS_NewAtomUInt32(ctx, id);
-    JS_SetProperty(ctx, stash, prop, value);
+    jlong handle = javaScriptObjects.add(value);
+    jobject javaThis = env->NewObject(javaScriptObjectClass, javaScriptObjectConstructor, javaQuack,
+        reinterpret_cast<jlong>(this), reinterpret_cast<jlong>(ptr), handle);
 
-    setFinalizer(value, javaWeakRefFinalizer, env->NewWeakGlobalRef(javaThis));
+    backReferences.add(env, ptr, javaThis, handle);
+    bridgeStats.converted(BridgeStats::TO_JAVA, BridgeStats::JAVASCRIPT_OBJECT);
+    bridgeStats.weakRefCreated();
 
     return javaThis;
 }
@@ -420,24 +673,349 @@ jobject QuickJSContext::toObjectCheckQuickJSError(JNIEnv *env, JSValue value) {
 }
 
 jobject QuickJSContext::evaluate(JNIEnv *env, jstring code, jstring filename) {
-    auto codeStr = env->GetStringUTFChars(code, 0);
-    int len = strlen(codeStr);
-    char* mem = (char*)js_malloc(ctx, len + 1);
-    mem[len] = '\0';
-    memcpy(mem, codeStr, len);
-    auto result = hold(JS_Eval(ctx, mem, len, env->GetStringUTFChars(filename, 0), JS_EVAL_TYPE_GLOBAL));
+    // JS_Eval requires a zero terminated buffer, which the string bridge guarantees.
+    JavaStringUTF8 codeStr(strings, env, code);
+    JavaStringUTF8 file(strings, env, filename);
+    auto result = hold(JS_Eval(ctx, codeStr.c_str(), codeStr.size(), file.c_str(), JS_EVAL_TYPE_GLOBAL));
     return toObjectCheckQuickJSError(env, result);
 }
 
 jobject QuickJSContext::compile(JNIEnv* env, jstring code, jstring filename) {
-    std::string wrapped = ::toStdString(env, code);
-    wrapped = "(" + wrapped + ")";
+    std::string wrapped = "(" + JavaStringUTF8(strings, env, code).str() + ")";
+    JavaStringUTF8 file(strings, env, filename);
 
-    auto codeStr = wrapped.c_str();
-    auto result = hold(JS_Eval(ctx, codeStr, wrapped.size(), env->GetStringUTFChars(filename, 0), JS_EVAL_TYPE_GLOBAL));
+    auto result = hold(JS_Eval(ctx, wrapped.c_str(), wrapped.size(), file.c_str(), JS_EVAL_TYPE_GLOBAL));
     return toObjectCheckQuickJSError(env, result);
 }
 
+jbyteArray QuickJSContext::compileBytecode(JNIEnv *env, jstring code, jstring filename) {
+    JavaStringUTF8 source(strings, env, code);
+    JavaStringUTF8 file(strings, env, filename);
+
+    auto func = hold(JS_Eval(ctx, source.c_str(), source.size(), file.c_str(), JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY));
+    if (JS_IsException(func)) {
+        auto exception = hold(JS_GetException(ctx));
+        rethrowQuickJSErrorToJava(env, exception);
+        return nullptr;
+    }
+
+    size_t size;
+    uint8_t *data = JS_WriteObject(ctx, &size, func, JS_WRITE_OBJ_BYTECODE);
+    if (data == nullptr) {
+        auto exception = hold(JS_GetException(ctx));
+        rethrowQuickJSErrorToJava(env, exception);
+        return nullptr;
+    }
+
+    jbyteArray ret = env->NewByteArray((jsize)size);
+    if (ret != nullptr)
+        env->SetByteArrayRegion(ret, 0, (jsize)size, reinterpret_cast<const jbyte *>(data));
+    js_free(ctx, data);
+    return ret;
+}
+
+jobject QuickJSContext::evaluateBytecode(JNIEnv *env, jbyteArray bytecode) {
+    // copied out, as finalizers run by allocations may call into JNI.
+    std::vector<uint8_t> data((size_t)env->GetArrayLength(bytecode));
+    env->GetByteArrayRegion(bytecode, 0, (jsize)data.size(), reinterpret_cast<jbyte *>(data.data()));
+    JSValue func = JS_ReadObject(ctx, data.data(), data.size(), JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(func)) {
+        auto exception = hold(JS_GetException(ctx));
+        rethrowQuickJSErrorToJava(env, exception);
+        return nullptr;
+    }
+
+    // JS_EvalFunction takes ownership of the function.
+    return toObjectCheckQuickJSError(env, hold(JS_EvalFunction(ctx, func)));
+}
+
+jbyteArray QuickJSContext::serialize(JNIEnv *env, jobject value) {
+    auto jsValue = hold(toObject(env, value));
+    SerializedWriter writer;
+    if (!serializeValue(writer, jsValue, 0)) {
+        auto exception = hold(JS_GetException(ctx));
+        rethrowQuickJSErrorToJava(env, exception);
+        return nullptr;
+    }
+
+    const std::vector<uint8_t> &data = writer.data();
+    jbyteArray ret = env->NewByteArray((jsize)data.size());
+    if (ret != nullptr)
+        env->SetByteArrayRegion(ret, 0, (jsize)data.size(), reinterpret_cast<const jbyte *>(data.data()));
+    return ret;
+}
+
+// returns false with a pending exception.
+bool QuickJSContext::serializeValue(SerializedWriter &writer, JSValueConst value, int depth) {
+    if (depth > ValueSerializer::MAX_DEPTH) {
+        JS_ThrowRangeError(ctx, "value is nested too deeply to serialize");
+        return false;
+    }
+
+    if (JS_IsUndefined(value)) {
+        writer.writeTag(ValueSerializer::TAG_UNDEFINED);
+        return true;
+    }
+    if (JS_IsNull(value)) {
+        writer.writeTag(ValueSerializer::TAG_NULL);
+        return true;
+    }
+    if (JS_IsBool(value)) {
+        writer.writeTag(JS_ToBool(ctx, value) ? ValueSerializer::TAG_TRUE : ValueSerializer::TAG_FALSE);
+        return true;
+    }
+    if (JS_IsInteger(value)) {
+        int32_t i;
+        JS_ToInt32(ctx, &i, value);
+        writer.writeInt32(i);
+        return true;
+    }
+    if (JS_IsNumber(value)) {
+        double d;
+        JS_ToFloat64(ctx, &d, value);
+        writer.writeNumber(d);
+        return true;
+    }
+    if (JS_IsString(value)) {
+        size_t length;
+        const char *str = JS_ToCStringLen(ctx, &length, value);
+        if (str == nullptr)
+            return false;
+        writer.writeTag(ValueSerializer::TAG_STRING);
+        writer.writeData(str, length);
+        JS_FreeCString(ctx, str);
+        return true;
+    }
+    // Java proxies are callable, so they are told apart before functions.
+    if (JS_IsObject(value) && JS_GetOpaque(value, quackObjectProxyClassId) != nullptr) {
+        JS_ThrowTypeError(ctx, "Java object could not be serialized");
+        return false;
+    }
+    if (!JS_IsObject(value) || JS_IsFunction(ctx, value)) {
+        JS_ThrowTypeError(ctx, "%s could not be serialized", JS_IsSymbol(value) ? "symbol" : JS_IsObject(value) ? "function" : "value");
+        return false;
+    }
+
+    if (writer.writeReference(JS_VALUE_GET_PTR(value)))
+        return true;
+
+    if (JS_IsArrayBuffer(value)) {
+        size_t size;
+        uint8_t *ptr = JS_GetArrayBuffer(ctx, &size, value);
+        if (ptr == nullptr)
+            return false;
+        writer.writeTag(ValueSerializer::TAG_ARRAY_BUFFER);
+        writer.writeData(ptr, size);
+        return true;
+    }
+
+    // this does not seem to be dup'd, so don't hold it.
+    auto prototype = JS_GetPrototype(ctx, value);
+    for (int kind = 0; kind < ValueSerializer::TYPED_ARRAY_KIND_COUNT; kind++) {
+        if (JS_VALUE_GET_PTR((JSValue)prototype) != JS_VALUE_GET_PTR(typedArrayPrototypes[kind]))
+            continue;
+        size_t offset;
+        size_t size;
+        size_t bpe;
+        auto buffer = hold(JS_GetTypedArrayBuffer(ctx, value, &offset, &size, &bpe));
+        if (JS_IsException(buffer))
+            return false;
+        size_t bufferSize;
+        uint8_t *ptr = JS_GetArrayBuffer(ctx, &bufferSize, buffer);
+        if (ptr == nullptr)
+            return false;
+        writer.writeTag(ValueSerializer::TAG_TYPED_ARRAY);
+        writer.writeTag(kind);
+        writer.writeData(ptr + offset, size);
+        return true;
+    }
+    if (JS_VALUE_GET_PTR((JSValue)prototype) == JS_VALUE_GET_PTR(datePrototype)) {
+        double time;
+        if (JS_ToFloat64(ctx, &time, value))
+            return false;
+        writer.writeDouble(ValueSerializer::TAG_DATE, time);
+        return true;
+    }
+
+    if (JS_IsArray(ctx, value) > 0) {
+        auto lengthValue = hold(JS_GetPropertyStr(ctx, value, "length"));
+        int64_t length;
+        if (JS_ToInt64(ctx, &length, lengthValue))
+            return false;
+        writer.writeTag(ValueSerializer::TAG_ARRAY);
+        writer.writeLength((uint64_t)length);
+        for (int64_t i = 0; i < length; i++) {
+            auto element = hold(JS_GetPropertyUint32(ctx, value, (uint32_t)i));
+            if (JS_IsException(element) || !serializeValue(writer, element, depth + 1))
+                return false;
+        }
+        return true;
+    }
+
+    // anything else is written as a plain object, like JSON.
+    JSPropertyEnum *properties;
+    uint32_t count;
+    if (JS_GetOwnPropertyNames(ctx, &properties, &count, value, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+        return false;
+    writer.writeTag(ValueSerializer::TAG_OBJECT);
+    bool ok = true;
+    for (uint32_t i = 0; i < count && ok; i++) {
+        auto key = hold(JS_AtomToString(ctx, properties[i].atom));
+        auto property = hold(JS_GetProperty(ctx, value, properties[i].atom));
+        ok = !JS_IsException(key) && !JS_IsException(property)
+            && serializeValue(writer, key, depth + 1) && serializeValue(writer, property, depth + 1);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        JS_FreeAtom(ctx, properties[i].atom);
+    }
+    js_free(ctx, properties);
+    if (ok)
+        writer.writeTag(ValueSerializer::TAG_END);
+    return ok;
+}
+
+jobject QuickJSContext::deserialize(JNIEnv *env, jbyteArray data) {
+    // copied out, as finalizers run by allocations may call into JNI.
+    std::vector<uint8_t> bytes((size_t)env->GetArrayLength(data));
+    env->GetByteArrayRegion(data, 0, (jsize)bytes.size(), reinterpret_cast<jbyte *>(bytes.data()));
+
+    SerializedReader reader(bytes.data(), bytes.size());
+    std::vector<JSValue> objects;
+    JSValue value = deserializeValue(reader, objects, 0);
+    for (const JSValue &object: objects) {
+        JS_FreeValue(ctx, object);
+    }
+    if (!JS_IsException(value) && !reader.atEnd()) {
+        JS_FreeValue(ctx, value);
+        value = JS_ThrowTypeError(ctx, "malformed serialized value");
+    }
+    return toObjectCheckQuickJSError(env, hold(value));
+}
+
+// objects holds a reference to each object read so far, by number, which the caller frees.
+JSValue QuickJSContext::deserializeValue(SerializedReader &reader, std::vector<JSValue> &objects, int depth) {
+    int tag = depth > ValueSerializer::MAX_DEPTH ? -1 : reader.readTag();
+    switch (reader.ok() ? tag : -1) {
+        case ValueSerializer::TAG_UNDEFINED:
+            return JS_UNDEFINED;
+        case ValueSerializer::TAG_NULL:
+            return JS_NULL;
+        case ValueSerializer::TAG_FALSE:
+            return JS_NewBool(ctx, 0);
+        case ValueSerializer::TAG_TRUE:
+            return JS_NewBool(ctx, 1);
+        case ValueSerializer::TAG_INT32: {
+            int32_t i = reader.readInt32();
+            if (reader.ok())
+                return JS_NewInt32(ctx, i);
+            break;
+        }
+        case ValueSerializer::TAG_DOUBLE: {
+            double d = reader.readDouble();
+            if (reader.ok())
+                return JS_NewFloat64(ctx, d);
+            break;
+        }
+        case ValueSerializer::TAG_STRING: {
+            size_t length;
+            const uint8_t *data = reader.readData(&length);
+            if (reader.ok())
+                return JS_NewStringLen(ctx, reinterpret_cast<const char *>(data), length);
+            break;
+        }
+        case ValueSerializer::TAG_DATE: {
+            double time = reader.readDouble();
+            if (!reader.ok())
+                break;
+            auto timeValue = hold(JS_NewFloat64(ctx, time));
+            JSValueConst args[] = { timeValue };
+            JSValue date = JS_CallConstructor(ctx, dateConstructor, 1, args);
+            if (!JS_IsException(date))
+                objects.push_back(JS_DupValue(ctx, date));
+            return date;
+        }
+        case ValueSerializer::TAG_ARRAY_BUFFER: {
+            size_t length;
+            const uint8_t *data = reader.readData(&length);
+            if (!reader.ok())
+                break;
+            JSValue buffer = JS_NewArrayBufferCopy(ctx, data, length);
+            if (!JS_IsException(buffer))
+                objects.push_back(JS_DupValue(ctx, buffer));
+            return buffer;
+        }
+        case ValueSerializer::TAG_TYPED_ARRAY: {
+            int kind = reader.readTag();
+            size_t length;
+            const uint8_t *data = reader.readData(&length);
+            if (!reader.ok() || kind >= ValueSerializer::TYPED_ARRAY_KIND_COUNT)
+                break;
+            auto buffer = hold(JS_NewArrayBufferCopy(ctx, data, length));
+            if (JS_IsException(buffer))
+                return JS_EXCEPTION;
+            JSValueConst args[] = { buffer };
+            JSValue array = JS_CallConstructor(ctx, typedArrayConstructors[kind], 1, args);
+            if (!JS_IsException(array))
+                objects.push_back(JS_DupValue(ctx, array));
+            return array;
+        }
+        case ValueSerializer::TAG_ARRAY: {
+            uint64_t length = reader.readLength();
+            if (!reader.ok() || length > reader.remaining())
+                break;
+            JSValue array = JS_NewArray(ctx);
+            if (JS_IsException(array))
+                return array;
+            objects.push_back(JS_DupValue(ctx, array));
+            for (uint32_t i = 0; i < (uint32_t)length; i++) {
+                JSValue element = deserializeValue(reader, objects, depth + 1);
+                if (JS_IsException(element) || JS_DefinePropertyValueUint32(ctx, array, i, element, JS_PROP_C_W_E) < 0) {
+                    JS_FreeValue(ctx, array);
+                    return JS_EXCEPTION;
+                }
+            }
+            return array;
+        }
+        case ValueSerializer::TAG_OBJECT: {
+            JSValue object = JS_NewObject(ctx);
+            if (JS_IsException(object))
+                return object;
+            objects.push_back(JS_DupValue(ctx, object));
+            while (true) {
+                int keyTag = reader.readTag();
+                if (keyTag == ValueSerializer::TAG_END && reader.ok())
+                    return object;
+                size_t length;
+                const uint8_t *key = reader.readData(&length);
+                if (keyTag != ValueSerializer::TAG_STRING || !reader.ok()) {
+                    JS_FreeValue(ctx, object);
+                    return JS_ThrowTypeError(ctx, "malformed serialized value");
+                }
+                JSAtom atom = JS_NewAtomLen(ctx, reinterpret_cast<const char *>(key), length);
+                JSValue property = deserializeValue(reader, objects, depth + 1);
+                // defined rather than set, so keys like __proto__ stay plain properties.
+                int defined = JS_IsException(property) ? -1 : JS_DefinePropertyValue(ctx, object, atom, property, JS_PROP_C_W_E);
+                JS_FreeAtom(ctx, atom);
+                if (defined < 0) {
+                    JS_FreeValue(ctx, object);
+                    return JS_EXCEPTION;
+                }
+            }
+        }
+        case ValueSerializer::TAG_REFERENCE: {
+            uint64_t number = reader.readLength();
+            if (reader.ok() && number < objects.size())
+                return JS_DupValue(ctx, objects[(size_t)number]);
+            break;
+        }
+        default:
+            break;
+    }
+    if (depth > ValueSerializer::MAX_DEPTH)
+        return JS_ThrowRangeError(ctx, "serialized value is nested too deeply");
+    return JS_ThrowTypeError(ctx, "malformed serialized value");
+}
+
 void QuickJSContext::setGlobalProperty(JNIEnv *env, jobject property, jobject value) {
     const auto global = hold(JS_GetGlobalObject(ctx));
     checkQuickJSErrorAndThrow(env, setKeyInternal(env, global, property, value));
@@ -465,7 +1043,9 @@ jobject QuickJSContext::callInternal(JNIEnv *env, JSValue func, JSValue thiz, jo
         JS_FreeValue(ctx, valueArg);
     }
 
-    return toObjectCheckQuickJSError(env, ret);
+    jobject result = toObjectCheckQuickJSError(env, ret);
+    collectGarbageIfNeeded(env);
+    return result;
 }
 
 jobject QuickJSContext::call(JNIEnv *env, jlong object, jobjectArray args) {
@@ -474,6 +1054,57 @@ jobject QuickJSContext::call(JNIEnv *env, jlong object, jobjectArray args) {
     return callInternal(env, func, global, args);
 }
 
+jobjectArray QuickJSContext::callBatch(JNIEnv *env, jlong object, jobjectArray argsList) {
+    auto global = hold(JS_GetGlobalObject(ctx));
+    auto func = toValueAsLocal(object);
+
+    const jsize count = env->GetArrayLength(argsList);
+    jobjectArray results = env->NewObjectArray(count, objectClass, nullptr);
+    if (results == nullptr)
+        return nullptr;
+
+    // reused across entries to avoid reallocating per call.
+    std::vector<JSValue> valueArgs;
+    for (jsize i = 0; i < count; i++) {
+        // each entry gets its own frame, so a large batch doesn't overflow the local ref table.
+        env->PushLocalFrame(16);
+
+        valueArgs.clear();
+        jobjectArray args = reinterpret_cast<jobjectArray>(env->GetObjectArrayElement(argsList, i));
+        jsize length = 0;
+        if (args != nullptr) {
+            length = env->GetArrayLength(args);
+            for (int j = 0; j < length; j++) {
+                const auto arg = LocalRefHolder(env, env->GetObjectArrayElement(args, j));
+                valueArgs.push_back(toObject(env, arg));
+            }
+        }
+
+        jobject result;
+        {
+            auto ret = hold(JS_Call(ctx, func, global, length, valueArgs.data()));
+            for (JSValue & valueArg : valueArgs) {
+                JS_FreeValue(ctx, valueArg);
+            }
+            result = toObjectCheckQuickJSError(env, ret);
+        }
+
+        // a failed entry holds its exception, and the batch continues.
+        if (env->ExceptionCheck()) {
+            result = env->ExceptionOccurred();
+            env->ExceptionClear();
+        }
+
+        result = env->PopLocalFrame(result);
+        env->SetObjectArrayElement(results, i, result);
+        env->DeleteLocalRef(result);
+    }
+
+    // the batch counts as a single call for the GC policy.
+    collectGarbageIfNeeded(env);
+    return results;
+}
+
 jobject QuickJSContext::callProperty(JNIEnv *env, jlong object, jobject property, jobjectArray args) {
     auto thiz = toValueAsLocal(object);
     auto propertyJSValue = hold(toObject(env, property));
@@ -491,7 +1122,8 @@ jobject QuickJSContext::callMethod(JNIEnv *env, jlong method, jobject object, jo
 }
 
 jobject QuickJSContext::getKeyString(JNIEnv* env, jlong object, jstring key) {
-    return toObjectCheckQuickJSError(env, hold(JS_GetPropertyStr(ctx, toValueAsLocal(object), env->GetStringUTFChars(key, 0))));
+    JavaStringUTF8 keyStr(strings, env, key);
+    return toObjectCheckQuickJSError(env, hold(JS_GetPropertyStr(ctx, toValueAsLocal(object), keyStr.c_str())));
 }
 
 jobject QuickJSContext::getKeyInteger(JNIEnv* env, jlong object, jint index) {
@@ -510,7 +1142,8 @@ jobject QuickJSContext::getKeyObject(JNIEnv* env, jlong object, jobject key) {
 jboolean QuickJSContext::setKeyString(JNIEnv* env, jlong object, jstring key, jobject value) {
     auto thiz = toValueAsLocal(object);
     auto set = hold(toObject(env, value));
-    return checkQuickJSErrorAndThrow(env, JS_SetPropertyStr(ctx, thiz, env->GetStringUTFChars(key, 0), JS_DupValue(ctx, set)));
+    JavaStringUTF8 keyStr(strings, env, key);
+    return checkQuickJSErrorAndThrow(env, JS_SetPropertyStr(ctx, thiz, keyStr.c_str(), JS_DupValue(ctx, set)));
 }
 
 jboolean QuickJSContext::setKeyInteger(JNIEnv* env, jlong object, jint index, jobject value) {
@@ -530,9 +1163,119 @@ jboolean QuickJSContext::setKeyObject(JNIEnv* env, jlong object, jobject key, jo
     return setKeyInternal(env, toValueAsLocal(object), key, value);
 }
 
+// The elements of a typed array of the given type, or null for any other value.
+void *QuickJSContext::typedArrayElements(JSValueConst value, ArrayRange::Type type, size_t *count) {
+    if (!JS_IsObject(value))
+        return nullptr;
+    // this does not seem to be dup'd, so don't hold it.
+    auto prototype = JS_GetPrototype(ctx, value);
+    if (JS_VALUE_GET_PTR((JSValue)prototype) != JS_VALUE_GET_PTR(typedArrayPrototypes[ArrayRange::typedArrayKind(type)]))
+        return nullptr;
+    size_t offset;
+    size_t size;
+    size_t bpe;
+    auto buffer = hold(JS_GetTypedArrayBuffer(ctx, value, &offset, &size, &bpe));
+    if (JS_IsException(buffer)) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return nullptr;
+    }
+    size_t bufferSize;
+    // the typed array keeps the buffer alive, null if it was detached.
+    uint8_t *ptr = JS_GetArrayBuffer(ctx, &bufferSize, buffer);
+    if (ptr == nullptr) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return nullptr;
+    }
+    *count = size / bpe;
+    return ptr + offset;
+}
+
+void QuickJSContext::getArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length) {
+    auto thiz = toValueAsLocal(object);
+    auto arrayType = (ArrayRange::Type)type;
+    size_t count;
+    void *elements = typedArrayElements(thiz, arrayType, &count);
+    if (elements != nullptr && (size_t)index + length <= count) {
+        ArrayRange::fromElements(env, array, arrayType, offset, length,
+                                 static_cast<uint8_t *>(elements) + index * ArrayRange::elementSize(arrayType));
+        return;
+    }
+
+    std::vector<double> numbers(length);
+    for (jint i = 0; i < length; i++) {
+        auto element = hold(JS_GetPropertyUint32(ctx, thiz, (uint32_t)(index + i)));
+        if (JS_IsException(element) || JS_ToFloat64(ctx, &numbers[i], element)) {
+            checkQuickJSErrorAndThrow(env, -1);
+            return;
+        }
+    }
+    ArrayRange::fromNumbers(env, array, arrayType, offset, length, numbers.data());
+}
+
+void QuickJSContext::setArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length) {
+    auto thiz = toValueAsLocal(object);
+    auto arrayType = (ArrayRange::Type)type;
+    size_t count;
+    void *elements = typedArrayElements(thiz, arrayType, &count);
+    if (elements != nullptr && (size_t)index + length <= count) {
+        ArrayRange::toElements(env, array, arrayType, offset, length,
+                               static_cast<uint8_t *>(elements) + index * ArrayRange::elementSize(arrayType));
+        return;
+    }
+
+    std::vector<double> numbers(length);
+    ArrayRange::toNumbers(env, array, arrayType, offset, length, numbers.data());
+    for (jint i = 0; i < length; i++) {
+        JSValue number = arrayType == ArrayRange::INT ? JS_NewInt32(ctx, (int32_t)numbers[i]) : JS_NewFloat64(ctx, numbers[i]);
+        if (JS_SetPropertyUint32(ctx, thiz, (uint32_t)(index + i), number) < 0) {
+            checkQuickJSErrorAndThrow(env, -1);
+            return;
+        }
+    }
+}
+
+jobject QuickJSContext::newTypedArray(JNIEnv *env, jarray array, jint type) {
+    auto arrayType = (ArrayRange::Type)type;
+    jsize length = env->GetArrayLength(array);
+    JSValueConst args[] = { JS_NewInt32(ctx, length) };
+    auto typedArray = hold(JS_CallConstructor(ctx, typedArrayConstructors[ArrayRange::typedArrayKind(arrayType)], 1, args));
+    if (JS_IsException(typedArray)) {
+        checkQuickJSErrorAndThrow(env, -1);
+        return nullptr;
+    }
+    size_t count;
+    void *elements = typedArrayElements(typedArray, arrayType, &count);
+    if (elements != nullptr)
+        ArrayRange::toElements(env, array, arrayType, 0, length, elements);
+    return toObject(env, typedArray);
+}
+
+jlong QuickJSContext::internKey(JNIEnv *env, jstring key) {
+    JavaStringUTF8 str(strings, env, key);
+    return (jlong)JS_NewAtomLen(ctx, str.c_str(), str.size());
+}
+
+void QuickJSContext::releaseKey(JNIEnv *env, jlong key) {
+    JS_FreeAtom(ctx, (JSAtom)key);
+}
+
+jobject QuickJSContext::getKeyHandle(JNIEnv* env, jlong object, jlong key) {
+    return toObjectCheckQuickJSError(env, hold(JS_GetProperty(ctx, toValueAsLocal(object), (JSAtom)key)));
+}
+
+jboolean QuickJSContext::setKeyHandle(JNIEnv* env, jlong object, jlong key, jobject value) {
+    auto thiz = toValueAsLocal(object);
+    auto set = hold(toObject(env, value));
+    return checkQuickJSErrorAndThrow(env, JS_SetProperty(ctx, thiz, (JSAtom)key, JS_DupValue(ctx, set)));
+}
+
+jobject QuickJSContext::callPropertyHandle(JNIEnv *env, jlong object, jlong key, jobjectArray args) {
+    auto thiz = toValueAsLocal(object);
+    auto func = hold(JS_GetProperty(ctx, thiz, (JSAtom)key));
+    return callInternal(env, func, thiz, args);
+}
+
 int QuickJSContext::quickjs_has(jobject object, JSAtom atom) {
-    if (atom == customFinalizerAtom)
-        return false;
     if (atom == atomHoldsJavaObject)
         return true;
 
@@ -544,14 +1287,106 @@ int QuickJSContext::quickjs_has(jobject object, JSAtom atom) {
         return -1;
     return has;
 }
+void QuickJSContext::clearFieldCache(JNIEnv *env) {
+    fieldCache.clear(env, [this](JSAtom atom) {
+        JS_FreeAtom(ctx, atom);
+    });
+    nativeMethods.clear(env);
+}
+
+void QuickJSContext::startExecutionBudget(JNIEnv *env, jlong timeoutNanos) {
+    executionBudget.start(timeoutNanos);
+}
+
+void QuickJSContext::stopExecutionBudget(JNIEnv *env) {
+    executionBudget.stop();
+}
+
+void QuickJSContext::interrupt() {
+    executionBudget.interrupt();
+}
+
+void QuickJSContext::startProfiling(JNIEnv *env, jlong intervalNanos) {
+    profiler.start(intervalNanos);
+}
+
+jstring QuickJSContext::stopProfiling(JNIEnv *env) {
+    std::string collapsed = profiler.stop();
+    return strings.toJavaString(env, collapsed.c_str(), collapsed.size());
+}
+
+// record the current stack from an Error created by the thrower function.
+void QuickJSContext::sampleProfile(const char *trap) {
+    // a trap may be returning with a pending exception, which the thrower would replace.
+    JSValue pending = JS_GetException(ctx);
+    JSValue error = JS_Call(ctx, thrower_function, JS_UNDEFINED, 0, nullptr);
+    if (!JS_IsException(error)) {
+        JSValue stack = JS_GetPropertyStr(ctx, error, "stack");
+        const char *stackString = JS_ToCString(ctx, stack);
+        if (stackString != nullptr) {
+            profiler.recordStackTrace(stackString, "<thrower>", trap);
+            JS_FreeCString(ctx, stackString);
+        }
+        JS_FreeValue(ctx, stack);
+    }
+    JS_FreeValue(ctx, error);
+    JS_Throw(ctx, pending);
+}
+
+// check for a public field on the object wrapped by a JavaObject, which can be accessed directly.
+bool QuickJSContext::findField(JNIEnv *env, jobject object, JSAtom atom, jobject *target, FieldCache<JSAtom>::Field *field) {
+    if (!env->IsInstanceOf(object, javaObjectClass))
+        return false;
+    jobject found = env->GetObjectField(object, javaObjectTargetField);
+    if (found == nullptr)
+        return false;
+    jclass targetClass = env->GetObjectClass(found);
+    *field = fieldCache.lookup(env, javaQuack, quackResolveField, object, targetClass, atom, [this](JSAtom key) {
+        // the cache holds the atom, so it can not be freed and reused for another name.
+        JS_DupAtom(ctx, key);
+        std::string name;
+        const char *str = JS_AtomToCString(ctx, key);
+        if (str != nullptr) {
+            name = str;
+            JS_FreeCString(ctx, str);
+        }
+        return name;
+    });
+    env->DeleteLocalRef(targetClass);
+    if (field->kind == FieldCache<JSAtom>::NONE) {
+        env->DeleteLocalRef(found);
+        return false;
+    }
+    *target = found;
+    return true;
+}
+
 JSValue QuickJSContext::quickjs_get(jobject object, JSAtom atom, JSValueConst receiver) {
-    if (atom == customFinalizerAtom)
-        return JS_UNDEFINED;
     JNIEnv *env = getEnvFromJavaVM(javaVM);
 
     if (atom == atomHoldsJavaObject)
         return JS_NewInt64(ctx, reinterpret_cast<int64_t>(env->NewLocalRef(object)));
 
+    jobject target;
+    FieldCache<JSAtom>::Field field;
+    if (findField(env, object, atom, &target, &field)) {
+        const auto targetHolder = LocalRefHolder(env, target);
+        switch (field.kind) {
+            case FieldCache<JSAtom>::INT:
+                return JS_NewInt32(ctx, env->GetIntField(target, field.id));
+            case FieldCache<JSAtom>::BOOLEAN:
+                return JS_NewBool(ctx, env->GetBooleanField(target, field.id));
+            case FieldCache<JSAtom>::DOUBLE:
+                return JS_NewFloat64(ctx, env->GetDoubleField(target, field.id));
+            default: {
+                const auto str = LocalRefHolder(env, env->GetObjectField(target, field.id));
+                if ((jobject)str == nullptr)
+                    return JS_NULL;
+                return toString(env, (jstring)(jobject)str);
+            }
+        }
+    }
+
     auto prop = hold(JS_AtomToValue(ctx, atom));
     const auto jprop = LocalRefHolder(env, toObject(env, prop));
     jobject result = env->CallObjectMethod(javaQuack, quackGetMethod, object, (jobject)jprop);
@@ -562,13 +1397,61 @@ JSValue QuickJSContext::quickjs_get(jobject object, JSAtom atom, JSValueConst re
     return toObject(env, result);
 }
 int QuickJSContext::quickjs_set(jobject object, JSAtom atom, JSValueConst value, JSValueConst receiver, int flags) {
-    if (atom == customFinalizerAtom)
-        return false;
     if (atom == atomHoldsJavaObject)
         return false;
 
-    auto prop = hold(JS_AtomToValue(ctx, atom));
     JNIEnv *env = getEnvFromJavaVM(javaVM);
+
+    jobject target;
+    FieldCache<JSAtom>::Field field;
+    if (findField(env, object, atom, &target, &field)) {
+        const auto targetHolder = LocalRefHolder(env, target);
+        // final fields and values that need coercion take the regular path, which reports errors.
+        int tag = JS_VALUE_GET_NORM_TAG(value);
+        if (!field.isFinal) {
+            switch (field.kind) {
+                case FieldCache<JSAtom>::INT:
+                    if (tag == JS_TAG_INT) {
+                        env->SetIntField(target, field.id, JS_VALUE_GET_INT(value));
+                        return true;
+                    }
+                    if (tag == JS_TAG_FLOAT64) {
+                        env->SetIntField(target, field.id, FieldCache<JSAtom>::toJavaInt(JS_VALUE_GET_FLOAT64(value)));
+                        return true;
+                    }
+                    break;
+                case FieldCache<JSAtom>::BOOLEAN:
+                    if (tag == JS_TAG_BOOL) {
+                        env->SetBooleanField(target, field.id, (jboolean)JS_VALUE_GET_BOOL(value));
+                        return true;
+                    }
+                    break;
+                case FieldCache<JSAtom>::DOUBLE:
+                    if (tag == JS_TAG_INT) {
+                        env->SetDoubleField(target, field.id, JS_VALUE_GET_INT(value));
+                        return true;
+                    }
+                    if (tag == JS_TAG_FLOAT64) {
+                        env->SetDoubleField(target, field.id, JS_VALUE_GET_FLOAT64(value));
+                        return true;
+                    }
+                    break;
+                default:
+                    if (tag == JS_TAG_STRING) {
+                        const auto str = LocalRefHolder(env, toString(env, value));
+                        env->SetObjectField(target, field.id, (jobject)str);
+                        return true;
+                    }
+                    if (tag == JS_TAG_NULL || tag == JS_TAG_UNDEFINED) {
+                        env->SetObjectField(target, field.id, nullptr);
+                        return true;
+                    }
+                    break;
+            }
+        }
+    }
+
+    auto prop = hold(JS_AtomToValue(ctx, atom));
     const auto jprop = LocalRefHolder(env, toObject(env, prop));
     const auto jvalue = LocalRefHolder(env, toObject(env, value));
     jboolean ret = env->CallBooleanMethod(javaQuack, quackSetMethod, object, (jobject)jprop, (jobject)jvalue);
@@ -578,9 +1461,100 @@ int QuickJSContext::quickjs_set(jobject object, JSAtom atom, JSValueConst value,
 
     return ret;
 }
+// call a QuackNativeMethod through JNI, if the arguments already match its parameter types.
+bool QuickJSContext::callNativeMethod(JNIEnv *env, jobject nativeMethod, int argc, JSValueConst *argv, JSValue *result) {
+    const NativeMethodCache::Method *method = nativeMethods.lookup(env, nativeMethod, nativeMethodTargetField, nativeMethodMethodField, nativeMethodSignatureField);
+    if (method == nullptr || (size_t)argc != method->parameterTypes.size())
+        return false;
+
+    jvalue args[NativeMethodCache::MAX_PARAMETERS];
+    for (int i = 0; i < argc; i++) {
+        int tag = JS_VALUE_GET_NORM_TAG(argv[i]);
+        bool matches = true;
+        switch (method->parameterTypes[i]) {
+            case 'I':
+                if (tag == JS_TAG_INT)
+                    args[i].i = JS_VALUE_GET_INT(argv[i]);
+                else if (tag == JS_TAG_FLOAT64)
+                    args[i].i = FieldCache<JSAtom>::toJavaInt(JS_VALUE_GET_FLOAT64(argv[i]));
+                else
+                    matches = false;
+                break;
+            case 'D':
+                if (tag == JS_TAG_INT)
+                    args[i].d = JS_VALUE_GET_INT(argv[i]);
+                else if (tag == JS_TAG_FLOAT64)
+                    args[i].d = JS_VALUE_GET_FLOAT64(argv[i]);
+                else
+                    matches = false;
+                break;
+            case 'Z':
+                if (tag == JS_TAG_BOOL)
+                    args[i].z = (jboolean)JS_VALUE_GET_BOOL(argv[i]);
+                else
+                    matches = false;
+                break;
+            default:
+                if (tag == JS_TAG_STRING)
+                    args[i].l = toString(env, argv[i]);
+                else if (tag == JS_TAG_NULL || tag == JS_TAG_UNDEFINED)
+                    args[i].l = nullptr;
+                else
+                    matches = false;
+                break;
+        }
+        if (!matches) {
+            for (int j = 0; j < i; j++) {
+                if (method->parameterTypes[j] == 'L')
+                    env->DeleteLocalRef(args[j].l);
+            }
+            return false;
+        }
+    }
+
+    const auto target = LocalRefHolder(env, env->GetObjectField(nativeMethod, nativeMethodTargetField));
+    switch (method->returnType) {
+        case 'V':
+            env->CallVoidMethodA(target, method->id, args);
+            *result = JS_NULL;
+            break;
+        case 'I':
+            *result = JS_NewInt32(ctx, env->CallIntMethodA(target, method->id, args));
+            break;
+        case 'D':
+            *result = JS_NewFloat64(ctx, env->CallDoubleMethodA(target, method->id, args));
+            break;
+        case 'Z':
+            *result = JS_NewBool(ctx, env->CallBooleanMethodA(target, method->id, args));
+            break;
+        default: {
+            const auto str = LocalRefHolder(env, env->CallObjectMethodA(target, method->id, args));
+            *result = JS_NULL;
+            if ((jobject)str != nullptr && !env->ExceptionCheck())
+                *result = toString(env, (jstring)(jobject)str);
+            break;
+        }
+    }
+
+    for (int i = 0; i < argc; i++) {
+        if (method->parameterTypes[i] == 'L')
+            env->DeleteLocalRef(args[i].l);
+    }
+
+    if (rethrowJavaExceptionToQuickJS(env)) {
+        JS_FreeValue(ctx, *result);
+        *result = JS_EXCEPTION;
+    }
+    return true;
+}
+
 JSValue QuickJSContext::quickjs_apply(jobject func_obj, JSValueConst this_val, int argc, JSValueConst *argv) {
     JNIEnv *env = getEnvFromJavaVM(javaVM);
 
+    JSValue nativeResult;
+    if (env->IsInstanceOf(func_obj, nativeMethodClass) && callNativeMethod(env, func_obj, argc, argv, &nativeResult))
+        return nativeResult;
+
     // unpack the arguments
     jobjectArray javaArgs = env->NewObjectArray((jsize)argc, objectClass, nullptr);
     for (int i = 0; i < argc; i++) {
@@ -615,9 +1589,259 @@ int QuickJSContext::quickjs_construct(JSValue func_obj, JSValueConst this_val, i
     auto value = LocalRefHolder(env, env->NewObject(javaObjectClass, javaObjectConstructor, javaQuack, (jobject)result));
 
     setFinalizerOnFinalizerObject(this_val, javaRefFinalizer, env->NewGlobalRef(value));
+    memoryStats.javaObjectReferenced();
+    bridgeStats.globalRefCreated();
     return 1;
 }
 
+// console arguments for ConsoleFormatter. A conversion that throws leaves its exception pending
+// and fails the rest.
+class QuickJSConsoleArgs {
+public:
+    QuickJSConsoleArgs(JSContext *ctx, int argc, JSValueConst *argv)
+        : ctx(ctx)
+        , argc(argc)
+        , argv(argv)
+        , failed(false) {
+    }
+
+    size_t count() const {
+        return (size_t)argc;
+    }
+
+    bool isString(size_t i) const {
+        return JS_IsString(argv[i]);
+    }
+
+    std::string toString(size_t i) {
+        if (!JS_IsSymbol(argv[i]))
+            return take(JS_DupValue(ctx, argv[i]));
+        // symbols can not be converted implicitly.
+        JSValue global = JS_GetGlobalObject(ctx);
+        JSValue string = JS_GetPropertyStr(ctx, global, "String");
+        JSValue ret = JS_Call(ctx, string, JS_UNDEFINED, 1, &argv[i]);
+        JS_FreeValue(ctx, string);
+        JS_FreeValue(ctx, global);
+        return take(ret);
+    }
+
+    std::string toNumber(size_t i, bool integer) {
+        double number;
+        if (failed || JS_ToFloat64(ctx, &number, argv[i])) {
+            failed = true;
+            return std::string();
+        }
+        return take(JS_NewFloat64(ctx, integer ? std::trunc(number) : number));
+    }
+
+    std::string inspect(size_t i) {
+        JSValueConst value = argv[i];
+        if (JS_IsError(ctx, value)) {
+            JSValue stack = JS_GetPropertyStr(ctx, value, "stack");
+            if (JS_IsString(stack) || JS_IsException(stack))
+                return take(stack);
+            JS_FreeValue(ctx, stack);
+        }
+        else if (JS_IsObject(value) && !JS_IsFunction(ctx, value)) {
+            JSValue json = JS_JSONStringify(ctx, value, JS_UNDEFINED, JS_UNDEFINED);
+            if (JS_IsString(json))
+                return take(json);
+            // cycles can not be written as JSON, fall back to String(value).
+            if (JS_IsException(json))
+                JS_FreeValue(ctx, JS_GetException(ctx));
+            else
+                JS_FreeValue(ctx, json);
+        }
+        return toString(i);
+    }
+
+    bool ok() const {
+        return !failed;
+    }
+
+private:
+    // the string of a value, which is freed.
+    std::string take(JSValue value) {
+        std::string ret;
+        const char *str = nullptr;
+        size_t length;
+        if (!failed && !JS_IsException(value))
+            str = JS_ToCStringLen(ctx, &length, value);
+        if (str != nullptr) {
+            ret.assign(str, length);
+            JS_FreeCString(ctx, str);
+        }
+        else {
+            failed = true;
+        }
+        JS_FreeValue(ctx, value);
+        return ret;
+    }
+
+    JSContext *ctx;
+    int argc;
+    JSValueConst *argv;
+    bool failed;
+};
+
+JSValue QuickJSContext::quickjs_console(int argc, JSValueConst *argv, int method) {
+    int level = method;
+    size_t first = 0;
+    if (method == ConsoleFormatter::ASSERT) {
+        if (argc > 0 && JS_ToBool(ctx, argv[0]) > 0)
+            return JS_UNDEFINED;
+        level = ConsoleFormatter::ERROR;
+        first = 1;
+    }
+
+    QuickJSConsoleArgs args(ctx, argc, argv);
+    std::string message = ConsoleFormatter::format(args, first);
+    if (!args.ok())
+        return JS_EXCEPTION;
+    if (method == ConsoleFormatter::ASSERT)
+        message = ConsoleFormatter::assertion(message);
+
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    auto jmessage = LocalRefHolder(env, strings.toJavaString(env, message.c_str(), message.size()));
+    env->CallVoidMethod(javaQuack, quackConsole, (jint)level, (jstring)(jobject)jmessage);
+    if (rethrowJavaExceptionToQuickJS(env))
+        return JS_EXCEPTION;
+    return JS_UNDEFINED;
+}
+
+void QuickJSContext::installConsole(JNIEnv *env) {
+    JSValue console = JS_NewObject(ctx);
+    for (int method = 0; method < ConsoleFormatter::METHOD_COUNT; method++) {
+        const char *name = ConsoleFormatter::methodName(method);
+        JS_SetPropertyStr(ctx, console, name, JS_NewCFunctionMagic(ctx, ::quickjs_console, name, 1, JS_CFUNC_generic_magic, method));
+    }
+    auto global = hold(JS_GetGlobalObject(ctx));
+    checkQuickJSErrorAndThrow(env, JS_SetPropertyStr(ctx, global, "console", console));
+}
+
+// the compiled module: the function a CommonJS module runs in, or an ES module, compiled only.
+JSValue QuickJSContext::loadModule(JNIEnv *env, const char *id, ModuleLoader::Kind kind) {
+    auto jid = LocalRefHolder(env, strings.toJavaString(env, id, strlen(id)));
+    auto loaded = LocalRefHolder(env, env->CallObjectMethod(javaQuack, quackLoadModule, (jstring)(jobject)jid, (jint)kind));
+    if (rethrowJavaExceptionToQuickJS(env))
+        return JS_EXCEPTION;
+
+    // cached bytecode.
+    if (env->IsInstanceOf(loaded, byteArrayClass)) {
+        auto bytecode = (jbyteArray)(jobject)loaded;
+        // copied out, as finalizers run by allocations may call into JNI.
+        std::vector<uint8_t> data((size_t)env->GetArrayLength(bytecode));
+        env->GetByteArrayRegion(bytecode, 0, (jsize)data.size(), reinterpret_cast<jbyte *>(data.data()));
+        JSValue module = JS_ReadObject(ctx, data.data(), data.size(), JS_READ_OBJ_BYTECODE);
+        if (JS_IsException(module) || kind == ModuleLoader::ES)
+            return module;
+        return JS_EvalFunction(ctx, module);
+    }
+
+    JSValue module;
+    {
+        JavaStringUTF8 source(strings, env, (jstring)(jobject)loaded);
+        if (kind == ModuleLoader::ES) {
+            module = JS_Eval(ctx, source.c_str(), source.size(), id, JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+        }
+        else {
+            std::string wrapped = ModuleLoader::wrapCommonJS(source.c_str(), source.size());
+            module = JS_Eval(ctx, wrapped.c_str(), wrapped.size(), id, JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+        }
+    }
+    if (JS_IsException(module))
+        return module;
+
+    // an ES module is registered by name as it compiles, so the cached bytecode has to come
+    // from this compilation rather than a separate one.
+    if (cacheModules) {
+        size_t size;
+        uint8_t *data = JS_WriteObject(ctx, &size, module, JS_WRITE_OBJ_BYTECODE);
+        if (data == nullptr) {
+            JS_FreeValue(ctx, module);
+            return JS_EXCEPTION;
+        }
+        auto bytecode = LocalRefHolder(env, env->NewByteArray((jsize)size));
+        if (bytecode != nullptr)
+            env->SetByteArrayRegion((jbyteArray)(jobject)bytecode, 0, (jsize)size, reinterpret_cast<const jbyte *>(data));
+        js_free(ctx, data);
+        env->CallVoidMethod(javaQuack, quackStoreModule, (jstring)(jobject)jid, (jint)kind, (jstring)(jobject)loaded, (jbyteArray)(jobject)bytecode);
+        if (rethrowJavaExceptionToQuickJS(env)) {
+            JS_FreeValue(ctx, module);
+            return JS_EXCEPTION;
+        }
+    }
+
+    if (kind == ModuleLoader::ES)
+        return module;
+    // JS_EvalFunction takes ownership of the function.
+    return JS_EvalFunction(ctx, module);
+}
+
+JSValue QuickJSContext::quickjs_resolve_module(JSValueConst referrer, JSValueConst specifier) {
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    auto jreferrer = LocalRefHolder(env, toString(env, referrer));
+    auto jspecifier = LocalRefHolder(env, toString(env, specifier));
+    auto id = LocalRefHolder(env, env->CallObjectMethod(javaQuack, quackResolveModule, (jstring)(jobject)jreferrer, (jstring)(jobject)jspecifier));
+    if (rethrowJavaExceptionToQuickJS(env))
+        return JS_EXCEPTION;
+    return toString(env, (jstring)(jobject)id);
+}
+
+JSValue QuickJSContext::quickjs_load_module(JSValueConst id) {
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    const char *str = JS_ToCString(ctx, id);
+    if (str == nullptr)
+        return JS_EXCEPTION;
+    JSValue ret = loadModule(env, str, ModuleLoader::COMMONJS);
+    JS_FreeCString(ctx, str);
+    return ret;
+}
+
+char *QuickJSContext::quickjs_module_normalize(const char *base, const char *name) {
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    auto jbase = LocalRefHolder(env, strings.toJavaString(env, base, strlen(base)));
+    auto jname = LocalRefHolder(env, strings.toJavaString(env, name, strlen(name)));
+    auto id = LocalRefHolder(env, env->CallObjectMethod(javaQuack, quackResolveModule, (jstring)(jobject)jbase, (jstring)(jobject)jname));
+    if (rethrowJavaExceptionToQuickJS(env))
+        return nullptr;
+    JavaStringUTF8 str(strings, env, (jstring)(jobject)id);
+    return js_strdup(ctx, str.c_str());
+}
+
+JSModuleDef *QuickJSContext::quickjs_module_loader(const char *name) {
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    JSValue module = loadModule(env, name, ModuleLoader::ES);
+    if (JS_IsException(module))
+        return nullptr;
+    // the module is owned by the context once compiled, so the value is dropped.
+    auto m = static_cast<JSModuleDef *>(JS_VALUE_GET_PTR(module));
+    JS_FreeValue(ctx, module);
+    return m;
+}
+
+void QuickJSContext::installModuleLoader(JNIEnv *env, jboolean cacheModules) {
+    this->cacheModules = cacheModules == JNI_TRUE;
+    JS_SetModuleLoaderFunc(runtime, ::quickjs_module_normalize, ::quickjs_module_loader, this);
+
+    const char *shimSource = ModuleLoader::requireShim();
+    auto shim = hold(JS_Eval(ctx, shimSource, strlen(shimSource), "<require>", JS_EVAL_TYPE_GLOBAL));
+    JSValue args[] = {
+        JS_NewCFunction(ctx, ::quickjs_resolve_module, "resolve", 2),
+        JS_NewCFunction(ctx, ::quickjs_load_module, "load", 1),
+    };
+    JSValue require = JS_IsException(shim) ? JS_EXCEPTION : JS_Call(ctx, shim, JS_UNDEFINED, 2, args);
+    JS_FreeValue(ctx, args[0]);
+    JS_FreeValue(ctx, args[1]);
+    if (JS_IsException(require)) {
+        auto exception = hold(JS_GetException(ctx));
+        rethrowQuickJSErrorToJava(env, exception);
+        return;
+    }
+    auto global = hold(JS_GetGlobalObject(ctx));
+    checkQuickJSErrorAndThrow(env, JS_SetPropertyStr(ctx, global, "require", require));
+}
+
 jboolean QuickJSContext::checkQuickJSErrorAndThrow(JNIEnv *env, int maybeException) {
     if (maybeException >= 0)
         return maybeException ? JNI_TRUE : JNI_FALSE;
@@ -629,6 +1853,10 @@ jboolean QuickJSContext::checkQuickJSErrorAndThrow(JNIEnv *env, int maybeExcepti
 }
 
 void QuickJSContext::rethrowQuickJSErrorToJava(JNIEnv *env, JSValue exception) {
+    // reading the error allocates, which must not fail if the error was the heap limit.
+    if (heapLimit != 0)
+        JS_SetMemoryLimit(runtime, (size_t)-1);
+
     // try to pull a stack trace out
     if (JS_IsError(ctx, exception)) {
 
@@ -637,12 +1865,18 @@ void QuickJSContext::rethrowQuickJSErrorToJava(JNIEnv *env, JSValue exception) {
         auto javaException = hold(JS_GetProperty(ctx, exception, javaExceptionAtom));
 
         if (!JS_IsUndefinedOrNull(javaException)) {
-//            auto errorMessage = hold(JS_ToString(ctx, exception));
-            auto stack = hold(JS_GetPropertyStr(ctx, exception, "stack"));
-
             jobject unwrappedException = toObject(env, javaException);
             jthrowable ex = (jthrowable)env->CallObjectMethod(unwrappedException, quackJavaObjectGetObject, nullptr);
-            env->CallStaticVoidMethod(quackExceptionClass, addJSStack, ex, toString(env, stack));
+            if (exceptionStackMode == EXCEPTION_STACK_MERGED) {
+                // the unmerged stack, as the Java one is already on the exception. the leading
+                // newline stands in for the message line addJSStack skips.
+                auto stack = hold(JS_GetProperty(ctx, exception, jsStackAtom));
+                std::string jsStack = "\n";
+                if (JS_IsString(stack))
+                    jsStack += toStdString(stack);
+                auto jsStackString = LocalRefHolder(env, strings.toJavaString(env, jsStack.c_str(), jsStack.size()));
+                env->CallStaticVoidMethod(quackExceptionClass, addJSStack, ex, (jstring)(jobject)jsStackString);
+            }
             env->Throw(ex);
         }
         else {
@@ -656,20 +1890,37 @@ void QuickJSContext::rethrowQuickJSErrorToJava(JNIEnv *env, JSValue exception) {
                 str += toStdString(errorMessage);
             else
                 str = "QuickJS Java unknown Error";
-            str += "\n";
-            if (!JS_IsUndefinedOrNull(stack))
-                str += toStdString(stack);
-            else
-                str += "    at unknown (unknown)\n";
-            env->ThrowNew(quackExceptionClass, str.c_str());
+            // the QuackException splices in the stack only if its trace is read.
+            if (exceptionStackMode == EXCEPTION_STACK_MERGED) {
+                str += "\n";
+                if (!JS_IsUndefinedOrNull(stack))
+                    str += toStdString(stack);
+                else
+                    str += "    at unknown (unknown)\n";
+            }
+            throwQuackException(env, str);
         }
     }
     else {
         // js can throw strings and ints and all sorts of stuff, so who knows what this is.
         // just stringify it as the message.
         auto string = hold(JS_ToString(ctx, exception));
-        env->ThrowNew(quackExceptionClass, toStdString(string).c_str());
+        throwQuackException(env, toStdString(string));
     }
+
+    if (heapLimit != 0)
+        JS_SetMemoryLimit(runtime, heapLimit);
+}
+
+void QuickJSContext::throwQuackException(JNIEnv *env, const std::string &message) {
+    // ThrowNew expects modified UTF-8, so the message is converted through the string bridge.
+    auto jmessage = LocalRefHolder(env, strings.toJavaString(env, message.c_str(), message.size()));
+    // errors while the budget is expired are the interrupt unwinding the script.
+    jobject exceptionObject = executionBudget.isExpired()
+        ? env->NewObject(quackInterruptedExceptionClass, quackInterruptedExceptionConstructor, (jstring)(jobject)jmessage)
+        : env->NewObject(quackExceptionClass, quackExceptionConstructor, (jstring)(jobject)jmessage);
+    auto exception = LocalRefHolder(env, exceptionObject);
+    env->Throw((jthrowable)(jobject)exception);
 }
 
 bool QuickJSContext::rethrowJavaExceptionToQuickJS(JNIEnv *env) {
@@ -680,55 +1931,125 @@ bool QuickJSContext::rethrowJavaExceptionToQuickJS(JNIEnv *env) {
     env->ExceptionClear();
 
     auto jmessage = LocalRefHolder(env, env->CallObjectMethod(e, objectToString));
-    std::string message;
-    if (jmessage != nullptr) {
-        message = ::toStdString(env, (jstring)(jobject)jmessage);
-    }
-    else {
-        message = "Java Exception";
-    }
 
     // grab js stack
     JSValue error = JS_Call(ctx, thrower_function, JS_UNDEFINED, 0, nullptr);
-    auto stack = hold(JS_GetPropertyStr(ctx, error, "stack"));
-
-    // merge the stacks
-    auto newStack = LocalRefHolder(env,
-        env->CallStaticObjectMethod(quackExceptionClass,
-            addJavaStack,
-            env->NewStringUTF((message + "\n" + toStdString(stack)).c_str()), e));
-    auto newStackValue = toObject(env, newStack);
     auto newMessage = toString(env, (jstring)(jobject)jmessage);
-
-    // update the stack
-    JS_DefinePropertyValueStr(ctx, error, "stack", newStackValue, 0);
     JS_DefinePropertyValueStr(ctx, error, "message", newMessage, 0);
 
+    // the exception is rethrown as is if the error makes it back to Java.
+    JS_DefinePropertyValue(ctx, error, javaExceptionAtom, toObject(env, (jobject)e), 0);
+    if (exceptionStackMode == EXCEPTION_STACK_MERGED) {
+        // the stacks are merged only if the stack is read.
+        JS_DefinePropertyValue(ctx, error, jsStackAtom, JS_GetPropertyStr(ctx, error, "stack"), 0);
+        JSAtom stackAtom = JS_NewAtom(ctx, "stack");
+        JS_DefinePropertyGetSet(ctx, error, stackAtom, JS_DupValue(ctx, javaStackGetter), JS_UNDEFINED, JS_PROP_CONFIGURABLE);
+        JS_FreeAtom(ctx, stackAtom);
+    }
+
     JS_Throw(ctx, error);
     return true;
 }
 
-void QuickJSContext::runJobs(JNIEnv *env) {
-    while (JS_IsJobPending(runtime)) {
-        JSContext *pctx;
-//        if (JS_ExecutePendingJob(runtime, &pctx))
-//            JS_FreeValue(ctx, JS_GetException(ctx));
+void QuickJSContext::setExceptionStackMode(JNIEnv *env, jint mode) {
+    exceptionStackMode = mode;
+}
 
+// the stack of an error thrown from Java, merged with the Java stack on first read.
+JSValue QuickJSContext::quickjs_java_stack(JSValueConst error) {
+    JNIEnv *env = getEnvFromJavaVM(javaVM);
+    auto javaException = hold(JS_GetProperty(ctx, error, javaExceptionAtom));
+    if (JS_IsUndefinedOrNull(javaException))
+        return JS_UNDEFINED;
+    auto message = hold(JS_GetPropertyStr(ctx, error, "message"));
+    auto stack = hold(JS_GetProperty(ctx, error, jsStackAtom));
+    if (!JS_IsString(message) || !JS_IsString(stack))
+        return JS_DupValue(ctx, stack);
+
+    std::string jsStack = toStdString(message) + "\n" + toStdString(stack);
+    auto jsStackString = LocalRefHolder(env, strings.toJavaString(env, jsStack.c_str(), jsStack.size()));
+    auto unwrappedException = LocalRefHolder(env, toObject(env, javaException));
+    auto ex = LocalRefHolder(env, env->CallObjectMethod(unwrappedException, quackJavaObjectGetObject, nullptr));
+    auto newStack = LocalRefHolder(env,
+        env->CallStaticObjectMethod(quackExceptionClass,
+            addJavaStack,
+            (jstring)(jobject)jsStackString, (jthrowable)(jobject)ex));
+    if (rethrowJavaExceptionToQuickJS(env))
+        return JS_EXCEPTION;
 
+    // replace the accessor, so the merge happens once.
+    JSValue newStackValue = toObject(env, newStack);
+    JS_DefinePropertyValueStr(ctx, error, "stack", JS_DupValue(ctx, newStackValue), JS_PROP_CONFIGURABLE | JS_PROP_WRITABLE);
+    return newStackValue;
+}
 
-        if (JS_ExecutePendingJob(runtime, &pctx) < 0)
-            printf("uhhh\n");
+void QuickJSContext::runJobs(JNIEnv *env) {
+    while (JS_IsJobPending(runtime)) {
+        JSContext *pctx;
+        // promise reactions settle their promise rather than throw, so this is an error outside
+        // of any promise, such as an interrupt. the remaining jobs stay queued.
+        if (JS_ExecutePendingJob(runtime, &pctx) < 0) {
+            auto exception = hold(JS_GetException(pctx));
+            rethrowQuickJSErrorToJava(env, exception);
+            return;
+        }
     }
 }
 
+jboolean QuickJSContext::hasPendingJobs(JNIEnv *env) {
+    return JS_IsJobPending(runtime) ? JNI_TRUE : JNI_FALSE;
+}
+
 jlong QuickJSContext::getHeapSize(JNIEnv* env) {
     JSMemoryUsage usage;
     JS_ComputeMemoryUsage(runtime, &usage);
     return (jlong)usage.memory_used_size;
 }
 
+void QuickJSContext::setHeapLimit(JNIEnv *env, jlong limit) {
+    heapLimit = limit > 0 ? (size_t)limit : 0;
+    JS_SetMemoryLimit(runtime, heapLimit != 0 ? heapLimit : (size_t)-1);
+}
+
+jlong QuickJSContext::getHeapHighWaterMark(JNIEnv *env) {
+    return (jlong)heapHighWaterMark;
+}
+
+void QuickJSContext::resetHeapHighWaterMark(JNIEnv *env) {
+    heapHighWaterMark = allocatedBytes;
+}
+
+void QuickJSContext::getMemoryStats(JNIEnv *env, jlongArray stats, jboolean detailed) {
+    jlong values[MemoryStats::COUNT];
+    for (jlong &value: values)
+        value = -1;
+    values[MemoryStats::HEAP_SIZE] = (jlong)allocatedBytes;
+    values[MemoryStats::HEAP_HIGH_WATER_MARK] = (jlong)heapHighWaterMark;
+    values[MemoryStats::HEAP_LIMIT] = (jlong)heapLimit;
+    values[MemoryStats::ALLOCATION_COUNT] = (jlong)allocationCount;
+    values[MemoryStats::JAVASCRIPT_OBJECT_COUNT] = (jlong)javaScriptObjects.size();
+    memoryStats.fill(values);
+
+    if (detailed) {
+        JSMemoryUsage usage;
+        JS_ComputeMemoryUsage(runtime, &usage);
+        values[MemoryStats::OBJECT_COUNT] = usage.obj_count;
+        values[MemoryStats::OBJECT_SIZE] = usage.obj_size;
+        values[MemoryStats::STRING_COUNT] = usage.str_count;
+        values[MemoryStats::STRING_SIZE] = usage.str_size;
+        values[MemoryStats::ATOM_COUNT] = usage.atom_count;
+        values[MemoryStats::ATOM_SIZE] = usage.atom_size;
+        values[MemoryStats::SHAPE_COUNT] = usage.shape_count;
+        values[MemoryStats::SHAPE_SIZE] = usage.shape_size;
+        values[MemoryStats::FUNCTION_COUNT] = usage.js_func_count;
+        values[MemoryStats::FUNCTION_BYTECODE_SIZE] = usage.js_func_code_size;
+    }
+    env->SetLongArrayRegion(stats, 0, MemoryStats::COUNT, values);
+}
+
 void QuickJSContext::waitForDebugger(JNIEnv *env, jstring connectionString) {
-    js_debugger_wait_connection(ctx, ::toStdString(env, connectionString).c_str());
+    JavaStringUTF8 connection(strings, env, connectionString);
+    js_debugger_wait_connection(ctx, connection.c_str());
 }
 
 jboolean QuickJSContext::isDebugging() {
@@ -738,3 +2059,21 @@ jboolean QuickJSContext::isDebugging() {
 void QuickJSContext::cooperateDebugger() {
     js_debugger_cooperate(ctx);
 }
+
+void QuickJSContext::setGCPolicy(JNIEnv *env, jint mode, jlong value) {
+    gcPolicy.set(mode, value);
+    gcPolicy.collected((jlong)allocatedBytes);
+}
+
+void QuickJSContext::gc(JNIEnv *env) {
+    memoryStats.collect([this] {
+        JS_RunGC(runtime);
+    });
+    gcPolicy.collected((jlong)allocatedBytes);
+}
+
+// allocatedBytes mirrors the malloc state, so heap growth is checked without walking the heap.
+void QuickJSContext::collectGarbageIfNeeded(JNIEnv *env) {
+    if (gcPolicy.shouldCollect((jlong)allocatedBytes))
+        gc(env);
+}
@@ -6,6 +6,19 @@
 #include "../quickjs/quickjs.h"
 #include "../quickjs/quickjs-debugger.h"
 #include "../JSContext.h"
+#include "../HandleTable.h"
+#include "../FieldCache.h"
+#include "../NativeMethodCache.h"
+#include "../ExecutionBudget.h"
+#include "../MemoryStats.h"
+#include "../Profiler.h"
+#include "../ValueSerializer.h"
+#include "../ArrayRange.h"
+#include "../FinalizationBudget.h"
+#include "../BackReferences.h"
+#include "../ConsoleFormatter.h"
+#include "../ModuleLoader.h"
+#include "QuickJSString.h"
 
 class QuickJSContext;
 
@@ -92,16 +105,22 @@ public:
     jobject toObject(JNIEnv *env, JSValue value);
     jobject toObjectCheckQuickJSError(JNIEnv *env, JSValue value);
     JSValue toObject(JNIEnv *env, jobject value);
+    jobject toByteBuffer(JNIEnv *env, JSValue arrayBuffer, uint8_t *ptr, size_t size);
     
-    void setFinalizer(JSValue value, CustomFinalizer finalizer, void *udata);
+    bool findField(JNIEnv *env, jobject object, JSAtom atom, jobject *target, FieldCache<JSAtom>::Field *field);
+    bool callNativeMethod(JNIEnv *env, jobject nativeMethod, int argc, JSValueConst *argv, JSValue *result);
     void setFinalizerOnFinalizerObject(JSValue finalizerObject, CustomFinalizer finalizer, void *udata);
 
-    void finalizeJavaScriptObject(JNIEnv *env, jlong object);
+    void finalizeJavaScriptObject(JNIEnv *env, jlong handle);
+    jint finalizeJavaScriptObjects(JNIEnv *env, jlongArray handles, jint count, jlong budgetNanos);
 
     jobject evaluate(JNIEnv *env, jstring code, jstring filename);
     jobject compile(JNIEnv* env, jstring code, jstring filename);
+    jbyteArray compileBytecode(JNIEnv *env, jstring code, jstring filename);
+    jobject evaluateBytecode(JNIEnv *env, jbyteArray bytecode);
     void setGlobalProperty(JNIEnv *env, jobject property, jobject value);
     jstring stringify(JNIEnv *env, jlong object);
+    jobject stringifyUtf8(JNIEnv *env, jlong object, jobject buffer);
 
     jobject getKeyString(JNIEnv* env, jlong object, jstring key);
     jobject getKeyInteger(JNIEnv* env, jlong object, jint index);
@@ -110,9 +129,19 @@ public:
     jboolean setKeyInteger(JNIEnv* env, jlong object, jint index, jobject value);
     jboolean setKeyInternal(JNIEnv* env, JSValue thiz, jobject key, jobject value);
     jboolean setKeyObject(JNIEnv* env, jlong object, jobject key, jobject value);
+    void *typedArrayElements(JSValueConst value, ArrayRange::Type type, size_t *count);
+    void getArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length);
+    void setArrayRange(JNIEnv *env, jlong object, jint index, jarray array, jint type, jint offset, jint length);
+    jobject newTypedArray(JNIEnv *env, jarray array, jint type);
+    jlong internKey(JNIEnv *env, jstring key);
+    void releaseKey(JNIEnv *env, jlong key);
+    jobject getKeyHandle(JNIEnv* env, jlong object, jlong key);
+    jboolean setKeyHandle(JNIEnv* env, jlong object, jlong key, jobject value);
+    jobject callPropertyHandle(JNIEnv *env, jlong object, jlong key, jobjectArray args);
 
     jobject callInternal(JNIEnv *env, JSValue func, JSValue thiz, jobjectArray args);
     jobject call(JNIEnv *env, jlong object, jobjectArray args);
+    jobjectArray callBatch(JNIEnv *env, jlong object, jobjectArray argsList);
     jobject callProperty(JNIEnv *env, jlong object, jobject property, jobjectArray args);
     jobject callMethod(JNIEnv *env, jlong method, jobject object, jobjectArray args);
 
@@ -121,6 +150,26 @@ public:
     jboolean isDebugging();
     void debuggerAppNotify(JNIEnv *env, jobjectArray args) {}
     jlong getHeapSize(JNIEnv* env);
+    void setHeapLimit(JNIEnv *env, jlong limit);
+    jlong getHeapHighWaterMark(JNIEnv *env);
+    void resetHeapHighWaterMark(JNIEnv *env);
+    void getMemoryStats(JNIEnv *env, jlongArray stats, jboolean detailed);
+    void setGCPolicy(JNIEnv *env, jint mode, jlong value);
+    void gc(JNIEnv *env);
+    void collectGarbageIfNeeded(JNIEnv *env);
+    void setZeroCopyBuffers(JNIEnv *env, jboolean zeroCopy);
+    void unpinBuffer(JNIEnv *env, jlong pin);
+    void clearFieldCache(JNIEnv *env);
+    void startExecutionBudget(JNIEnv *env, jlong timeoutNanos);
+    void stopExecutionBudget(JNIEnv *env);
+    void interrupt();
+    void startProfiling(JNIEnv *env, jlong intervalNanos);
+    jstring stopProfiling(JNIEnv *env);
+    void sampleProfile(const char *trap);
+    jbyteArray serialize(JNIEnv *env, jobject value);
+    jobject deserialize(JNIEnv *env, jbyteArray data);
+    bool serializeValue(SerializedWriter &writer, JSValueConst value, int depth);
+    JSValue deserializeValue(SerializedReader &reader, std::vector<JSValue> &objects, int depth);
 
     // DuktapeObject class traps
     int quickjs_has(jobject object, JSAtom atom);
@@ -128,20 +177,57 @@ public:
     int quickjs_set(jobject object, JSAtom atom, JSValueConst value, JSValueConst receiver, int flags);
     JSValue quickjs_apply(jobject func_obj, JSValueConst this_val, int argc, JSValueConst *argv);
     int quickjs_construct(JSValue func_obj, JSValueConst this_val, int argc, JSValueConst *argv);
+    void installConsole(JNIEnv *env);
+    JSValue quickjs_console(int argc, JSValueConst *argv, int method);
+    void installModuleLoader(JNIEnv *env, jboolean cacheModules);
+    JSValue loadModule(JNIEnv *env, const char *id, ModuleLoader::Kind kind);
+    JSValue quickjs_resolve_module(JSValueConst referrer, JSValueConst specifier);
+    JSValue quickjs_load_module(JSValueConst id);
+    char *quickjs_module_normalize(const char *base, const char *name);
+    JSModuleDef *quickjs_module_loader(const char *name);
 
     bool checkQuickJSErrorAndThrow(JNIEnv *env, JSValue maybeException);
     jboolean checkQuickJSErrorAndThrow(JNIEnv *env, int maybeException);
     void rethrowQuickJSErrorToJava(JNIEnv *env, JSValue exception);
+    void throwQuackException(JNIEnv *env, const std::string &message);
     bool rethrowJavaExceptionToQuickJS(JNIEnv *env);
+    void setExceptionStackMode(JNIEnv *env, jint mode);
+    JSValue quickjs_java_stack(JSValueConst error);
 
     void runJobs(JNIEnv *env);
+    jboolean hasPendingJobs(JNIEnv *env);
 
     JavaVM* javaVM;
+    StringBridge strings;
+    GCPolicy gcPolicy;
+    bool zeroCopyBuffers;
+    // whether modules compiled from source are handed back to Java for the bytecode cache.
+    bool cacheModules;
+    // a JSContext::ExceptionStackMode.
+    int exceptionStackMode;
+    uint32_t nextPinnedBuffer;
+    // 0 for no limit.
+    size_t heapLimit;
+    // mirrors of the runtime malloc state, kept by the allocator.
+    size_t allocatedBytes;
+    size_t allocationCount;
+    size_t heapHighWaterMark;
+    MemoryStats memoryStats;
     jobject javaQuack;
     JSRuntime *runtime;
     JSContext *ctx;
-    JSValue stash;
+    // strong references held on behalf of Java JavaScriptObjects.
+    HandleTable<JSValue> javaScriptObjects;
+    // the JavaScriptObject of each of those values, looked up when they cross again.
+    BackReferences backReferences;
+    FieldCache<JSAtom> fieldCache;
+    NativeMethodCache nativeMethods;
+    ExecutionBudget executionBudget;
+    Profiler profiler;
+    JSValue pinnedBuffers;
     JSValue thrower_function;
+    // the stack accessor of errors thrown from Java, which merges in the Java stack when read.
+    JSValue javaStackGetter;
 
     jclass objectClass;
     jmethodID objectToString;
@@ -158,12 +244,27 @@ public:
     jmethodID quackSetMethod;
     jmethodID quackApply;
     jmethodID quackConstruct;
+    jmethodID quackConsole;
+    jmethodID quackResolveModule;
+    jmethodID quackLoadModule;
+    jmethodID quackStoreModule;
+    jmethodID quackPinBuffer;
+    jmethodID quackResolveField;
     jmethodID javaScriptObjectConstructor;
     jmethodID javaObjectConstructor;
+    jfieldID javaObjectTargetField;
+    jclass nativeMethodClass;
+    jfieldID nativeMethodTargetField;
+    jfieldID nativeMethodMethodField;
+    jfieldID nativeMethodSignatureField;
     jmethodID byteBufferAllocateDirect;
     jfieldID contextField;
     jfieldID pointerField;
     jfieldID quackJsonField;
+    jfieldID quackJsonUtf8Field;
+    jfieldID quackJsonPositionField;
+    jfieldID quackJsonLimitField;
+    jmethodID quackJsonBuffer;
 
     jclass booleanClass;
     jmethodID booleanValueOf;
@@ -175,17 +276,27 @@ public:
     jmethodID doubleValueOf;
     jmethodID doubleValue;
     jclass stringClass;
+    jclass byteArrayClass;
     jclass byteBufferClass;
 
     jclass quackExceptionClass;
+    jmethodID quackExceptionConstructor;
+    jclass quackInterruptedExceptionClass;
+    jmethodID quackInterruptedExceptionConstructor;
     jmethodID addJSStack;
     jmethodID addJavaStack;
 
     JSAtom atomHoldsJavaObject;
-    JSAtom customFinalizerAtom;
     JSAtom javaExceptionAtom;
+    // the JavaScript stack of an error thrown from Java, before merging.
+    JSAtom jsStackAtom;
     JSValue uint8ArrayConstructor;
     JSValue uint8ArrayPrototype;
+    // by ValueSerializer::TypedArrayKind.
+    JSValue typedArrayConstructors[ValueSerializer::TYPED_ARRAY_KIND_COUNT];
+    JSValue typedArrayPrototypes[ValueSerializer::TYPED_ARRAY_KIND_COUNT];
+    JSValue dateConstructor;
+    JSValue datePrototype;
 };
 
 #endif
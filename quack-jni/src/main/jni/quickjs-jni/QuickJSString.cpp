@@ -0,0 +1,131 @@
+#include "QuickJSString.h"
+
+// strings longer than this are read in place rather than copied into the UTF-16 scratch buffer.
+#define CRITICAL_STRING_LENGTH (64 * 1024)
+// scratch buffers grown past this by a large script are released after use.
+#define MAX_RETAINED_SCRATCH (1024 * 1024)
+
+void StringBridge::trim() {
+    if (utf8.capacity() > MAX_RETAINED_SCRATCH)
+        std::vector<char>().swap(utf8);
+    if (utf16.capacity() > MAX_RETAINED_SCRATCH / sizeof(jchar))
+        std::vector<jchar>().swap(utf16);
+}
+
+void StringBridge::encode(const jchar *chars, jsize length, std::vector<char> &out) {
+    // worst case is 3 bytes per UTF-16 unit, plus the terminator.
+    out.resize((size_t)length * 3 + 1);
+    char *p = out.data();
+    for (jsize i = 0; i < length; i++) {
+        jchar c = chars[i];
+        if (c < 0x80) {
+            *p++ = (char)c;
+        }
+        else if (c < 0x800) {
+            *p++ = (char)(0xC0 | (c >> 6));
+            *p++ = (char)(0x80 | (c & 0x3F));
+        }
+        else if (c >= 0xD800 && c < 0xDC00 && i + 1 < length && chars[i + 1] >= 0xDC00 && chars[i + 1] < 0xE000) {
+            uint32_t codePoint = 0x10000 + (((uint32_t)c - 0xD800) << 10) + ((uint32_t)chars[i + 1] - 0xDC00);
+            *p++ = (char)(0xF0 | (codePoint >> 18));
+            *p++ = (char)(0x80 | ((codePoint >> 12) & 0x3F));
+            *p++ = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+            *p++ = (char)(0x80 | (codePoint & 0x3F));
+            i++;
+        }
+        else {
+            *p++ = (char)(0xE0 | (c >> 12));
+            *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *p++ = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    *p++ = '\0';
+    out.resize(p - out.data());
+}
+
+jstring StringBridge::toJavaString(JNIEnv *env, const char *str, size_t length) {
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(str);
+
+    // ascii without embedded nulls is also valid modified UTF-8, which is the fastest path.
+    size_t i = 0;
+    while (i < length && s[i] - 1u < 0x7Fu)
+        i++;
+    if (i == length)
+        return env->NewStringUTF(str);
+
+    // UTF-16 never needs more units than UTF-8 needs bytes.
+    utf16.resize(length);
+    jchar *out = utf16.data();
+    for (size_t j = 0; j < i; j++)
+        *out++ = s[j];
+
+    while (i < length) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            *out++ = c;
+            i++;
+        }
+        else if ((c & 0xE0) == 0xC0 && i + 1 < length) {
+            *out++ = (jchar)(((c & 0x1F) << 6) | (s[i + 1] & 0x3F));
+            i += 2;
+        }
+        else if ((c & 0xF0) == 0xE0 && i + 2 < length) {
+            *out++ = (jchar)(((c & 0x0F) << 12) | ((s[i + 1] & 0x3F) << 6) | (s[i + 2] & 0x3F));
+            i += 3;
+        }
+        else if ((c & 0xF8) == 0xF0 && i + 3 < length) {
+            uint32_t codePoint = ((uint32_t)(c & 0x07) << 18) | ((uint32_t)(s[i + 1] & 0x3F) << 12)
+                | ((uint32_t)(s[i + 2] & 0x3F) << 6) | (uint32_t)(s[i + 3] & 0x3F);
+            codePoint -= 0x10000;
+            *out++ = (jchar)(0xD800 + (codePoint >> 10));
+            *out++ = (jchar)(0xDC00 + (codePoint & 0x3FF));
+            i += 4;
+        }
+        else {
+            // truncated or invalid sequence.
+            *out++ = 0xFFFD;
+            i++;
+        }
+    }
+
+    jstring ret = env->NewString(utf16.data(), (jsize)(out - utf16.data()));
+    trim();
+    return ret;
+}
+
+JavaStringUTF8::JavaStringUTF8(StringBridge &bridge, JNIEnv *env, jstring value):
+    bridge(bridge),
+    buffer(&own) {
+    if (!bridge.utf8InUse) {
+        bridge.utf8InUse = true;
+        buffer = &bridge.utf8;
+    }
+
+    jsize length = value == nullptr ? 0 : env->GetStringLength(value);
+    if (length == 0) {
+        buffer->assign(1, '\0');
+    }
+    else if (length > CRITICAL_STRING_LENGTH) {
+        // encoding makes no JNI calls, so the characters can be read in place.
+        const jchar *chars = env->GetStringCritical(value, nullptr);
+        if (chars != nullptr) {
+            bridge.encode(chars, length, *buffer);
+            env->ReleaseStringCritical(value, chars);
+        }
+        else {
+            buffer->assign(1, '\0');
+        }
+    }
+    else {
+        bridge.utf16.resize((size_t)length);
+        env->GetStringRegion(value, 0, length, bridge.utf16.data());
+        bridge.encode(bridge.utf16.data(), length, *buffer);
+    }
+}
+
+JavaStringUTF8::~JavaStringUTF8() {
+    if (buffer == &bridge.utf8) {
+        bridge.utf8InUse = false;
+        bridge.trim();
+    }
+}
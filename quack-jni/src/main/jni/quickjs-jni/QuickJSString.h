@@ -0,0 +1,72 @@
+#ifndef QUICKJS_STRING_H
+#define QUICKJS_STRING_H
+
+#include <jni.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Converts strings between Java (UTF-16) and QuickJS (UTF-8). JNI's modified UTF-8 encodes
+ * characters outside the BMP as surrogate pairs of 3 byte sequences, which QuickJS does not
+ * decode, and QuickJS emits 4 byte sequences which JNI rejects, so the conversion is done here.
+ * Lone surrogates are carried through as 3 byte sequences in both directions.
+ *
+ * One instance is owned by each QuickJSContext, and its buffers are reused across conversions.
+ */
+class StringBridge {
+public:
+    StringBridge():
+        utf8InUse(false) {
+    }
+    StringBridge(const StringBridge &) = delete;
+    StringBridge & operator=(const StringBridge &) = delete;
+
+    jstring toJavaString(JNIEnv *env, const char *utf8, size_t length);
+
+private:
+    friend class JavaStringUTF8;
+
+    void encode(const jchar *utf16, jsize length, std::vector<char> &out);
+    void trim();
+
+    std::vector<char> utf8;
+    bool utf8InUse;
+    std::vector<jchar> utf16;
+};
+
+/**
+ * RAII UTF-8 copy of a Java string, zero terminated. The bridge's scratch buffer is used when
+ * it is not already held by another JavaStringUTF8 further up the stack.
+ */
+class JavaStringUTF8 {
+public:
+    JavaStringUTF8(StringBridge &bridge, JNIEnv *env, jstring value);
+    ~JavaStringUTF8();
+    JavaStringUTF8(const JavaStringUTF8 &) = delete;
+    JavaStringUTF8 & operator=(const JavaStringUTF8 &) = delete;
+
+    const char *c_str() const {
+        return buffer->data();
+    }
+
+    // length in bytes, excluding the terminator.
+    size_t size() const {
+        return buffer->size() - 1;
+    }
+
+    operator const char *() const {
+        return c_str();
+    }
+
+    std::string str() const {
+        return std::string(c_str(), size());
+    }
+
+private:
+    StringBridge &bridge;
+    std::vector<char> own;
+    std::vector<char> *buffer;
+};
+
+#endif